@@ -47,14 +47,12 @@ def main():
             if not run_in_parallel:
                 subsplit(root)
 
-    # Run all splittings in parallel.
-    if run_in_parallel:
-        commands = [["cm_vsm", "-d", p] for p in paths]
-        for i in range(0, len(commands), args.num_jobs):
-            cmds = commands[i:(i + args.num_jobs)]
-            procs = [subprocess.Popen(p) for p in cmds]
-            for p in procs:
-                p.wait()
+    # Run all splittings in parallel, within a single cm_vsm process.
+    if run_in_parallel and paths:
+        command = ["cm_vsm", "-w", str(args.num_jobs)]
+        for p in paths:
+            command += ["-d", p]
+        subprocess.run(command)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,302 @@
+// End-to-end benchmark of splitting synthetic Sentinel-2 products
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "version.hpp"
+#include "raster/esa_s2.hpp"
+#include "raster/synthetic_s2.hpp"
+#include "util/stage_stats.hpp"
+#include "util/text.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <Magick++.h>
+#include <nlohmann/json.hpp>
+#include <gdal.h>
+
+
+/**
+ * @brief Fixed settings of a benchmark run.
+ */
+struct BenchConfig {
+	std::string name;	///< Name of the configuration, to match runs against the baseline.
+	unsigned int tile_size;	///< Size of the sub-tiles.
+	int num_workers;	///< Number of workers (0 for all the cores).
+	bool tiled_input;	///< Whether to decode the input tile by tile.
+	int deflate_level;	///< Compression level of the NetCDF files.
+	bool png_output;	///< Whether to write PNG previews of the sub-tiles.
+	bool gdal;	///< Whether to read all the bands through GDAL, instead of OpenJPEG.
+};
+
+//! The configurations, in the order of running them.
+static const BenchConfig configs[] = {
+	{"whole", 512, 1, false, 9, false, false},
+	{"tiled", 512, 1, true, 9, false, false},
+	{"parallel", 512, 0, true, 9, false, false},
+	{"deflate0", 512, 0, true, 0, false, false},
+	{"png", 512, 0, true, 9, true, false},
+	{"gdal", 512, 0, true, 9, false, true}
+};
+
+/**
+ * @brief Measurements which the child process running a configuration sends back to the parent.
+ */
+struct BenchResult {
+	bool success;	///< Whether the product was processed without errors.
+	double seconds;	///< Wall-clock time of processing.
+	uint64_t subtiles;	///< Number of sub-tiles of single bands written.
+	uint64_t bytes_decoded;	///< Number of bytes of input decoded.
+};
+
+/**
+ * Process the product with a configuration in a child process, so that each run has its own peak RSS.
+ * @param[in] config Reference to the configuration.
+ * @param[in] path_product Reference to the path of the .SAFE directory.
+ * @param[in] path_dir_out Reference to the output directory, which is emptied first.
+ * @param[out] result Reference to the measurements to fill.
+ * @param[out] usage Reference to the resource usage of the child process.
+ * @return True on success.
+ */
+bool run_config(const BenchConfig &config, const std::filesystem::path &path_product, const std::filesystem::path &path_dir_out, BenchResult &result, struct rusage &usage) {
+	std::error_code ec;
+	std::filesystem::remove_all(path_dir_out, ec);
+
+	int fds[2];
+	if (pipe(fds) != 0) {
+		std::cerr << "ERROR: Failed to create a pipe: " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		std::cerr << "ERROR: Failed to fork: " << strerror(errno) << std::endl;
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	} else if (pid == 0) {
+		close(fds[0]);
+
+		ESA_S2_Image img;
+		EmptyImageOperator img_op;
+		img.set_tile_size(config.tile_size);
+		img.set_deflate_factor(config.deflate_level);
+		img.set_png_output(config.png_output);
+		img.set_tiled_input(config.tiled_input);
+		img.set_num_workers(config.num_workers > 0 ? config.num_workers : std::max(std::thread::hardware_concurrency(), 1u));
+		img.set_overwrite(true);
+		if (config.gdal)
+			img.set_gdal_bands({"all"});
+
+		std::vector<std::string> bands(
+			&ESA_S2_Image_Operator::data_type_name[0],
+			&ESA_S2_Image_Operator::data_type_name[ESA_S2_Image_Operator::DT_COUNT]
+		);
+
+		BenchResult r;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		r.success = img.process(path_product, path_dir_out, img_op, bands);
+		r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		r.subtiles = StageStats::get_live_subtiles();
+		r.bytes_decoded = StageStats::get_live_bytes(StageStats::ST_DECODE);
+
+		bool sent = write(fds[1], &r, sizeof(r)) == (ssize_t) sizeof(r);
+		close(fds[1]);
+		_exit(sent ? 0 : 1);
+	}
+
+	close(fds[1]);
+	bool received = read(fds[0], &result, sizeof(result)) == (ssize_t) sizeof(result);
+	close(fds[0]);
+
+	int status = 0;
+	if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || !received) {
+		std::cerr << "ERROR: The run of " << config.name << " failed." << std::endl;
+		return false;
+	}
+	return result.success;
+}
+
+/**
+ * Generate the synthetic product, unless it has been generated before with the same settings.
+ * @param[in] product Reference to the generator.
+ * @param[in] path_dir Reference to the directory to generate the product into.
+ * @return True on success.
+ */
+bool prepare_product(const SyntheticS2Product &product, const std::filesystem::path &path_dir) {
+	// The stamp is written last, so that an interrupted generation is started over.
+	std::filesystem::path path_stamp = path_dir / ".complete";
+	if (std::filesystem::exists(path_stamp))
+		return true;
+
+	std::cout << "Generating a synthetic product of " << product.size << "x" << product.size << " pixels in " << path_dir << std::endl;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (!product.write(path_dir))
+		return false;
+	std::cout << "Generated in " << std::fixed << std::setprecision(1)
+		<< std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+
+	std::ofstream f(path_stamp);
+	return f.good();
+}
+
+int main(int argc, char *argv[]) {
+	std::cout << "cm_vsm_bench " << CM_CONVERTER_VERSION_STR << std::endl;
+
+	std::string arg_path_work = "/tmp/cm_vsm_bench", arg_path_json, arg_path_baseline, arg_configs;
+	unsigned int size = 10980;
+	unsigned int seed = 1;
+
+	for (int i=1; i<argc; i++) {
+		if (!strncmp(argv[i], "-h", 2) || i + 1 >= argc) {
+			std::cout << "Usage: " << argv[0] << " [-w WORK_DIR] [-s SIZE] [-e SEED] [-c CONFIGS] [-o JSON] [-b BASELINE]" << std::endl
+				<< "Generate a synthetic Sentinel-2 product, split it with fixed configurations, and report the throughput and peak memory use." << std::endl
+				<< "\tWORK_DIR Directory for the product and the output (default: /tmp/cm_vsm_bench). The product is reused between runs." << std::endl
+				<< "\tSIZE Width and height of the 10 m bands in pixels (default: 10980, as in real products)." << std::endl
+				<< "\tSEED Seed of the content of the product (default: 1)." << std::endl
+				<< "\tCONFIGS Comma-separated list of configurations to run (default: all of whole, tiled, parallel, deflate0, png, gdal)." << std::endl
+				<< "\tJSON File to write the results into." << std::endl
+				<< "\tBASELINE Results of an earlier run, to compare with." << std::endl;
+			return 1;
+		}
+		if (!strncmp(argv[i], "-w", 2))
+			arg_path_work.assign(argv[i + 1]);
+		else if (!strncmp(argv[i], "-s", 2))
+			size = atoi(argv[i + 1]);
+		else if (!strncmp(argv[i], "-e", 2))
+			seed = atoi(argv[i + 1]);
+		else if (!strncmp(argv[i], "-c", 2))
+			arg_configs.assign(argv[i + 1]);
+		else if (!strncmp(argv[i], "-o", 2))
+			arg_path_json.assign(argv[i + 1]);
+		else if (!strncmp(argv[i], "-b", 2))
+			arg_path_baseline.assign(argv[i + 1]);
+		i++;
+	}
+
+	if (size == 0) {
+		std::cerr << "ERROR: Invalid size of the product." << std::endl;
+		return 1;
+	}
+
+	nlohmann::json baseline;
+	if (!arg_path_baseline.empty()) {
+		std::ifstream f(arg_path_baseline);
+		try {
+			f >> baseline;
+		} catch (const nlohmann::json::exception &e) {
+			std::cerr << "ERROR: Failed to read the baseline " << arg_path_baseline << ": " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	GDALAllRegister();
+	Magick::InitializeMagick(*argv);
+
+	std::filesystem::path path_work = std::filesystem::absolute(arg_path_work);
+	SyntheticS2Product product(size, seed);
+	std::filesystem::path path_dir_product = path_work / ("product_" + std::to_string(size) + "_" + std::to_string(seed));
+	if (!prepare_product(product, path_dir_product))
+		return 2;
+	std::filesystem::path path_product = path_dir_product / SyntheticS2Product::get_name();
+
+	uintmax_t input_bytes = 0;
+	for (const auto &entry: std::filesystem::recursive_directory_iterator(path_product)) {
+		if (entry.is_regular_file())
+			input_bytes += entry.file_size();
+	}
+
+	std::vector<std::string> names = split_str(arg_configs, ',');
+	nlohmann::json results = {
+		{"version", CM_CONVERTER_VERSION_STR},
+		{"size", size},
+		{"seed", seed},
+		{"input_bytes", input_bytes},
+		{"cores", std::thread::hardware_concurrency()},
+		{"configurations", nlohmann::json::array()}
+	};
+
+	bool success = true;
+	for (const BenchConfig &config: configs) {
+		if (!arg_configs.empty() && std::find(names.begin(), names.end(), config.name) == names.end())
+			continue;
+
+		std::cout << "Running " << config.name << std::endl;
+		BenchResult r;
+		struct rusage usage;
+		memset(&r, 0, sizeof(r));
+		memset(&usage, 0, sizeof(usage));
+		if (!run_config(config, path_product, path_work / ("out_" + config.name), r, usage)) {
+			success = false;
+			continue;
+		}
+
+		nlohmann::json j = {
+			{"name", config.name},
+			{"tile_size", config.tile_size},
+			{"workers", config.num_workers > 0 ? config.num_workers : (int) std::thread::hardware_concurrency()},
+			{"tiled_input", config.tiled_input},
+			{"deflate_level", config.deflate_level},
+			{"png_output", config.png_output},
+			{"seconds", r.seconds},
+			{"user_seconds", usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6},
+			{"system_seconds", usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6},
+			{"band_subtiles", r.subtiles},
+			{"band_subtiles_per_second", r.seconds > 0 ? r.subtiles / r.seconds : 0.0},
+			{"input_mib_per_second", r.seconds > 0 ? input_bytes / 1048576.0 / r.seconds : 0.0},
+			{"decoded_mib_per_second", r.seconds > 0 ? r.bytes_decoded / 1048576.0 / r.seconds : 0.0},
+			// ru_maxrss is in kilobytes on Linux.
+			{"max_rss_bytes", (uintmax_t) usage.ru_maxrss * 1024}
+		};
+
+		std::cout << std::fixed << std::setprecision(2) << "\t" << r.seconds << " s, "
+			<< j["band_subtiles_per_second"].get<double>() << " band sub-tiles/s, "
+			<< j["input_mib_per_second"].get<double>() << " MiB/s, "
+			<< (usage.ru_maxrss / 1024) << " MiB peak RSS";
+
+		// Compare with the run of the same configuration in the baseline, if any.
+		if (baseline.contains("configurations")) {
+			for (const nlohmann::json &b: baseline["configurations"]) {
+				if (b.value("name", "") != config.name || r.seconds <= 0)
+					continue;
+				double speedup = b.value("seconds", 0.0) / r.seconds;
+				double rss_ratio = b.value("max_rss_bytes", 0.0) > 0 ? j["max_rss_bytes"].get<double>() / b.value("max_rss_bytes", 0.0) : 0.0;
+				j["baseline"] = {{"speedup", speedup}, {"max_rss_ratio", rss_ratio}};
+				std::cout << ", " << speedup << "x the speed and " << rss_ratio << "x the memory of the baseline";
+			}
+		}
+		std::cout << std::endl;
+
+		results["configurations"].push_back(j);
+	}
+
+	if (!arg_path_json.empty()) {
+		std::ofstream f(arg_path_json);
+		f << results.dump(2) << std::endl;
+		if (!f.good()) {
+			std::cerr << "ERROR: Failed to write " << arg_path_json << std::endl;
+			return 3;
+		}
+	}
+
+	return success ? 0 : 4;
+}
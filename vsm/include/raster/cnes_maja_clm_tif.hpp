@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include "raster/pixel_kernels.hpp"
 #include "raster/tif_image.hpp"
 
 #include <filesystem>
@@ -84,5 +85,12 @@ class CNES_MAJA_CLM_TIF: public TIF_Image {
 		 * @return Pointer to the raster image with remapped pixel values.
 		 */
 		static RasterImage *remap_majac_values(RasterImage *img, clm_format_t flags_fmt);
+
+		/**
+		 * Fill a table of Sen2Cor classes for each 8-bit combination of MAJA flags, as remap_majac_values() uses it.
+		 * @param[in] flags_fmt MAJA flags format in the input raster.
+		 * @param[out] table Reference to the table to fill.
+		 */
+		static void make_class_table(clm_format_t flags_fmt, PixelKernels::class_table_t &table);
 };
 
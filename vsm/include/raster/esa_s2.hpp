@@ -17,11 +17,29 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
 #include <vector>
 
 #include "util/geometry.hpp"
+#include "util/thread_pool.hpp"
+#include "util/memory_budget.hpp"
+#include "util/metrics_exporter.hpp"
+#include "util/prefetcher.hpp"
+#include "util/stage_stats.hpp"
+#include "util/subtile_grid.hpp"
+#include "util/subtile_selector.hpp"
 #include "raster/cnes_maja_clm_tif.hpp"
+#include "raster/subtile_splitter.hpp"
 
 /**
  * @brief An operator class for raster or vector layers, which are related to ESA Sentinel-2 images.
@@ -105,6 +123,103 @@ public:
 };
 
 
+/**
+ * @brief A band file within a Sentinel-2 product, to be split into sub-tiles.
+ */
+class ESA_S2_Band {
+	public:
+		/**
+		 * @brief File format of the band, which determines the loader.
+		 */
+		enum raster_format_t {
+			RF_JP2,	///< JPEG2000, loaded with OpenJPEG.
+			RF_TIF,	///< TIFF, loaded with libtiff and Magick.
+			RF_PNG,	///< PNG, loaded with Magick.
+			RF_COUNT	///< Total number of raster formats.
+		};
+
+		/**
+		 * @param[in] path Reference to the path of the raster file.
+		 * @param[in] data_type Band type.
+		 * @param[in] data_resolution Band resolution.
+		 * @param[in] format File format.
+		 * @param[in] file_size Size of the file in bytes, as an estimate of the cost of splitting it.
+		 */
+		ESA_S2_Band(const std::filesystem::path &path, ESA_S2_Image_Operator::data_type_t data_type, ESA_S2_Image_Operator::data_resolution_t data_resolution, raster_format_t format, uintmax_t file_size):
+			path(path), data_type(data_type), data_resolution(data_resolution), format(format), file_size(file_size),
+			read_whole(false), read_gdal(false), memory_cost(0) {}
+
+		std::filesystem::path path;	///< Path to the raster file.
+		ESA_S2_Image_Operator::data_type_t data_type;	///< Band type.
+		ESA_S2_Image_Operator::data_resolution_t data_resolution;	///< Band resolution.
+		raster_format_t format;	///< File format.
+		uintmax_t file_size;	///< Size of the file in bytes.
+
+		bool read_whole;	///< Whether to decode the whole JP2 file into RAM, rather than tile by tile.
+		bool read_gdal;	///< Whether to read the file through GDAL, rather than with the format specific loader.
+		uintmax_t memory_cost;	///< Estimated peak RAM usage of a task which splits the band, in bytes.
+};
+
+
+/**
+ * @brief Descriptor of a band file, for recognizing the band within a Sentinel-2 product.
+ */
+class ESA_S2_Band_Descriptor {
+	public:
+		const char *dir;	///< Directory of the file, relative to the granule or product directory.
+		const char *suffix;	///< Suffix of the file name.
+		bool in_granule;	///< Whether the directory is relative to `GRANULE/<granule>` (true) or to the product directory (false).
+		ESA_S2_Image_Operator::data_type_t data_type;	///< Band type.
+		ESA_S2_Image_Operator::data_resolution_t data_resolution;	///< Band resolution.
+		ESA_S2_Band::raster_format_t format;	///< File format.
+};
+
+
+/**
+ * @brief Processing state of a single Sentinel-2 product.
+ * Kept apart from ESA_S2_Image, so that several products can be processed in parallel with the same settings.
+ */
+class ESA_S2_Product {
+	public:
+		/**
+		 * @param[in] path_dir_in Reference to the path to the .SAFE directory.
+		 * @param[in] path_dir_out Reference to the path to the output directory.
+		 */
+		ESA_S2_Product(const std::filesystem::path &path_dir_in, const std::filesystem::path &path_dir_out):
+			path_dir_in(path_dir_in), path_dir_out(path_dir_out), geo_extracted(false), subtile_block_size(1), prefetcher(nullptr), aborted(false) {}
+
+		/**
+		 * Release the files of the product which have been queued for prefetching, but never read,
+		 * such as those of an aborted product, or of a product which ended early.
+		 */
+		~ESA_S2_Product() {
+			if (prefetcher != nullptr)
+				prefetcher->forget(prefetched);
+		}
+
+		std::filesystem::path path_dir_in;	///< Path to the .SAFE directory, or to a .zip archive of it.
+		std::filesystem::path path_dir_out;	///< Path to the output directory.
+
+		bool geo_extracted;	///< Whether the geo-coordinates have been extracted from at least one of the overlapping rasters.
+		std::string proj_ref;	///< Projection reference, as extracted from the JP2 file.
+		SubtileGrid subtile_mask;	///< Mask of subtiles to fill.
+		unsigned int subtile_block_size;	///< Number of sub-tiles along the side of a JP2 tile.
+		AABB<float> aabb_buf;	///< Buffered axis-aligned bounding box surrounding the area of interest polygon, in relative image coordinates.
+		Polygon<int> aoi_poly;	///< Area of interest polygon in pixel coordinates.
+		std::vector<Vector<int>> subtiles;	///< List of sub-tiles to split, from the subtile mask.
+		ResumeManifest manifest;	///< Layers of the sub-tiles which have been stored in the output directory.
+		std::map<std::pair<int, int>, float> valid_fractions;	///< Fraction of valid pixels per sub-tile, if the empty sub-tiles have been eliminated.
+
+		std::map<std::tuple<int, unsigned int, unsigned int>, std::shared_ptr<const SubtilePlan>> plans;	///< Sub-tile plan per resolution and raster size.
+		std::mutex plans_mutex;	///< Guards the sub-tile plans.
+
+		Prefetcher *prefetcher;	///< Prefetcher which the band files have been queued with (if any).
+		std::vector<std::filesystem::path> prefetched;	///< Band files which have been queued for prefetching.
+
+		std::atomic<bool> aborted;	///< Set when the image operator has asked to stop processing the product.
+};
+
+
 /**
  * @brief Class for an ESA Sentinel-2 image.
  */
@@ -173,6 +288,63 @@ class ESA_S2_Image {
 		 */
 		void set_num_threads(int num_threads);
 
+		/**
+		 * Set the memory budget for decoded rasters.
+		 * With a budget, the choice between reading a JP2 file as a whole or in tiles is made per band
+		 * (instead of set_tiled_input()), and the workers only start splitting a band while its estimated
+		 * memory usage fits into the budget.
+		 * @param max_memory Budget in bytes (0 for unlimited).
+		 */
+		void set_max_memory(uintmax_t max_memory);
+
+		/**
+		 * Set the read-ahead window for the band files.
+		 * While a band is being split, the band files which are queued after it, including the ones
+		 * of the next products of a batch, are read into the page cache in the background.
+		 * @param bytes Window in bytes (0 to disable read-ahead).
+		 */
+		void set_prefetch_window(uintmax_t bytes);
+
+		/**
+		 * Set the order in which the sub-tiles of a product are split.
+		 * Sub-tiles are grouped into blocks which match the tiles of the JP2 files, and the blocks are
+		 * traversed in the given order, so that consecutive sub-tiles read neighbouring parts of the rasters.
+		 * @param order Order of traversing the blocks of sub-tiles.
+		 */
+		void set_subtile_order(SubtileGrid::order_t order);
+
+		/**
+		 * Skip the sub-tiles which are mostly outside of the swath, in all of the bands.
+		 * The fraction of valid pixels per sub-tile is found once per product, from the cheapest band
+		 * which marks no-data with 0 (the 60 m B01 or the 20 m SCL), and stored in the NetCDF files.
+		 * @param min_valid Minimum fraction of valid pixels in a sub-tile, between 0 and 1 (0 to keep all the sub-tiles).
+		 */
+		void set_min_valid(float min_valid);
+
+		/**
+		 * Split only the sub-tiles which satisfy an expression on the fractions of values in mask bands,
+		 * such as the classes of SCL or the cloud probabilities of S2CC (see SubtileSelector).
+		 * The mask bands are decoded once per product, before any of the other bands.
+		 * @param[in] expr Reference to the expression (empty to split all the sub-tiles).
+		 * @return True on success, false if the expression is invalid.
+		 */
+		bool set_selection(const std::string &expr);
+
+		/**
+		 * Read some of the bands through GDAL, instead of OpenJPEG and libtiff.
+		 * Useful for comparing the GDAL JP2 drivers with OpenJPEG, and for COG or VRT inputs.
+		 * PNG files are always read with libpng.
+		 * @param[in] bands Reference to the list of band names (such as B02 or SCL), or "all" for all the bands.
+		 */
+		void set_gdal_bands(const std::vector<std::string> &bands);
+
+		/**
+		 * Set the number of worker threads which process products, bands and sub-tiles in parallel.
+		 * @note In the whole image mode, each worker keeps a decoded band in RAM.
+		 * @param num_workers Number of workers (1 by default, 0 or negative to use all available threads).
+		 */
+		void set_num_workers(int num_workers);
+
 		/**
 		 * Set a WKT geometry of the area of interest which limits the sub-tiles.
 		 * @param wkt_geom Reference to the WKT string which outlines the area of interest.
@@ -204,9 +376,22 @@ class ESA_S2_Image {
 		 */
 		void set_subtiles(const std::vector<Vector<int>> &subtiles);
 
+		/**
+		 * Set the path of a timing report of all the products, in addition to the report in the output directory of each product.
+		 * @param[in] path Reference to the path of the JSON file (empty for no combined report).
+		 */
+		void set_report_path(const std::filesystem::path &path);
+
+		/**
+		 * Periodically write the progress and throughput of a batch into a file, in the Prometheus text format.
+		 * @param[in] path Reference to the path of the metrics file (empty for no metrics).
+		 * @param interval Number of seconds between the updates.
+		 */
+		void set_metrics(const std::filesystem::path &path, unsigned int interval);
+
 		/**
 		 * Process a Sentinel-2 L1C or L2A image.
-		 * @param path_dir_in Path to the .SAFE directory.
+		 * @param path_dir_in Path to the .SAFE directory, or to a .zip archive of it.
 		 * @param path_dir_out Path to the output directory.
 		 * @param op Operator for class remapping and any other post-processing.
 		 * @param bands List of band names (ESA_S2_Image_Operator::data_type_name) to process.
@@ -214,7 +399,63 @@ class ESA_S2_Image {
 		 */
 		bool process(const std::filesystem::path &path_dir_in, const std::filesystem::path &path_dir_out, ESA_S2_Image_Operator &op, std::vector<std::string> bands);
 
+		/**
+		 * Process a batch of Sentinel-2 L1C or L2A images.
+		 * Sub-tiles of all of the products are split by a shared pool of workers.
+		 * @param products List of pairs of paths to the .SAFE directory and the output directory.
+		 * @param op Operator for class remapping and any other post-processing.
+		 * @param bands List of band names (ESA_S2_Image_Operator::data_type_name) to process.
+		 * @return True on success, false if processing failed for any of the products.
+		 */
+		bool process_batch(const std::vector<std::pair<std::filesystem::path, std::filesystem::path>> &products, ESA_S2_Image_Operator &op, std::vector<std::string> bands);
+
+		/**
+		 * Build an inventory of the band files within a product, with a single recursive scan of the product directory.
+		 * Files are recognized by ESA_S2_Image::band_descriptors. If a band is present in more than one form
+		 * (for example, MAJA cloud masks at 10 m and 20 m), only the form which comes first in the table is kept.
+		 * A zipped product is scanned from the central directory of the archive, and its band files are
+		 * given virtual paths (see ZipArchive::make_member_path()).
+		 * @param path_dir_in Reference to the path to the .SAFE directory, or to a .zip archive of it.
+		 * @return List of band files, in the order of the descriptor table.
+		 */
+		static std::vector<ESA_S2_Band> scan_product(const std::filesystem::path &path_dir_in);
+
+		/**
+		 * Estimate the peak RAM usage of decoding a raster: the 32-bit OpenJPEG components plus the Magick image.
+		 * @param width Raster width, in pixels.
+		 * @param height Raster height, in pixels.
+		 * @param num_components Number of components decoded by OpenJPEG (0 for rasters which are decoded by Magick alone).
+		 * @return Estimated RAM usage in bytes.
+		 */
+		static uintmax_t estimate_decoded_memory(unsigned int width, unsigned int height, unsigned int num_components);
+
+		/**
+		 * Compute the fraction of valid pixels, which are the ones with a non-zero value.
+		 * @param[in] px Pointer to the pixels of a grayscale image.
+		 * @param n Number of pixels.
+		 * @return Fraction of valid pixels, between 0 and 1 (0 for no pixels).
+		 */
+		static float get_valid_fraction(const Magick::PixelPacket *px, size_t n);
+
+		/**
+		 * @param data_resolution Band resolution.
+		 * @return Ground resolution of the band relative to 10 m (2 for 20 m, 6 for 60 m).
+		 */
+		static float get_resolution_factor(ESA_S2_Image_Operator::data_resolution_t data_resolution);
+
+		static const std::vector<ESA_S2_Band_Descriptor> band_descriptors;	///< Band files which can be recognized within a product, in the order of preference.
+
 	protected:
+		/**
+		 * @brief Band decoded for scanning the sub-tiles of a product, with its share of the memory budget.
+		 */
+		struct ScanSource {
+			std::unique_ptr<MemoryBudget::Reservation> reservation;	///< Reservation for the decoded band, which is released after the band is freed.
+			std::unique_ptr<JP2RasterSource> src;	///< Decoded band.
+		};
+
+		typedef std::map<std::filesystem::path, ScanSource> scan_cache_t;	///< Bands decoded for scanning the sub-tiles of a product, by path.
+
 		unsigned int tile_size;	///< Sub-tile size, in pixels.
 
 		unsigned char *scl_value_map;	///< Pointer to class map from Sen2Cor into a custom classification scheme.
@@ -230,53 +471,197 @@ class ESA_S2_Image {
 		bool store_png;	///< Whether to store intermediate output in PNG files or not.
 		bool read_tiled;	///< Whether to read JP2 files in tiles, or to read full images into RAM.
 		int num_threads;	///< Number of threads to parallelize to.
+		int num_workers;	///< Number of workers to process sub-tiles with.
+		uintmax_t max_memory;	///< Memory budget for decoded rasters, in bytes (0 for unlimited).
+		std::unique_ptr<MemoryBudget> memory_budget;	///< Memory budget shared by the workers of the current batch.
+		std::set<std::string> gdal_bands;	///< Names of the bands to read through GDAL.
+		Prefetcher prefetcher;	///< Read-ahead of the band files which are queued for splitting.
+		unsigned int subtiles_per_task;	///< Number of sub-tiles per task, for bands which are not decoded as a whole.
+		SubtileGrid::order_t subtile_order;	///< Order of splitting the sub-tiles.
+		float min_valid;	///< Minimum fraction of valid pixels in a sub-tile (0 to keep all the sub-tiles).
+		SubtileSelector selector;	///< Selection of the sub-tiles by the content of the mask bands.
 
 		bool overwrite_subtiles;	///< Whether to overwrite subtiles which already exist.
 
 		std::string wkt_geom_aoi;	///< Area of interest as WKT geometry.
 
-		bool geo_extracted;	///< Whether the geo-coordinates have been extracted from at least one of the overlapping rasters.
-		std::string proj_ref;	///< Projection reference, as extracted from the JP2 file.
 		std::vector<Vector<int>> limit_to_subtiles;	///< Limit processing to a list of subtiles.
-		std::vector<std::vector<unsigned char>> subtile_mask;	///< Mask of subtiles to fill.
-		AABB<float> aabb_buf;	///< Buffered axis-aligned bounding box surrounding the area of interest polygon, in relative image coordinates.
-		Polygon<int> aoi_poly;	///< Area of interest polygon in pixel coordinates.
 
 		CNES_MAJA_CLM_TIF::clm_format_t maja_flags_format;	///< MAJA flags format to be expected from MAJA TIF files.
 
-		void extract_geo(const std::filesystem::path &path_in, const AABB<int> &image_aabb, float tile_size_div);
+		std::mutex op_mutex;	///< Serializes calls to the image operator.
+
+		std::filesystem::path path_report;	///< Path of the timing report of all the products (empty for none).
+		std::map<std::filesystem::path, std::map<std::string, StageStats>> stage_stats;	///< Stage statistics per output directory and band.
+		std::mutex stats_mutex;	///< Guards the stage statistics.
+
+		std::filesystem::path path_metrics;	///< Path of the metrics file (empty for none).
+		unsigned int metrics_interval;	///< Number of seconds between the updates of the metrics file.
+		std::atomic<unsigned long> products_scanned;	///< Number of products of the batch which have been scanned.
+		std::atomic<uint64_t> subtiles_planned;	///< Number of sub-tiles of all the bands queued for splitting.
+		std::atomic<uint64_t> subtiles_finished;	///< Number of sub-tiles of all the bands which the finished tasks have been given.
 
 		/**
-		 * Split a JP2 file into sub-tiles.
-		 * @param path_in Path to the JP2 file.
-		 * @param path_dir_out Path to the output directory to store the sub-tiles.
-		 * @param op Operator for class remapping and any other post-processing.
-		 * @param data_type Band type.
-		 * @param data_resolution Band resolution.
-		 * @return True on success, false on failure.
+		 * Add the stage statistics of a task to the statistics of a product.
+		 * @param product Reference to the product.
+		 * @param[in] name Reference to the name of the band, or "schedule" for scanning the product.
+		 * @param[in] stats Reference to the statistics of the task.
+		 */
+		void add_stage_stats(const ESA_S2_Product &product, const std::string &name, const StageStats &stats);
+
+		/**
+		 * Write the timing report of each product into its output directory, and the combined report, if requested.
+		 * @param[in] products Reference to the list of pairs of paths to the .SAFE directory and the output directory.
+		 * @return True on success.
 		 */
-		bool splitJP2(const std::filesystem::path &path_in, const std::filesystem::path &path_dir_out, ESA_S2_Image_Operator &op, ESA_S2_Image_Operator::data_type_t data_type, ESA_S2_Image_Operator::data_resolution_t data_resolution);
+		bool write_stage_report(const std::vector<std::pair<std::filesystem::path, std::filesystem::path>> &products);
 
 		/**
-		 * Split a TIFF file into sub-tiles.
-		 * @param path_in Path to the TIFF file.
-		 * @param path_dir_out Path to the output directory to store the sub-tiles.
+		 * Write the metrics of the current batch.
+		 * @param[in] os Reference to the stream to write to.
+		 * @param pool Reference to the worker pool of the batch.
+		 * @param num_products Number of products in the batch.
+		 * @param start Time when the batch was started.
+		 */
+		void format_metrics(std::ostream &os, WorkStealingPool &pool, size_t num_products, std::chrono::steady_clock::time_point start);
+
+		/**
+		 * Scan a product, extract its geo-coordinates and queue the splitting of its bands.
+		 * @param pool Reference to the worker pool.
+		 * @param product Shared pointer to the product.
 		 * @param op Operator for class remapping and any other post-processing.
-		 * @param data_type Band type.
+		 * @param b Flags of the bands to process, indexed by ESA_S2_Image_Operator::data_type_t.
+		 * @throws RasterException if there's no band to extract the geo-coordinates from, or the sub-tiles can't be selected.
+		 */
+		void schedule_product(WorkStealingPool &pool, std::shared_ptr<ESA_S2_Product> product, ESA_S2_Image_Operator &op, const std::vector<bool> &b);
+
+		/**
+		 * Choose between reading a band as a whole or in tiles, and estimate the memory usage of splitting it.
+		 * @param product Reference to the product, with the sub-tiles to split.
+		 * @param[in,out] band Reference to the band to update.
+		 * @param num_workers Number of workers which may split bands concurrently.
+		 */
+		void choose_read_strategy(ESA_S2_Product &product, ESA_S2_Band &band, unsigned int num_workers);
+
+		/**
+		 * Effective sub-tile size in the pixels of a band, accounting for the overlap.
 		 * @param data_resolution Band resolution.
-		 * @return True on success, false on failure.
+		 * @return Sub-tile size in source pixels.
+		 */
+		float get_tile_size_div(ESA_S2_Image_Operator::data_resolution_t data_resolution) const;
+
+		void extract_geo(ESA_S2_Product &product, const std::filesystem::path &path_in, const AABB<int> &image_aabb, float tile_size_div);
+
+		/**
+		 * Drop the sub-tiles with less than min_valid of valid pixels from the subtile mask of a product,
+		 * and record the fraction of valid pixels of the others.
+		 * @param[in,out] product Reference to the product, with the subtile mask.
+		 * @param inventory Reference to all the band files of the product.
+		 * @param[out] decoded Reference to the bands decoded by the scan, for the later scans of the product to reuse.
+		 */
+		void eliminate_empty_subtiles(ESA_S2_Product &product, const std::vector<ESA_S2_Band> &inventory, scan_cache_t &decoded);
+
+		/**
+		 * Drop the sub-tiles which don't satisfy the selection expression from the subtile mask of a product.
+		 * @param[in,out] product Reference to the product, with the subtile mask.
+		 * @param inventory Reference to all the band files of the product.
+		 * @param decoded Reference to the bands decoded by earlier scans of the product, to reuse.
+		 * @return True on success, false if any of the bands of the expression is missing or could not be read.
+		 */
+		bool select_subtiles(ESA_S2_Product &product, const std::vector<ESA_S2_Band> &inventory, scan_cache_t &decoded);
+
+		/**
+		 * Pass the pixels of each sub-tile in the subtile mask of a product to a function, from top to bottom.
+		 * Sub-tiles outside of the raster are passed without any pixels.
+		 * A JP2 band is decoded as a whole, within the window of the sub-tiles, and kept for the later scans of the product,
+		 * which may only cover fewer sub-tiles. TIF and PNG bands are read window by window.
+		 * The other bands in the cache are freed first, so that at most one of them holds a memory reservation.
+		 * @param product Reference to the product.
+		 * @param band Reference to the band.
+		 * @param decoded Reference to the bands decoded by earlier scans of the product.
+		 * @param fn Function to call with the index of each sub-tile, its pixels, and the number of pixels.
+		 * @return True on success, false if the band could not be decoded.
+		 */
+		bool scan_subtiles(ESA_S2_Product &product, const ESA_S2_Band &band, scan_cache_t &decoded,
+			const std::function<void(const Vector<int> &p, const Magick::PixelPacket *px, size_t n)> &fn);
+
+		/**
+		 * Collect the settings for splitting a band of a product.
+		 * @param product Reference to the product.
+		 * @param band Reference to the band.
+		 * @return Settings for split_subtiles().
+		 */
+		SubtileSplitSettings get_split_settings(ESA_S2_Product &product, const ESA_S2_Band &band) const;
+
+		/**
+		 * Hash the settings which the stored layer of a band depends on, so that the layers stored
+		 * with different settings are split again on reruns.
+		 * @param band Reference to the band.
+		 * @return Hash for the resume manifest.
 		 */
-		bool splitTIF(const std::filesystem::path &path_in, const std::filesystem::path &path_dir_out, ESA_S2_Image_Operator &op, ESA_S2_Image_Operator::data_type_t data_type, ESA_S2_Image_Operator::data_resolution_t data_resolution);
+		uint64_t get_params_hash(const ESA_S2_Band &band) const;
 
 		/**
-		 * Split a PNG file into sub-tiles.
-		 * @param path_in Path to the TIFF file.
-		 * @param path_dir_out Path to the output directory to store the sub-tiles.
+		 * Check in the resume manifest of a product whether a range of sub-tiles of a band has already been stored.
+		 * @param product Reference to the product.
+		 * @param band Reference to the band.
+		 * @param first Index of the first sub-tile.
+		 * @param last Index past the last sub-tile.
+		 * @return True if all the sub-tiles in the range have been stored with the current settings, into files which haven't changed since.
+		 */
+		bool is_done(ESA_S2_Product &product, const ESA_S2_Band &band, size_t first, size_t last) const;
+
+		/**
+		 * Finish a task of a band for the staged batches of the NetCDF files of a range of sub-tiles.
+		 * @param product Reference to the product.
+		 * @param band Reference to the band.
+		 * @param first Index of the first sub-tile.
+		 * @param last Index past the last sub-tile.
+		 * @return True if all the files which were due were published.
+		 */
+		static bool end_batches(ESA_S2_Product &product, const ESA_S2_Band &band, size_t first, size_t last);
+
+		/**
+		 * Get the sub-tile plan for a band, building it for the first band of its resolution.
+		 * @param product Reference to the product.
+		 * @param band Reference to the band.
+		 * @param geometry Reference to the geometry of the band raster.
+		 * @return Pointer to the sub-tile plan.
+		 */
+		std::shared_ptr<const SubtilePlan> get_subtile_plan(ESA_S2_Product &product, const ESA_S2_Band &band, const Magick::Geometry &geometry);
+
+		/**
+		 * Get the part of a band which a range of sub-tiles covers, for decoding only that part
+		 * of a band which is read as a whole. With an area of interest, it's usually a fraction of the band.
+		 * @param product Reference to the product.
+		 * @param band Reference to the band.
+		 * @param geometry Reference to the geometry of the band raster.
+		 * @param first Index of the first sub-tile.
+		 * @param last Index past the last sub-tile.
+		 * @param[out] x0 Reference to the left side of the window.
+		 * @param[out] y0 Reference to the top side of the window.
+		 * @param[out] x1 Reference to the right side of the window (exclusive).
+		 * @param[out] y1 Reference to the bottom side of the window (exclusive).
+		 * @return True if the window is within the raster, false if none of the sub-tiles is.
+		 */
+		bool get_decode_window(ESA_S2_Product &product, const ESA_S2_Band &band, const Magick::Geometry &geometry,
+			size_t first, size_t last, int &x0, int &y0, int &x1, int &y1);
+
+		/**
+		 * Get the part of a raster which a range of the sub-tiles of a plan covers.
+		 * @see get_decode_window() for the parameters.
+		 */
+		static bool get_decode_window(const SubtilePlan &plan, const Magick::Geometry &geometry,
+			size_t first, size_t last, int &x0, int &y0, int &x1, int &y1);
+
+		/**
+		 * Split a band with the raster source and the transform which match its file format and data type.
+		 * @param product Reference to the product.
+		 * @param band Reference to the band.
+		 * @param first Index of the first sub-tile in the product sub-tile list to split.
+		 * @param last Index past the last sub-tile to split.
 		 * @param op Operator for class remapping and any other post-processing.
-		 * @param data_type Band type.
-		 * @param data_resolution Band resolution.
 		 * @return True on success, false on failure.
 		 */
-		bool splitPNG(const std::filesystem::path &path_in, const std::filesystem::path &path_dir_out, ESA_S2_Image_Operator &op, ESA_S2_Image_Operator::data_type_t data_type, ESA_S2_Image_Operator::data_resolution_t data_resolution);
+		bool split_band(ESA_S2_Product &product, const ESA_S2_Band &band, size_t first, size_t last, ESA_S2_Image_Operator &op);
 };
-
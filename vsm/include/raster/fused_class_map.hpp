@@ -0,0 +1,69 @@
+//! @file
+//! @brief Remapping, resampling and conversion of classification masks in a single pass
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "raster/pixel_kernels.hpp"
+#include "raster/raster_image.hpp"
+#include <array>
+#include <vector>
+
+
+/**
+ * @brief Class maps of a mask, composed into a single table, and applied together with point resampling
+ * and the conversion for NetCDF.
+ *
+ * Remapping a sub-tile one class map at a time, resizing it with the point filter, and converting it for NetCDF
+ * reads and writes the whole sub-tile through the pixel cache of GraphicsMagick on each step. As every step only
+ * depends on the 8-bit value of a pixel, or on its position, the steps are composed into a table of the output
+ * value for each 8-bit source value, and a table of the source pixel for each output row and column. A single pass
+ * then reads the sampled source pixels and writes the output buffer for NetCDF directly. The tables are filled
+ * with the same conversions as the separate steps, so that the output is the same bit by bit.
+ */
+class FusedClassMap {
+	public:
+		FusedClassMap();
+
+		/**
+		 * Append a class map, to be applied after the ones added before it.
+		 * @param[in] table Reference to the table of classes, as for PixelKernels::remap_classes().
+		 */
+		void add_classes(const PixelKernels::class_table_t &table);
+
+		/**
+		 * @return True if no class maps have been added.
+		 */
+		bool empty() const { return num_maps == 0; }
+
+		/**
+		 * Remap the subset of a raster, resample it into a square with the point filter, and convert it
+		 * for NetCDF, as RasterImage::remap_values(), RasterImage::scale_to() and NetCDFInterface::add_to_file() would.
+		 * The subset itself is left as it is, but the resampling filter and the scaling factor are set for the metadata.
+		 * @param[in,out] image Reference to the raster.
+		 * @param size Width and height of the output, in pixels.
+		 * @param[out] px Reference to the pointer to set to the 8-bit values or floats, depending on the depth of the raster.
+		 * The values are in the WorkerArena::SLOT_FUSED buffer of the calling thread, which is overwritten by the next call.
+		 * @return True on success, false if the subset can't be transformed in a single pass (and has to go through the separate steps).
+		 */
+		bool apply(RasterImage &image, unsigned int size, const void *&px) const;
+
+	protected:
+		unsigned int num_maps;	///< Number of class maps composed so far.
+		PixelKernels::class_table_t classes;	///< Output pixel for each 8-bit source value, after all the class maps.
+		std::array<unsigned char, 256> values_ubyte;	///< Output value for each 8-bit source value, for 8-bit layers.
+		std::array<float, 256> values_float;	///< Output value for each 8-bit source value, for float layers.
+};
@@ -0,0 +1,110 @@
+//! @file
+//! @brief Windowed loading of any raster supported by GDAL
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "raster/raster_image.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+class GDALDataset;
+
+
+/**
+ * @brief Raster image which is read through GDAL, in windows.
+ *
+ * Works with any format which GDAL has a driver for (JP2, GeoTIFF, COG, VRT, ...).
+ * Decoded blocks are kept in the GDAL block cache (see GDAL_CACHEMAX), and a window which is
+ * read into a smaller buffer is taken from the best matching overview or reduced resolution level.
+ *
+ * Integer samples are normalized into [0, 1] by the maximum value of the data type,
+ * floating point samples are kept as they are. Datasets with 3 bands are read as RGB,
+ * everything else is read from the first band.
+ */
+class GDAL_Image: public RasterImage {
+	public:
+		/**
+		 * Initialize an empty raster.
+		 */
+		GDAL_Image();
+
+		/**
+		 * Close the dataset and de-initialize the raster.
+		 */
+		~GDAL_Image();
+
+		GDAL_Image(const GDAL_Image &) = delete;
+		GDAL_Image &operator=(const GDAL_Image &) = delete;
+
+		/**
+		 * Open the dataset and load the image header.
+		 * @param[in] path Reference to the raster file path.
+		 * @return True on success, false on failure.
+		 */
+		bool load_header(const std::filesystem::path &path);
+
+		/**
+		 * Load a subset of the raster.
+		 * The top-left corner of the subset is specified by \f$x_0, y_0\f$
+		 * and the bottom-right corner is specified by \f$x_1, y_1\f$.
+		 * Parts of the subset outside of the raster are filled with 0.
+		 * @param[in] path Reference to the raster file path.
+		 * @param da_x0 \f$x_0\f$ coordinate (left side) of the image to load.
+		 * @param da_y0 \f$y_0\f$ coordinate (top side) of the image to load.
+		 * @param da_x1 \f$x_1\f$ coordinate (right side) of the image to load.
+		 * @param da_y1 \f$y_1\f$ coordinate (bottom side) of the image to load.
+		 * @param out_size Size of the square subset to resample into with GDAL (0 to keep the original size).
+		 * @param[in] resampling_name Reference to the name of the resampling method (as in set_resampling_filter()).
+		 * The subset is only resampled if the method has a GDAL counterpart, otherwise it's left to scale_to().
+		 * @return True on success, False otherwise.
+		 */
+		bool load_subset(const std::filesystem::path &path, unsigned int da_x0, unsigned int da_y0, unsigned int da_x1, unsigned int da_y1,
+			unsigned int out_size = 0, const std::string &resampling_name = "");
+
+		/**
+		 * Set the size of the GDAL block cache, shared by all the datasets.
+		 * @param bytes Cache size in bytes.
+		 */
+		static void set_cache_max(uintmax_t bytes);
+
+	protected:
+		GDALDataset *dataset;	///< Open dataset.
+		std::filesystem::path dataset_path;	///< Path of the open dataset.
+		float sample_scale;	///< Factor to normalize samples with.
+
+		/**
+		 * Open a dataset, unless it's already open.
+		 * @param[in] path Reference to the raster file path.
+		 * @return True if the dataset is open.
+		 */
+		bool open_dataset(const std::filesystem::path &path);
+
+		/**
+		 * Find the GDAL counterpart of a resampling method.
+		 * @param[in] resampling_name Reference to the name of the resampling method.
+		 * @param[out] alg Reference to the GDALRIOResampleAlg value.
+		 * @return True if there's a counterpart.
+		 */
+		static bool get_gdal_resampling(const std::string &resampling_name, int &alg);
+
+		/**
+		 * Close the dataset.
+		 */
+		void close_dataset();
+};
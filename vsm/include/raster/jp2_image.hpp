@@ -19,6 +19,7 @@
 
 #include "raster/raster_image.hpp"
 
+#include <cstdint>
 #include <filesystem>
 
 
@@ -58,14 +59,19 @@ class JP2_Image: public RasterImage {
 		bool load_subset(const std::filesystem::path &path, int da_x0, int da_y0, int da_x1, int da_y1);
 
 		/**
-		 * Load the whole JP2 file in RAM.
+		 * Load the whole JP2 file in RAM, or only a window of it.
+		 * The window is clamped to the image, and an empty window stands for the whole image.
 		 * @param[in] path Path to the JP2 file.
+		 * @param[in] da_x0 Left side of the decode window, in pixels.
+		 * @param[in] da_y0 Top side of the decode window, in pixels.
+		 * @param[in] da_x1 Right side of the decode window, in pixels.
+		 * @param[in] da_y1 Bottom side of the decode window, in pixels.
 		 * @return True on success, False otherwise.
 		 */
-		bool load_whole(const std::filesystem::path &path);
+		bool load_whole(const std::filesystem::path &path, int da_x0 = 0, int da_y0 = 0, int da_x1 = 0, int da_y1 = 0);
 
 		/**
-		 * Subset the whole JP2 file.
+		 * Subset the decoded JP2 file. Parts of the subset outside of the decode window are filled with 0.
 		 * @param[in] da_x0 Left side of the decode area, in pixels.
 		 * @param[in] da_y0 Top side of the decode area, in pixels.
 		 * @param[in] da_x1 Right side of the decode area, in pixels.
@@ -74,14 +80,46 @@ class JP2_Image: public RasterImage {
 		 */
 		bool subset_whole(int da_x0, int da_y0, int da_x1, int da_y1);
 
+		/**
+		 * Convert the samples of a decoded grayscale component into pixels.
+		 * @param[in] data Pointer to the samples.
+		 * @param n Number of samples.
+		 * @param f Factor to scale the samples into [0, 1] with.
+		 * @param num_values Number of sample values to convert through a table (256 or 65536). Samples outside of the table
+		 * are converted one by one.
+		 * @param[out] px Pointer to the pixels to fill.
+		 */
+		static void component_to_pixels(const int32_t *data, unsigned long n, float f, uint32_t num_values, Magick::PixelPacket *px);
+
+		/**
+		 * Copy a block of pixels into a larger raster.
+		 * @param[in] src Pointer to the block, row by row.
+		 * @param w_src Width of the block, in pixels.
+		 * @param h_src Height of the block, in pixels.
+		 * @param[out] dst Pointer to the raster to copy into.
+		 * @param w_dst Width of the raster, in pixels.
+		 * @param dx Left side of the block within the raster.
+		 * @param dy Top side of the block within the raster.
+		 */
+		static void blit(const Magick::PixelPacket *src, unsigned long w_src, unsigned long h_src, Magick::PixelPacket *dst, unsigned long w_dst, unsigned long dx, unsigned long dy);
+
 		static void error_callback(const char *msg, void *client_data);
 
 		static void warning_callback(const char *msg, void *client_data);
 
 		static void info_callback(const char *msg, void *client_data);
 
+		//! Width of the JPEG2000 tiles, from the last header loaded (the image width if untiled).
+		unsigned int tile_width;
+		//! Height of the JPEG2000 tiles, from the last header loaded (the image height if untiled).
+		unsigned int tile_height;
+
 	private:
-		//! The whole decoded image.
+		//! The whole decoded image, or the decoded window of it.
 		Magick::Image *whole_image;
+		//! Left side of the decoded window within the image.
+		int whole_x0;
+		//! Top side of the decoded window within the image.
+		int whole_y0;
 };
 
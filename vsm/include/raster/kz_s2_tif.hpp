@@ -21,6 +21,7 @@
 #include <vector>
 
 #include "util/geometry.hpp"
+#include "util/subtile_grid.hpp"
 
 
 /**
@@ -182,7 +183,7 @@ class KZ_S2_TIF_Image {
 
 		bool geo_extracted;	///< Whether the geo-coordinates have been extracted from at least one of the overlapping rasters.
 		std::string proj_ref;	///< Projection reference, as extracted from the JP2 file.
-		std::vector<std::vector<unsigned char>> subtile_mask;	///< Mask of subtiles to fill.
+		SubtileGrid subtile_mask;	///< Mask of subtiles to fill.
 		AABB<float> aabb_buf;	///< Buffered axis-aligned bounding box surrounding the area of interest polygon, in relative image coordinates.
 		Polygon<int> aoi_poly;	///< Area of interest polygon in pixel coordinates.
 
@@ -19,8 +19,16 @@
 
 #include <iostream>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "raster/raster_image.hpp"
+#include "util/staged_file.hpp"
 
 
 /**
@@ -61,6 +69,7 @@ class NCException: public std::exception {
 
 /**
  * @brief An interface to manipulate NetCDF files.
+ * @note The NetCDF library is not thread-safe, so all of the instances share a single lock.
  */
 class NetCDFInterface {
 	public:
@@ -75,6 +84,52 @@ class NetCDFInterface {
 		 */
 		bool add_to_file(const std::filesystem::path &path, const std::string &name_in_netcdf, const RasterImage &image);
 
+		/**
+		 * Add a single-channel layer to a NetCDF file, from content which has already been converted.
+		 * @param path Path to the NetCDF file.
+		 * @param name_in_netcdf Variable name in NetCDF.
+		 * @param image Reference to the raster which the content comes from, for the metadata and the data type.
+		 * @param px Pointer to w * h floats if the depth of the raster is over 8 bits, or to w * h unsigned bytes otherwise.
+		 * @param w Width of the layer, in pixels.
+		 * @param h Height of the layer, in pixels.
+		 * @return True on success, false on failure.
+		 */
+		bool add_to_file(const std::filesystem::path &path, const std::string &name_in_netcdf, const RasterImage &image, const void *px, unsigned int w, unsigned int h);
+
+		/**
+		 * Configure staging of the files which add_to_file() writes, for all the instances.
+		 * With staging, each file is modified through a staging copy which then replaces it atomically.
+		 * By default, the files are staged next to themselves.
+		 * @param enabled Whether to stage the files (otherwise they're modified in place).
+		 * @param dir Staging directory, preferably on a fast local file system (empty to stage next to the files).
+		 */
+		static void set_staging(bool enabled, const std::filesystem::path &dir = std::filesystem::path());
+
+		/**
+		 * Keep the updates of a file in a single staging copy until a number of writers have finished with it.
+		 * The staging copy is made by the first update, and published by the last call to end_batch().
+		 * Calls for a file with a batch in progress add to its writers. Without staging, this does nothing.
+		 * @param path Path to the NetCDF file.
+		 * @param num_writers Number of calls to end_batch() to wait for.
+		 */
+		static void begin_batch(const std::filesystem::path &path, unsigned int num_writers);
+
+		/**
+		 * Finish a writer of the batch of a file, and publish the staging copy if it was the last writer.
+		 * A staging copy which any of the updates failed to write is discarded instead.
+		 * @param path Path to the NetCDF file.
+		 * @return True on success, or if there's no batch for the file.
+		 */
+		static bool end_batch(const std::filesystem::path &path);
+
+		/**
+		 * Call a function once the updates of a file have been published, or at once if the file has no batch in progress.
+		 * The function isn't called if the staging copy is discarded.
+		 * @param path Path to the NetCDF file.
+		 * @param fn Function to call, from the thread which publishes the file.
+		 */
+		static void on_published(const std::filesystem::path &path, std::function<void()> fn);
+
 		/**
 		 * Check if the NetCDF file has a layer with a specific name.
 		 * @param path Path to the NetCDF file.
@@ -91,8 +146,49 @@ class NetCDFInterface {
 		unsigned int set_deflate_level(unsigned int level);
 
 	private:
+		/**
+		 * @brief Staging copy of a file, shared by the updates of a batch.
+		 */
+		struct StagedBatch {
+			StagedBatch(const std::filesystem::path &path, const std::filesystem::path &dir_staging):
+				file(path, dir_staging), num_writers(0), begun(false), failed(false) {}
+
+			std::mutex mutex;	///< Serializes the updates of the staging copy.
+			StagedFile file;	///< Staging copy of the file.
+			unsigned int num_writers;	///< Number of writers which haven't finished yet.
+			bool begun;	///< Whether the staging copy has been made.
+			bool failed;	///< Whether any of the updates failed, which leaves the staging copy unfit for publishing.
+			std::vector<std::function<void()>> on_published;	///< Functions to call after publishing.
+		};
+
+		static std::mutex nc_mutex;	///< Serializes calls to the NetCDF library.
+		static std::mutex staging_mutex;	///< Guards the staging settings and the batches.
+		static bool staging_enabled;	///< Whether to write through staging files.
+		static std::filesystem::path dir_staging;	///< Staging directory (empty to stage next to the files).
+		static std::map<std::filesystem::path, std::shared_ptr<StagedBatch>> batches;	///< Batches in progress, by the path of the file.
+
 		unsigned int deflate_level;	///< Deflate level [0, 9] for the NetCDF variable.
 
+		/**
+		 * Add layers to a NetCDF file, through the staging copy of its batch if staging is enabled.
+		 * @param path Path to the NetCDF file.
+		 * @param image Reference to the raster which the layers come from, for the metadata and the data type.
+		 * @param w Width of the layers, in pixels.
+		 * @param h Height of the layers, in pixels.
+		 * @param layers Reference to the names of the variables, with pointers to their content.
+		 * @return True on success, false on failure.
+		 */
+		bool write_layers(const std::filesystem::path &path, const RasterImage &image, unsigned int w, unsigned int h, const std::vector<std::pair<std::string, const void *>> &layers);
+
+		/**
+		 * Open or create a NetCDF file, and add layers to it.
+		 * @param path_write Path to the file to write, which may be a staging copy.
+		 * @param path Path to the NetCDF file (used for errors and exceptions).
+		 * @see write_layers() for the other parameters.
+		 * @return True on success, false on failure.
+		 */
+		bool write_nc(const std::filesystem::path &path_write, const std::filesystem::path &path, const RasterImage &image, unsigned int w, unsigned int h, const std::vector<std::pair<std::string, const void *>> &layers);
+
 		/**
 		 * Add a layer to an open NetCDF file.
 		 * @param ncid ID of the open NetCDF instance.
@@ -0,0 +1,124 @@
+//! @file
+//! @brief Vectorized kernels for the pixels of grayscale rasters
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <Magick++.h>
+
+
+/**
+ * @brief Kernels for the pixels of grayscale rasters, in the instruction set selected by CPUDispatch.
+ *
+ * The pixel-by-pixel conversions through `Magick::ColorGray` only depend on the green quantum of a pixel,
+ * or on the decoded sample. Each of them is split into tables, which are filled through `Magick::ColorGray`
+ * exactly like before, and a kernel which looks the pixels up in the tables. This way, the output is the same
+ * bit by bit as that of the conversions, and only the kernels need to be vectorized.
+ */
+class PixelKernels {
+	public:
+		typedef std::array<Magick::PixelPacket, 256> class_table_t;	///< Output pixel per 8-bit value of a class.
+
+		/**
+		 * @return Pointer to the table of 65536 8-bit values, which `(unsigned char) (255 * shade)` gives for each green quantum,
+		 * followed by padding for the vector loads.
+		 */
+		static const uint8_t *get_value_lut();
+
+		/**
+		 * Fill a table of classes from a map of class values, as RasterImage::remap_values() uses it.
+		 * @param[in] values Pointer to the map of values. Values over max_value are mapped like max_value.
+		 * @param max_value Maximum index into values.
+		 * @param[out] table Reference to the table to fill.
+		 */
+		static void make_class_table(const unsigned char *values, unsigned char max_value, class_table_t &table);
+
+		/**
+		 * Replace each pixel with the entry of the class table for its 8-bit value.
+		 * @param[in,out] px Pointer to the pixels.
+		 * @param n Number of pixels.
+		 * @param[in] table Reference to the table of classes.
+		 */
+		static void remap_classes(Magick::PixelPacket *px, size_t n, const class_table_t &table);
+
+		/**
+		 * Replace each pixel with the entry of the class table for its 8-bit value in a value table.
+		 * @param[in] value_lut Pointer to the value for each green quantum, as get_value_lut().
+		 * @see The overload without value_lut for the other parameters.
+		 */
+		static void remap_classes(Magick::PixelPacket *px, size_t n, const uint8_t *value_lut, const class_table_t &table);
+
+		/**
+		 * Convert pixels into values in [0, 1], from the green quantum.
+		 * @param[in] px Pointer to the pixels.
+		 * @param n Number of pixels.
+		 * @param[out] dst Pointer to the values to fill.
+		 */
+		static void pixels_to_float(const Magick::PixelPacket *px, size_t n, float *dst);
+
+		/**
+		 * Convert pixels into 8-bit values, from the green quantum.
+		 * @see pixels_to_float() for the parameters.
+		 */
+		static void pixels_to_ubyte(const Magick::PixelPacket *px, size_t n, unsigned char *dst);
+
+		/**
+		 * Replace each sample with the entry of a table of pixels.
+		 * @param[in] data Pointer to the samples.
+		 * @param n Number of samples.
+		 * @param[in] table Pointer to the pixel for each sample value.
+		 * @param num_values Number of entries in the table.
+		 * @param[out] px Pointer to the pixels to fill.
+		 * @return True on success, false if any of the samples is outside of the table (the pixels are then incomplete).
+		 */
+		static bool samples_to_pixels(const int32_t *data, size_t n, const Magick::PixelPacket *table, uint32_t num_values, Magick::PixelPacket *px);
+
+		/**
+		 * Find the source pixel of each output pixel along an axis, for resampling with the point filter.
+		 * The geometry is that of the resize of GraphicsMagick, which reduces the point filter to a box of 0.5 + epsilon
+		 * around the center of each output pixel.
+		 * @param n_src Number of source pixels.
+		 * @param n_dst Number of output pixels.
+		 * @param[out] index Reference to the index of the source pixel of each output pixel, to fill.
+		 * @return True on success, false if any output pixel wouldn't have exactly a single source pixel.
+		 */
+		static bool point_sample_index(unsigned int n_src, unsigned int n_dst, std::vector<uint32_t> &index);
+
+		/**
+		 * Remap, resample with the point filter and convert pixels for NetCDF in a single pass.
+		 * Only the source pixels which are sampled are read, and each output row is written once.
+		 * @param[in] src Pointer to the source pixels.
+		 * @param w_src Width of the source, in pixels.
+		 * @param[in] value_lut Pointer to the 8-bit value for each green quantum, as get_value_lut().
+		 * @param[in] values Pointer to the output value for each 8-bit value.
+		 * @param[in] x_index Reference to the source column of each output column, from point_sample_index().
+		 * @param[in] y_index Reference to the source row of each output row.
+		 * @param[out] dst Pointer to the output values, row by row.
+		 */
+		static void remap_resample(const Magick::PixelPacket *src, unsigned int w_src, const uint8_t *value_lut, const unsigned char *values,
+			const std::vector<uint32_t> &x_index, const std::vector<uint32_t> &y_index, unsigned char *dst);
+
+		/**
+		 * Remap, resample with the point filter and convert pixels into values in [0, 1].
+		 * @see The overload for 8-bit values, for the parameters.
+		 */
+		static void remap_resample(const Magick::PixelPacket *src, unsigned int w_src, const uint8_t *value_lut, const float *values,
+			const std::vector<uint32_t> &x_index, const std::vector<uint32_t> &y_index, float *dst);
+};
@@ -18,6 +18,7 @@
 #pragma once
 
 #include "raster/raster_image.hpp"
+#include "raster/png_row_reader.hpp"
 
 #include <filesystem>
 
@@ -53,8 +54,27 @@ class PNG_Image: public RasterImage {
 		 * @param da_y0 \f$y_0\f$ coordinate (top side) of the image to load.
 		 * @param da_x1 \f$x_1\f$ coordinate (right side) of the image to load.
 		 * @param da_y1 \f$y_1\f$ coordinate (bottom side) of the image to load.
+		 * @note Subsets are decoded progressively, so that loading them in row-major order decodes the file only once.
 		 * @return True on success, False otherwise.
 		 */
 		bool load_subset(const std::filesystem::path &path, int da_x0, int da_y0, int da_x1, int da_y1);
+
+	protected:
+		PNGRowReader reader;	///< Row reader, which keeps the file open and the rows of the current subset in RAM.
+		std::filesystem::path reader_path;	///< Path of the file which the reader was last asked to open.
+		bool reader_failed;	///< Whether the reader failed to open the file at reader_path.
+
+		/**
+		 * Open the row reader for a file, unless it's already open.
+		 * @param[in] path Reference to the PNG file path.
+		 * @return True if the reader is open, false if the file can't be read with the row reader.
+		 */
+		bool open_reader(const std::filesystem::path &path);
+
+		/**
+		 * Load a subset by decoding the whole PNG file with Magick and cropping it.
+		 * Used for palette, alpha and interlaced files.
+		 */
+		bool load_subset_magick(const std::filesystem::path &path, int da_x0, int da_y0, int da_x1, int da_y1);
 };
 
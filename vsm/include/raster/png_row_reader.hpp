@@ -0,0 +1,131 @@
+//! @file
+//! @brief Streaming reading of PNG files, row by row
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+class ZipMemberReader;
+
+/**
+ * @brief Reader for rectangular windows of a PNG file, which decodes the rows progressively.
+ *
+ * PNG can only be decoded from top to bottom, so the reader keeps the band of rows between the top
+ * of the current window and the last decoded row, and drops the rows above the window as it moves down.
+ * Windows which are read in row-major order decode each row of the file exactly once.
+ * Moving back up restarts decoding from the top of the file.
+ *
+ * Files within ZIP archives are decoded straight from the archive.
+ *
+ * Supports non-interlaced grayscale (1 to 16 bits) and RGB (8 or 16 bits) files without alpha.
+ * Samples are normalized into [0, 1] by the maximum value of the sample type.
+ */
+class PNGRowReader {
+	public:
+		PNGRowReader();
+		~PNGRowReader();
+
+		PNGRowReader(const PNGRowReader &) = delete;
+		PNGRowReader &operator=(const PNGRowReader &) = delete;
+
+		/**
+		 * Open a PNG file and read its header.
+		 * @param[in] path Reference to the PNG file path.
+		 * @return True on success, false if the file could not be opened or its layout is not supported.
+		 */
+		bool open(const std::filesystem::path &path);
+
+		/**
+		 * Close the file and drop the cached rows.
+		 */
+		void close();
+
+		/**
+		 * @return True if a file is open.
+		 */
+		bool is_open() const { return png != nullptr; }
+
+		/**
+		 * @return Path of the open file.
+		 */
+		const std::filesystem::path &get_path() const { return path; }
+
+		/**
+		 * Read a window of all the channels into planar float buffers.
+		 * Pixels outside of the raster are set to 0.
+		 * @param x0 Left side of the window.
+		 * @param y0 Top side of the window.
+		 * @param x1 Right side of the window (exclusive).
+		 * @param y1 Bottom side of the window (exclusive).
+		 * @param[out] dst Pointer to an output buffer of \f$(x_1 - x_0) \times (y_1 - y_0)\f$ floats per channel.
+		 * @return True on success, false if decoding failed.
+		 */
+		bool read_window(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, float *const *dst);
+
+		/**
+		 * @return Number of rows decoded since the file was opened, including restarts.
+		 */
+		unsigned long get_num_decoded_rows() const { return num_decoded_rows; }
+
+		/**
+		 * @return Number of rows currently kept in RAM.
+		 */
+		size_t get_num_cached_rows() const { return rows.size(); }
+
+		unsigned int width;	///< Raster width, in pixels.
+		unsigned int height;	///< Raster height, in pixels.
+		unsigned int num_channels;	///< Number of channels (1 for grayscale, 3 for RGB).
+		unsigned int bit_depth;	///< Bit depth of the decoded samples (8 or 16).
+		unsigned int file_bit_depth;	///< Bit depth of the samples in the file.
+
+	protected:
+		std::filesystem::path path;	///< Path of the open file.
+		FILE *fp;	///< Open file.
+		std::unique_ptr<ZipMemberReader> zip_reader;	///< Open file within a ZIP archive.
+		void *png;	///< libpng read struct.
+		void *info;	///< libpng info struct.
+
+		std::deque<std::vector<unsigned char>> rows;	///< Decoded rows, starting from first_row.
+		std::vector<std::vector<unsigned char>> spare_rows;	///< Dropped rows, to be reused.
+		unsigned int first_row;	///< Index of the first row in rows.
+		unsigned int next_row;	///< Index of the next row to decode.
+		size_t row_bytes;	///< Size of a decoded row, in bytes.
+		unsigned long num_decoded_rows;	///< Number of rows decoded since opening the file.
+
+		/**
+		 * Start decoding from the top of the file.
+		 * @return True on success.
+		 */
+		bool start();
+
+		/**
+		 * Release the libpng structs and close the file, but keep the path.
+		 */
+		void release();
+
+		/**
+		 * Decode the next row of the file.
+		 * @param[out] row Pointer to a buffer of row_bytes.
+		 * @return True on success.
+		 */
+		bool decode_row(unsigned char *row);
+};
@@ -192,6 +192,15 @@ class RasterImage {
 		 */
 		Magick::Image *create_grayscale(const Magick::Geometry &geometry, int pixel_depth, int background_value);
 
+		/**
+		 * Read an image file with Magick. Files within ZIP archives are decoded from RAM.
+		 * @param[out] img Reference to the image to read into.
+		 * @param[in] path Reference to the file path, or the virtual path of a file within an archive.
+		 * @param ping Only read the image attributes, without the pixels.
+		 * @return True on success, false if the file within an archive could not be read.
+		 */
+		static bool read_magick(Magick::Image &img, const std::filesystem::path &path, bool ping = false);
+
 		/**
 		 * Abstract function for loading image from file in subclasses.
 		 */
@@ -219,6 +228,15 @@ class RasterImage {
 		 */
 		void clear();
 
+		/**
+		 * Prepare a blank subset image of the number of channels in main_num_components, for a loader to fill.
+		 * The current subset is reused if it already has the same size and number of channels, so that windows
+		 * of the same size don't allocate a new image each time.
+		 * @param w Width of the subset, in pixels.
+		 * @param h Height of the subset, in pixels.
+		 */
+		void reset_subset(unsigned int w, unsigned int h);
+
 		std::string product_name;	///< Product name, for NetCDF metadata.
 		std::string resampling_filter_name;	///< Name of the resampling filter used, for NetCDF metadata.
 
@@ -226,9 +244,11 @@ class RasterImage {
 		Magick::Geometry main_geometry;	///< Image geometry
 		unsigned char main_depth;	///< Pixel depth in bits.
 		unsigned char main_num_components;	///< Number of channels (1 for grayscale, 3 for RGB) in the raster image.
+		unsigned char subset_components;	///< Number of channels which reset_subset() allocated the subset with (0 if unknown).
 
 		float f_overlap;	///< Overlap factor [0.0f, 0.5f], for NetCDF metadata.
 		float scaling_factor;	///< Scaling factor used for resampling the image for storage in NetCDF.
+		float valid_fraction;	///< Fraction of valid pixels in the sub-tile, for NetCDF metadata (negative if unknown).
 
 		/**
 		 * Set the deflate level to use for NetCDF storage.
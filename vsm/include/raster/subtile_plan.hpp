@@ -0,0 +1,141 @@
+//! @file
+//! @brief Precomputed sub-tile windows and output paths
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "util/geometry.hpp"
+
+
+/**
+ * @brief Window of a sub-tile in the source raster, and the paths of its output files.
+ */
+class SubtileWindow {
+	public:
+		Vector<int> p;	///< Sub-tile index.
+		int x0;	///< Left edge of the window, in source pixels.
+		int y0;	///< Top edge of the window, in source pixels.
+		int x1;	///< Right edge of the window, in source pixels (exclusive).
+		int y1;	///< Bottom edge of the window, in source pixels (exclusive).
+		bool skip;	///< Whether the window is empty or outside of the raster.
+		float valid_fraction;	///< Fraction of valid pixels in the sub-tile, for NetCDF metadata (negative if unknown).
+
+		std::string path_dir;	///< Output directory of the sub-tile, with a trailing slash.
+		std::string path_nc;	///< Path of the NetCDF file of the sub-tile.
+		std::string name_suffix;	///< File name suffix `_tile_X_Y`, to append to band-specific prefixes.
+};
+
+
+/**
+ * @brief Immutable list of sub-tile windows for rasters of a single resolution.
+ *
+ * The plan is built once per resolution group of a product, and shared by all the bands
+ * (and threads) which split rasters of that resolution.
+ */
+class SubtilePlan {
+	public:
+		/**
+		 * @param subtiles Reference to the list of sub-tiles to split.
+		 * @param path_dir_out Output directory, which holds the `tile_X_Y` directories.
+		 * @param nc_prefix Name prefix of the NetCDF files.
+		 * @param aabb_buf Buffered axis-aligned bounding box surrounding the area of interest, in relative image coordinates.
+		 * @param width Raster width, in source pixels.
+		 * @param height Raster height, in source pixels.
+		 * @param tile_size Sub-tile size, in 10 m pixels.
+		 * @param f_overlap Overlap between sub-tiles.
+		 * @param div_f Ground resolution of the raster relative to 10 m (2 for 20 m, 6 for 60 m).
+		 * @param valid_fractions Reference to the fraction of valid pixels per sub-tile, where known.
+		 */
+		SubtilePlan(const std::vector<Vector<int>> &subtiles, const std::filesystem::path &path_dir_out, const std::string &nc_prefix,
+			const AABB<float> &aabb_buf, unsigned int width, unsigned int height, unsigned int tile_size, float f_overlap, float div_f,
+			const std::map<std::pair<int, int>, float> &valid_fractions = {});
+
+		/**
+		 * @return Number of sub-tiles in the plan.
+		 */
+		size_t size() const { return windows.size(); }
+
+		/**
+		 * @param i Index of the sub-tile.
+		 * @return Reference to the window of the sub-tile.
+		 */
+		const SubtileWindow &operator[](size_t i) const { return windows[i]; }
+
+		/**
+		 * Order a range of sub-tiles by rows of windows, top to bottom and left to right,
+		 * for rasters which can only be decoded from top to bottom.
+		 * @param first Index of the first sub-tile.
+		 * @param last Index past the last sub-tile.
+		 * @return Indices of the sub-tiles in the range, in row-major order.
+		 */
+		std::vector<size_t> get_row_major_order(size_t first, size_t last) const;
+
+		/**
+		 * Compute the bounding box of the windows of a range of sub-tiles, for decoding only the part
+		 * of the raster which is covered by the sub-tiles. Skipped sub-tiles are left out.
+		 * @param first Index of the first sub-tile.
+		 * @param last Index past the last sub-tile.
+		 * @param[out] x0 Reference to the left edge of the bounding box, in source pixels.
+		 * @param[out] y0 Reference to the top edge of the bounding box, in source pixels.
+		 * @param[out] x1 Reference to the right edge of the bounding box, in source pixels (exclusive).
+		 * @param[out] y1 Reference to the bottom edge of the bounding box, in source pixels (exclusive).
+		 * @return True if any of the sub-tiles in the range has a window, false if all of them are skipped.
+		 */
+		bool get_bounds(size_t first, size_t last, int &x0, int &y0, int &x1, int &y1) const;
+
+		/**
+		 * Compute the window of a sub-tile in the source raster.
+		 * The window is square, with the overlap added to the right and bottom edges.
+		 * @param[out] w Reference to the window to fill.
+		 * @param aabb_buf Buffered axis-aligned bounding box surrounding the area of interest, in relative image coordinates.
+		 * @param width Raster width, in source pixels.
+		 * @param height Raster height, in source pixels.
+		 * @param tile_size Sub-tile size, in 10 m pixels.
+		 * @param f_overlap Overlap between sub-tiles.
+		 * @param div_f Ground resolution of the raster relative to 10 m.
+		 */
+		static void compute_window(SubtileWindow &w, const AABB<float> &aabb_buf, unsigned int width, unsigned int height, unsigned int tile_size, float f_overlap, float div_f);
+
+		/**
+		 * @param path_dir_out Output directory.
+		 * @param p Sub-tile index.
+		 * @return Output directory of the sub-tile, with a trailing slash.
+		 */
+		static std::string get_subtile_dir(const std::filesystem::path &path_dir_out, const Vector<int> &p);
+
+		/**
+		 * @param path_dir_out Output directory.
+		 * @param nc_prefix Prefix of the NetCDF file names.
+		 * @param p Sub-tile index.
+		 * @return Path to the NetCDF file of the sub-tile.
+		 */
+		static std::string get_nc_path(const std::filesystem::path &path_dir_out, const std::string &nc_prefix, const Vector<int> &p);
+
+		/**
+		 * Create the output directories for a list of sub-tiles, in a single pass before splitting.
+		 * @param path_dir_out Output directory.
+		 * @param subtiles Reference to the list of sub-tiles.
+		 */
+		static void create_directories(const std::filesystem::path &path_dir_out, const std::vector<Vector<int>> &subtiles);
+
+	protected:
+		std::vector<SubtileWindow> windows;	///< Window per sub-tile, in the order of the sub-tile list.
+};
@@ -0,0 +1,466 @@
+//! @file
+//! @brief Generic splitting of rasters into sub-tiles
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "raster/esa_s2_band_jp2.hpp"
+#include "raster/gdal_image.hpp"
+#include "raster/tif_image.hpp"
+#include "raster/png_image.hpp"
+#include "raster/cnes_maja_clm_tif.hpp"
+#include "raster/fused_class_map.hpp"
+#include "raster/netcdf_interface.hpp"
+#include "raster/subtile_plan.hpp"
+#include "util/geometry.hpp"
+#include "util/resume_manifest.hpp"
+#include "util/stage_stats.hpp"
+#include "util/worker_arena.hpp"
+
+
+/**
+ * @brief Settings which are shared by all the sub-tiles of a raster.
+ */
+class SubtileSplitSettings {
+	public:
+		SubtileSplitSettings():
+			output_size(512), f_overlap(0.0f), deflate_factor(9), store_png(false), skip_existing(false),
+			manifest(nullptr), params_hash(0), aborted(nullptr) {}
+
+		unsigned int output_size;	///< Size of the stored sub-tile, in pixels.
+		float f_overlap;	///< Overlap between sub-tiles, for NetCDF metadata.
+		unsigned int deflate_factor;	///< Deflate factor for NetCDF storage.
+
+		bool store_png;	///< Whether to store sub-tiles in PNG files, too.
+		bool skip_existing;	///< Whether to skip sub-tiles for which the NetCDF file already has the layer.
+		ResumeManifest *manifest;	///< Optional manifest for skipping and recording the stored sub-tiles, instead of probing the NetCDF files.
+		uint64_t params_hash;	///< Hash of the parameters which the stored layer depends on, for the manifest.
+
+		std::string png_prefix;	///< Name prefix of the PNG files.
+		std::string layer_name;	///< Name of the layer in the NetCDF files.
+		std::string product_name;	///< Product name, for NetCDF metadata.
+
+		const std::atomic<bool> *aborted;	///< Optional flag to stop splitting at the next sub-tile.
+};
+
+
+/**
+ * @brief JP2 source, read either as a whole or tile by tile.
+ *
+ * Together with the other sources, this implements the RasterSource concept of split_subtiles():
+ * a public `image` which derives from RasterImage,
+ * `bool open(const std::filesystem::path &path)` to load the header (or the whole raster),
+ * and `bool load(const std::filesystem::path &path, int x0, int y0, int x1, int y1)` to load a subset into `image.subset`.
+ */
+class JP2RasterSource {
+	public:
+		/**
+		 * @param read_tiled False to decode the whole JP2 file into RAM, true to decode tiles on demand.
+		 */
+		JP2RasterSource(bool read_tiled): read_tiled(read_tiled), decode_x0(0), decode_y0(0), decode_x1(0), decode_y1(0) {}
+
+		bool open(const std::filesystem::path &path) {
+			return read_tiled ? image.load_header(path) : image.load_whole(path, decode_x0, decode_y0, decode_x1, decode_y1);
+		}
+
+		bool load(const std::filesystem::path &path, int x0, int y0, int x1, int y1) {
+			return read_tiled ? image.load_subset(path, x0, y0, x1, y1) : image.subset_whole(x0, y0, x1, y1);
+		}
+
+		ESA_S2_Band_JP2_Image image;	///< Raster with the current subset.
+		bool read_tiled;	///< Whether to decode tiles on demand.
+		int decode_x0;	///< Left side of the window to decode when reading the whole file.
+		int decode_y0;	///< Top side of the window to decode when reading the whole file.
+		int decode_x1;	///< Right side of the window to decode (0 for the whole file).
+		int decode_y1;	///< Bottom side of the window to decode (0 for the whole file).
+};
+
+
+/**
+ * @brief TIF source with 1 or 3 channels.
+ */
+class TIFRasterSource {
+	public:
+		bool open(const std::filesystem::path &path) {
+			return image.load_header(path);
+		}
+
+		bool load(const std::filesystem::path &path, int x0, int y0, int x1, int y1) {
+			return image.load_subset(path, x0, y0, x1, y1);
+		}
+
+		TIF_Image image;	///< Raster with the current subset.
+};
+
+
+/**
+ * @brief Channels of a multi-channel TIF source.
+ *
+ * All the channels of a window are decoded together on the first load of the window,
+ * and the following loads of the same window only select another channel.
+ */
+class TIFChannelRasterSource {
+	public:
+		TIFChannelRasterSource(): current(0) {}
+
+		bool open(const std::filesystem::path &path) {
+			return image.load_header(path);
+		}
+
+		bool load(const std::filesystem::path &path, int x0, int y0, int x1, int y1) {
+			if (!image.has_subset_channels(path, x0, y0, x1, y1) && !image.load_subset_channels(path, x0, y0, x1, y1, channels, scales))
+				return false;
+			return image.select_subset_channel(current);
+		}
+
+		TIF_Image image;	///< Raster with the current subset.
+		std::vector<unsigned int> channels;	///< Indices of the channels to decode.
+		std::vector<float> scales;	///< Factor to multiply each channel with.
+		size_t current;	///< Index into channels, of the channel to load.
+};
+
+
+/**
+ * @brief PNG source.
+ */
+class PNGRasterSource {
+	public:
+		bool open(const std::filesystem::path &path) {
+			return image.load_header(path);
+		}
+
+		bool load(const std::filesystem::path &path, int x0, int y0, int x1, int y1) {
+			return image.load_subset(path, x0, y0, x1, y1);
+		}
+
+		PNG_Image image;	///< Raster with the current subset.
+};
+
+
+/**
+ * @brief Source for any raster which GDAL can read, including JP2, COG and VRT files.
+ *
+ * With an output size, GDAL resamples each window while reading it, from an overview when downscaling.
+ */
+class GDALRasterSource {
+	public:
+		/**
+		 * @param output_size Size of the stored sub-tile, to resample into (0 to keep the original size).
+		 * @param resampling_method_name Reference to the name of the resampling method.
+		 */
+		GDALRasterSource(unsigned int output_size = 0, const std::string &resampling_method_name = ""):
+			output_size(output_size), resampling_method_name(resampling_method_name) {}
+
+		bool open(const std::filesystem::path &path) {
+			return image.load_header(path);
+		}
+
+		bool load(const std::filesystem::path &path, int x0, int y0, int x1, int y1) {
+			return image.load_subset(path, x0, y0, x1, y1, output_size, resampling_method_name);
+		}
+
+		GDAL_Image image;	///< Raster with the current subset.
+		unsigned int output_size;	///< Size to resample into, or 0.
+		std::string resampling_method_name;	///< Name of the resampling method.
+};
+
+
+/**
+ * @brief Transform for spectral bands: resampling with the configured filter.
+ */
+class SpectralTransform {
+	public:
+		/**
+		 * @param resampling_method_name Reference to the name of the resampling method.
+		 */
+		SpectralTransform(const std::string &resampling_method_name): resampling_method_name(resampling_method_name) {}
+
+		void operator()(RasterImage &image, unsigned int size) const {
+			image.set_resampling_filter(resampling_method_name);
+			image.scale_to(size);
+		}
+
+		/**
+		 * Spectral bands are always transformed step by step.
+		 * @return False.
+		 */
+		bool apply_fused(RasterImage &image, unsigned int size, const void *&px) const {
+			(void) image;
+			(void) size;
+			(void) px;
+			return false;
+		}
+
+		std::string resampling_method_name;	///< Name of the resampling method.
+};
+
+
+/**
+ * @brief Transform for classification masks: remapping into Sen2Cor classes, then into the desired classes,
+ * and nearest neighbour resampling.
+ * This helps to ensure that there's only a single place in code which is responsible for the mapping
+ * and that the mapping is configurable.
+ */
+class ClassMapTransform {
+	public:
+		/**
+		 * @param src_map Pointer to the map from the source classes into Sen2Cor classes (nullptr for Sen2Cor masks).
+		 * @param src_map_size Number of elements in the source map. The last one is for unmatched classes.
+		 * @param scl_map Pointer to the map from Sen2Cor classes into the desired classes (nullptr to keep Sen2Cor classes).
+		 * @param scl_max Maximum index for the Sen2Cor class map.
+		 */
+		ClassMapTransform(const unsigned char *src_map, unsigned int src_map_size, const unsigned char *scl_map, unsigned char scl_max):
+			src_map(src_map), src_max(src_map_size > 0 ? src_map_size - 1 : 0), scl_map(scl_map), scl_max(scl_max) {
+			PixelKernels::class_table_t table;
+			if (src_map != nullptr) {
+				PixelKernels::make_class_table(src_map, src_max, table);
+				fused.add_classes(table);
+			}
+			if (scl_map != nullptr) {
+				PixelKernels::make_class_table(scl_map, scl_max, table);
+				fused.add_classes(table);
+			}
+		}
+
+		void operator()(RasterImage &image, unsigned int size) const {
+			if (src_map != nullptr)
+				image.remap_values(src_map, src_max);
+			if (scl_map != nullptr)
+				image.remap_values(scl_map, scl_max);
+			image.set_resampling_filter("point");
+			image.scale_to(size);
+		}
+
+		/**
+		 * Remap, resample and convert the sub-tile for NetCDF in a single pass, without modifying the raster.
+		 * @param[out] px Reference to the pointer to set to the content for NetCDFInterface::add_to_file().
+		 * @return True on success, false if the sub-tile has to be transformed with operator() instead.
+		 */
+		bool apply_fused(RasterImage &image, unsigned int size, const void *&px) const {
+			return fused.apply(image, size, px);
+		}
+
+		const unsigned char *src_map;	///< Map from source classes into Sen2Cor classes.
+		unsigned char src_max;	///< Maximum index for the source class map.
+		const unsigned char *scl_map;	///< Map from Sen2Cor classes into the desired classes.
+		unsigned char scl_max;	///< Maximum index for the Sen2Cor class map.
+		FusedClassMap fused;	///< Both of the class maps, composed.
+};
+
+
+/**
+ * @brief Transform for CNES MAJA cloud masks: decoding of the flags into Sen2Cor classes,
+ * then remapping into the desired classes, and nearest neighbour resampling.
+ */
+class MajaClassMapTransform {
+	public:
+		/**
+		 * @param flags_fmt MAJA flags format in the source raster.
+		 * @param scl_map Pointer to the map from Sen2Cor classes into the desired classes (nullptr to keep Sen2Cor classes).
+		 * @param scl_max Maximum index for the Sen2Cor class map.
+		 */
+		MajaClassMapTransform(CNES_MAJA_CLM_TIF::clm_format_t flags_fmt, const unsigned char *scl_map, unsigned char scl_max):
+			flags_fmt(flags_fmt), scl_map(scl_map), scl_max(scl_max) {
+			PixelKernels::class_table_t table;
+			CNES_MAJA_CLM_TIF::make_class_table(flags_fmt, table);
+			fused.add_classes(table);
+			if (scl_map != nullptr) {
+				PixelKernels::make_class_table(scl_map, scl_max, table);
+				fused.add_classes(table);
+			}
+		}
+
+		void operator()(RasterImage &image, unsigned int size) const {
+			CNES_MAJA_CLM_TIF::remap_majac_values(&image, flags_fmt);
+			if (scl_map != nullptr)
+				image.remap_values(scl_map, scl_max);
+			image.set_resampling_filter("point");
+			image.scale_to(size);
+		}
+
+		/**
+		 * @see ClassMapTransform::apply_fused().
+		 */
+		bool apply_fused(RasterImage &image, unsigned int size, const void *&px) const {
+			return fused.apply(image, size, px);
+		}
+
+		CNES_MAJA_CLM_TIF::clm_format_t flags_fmt;	///< MAJA flags format.
+		const unsigned char *scl_map;	///< Map from Sen2Cor classes into the desired classes.
+		unsigned char scl_max;	///< Maximum index for the Sen2Cor class map.
+		FusedClassMap fused;	///< The decoding of the flags and the class map, composed.
+};
+
+
+/**
+ * @brief Transform for sources which have already been scaled while decoding, such as the KappaZeta rasters.
+ */
+class IdentityTransform {
+	public:
+		void operator()(RasterImage &image, unsigned int size) const {
+			(void) image;
+			(void) size;
+		}
+
+		bool apply_fused(RasterImage &image, unsigned int size, const void *&px) const {
+			(void) image;
+			(void) size;
+			(void) px;
+			return false;
+		}
+};
+
+
+/**
+ * Split a raster into sub-tiles, and add each sub-tile into the NetCDF file of the sub-tile.
+ * The loader, the raster type and the pixel transform are resolved at compile time, so that
+ * any improvement to the splitting applies to all of the raster formats.
+ * @param src Reference to an opened raster source (JP2RasterSource, TIFRasterSource, TIFChannelRasterSource, PNGRasterSource or GDALRasterSource).
+ * @param transform Reference to the transform to apply to each sub-tile (SpectralTransform, ClassMapTransform, ...).
+ * @param path_in Reference to the path of the raster file.
+ * @param settings Reference to the settings shared by all the sub-tiles.
+ * @param plan Reference to the sub-tile plan for the resolution of the raster. The output directories must already exist.
+ * @param order Reference to the indices of the sub-tiles in the plan to split, in the order to split them in.
+ * @param on_subtile Callback for each sub-tile which has been stored, with the path to the sub-tile directory. Return false to stop splitting.
+ * @return True on success, false if any of the sub-tiles failed to load or if splitting was stopped.
+ */
+template<class Source, class Transform, class Callback>
+bool split_subtiles(Source &src, const Transform &transform, const std::filesystem::path &path_in, const SubtileSplitSettings &settings, const SubtilePlan &plan, const std::vector<size_t> &order, Callback on_subtile) {
+	NetCDFInterface nci;
+	StageStats *stats = StageStats::get_current();
+	const void *px_fused = nullptr;
+	bool retval = true;
+
+	// Grow the buffers of the thread to the size of a sub-tile once, rather than with the first sub-tiles.
+	WorkerArena &arena = WorkerArena::get_current();
+	size_t size_layer = (size_t) settings.output_size * settings.output_size * sizeof(float);
+	arena.reserve(WorkerArena::SLOT_NC_LAYERS, size_layer);
+	if (!settings.store_png)
+		arena.reserve(WorkerArena::SLOT_FUSED, size_layer);
+
+	nci.set_deflate_level(settings.deflate_factor);
+
+	// Propagate overlap factor and product name for NetCDF metadata.
+	src.image.f_overlap = settings.f_overlap;
+	src.image.product_name = settings.product_name;
+
+	for (size_t i: order) {
+		if (settings.aborted != nullptr && *settings.aborted)
+			return false;
+
+		const SubtileWindow &w = plan[i];
+
+		// Skip the subtile if it's already stored in the NetCDF file and we haven't been asked to overwrite subtiles.
+		// Output directories with a manifest from an earlier run are checked in memory, as long as the file hasn't changed since.
+		if (settings.skip_existing) {
+			bool recorded = settings.manifest != nullptr && settings.manifest->has(w.p.x, w.p.y, settings.layer_name, settings.params_hash);
+			if (recorded && settings.manifest->is_intact(w.p.x, w.p.y, w.path_nc))
+				continue;
+			if ((recorded || settings.manifest == nullptr || !settings.manifest->existed()) && nci.has_layer(w.path_nc, settings.layer_name))
+				continue;
+		}
+
+		// Windows which are empty or outside of the raster are reported, but not decoded, and don't count as failures.
+		if (w.skip) {
+			std::cout << "Skipping subset tile_" << w.p.x << "_" << w.p.y << ": " << w.x0 << ", " << w.y0 << ", " << w.x1 << ", " << w.y1 << " outside of " << path_in << std::endl;
+			continue;
+		}
+
+		src.image.valid_fraction = w.valid_fraction;
+		if (stats != nullptr)
+			stats->begin_subtile();
+
+		// Load the subset of the source image.
+		// The times of a sub-tile which fails to load are dropped by the next begin_subtile().
+		StageTimer timer_decode(StageStats::ST_DECODE);
+		if (!src.load(path_in, w.x0, w.y0, w.x1, w.y1) || src.image.subset == nullptr) {
+			std::cerr << "Failed to load subset " << "tile_" << w.p.x << "_" << w.p.y << ": " << w.x0 << ", " << w.y0 << ", " << w.x1 << ", " << w.y1 << " of " << path_in << std::endl;
+			retval = false;
+			continue;
+		}
+		timer_decode.add_bytes((uint64_t) src.image.subset->columns() * src.image.subset->rows() * sizeof(Magick::PixelPacket));
+		timer_decode.stop();
+
+		// Masks go straight into the NetCDF buffer in a single pass, unless the transformed raster is needed for a PNG.
+		bool fused = !settings.store_png && transform.apply_fused(src.image, settings.output_size, px_fused);
+		if (!fused) {
+			transform(src.image, settings.output_size);
+
+			if (src.image.subset->rows() != settings.output_size || src.image.subset->columns() != settings.output_size) {
+				std::cout << "Invalid geometry " << src.image.subset->rows() << "x" << src.image.subset->columns() << " for subtile " << w.p.x << ", " << w.p.y << std::endl;
+			}
+		}
+
+		// Save PNG.
+		if (settings.store_png) {
+			std::filesystem::path path_png = w.path_dir + settings.png_prefix + w.name_suffix + ".png";
+			StageTimer timer_png(StageStats::ST_PNG);
+			src.image.save(path_png);
+			std::error_code ec;
+			uintmax_t size_png = std::filesystem::file_size(path_png, ec);
+			if (!ec)
+				timer_png.add_bytes(size_png);
+		}
+		// Add to NetCDF.
+		bool added = fused ?
+			nci.add_to_file(w.path_nc, settings.layer_name, src.image, px_fused, settings.output_size, settings.output_size) :
+			nci.add_to_file(w.path_nc, settings.layer_name, src.image);
+		if (added) {
+			// A file is only recorded in the manifest once it has been published, or closed and synced.
+			if (settings.manifest != nullptr) {
+				ResumeManifest *manifest = settings.manifest;
+				Vector<int> p = w.p;
+				std::string layer_name = settings.layer_name;
+				uint64_t params_hash = settings.params_hash;
+				std::filesystem::path path_nc = w.path_nc;
+				NetCDFInterface::on_published(w.path_nc, [manifest, p, layer_name, params_hash, path_nc]() {
+					manifest->add(p.x, p.y, layer_name, params_hash, path_nc);
+				});
+			}
+		} else {
+			retval = false;
+		}
+		if (stats != nullptr)
+			stats->end_subtile();
+
+		// Potential post-processing of the file.
+		if (!on_subtile(w.path_dir))
+			return false;
+	}
+
+	return retval;
+}
+
+
+/**
+ * Split a range of the sub-tiles of a plan, in the order of the plan.
+ * @param first Index of the first sub-tile in the plan to split.
+ * @param last Index past the last sub-tile in the plan to split.
+ * @see The overload with a list of sub-tile indices, for the other parameters.
+ */
+template<class Source, class Transform, class Callback>
+bool split_subtiles(Source &src, const Transform &transform, const std::filesystem::path &path_in, const SubtileSplitSettings &settings, const SubtilePlan &plan, size_t first, size_t last, Callback on_subtile) {
+	std::vector<size_t> order;
+	for (size_t i = first; i < last && i < plan.size(); i++)
+		order.push_back(i);
+	return split_subtiles(src, transform, path_in, settings, plan, order, on_subtile);
+}
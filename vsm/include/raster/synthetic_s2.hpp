@@ -0,0 +1,119 @@
+//! @file
+//! @brief Synthetic Sentinel-2 products for benchmarking
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+
+
+/**
+ * @brief Generator of a synthetic Sentinel-2 L2A product, with the layout and the raster formats of a real one.
+ *
+ * The product has the JP2 bands at 10, 20 and 60 m, tiled like the ESA products, the SCL and the cloud
+ * probabilities of Sen2Cor, the MAJA cloud masks as TIF files, and the S2Cloudless maps as PNG files.
+ * The content is a deterministic function of the seed: a pattern of clouds, which is consistent between
+ * all the bands and the masks, over a textured surface, with a no-data wedge at the left edge,
+ * like the granules at the edge of a swath. The same settings always produce the same files,
+ * so that benchmark runs can be compared with each other.
+ */
+class SyntheticS2Product {
+	public:
+		/**
+		 * @param size Width and height of the 10 m bands, in pixels (10980 for a full granule).
+		 * @param seed Seed of the content.
+		 */
+		SyntheticS2Product(unsigned int size = 10980, unsigned int seed = 1);
+
+		unsigned int size;	///< Width and height of the 10 m bands, in pixels.
+		unsigned int seed;	///< Seed of the content.
+		unsigned int tile_size;	///< Width and height of the JP2 tiles of the 10 m bands, in pixels. Tiles of the other bands cover the same area.
+		float nodata_fraction;	///< Fraction of the width of the granule which the no-data wedge reaches at the top edge.
+
+		/**
+		 * @return Name of the .SAFE directory.
+		 */
+		static std::string get_name();
+
+		/**
+		 * Write the product, replacing any files which it consists of.
+		 * @param[in] path_dir Reference to the directory to write the .SAFE directory into.
+		 * @return True on success.
+		 */
+		bool write(const std::filesystem::path &path_dir) const;
+
+		/**
+		 * @return True if the pixel at 10 m pixel coordinates \f$(x, y)\f$ is within the swath.
+		 */
+		bool is_valid(float x, float y) const;
+
+		/**
+		 * @return Cloudiness at 10 m pixel coordinates \f$(x, y)\f$, between 0 and 1. Clouds start at 0.6.
+		 */
+		float get_cloud(float x, float y) const;
+
+		/**
+		 * @param band Index of the spectral band, which sets its brightness.
+		 * @return 16-bit reflectance of a band at 10 m pixel coordinates \f$(x, y)\f$ (0 outside of the swath).
+		 */
+		uint16_t get_reflectance(unsigned int band, float x, float y) const;
+
+		/**
+		 * @return Sen2Cor scene class at 10 m pixel coordinates \f$(x, y)\f$.
+		 */
+		unsigned char get_scl(float x, float y) const;
+
+		/**
+		 * @return MAJA cloud mask flags (THEIA format) at 10 m pixel coordinates \f$(x, y)\f$.
+		 */
+		unsigned char get_clm(float x, float y) const;
+
+		/**
+		 * @param max_value Value for certain clouds (100 for Sen2Cor, 255 for S2Cloudless).
+		 * @return Cloud probability at 10 m pixel coordinates \f$(x, y)\f$.
+		 */
+		unsigned char get_cloud_probability(float x, float y, unsigned int max_value) const;
+
+		typedef std::function<uint32_t(float x, float y)> pixel_fn_t;	///< Value of a pixel at 10 m pixel coordinates.
+
+		/**
+		 * Write a single-component JP2 file, tile by tile.
+		 * @param[in] path Reference to the path of the file.
+		 * @param factor Size of the pixels relative to 10 m (1, 2 or 6).
+		 * @param precision Number of bits per pixel (8 or 16).
+		 * @param[in] fn Reference to the function of the pixel values.
+		 * @return True on success.
+		 */
+		bool write_jp2(const std::filesystem::path &path, unsigned int factor, unsigned int precision, const pixel_fn_t &fn) const;
+
+		/**
+		 * Write an 8-bit TIF file.
+		 * @see write_jp2() for the parameters.
+		 */
+		bool write_tif(const std::filesystem::path &path, unsigned int factor, const pixel_fn_t &fn) const;
+
+		/**
+		 * Write an 8-bit grayscale PNG file.
+		 * @see write_jp2() for the parameters.
+		 */
+		bool write_png(const std::filesystem::path &path, unsigned int factor, const pixel_fn_t &fn) const;
+
+	protected:
+		float phase[4];	///< Phases of the cloud pattern, from the seed.
+};
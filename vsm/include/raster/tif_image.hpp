@@ -18,6 +18,7 @@
 #pragma once
 
 #include "raster/raster_image.hpp"
+#include "raster/tif_window_reader.hpp"
 
 #include <filesystem>
 
@@ -67,12 +68,62 @@ class TIF_Image: public RasterImage {
 		 * @param da_x1 \f$x_1\f$ coordinate (right side) of the image to load.
 		 * @param da_y1 \f$y_1\f$ coordinate (bottom side) of the image to load.
 		 * @param channel Channel index within the image.
+		 * @note Works with both striped and tiled files, of any sample format supported by TIFWindowReader.
+		 * Floating point samples are stored as they are, integer samples are normalized by the maximum of the sample type.
 		 * @return True on success, False otherwise.
 		 */
 		bool load_subset_channel(const std::filesystem::path &path, unsigned int da_x0, unsigned int da_y0, unsigned int da_x1, unsigned int da_y1, unsigned int channel);
 
+		/**
+		 * Decode several channels of a subset of the TIF file in a single pass over its strips or tiles.
+		 * The channels are kept in planar buffers, to be selected into the subset with select_subset_channel().
+		 * @param[in] path Reference to the TIF file path.
+		 * @param da_x0 \f$x_0\f$ coordinate (left side) of the image to load.
+		 * @param da_y0 \f$y_0\f$ coordinate (top side) of the image to load.
+		 * @param da_x1 \f$x_1\f$ coordinate (right side) of the image to load.
+		 * @param da_y1 \f$y_1\f$ coordinate (bottom side) of the image to load.
+		 * @param[in] channels Reference to the channel indices within the image.
+		 * @param[in] scales Reference to the factor to multiply each channel with (empty for no scaling).
+		 * @return True on success, False otherwise.
+		 */
+		bool load_subset_channels(const std::filesystem::path &path, unsigned int da_x0, unsigned int da_y0, unsigned int da_x1, unsigned int da_y1,
+			const std::vector<unsigned int> &channels, const std::vector<float> &scales);
+
+		/**
+		 * @return True if the channels of exactly this subset have been decoded by load_subset_channels().
+		 */
+		bool has_subset_channels(const std::filesystem::path &path, unsigned int da_x0, unsigned int da_y0, unsigned int da_x1, unsigned int da_y1) const;
+
+		/**
+		 * Copy a decoded channel into the subset.
+		 * @param i Index into the channels passed to load_subset_channels().
+		 * @return True on success, False if there's no such channel.
+		 */
+		bool select_subset_channel(size_t i);
+
 	protected:
 		unsigned int num_tiff_channels; 	///< Number of channels in the TIFF file.
 
+		TIFWindowReader reader;	///< Window reader, which keeps the file open between subsets.
+		std::filesystem::path reader_path;	///< Path of the file which the reader was last asked to open.
+		bool reader_failed;	///< Whether the reader failed to open the file at reader_path.
+
+		std::vector<std::vector<float>> channel_planes;	///< Channels decoded by load_subset_channels().
+		std::filesystem::path channel_planes_path;	///< Path of the file which the channels were decoded from.
+		unsigned int channel_planes_window[4];	///< Subset which the channels were decoded from.
+
+		/**
+		 * Open the window reader for a file, unless it's already open.
+		 * @param[in] path Reference to the TIF file path.
+		 * @return True if the reader is open, false if the file can't be read with the window reader.
+		 */
+		bool open_reader(const std::filesystem::path &path);
+
+		/**
+		 * Load a subset by decoding the whole TIF file with Magick and cropping it.
+		 * Slow, but supports all the layouts which Magick supports.
+		 */
+		bool load_subset_magick(const std::filesystem::path &path, unsigned int da_x0, unsigned int da_y0, unsigned int da_x1, unsigned int da_y1);
+
 };
 
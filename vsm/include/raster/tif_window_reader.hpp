@@ -0,0 +1,159 @@
+//! @file
+//! @brief Windowed reading of TIFF files
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+typedef struct tiff TIFF;
+
+
+/**
+ * @brief Reader for rectangular windows of a TIFF file, which only decodes the strips or tiles covering the window.
+ *
+ * The file is kept open between windows, and the most recently decoded strips or tiles are cached,
+ * so that neighbouring windows which share a strip don't decode it twice.
+ * Supports 8, 16, 32 and 64-bit samples of unsigned, signed and floating point formats,
+ * in both contiguous and separate planar layouts.
+ *
+ * Integer samples are normalized into [0, 1] by the maximum value of the sample type,
+ * the same way as Magick would. Floating point samples are kept as they are.
+ * Negative values are clamped to 0.
+ */
+class TIFWindowReader {
+	public:
+		/**
+		 * @param cache_size Number of decoded strips or tiles to cache.
+		 */
+		TIFWindowReader(unsigned int cache_size = 8);
+		~TIFWindowReader();
+
+		TIFWindowReader(const TIFWindowReader &) = delete;
+		TIFWindowReader &operator=(const TIFWindowReader &) = delete;
+
+		/**
+		 * Open a TIFF file and read its layout.
+		 * @param[in] path Reference to the TIF file path.
+		 * @return True on success, false if the file could not be opened or its layout is not supported.
+		 */
+		bool open(const std::filesystem::path &path);
+
+		/**
+		 * Close the file and drop the cache.
+		 */
+		void close();
+
+		/**
+		 * Open a TIFF file with libtiff. Files within ZIP archives are read through ZipMemberReader.
+		 * @param[in] path Reference to the TIF file path, or the virtual path of a file within an archive.
+		 * @return Pointer to the open file, to be closed with TIFFClose(), or nullptr on failure.
+		 */
+		static TIFF *open_tiff(const std::filesystem::path &path);
+
+		/**
+		 * @return True if a file is open.
+		 */
+		bool is_open() const { return ptif != nullptr; }
+
+		/**
+		 * @return Size of a decoded strip or tile, in bytes (0 if no file is open).
+		 */
+		size_t get_block_size() const { return block_size; }
+
+		/**
+		 * @return Maximum number of decoded strips or tiles kept in the cache.
+		 */
+		unsigned int get_cache_size() const { return cache_size; }
+
+		/**
+		 * @return Path of the open file.
+		 */
+		const std::filesystem::path &get_path() const { return path; }
+
+		/**
+		 * Read a window of one or more channels into planar float buffers.
+		 * Each strip or tile is decoded once, and with contiguous samples, all the requested channels
+		 * are deinterleaved in a single pass over it. Pixels outside of the raster are set to 0.
+		 * @param x0 Left side of the window.
+		 * @param y0 Top side of the window.
+		 * @param x1 Right side of the window (exclusive).
+		 * @param y1 Bottom side of the window (exclusive).
+		 * @param[in] channels Pointer to the channel indices to read.
+		 * @param num_channels Number of channels to read.
+		 * @param[out] dst Pointer to an output buffer of \f$(x_1 - x_0) \times (y_1 - y_0)\f$ floats per channel.
+		 * @param[in] scales Optional pointer to a factor per channel, to multiply the (normalized) samples with.
+		 * @return True on success, false if any of the strips or tiles failed to decode.
+		 */
+		bool read_window(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, const unsigned int *channels, unsigned int num_channels, float *const *dst, const float *scales = nullptr);
+
+		unsigned int width;	///< Raster width, in pixels.
+		unsigned int height;	///< Raster height, in pixels.
+		unsigned int num_channels;	///< Number of samples per pixel.
+		unsigned int bits_per_sample;	///< Sample size, in bits.
+		unsigned int sample_format;	///< SAMPLEFORMAT_UINT, SAMPLEFORMAT_INT or SAMPLEFORMAT_IEEEFP.
+		unsigned int photometric;	///< Photometric interpretation.
+		bool planar_separate;	///< Whether channels are stored in separate planes.
+		bool tiled;	///< Whether the file is tiled, rather than striped.
+		unsigned int block_w;	///< Width of a tile, or raster width for strips.
+		unsigned int block_h;	///< Height of a tile, or rows per strip.
+
+	protected:
+		/**
+		 * @brief A decoded strip or tile.
+		 */
+		struct Block {
+			uint32_t index;	///< Strip or tile index.
+			unsigned long last_used;	///< Value of the use counter at the last access.
+			std::vector<unsigned char> data;	///< Decoded samples.
+		};
+
+		TIFF *ptif;	///< Open file.
+		std::filesystem::path path;	///< Path of the open file.
+		size_t block_size;	///< Size of a decoded strip or tile, in bytes.
+		unsigned int cache_size;	///< Maximum number of cached blocks.
+		std::vector<Block> cache;	///< Cached blocks.
+		unsigned long use_counter;	///< Counter for finding the least recently used block.
+
+		/**
+		 * Get a decoded strip or tile, from the cache or from the file.
+		 * @param index Strip or tile index.
+		 * @return Pointer to the decoded samples, or nullptr on failure.
+		 */
+		const unsigned char *get_block(uint32_t index);
+
+		/**
+		 * Copy channels from the intersection of a block and a window into planar float buffers.
+		 * @param[in] block Pointer to the decoded block.
+		 * @param bx0 Left side of the block in the raster.
+		 * @param by0 Top side of the block in the raster.
+		 * @param ix0 Left side of the intersection.
+		 * @param iy0 Top side of the intersection.
+		 * @param ix1 Right side of the intersection (exclusive).
+		 * @param iy1 Bottom side of the intersection (exclusive).
+		 * @param[in] channels Pointer to the channel indices within the block (0 for separate planes).
+		 * @param[in] scales Pointer to the factor per channel.
+		 * @param num_channels Number of channels to copy.
+		 * @param wx0 Left side of the window.
+		 * @param wy0 Top side of the window.
+		 * @param ww Width of the window.
+		 * @param[out] dst Pointer to the output buffers of the window, one per channel.
+		 */
+		void copy_block(const unsigned char *block, unsigned int bx0, unsigned int by0, unsigned int ix0, unsigned int iy0, unsigned int ix1, unsigned int iy1,
+			const unsigned int *channels, const float *scales, unsigned int num_channels, unsigned int wx0, unsigned int wy0, unsigned int ww, float *const *dst) const;
+};
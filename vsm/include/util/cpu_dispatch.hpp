@@ -0,0 +1,78 @@
+//! @file
+//! @brief Selection of the instruction set for the vectorized kernels
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <string>
+
+
+/**
+ * @brief Instruction set which the vectorized kernels use, selected at start-up.
+ *
+ * The kernels are compiled for each of the instruction sets with function attributes, so that the build
+ * doesn't need any `-march` flags, and the binary runs on any x86-64 host. At start-up, the best instruction
+ * set which both the CPU and the OS support is selected, as reported by `cpuid`. A lower one can be forced
+ * for testing and for comparing the kernels with each other.
+ */
+class CPUDispatch {
+	public:
+		/**
+		 * @brief Instruction set of the kernels, from the lowest to the highest.
+		 */
+		enum isa_t {
+			ISA_GENERIC = 0,	///< Plain C++, for any CPU.
+			ISA_AVX2,	///< AVX2.
+			ISA_AVX512,	///< AVX-512 Foundation.
+			ISA_COUNT
+		};
+
+		static const char *isa_name[ISA_COUNT];	///< Names of the instruction sets: "generic", "avx2", "avx512".
+
+		/**
+		 * @return True if the host can run the kernels of an instruction set.
+		 */
+		static bool is_supported(isa_t isa);
+
+		/**
+		 * @return The highest instruction set which the host supports.
+		 */
+		static isa_t get_best();
+
+		/**
+		 * @return Instruction set of the kernels in use.
+		 */
+		static isa_t get_isa() { return selected.load(std::memory_order_relaxed); }
+
+		/**
+		 * Force the kernels of an instruction set.
+		 * @param isa Instruction set to use.
+		 * @return True on success, false if the host doesn't support the instruction set.
+		 */
+		static bool set_isa(isa_t isa);
+
+		/**
+		 * Parse the name of an instruction set.
+		 * @param[in] name Reference to the name, one of isa_name.
+		 * @param[out] isa Reference to the instruction set to set.
+		 * @return True on success, false if the name is not recognized.
+		 */
+		static bool parse_isa(const std::string &name, isa_t &isa);
+
+	protected:
+		static std::atomic<isa_t> selected;	///< Instruction set of the kernels in use.
+};
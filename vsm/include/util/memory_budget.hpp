@@ -0,0 +1,87 @@
+//! @file
+//! @brief Memory budget for admitting concurrent work
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+
+/**
+ * @brief A counting semaphore over bytes of RAM.
+ *
+ * Workers reserve the estimated memory cost of their task before starting it, and wait while the
+ * reservation would exceed the budget. Reservations are admitted first in, first out, so that a large
+ * one is never starved by smaller ones which keep arriving after it, while those wait behind it.
+ * A reservation larger than the whole budget is admitted once nothing else is reserved,
+ * so that an oversized task can't block forever.
+ */
+class MemoryBudget {
+	public:
+		/**
+		 * @brief Reservation which is released when it goes out of scope.
+		 */
+		class Reservation {
+			public:
+				Reservation(MemoryBudget &budget, uintmax_t bytes): budget(budget), bytes(budget.acquire(bytes)) {}
+				~Reservation() { budget.release(bytes); }
+
+				Reservation(const Reservation &) = delete;
+				Reservation &operator=(const Reservation &) = delete;
+
+			private:
+				MemoryBudget &budget;	///< Budget to release the bytes to.
+				uintmax_t bytes;	///< Reserved number of bytes.
+		};
+
+		/**
+		 * @param[in] limit Budget in bytes (0 for unlimited).
+		 */
+		MemoryBudget(uintmax_t limit);
+
+		/**
+		 * Reserve memory, waiting until the earlier reservations have been admitted and it fits into the budget.
+		 * @param[in] bytes Number of bytes to reserve.
+		 * @return Number of bytes reserved, which is to be passed to release().
+		 */
+		uintmax_t acquire(uintmax_t bytes);
+
+		/**
+		 * Release a reservation.
+		 * @param[in] bytes Number of bytes, as returned by acquire().
+		 */
+		void release(uintmax_t bytes);
+
+		/**
+		 * @return Budget in bytes (0 for unlimited).
+		 */
+		uintmax_t get_limit() const { return limit; }
+
+		/**
+		 * @return Number of bytes currently reserved.
+		 */
+		uintmax_t get_in_use();
+
+	protected:
+		uintmax_t limit;	///< Budget in bytes (0 for unlimited).
+		uintmax_t in_use;	///< Number of bytes currently reserved.
+		uint64_t next_ticket;	///< Ticket of the next reservation to arrive.
+		uint64_t serving;	///< Ticket of the reservation to admit next.
+		std::mutex mutex;	///< Guards in_use.
+		std::condition_variable cv;	///< Signalled when memory is released.
+};
@@ -0,0 +1,114 @@
+//! @file
+//! @brief Periodic export of metrics in the Prometheus text format
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+
+/**
+ * @brief Background thread which periodically writes metrics into a file, for the textfile collector of node_exporter.
+ *
+ * The metrics are formatted by a callback, which reads the counters that the workers update,
+ * so that the workers never wait for the exporter. Each update is written into a temporary file
+ * which then replaces the metrics file, so that the collector never reads a partial file.
+ */
+class MetricsExporter {
+	public:
+		typedef std::function<void(std::ostream &os)> formatter_t;	///< Writes the current metrics into a stream.
+
+		MetricsExporter();
+
+		/**
+		 * Stop the background thread, writing the metrics one last time.
+		 */
+		~MetricsExporter();
+
+		MetricsExporter(const MetricsExporter &) = delete;
+		MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+		/**
+		 * Start writing the metrics periodically, starting right away.
+		 * @param[in] path Reference to the path of the metrics file, which should have the .prom extension.
+		 * @param interval Number of seconds between the updates.
+		 * @param[in] formatter Callback which writes the metrics, called from the background thread.
+		 * @return True on success, false if the exporter is already running.
+		 */
+		bool start(const std::filesystem::path &path, unsigned int interval, formatter_t formatter);
+
+		/**
+		 * Stop the background thread, writing the metrics one last time.
+		 */
+		void stop();
+
+		/**
+		 * Write the metrics into the file.
+		 * @return True on success.
+		 */
+		bool write();
+
+		/**
+		 * Write the HELP and TYPE lines of a metric.
+		 * @param[in] os Reference to the stream to write to.
+		 * @param[in] name Reference to the name of the metric.
+		 * @param[in] type Reference to the type of the metric: "counter" or "gauge".
+		 * @param[in] help Reference to the description of the metric.
+		 */
+		static void write_header(std::ostream &os, const std::string &name, const std::string &type, const std::string &help);
+
+		/**
+		 * Write a sample of a metric.
+		 * @param[in] os Reference to the stream to write to.
+		 * @param[in] name Reference to the name of the metric.
+		 * @param value Value of the sample.
+		 * @param[in] labels Reference to the labels, such as `stage="decode"` (empty for none).
+		 */
+		static void write_sample(std::ostream &os, const std::string &name, double value, const std::string &labels = "");
+
+		/**
+		 * Write the HELP, TYPE and the sample of a metric without labels.
+		 * @see write_header() and write_sample().
+		 */
+		static void write_metric(std::ostream &os, const std::string &name, const std::string &type, const std::string &help, double value);
+
+		/**
+		 * @return Peak resident set size of the process, in bytes.
+		 */
+		static uintmax_t get_max_rss();
+
+	protected:
+		std::filesystem::path path;	///< Path of the metrics file.
+		unsigned int interval;	///< Number of seconds between the updates.
+		formatter_t formatter;	///< Callback which writes the metrics.
+
+		std::thread thread;	///< Background thread.
+		bool stopping;	///< Set when the background thread is to stop.
+		std::mutex mutex;	///< Guards stopping.
+		std::condition_variable cv;	///< Signalled when the background thread is to stop.
+
+		/**
+		 * Write the metrics periodically, until stopped.
+		 */
+		void run();
+};
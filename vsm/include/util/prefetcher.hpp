@@ -0,0 +1,131 @@
+//! @file
+//! @brief Read-ahead of the files which are about to be read
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+
+/**
+ * @brief Background thread which asks the kernel to read files into the page cache before they're needed.
+ *
+ * Files are queued in the order in which they're expected to be read, and prefetched one after another
+ * with `posix_fadvise(POSIX_FADV_WILLNEED)`, as long as the prefetched files which haven't been read yet
+ * fit into the read-ahead window. Marking a file as consumed makes room for the next ones, so the window
+ * slides along the queue without evicting the files which are still waiting to be read. Files which are never
+ * read, such as those of an aborted product, have to be forgotten to make room.
+ */
+class Prefetcher {
+	public:
+		/**
+		 * @param[in] window Read-ahead window in bytes (0 to disable prefetching).
+		 */
+		Prefetcher(uintmax_t window = 0);
+
+		/**
+		 * Stop the background thread, dropping the files which haven't been prefetched yet.
+		 */
+		~Prefetcher();
+
+		Prefetcher(const Prefetcher &) = delete;
+		Prefetcher &operator=(const Prefetcher &) = delete;
+
+		/**
+		 * Set the size of the read-ahead window.
+		 * @param[in] bytes Window in bytes (0 to disable prefetching).
+		 */
+		void set_window(uintmax_t bytes);
+
+		/**
+		 * @return Read-ahead window in bytes (0 if prefetching is disabled).
+		 */
+		uintmax_t get_window() const { return window; }
+
+		/**
+		 * Queue a file for prefetching, after the files queued before it.
+		 * @param[in] path Reference to the file path, or the virtual path of a file within a ZIP archive.
+		 * @param[in] size Size of the file in bytes.
+		 */
+		void enqueue(const std::filesystem::path &path, uintmax_t size);
+
+		/**
+		 * Mark a file as being read, so that it no longer takes up the window.
+		 * A file which hasn't been prefetched yet is dropped from the queue.
+		 * Only the first call for a file counts as a hit or a miss, until the file is queued again.
+		 * @param[in] path Reference to the file path, as passed to enqueue().
+		 */
+		void consume(const std::filesystem::path &path);
+
+		/**
+		 * Drop files from the queue and from the window, whether they've been consumed or not,
+		 * for example once the product which they belong to has finished or aborted.
+		 * Files which are dropped before they're consumed count neither as hits nor as misses.
+		 * @param[in] paths Reference to the file paths, as passed to enqueue().
+		 */
+		void forget(const std::vector<std::filesystem::path> &paths);
+
+		/**
+		 * @return Number of files prefetched so far.
+		 */
+		unsigned long get_num_prefetched();
+
+		/**
+		 * @return Number of consumed files which had been prefetched.
+		 */
+		unsigned long get_num_hits();
+
+		/**
+		 * @return Number of consumed files which hadn't been prefetched yet.
+		 */
+		unsigned long get_num_misses();
+
+		/**
+		 * Ask the kernel to read a file into the page cache, without waiting for it.
+		 * Only the part of the archive which holds the file is read for files within ZIP archives.
+		 * @param[in] path Reference to the file path, or the virtual path of a file within a ZIP archive.
+		 * @return True on success.
+		 */
+		static bool advise(const std::filesystem::path &path);
+
+	protected:
+		uintmax_t window;	///< Read-ahead window in bytes (0 to disable prefetching).
+		std::deque<std::pair<std::filesystem::path, uintmax_t>> queue;	///< Files to prefetch, with their sizes.
+		std::map<std::filesystem::path, uintmax_t> in_window;	///< Prefetched files which haven't been consumed yet.
+		std::set<std::filesystem::path> consumed;	///< Files which have been consumed since they were queued.
+		uintmax_t in_window_bytes;	///< Total size of the files in in_window.
+		unsigned long num_prefetched;	///< Number of files prefetched so far.
+		unsigned long num_hits;	///< Number of consumed files which had been prefetched.
+		unsigned long num_misses;	///< Number of consumed files which hadn't been prefetched.
+
+		std::thread thread;	///< Background thread, started with the first queued file.
+		bool stopping;	///< Set when the background thread is to stop.
+		std::mutex mutex;	///< Guards the queue and the window.
+		std::condition_variable cv;	///< Signalled when files are queued or consumed.
+
+		/**
+		 * Prefetch the queued files as they fit into the window, until stopped.
+		 */
+		void run();
+};
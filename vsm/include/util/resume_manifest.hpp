@@ -0,0 +1,140 @@
+//! @file
+//! @brief Record of the sub-tile layers which have already been stored
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+
+/**
+ * @brief Manifest of the completed (sub-tile, layer, parameters) entries of an output directory.
+ *
+ * The manifest is read once when it's opened, so that reruns check for completed work in memory,
+ * instead of opening the NetCDF file of every sub-tile for every band. Each completed entry is appended
+ * as a single line with a single write, so that an interrupted run leaves at most a partial last line,
+ * which is ignored. On opening, the manifest is compacted into a temporary file, which replaces it atomically.
+ *
+ * Each entry also holds the size and the modification time of the output file of the sub-tile, as it was
+ * after the layer had been stored. The entries of a file which has since been changed or removed aren't
+ * trusted, so that the file is probed (and rewritten, if need be) instead.
+ */
+class ResumeManifest {
+	public:
+		ResumeManifest();
+
+		/**
+		 * Close the manifest.
+		 */
+		~ResumeManifest();
+
+		ResumeManifest(const ResumeManifest &) = delete;
+		ResumeManifest &operator=(const ResumeManifest &) = delete;
+
+		/**
+		 * Read the manifest of an output directory, creating it if it doesn't exist, and keep it open for appending.
+		 * @param[in] path_dir_out Reference to the path of the output directory.
+		 * @return True on success.
+		 */
+		bool open(const std::filesystem::path &path_dir_out);
+
+		/**
+		 * Close the manifest, dropping the entries.
+		 */
+		void close();
+
+		/**
+		 * @return True if the manifest is open.
+		 */
+		bool is_open() const { return fd >= 0; }
+
+		/**
+		 * @return True if the manifest file already existed when it was opened.
+		 */
+		bool existed() const { return file_existed; }
+
+		/**
+		 * @return Number of entries.
+		 */
+		size_t size() const;
+
+		/**
+		 * Check whether a layer of a sub-tile has been stored with the same parameters.
+		 * @param x Sub-tile index along the x axis.
+		 * @param y Sub-tile index along the y axis.
+		 * @param[in] layer Reference to the name of the layer.
+		 * @param params_hash Hash of the parameters which the layer depends on.
+		 * @return True if there's an entry with the same parameters.
+		 */
+		bool has(int x, int y, const std::string &layer, uint64_t params_hash) const;
+
+		/**
+		 * Check whether the output file of a sub-tile is the same as when the last layer of it was recorded.
+		 * @param x Sub-tile index along the x axis.
+		 * @param y Sub-tile index along the y axis.
+		 * @param[in] path_file Reference to the path of the output file of the sub-tile.
+		 * @return True if the file exists, and its size and modification time match the manifest.
+		 */
+		bool is_intact(int x, int y, const std::filesystem::path &path_file) const;
+
+		/**
+		 * Record a stored layer of a sub-tile, replacing any earlier entry of the same layer.
+		 * The output file has to be complete on the disk, so that it can be checked on resuming.
+		 * @param x Sub-tile index along the x axis.
+		 * @param y Sub-tile index along the y axis.
+		 * @param[in] layer Reference to the name of the layer.
+		 * @param params_hash Hash of the parameters which the layer depends on.
+		 * @param[in] path_file Reference to the path of the output file of the sub-tile.
+		 * @return True on success.
+		 */
+		bool add(int x, int y, const std::string &layer, uint64_t params_hash, const std::filesystem::path &path_file);
+
+		/**
+		 * 64-bit FNV-1a hash, which remains the same between builds and platforms.
+		 * @param[in] s Reference to the string to hash.
+		 * @return Hash of the string.
+		 */
+		static uint64_t hash(const std::string &s);
+
+		static const char *file_name;	///< Name of the manifest file within the output directory.
+
+	protected:
+		typedef std::pair<uintmax_t, int64_t> stamp_t;	///< Size and modification time of an output file.
+
+		std::filesystem::path path;	///< Path of the manifest file.
+		std::map<std::tuple<int, int, std::string>, uint64_t> entries;	///< Parameters hash per sub-tile and layer.
+		std::map<std::pair<int, int>, stamp_t> stamps;	///< Output file stamp per sub-tile, from its last entry.
+		int fd;	///< File descriptor for appending to the manifest.
+		bool file_existed;	///< Whether the manifest file existed when it was opened.
+		mutable std::mutex mutex;	///< Guards the entries and the appending.
+
+		/**
+		 * @param[in] path_file Reference to the path of a file.
+		 * @param[out] stamp Reference to the stamp to set.
+		 * @return True if the file exists.
+		 */
+		static bool get_stamp(const std::filesystem::path &path_file, stamp_t &stamp);
+
+		/**
+		 * @return Line of the manifest for an entry, with the trailing newline.
+		 */
+		static std::string format_entry(int x, int y, const std::string &layer, uint64_t params_hash, const stamp_t &stamp);
+};
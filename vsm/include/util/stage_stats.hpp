@@ -0,0 +1,246 @@
+//! @file
+//! @brief Timing and byte counters of the stages of splitting a raster into sub-tiles
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+
+/**
+ * @brief Time spent and bytes processed per stage, in total and per sub-tile.
+ *
+ * Each task collects its own statistics without locking, by making them current for its thread
+ * with a Scope. The StageTimer instances along the hot path add to the current statistics of the
+ * thread, if any, so that code which runs outside of a task isn't affected. The statistics of the
+ * tasks are merged once the tasks are done. Meanwhile, the totals of the whole process are kept up to date
+ * with relaxed atomic additions, for watching a run while it's going on.
+ */
+class StageStats {
+	public:
+		/**
+		 * @brief Stage of splitting a raster.
+		 */
+		enum stage_t {
+			ST_DECODE = 0,	///< Decoding of the source raster, whole or a window of it.
+			ST_REMAP,	///< Remapping of class values.
+			ST_RESAMPLE,	///< Resampling into the sub-tile size.
+			ST_PNG,	///< Encoding of PNG files.
+			ST_NC_OPEN,	///< Opening or creating of NetCDF files, including the staging copies.
+			ST_NC_DEFINE,	///< Definition of NetCDF dimensions, variables and attributes.
+			ST_NC_WRITE,	///< Conversion and writing of NetCDF variables.
+			ST_NC_CLOSE,	///< Closing of NetCDF files, including the publishing of the staging copies.
+			ST_DIRECTORIES,	///< Creation of the output directories.
+			ST_COUNT
+		};
+
+		static const char *stage_name[ST_COUNT];	///< Names of the stages, for the report.
+
+		/**
+		 * @brief Kind of memory which the splitting of sub-tiles allocates or reuses.
+		 */
+		enum alloc_t {
+			AL_BUFFER = 0,	///< Buffers of a WorkerArena.
+			AL_IMAGE,	///< Magick images of the subsets.
+			AL_COUNT
+		};
+
+		static const char *alloc_name[AL_COUNT];	///< Names of the kinds of memory, for the report.
+
+		/**
+		 * @brief Makes statistics current for the thread, restoring the previous ones when destroyed.
+		 */
+		class Scope {
+			public:
+				Scope(StageStats &stats): previous(current) { current = &stats; }
+				~Scope() { current = previous; }
+
+				Scope(const Scope &) = delete;
+				Scope &operator=(const Scope &) = delete;
+
+			protected:
+				StageStats *previous;	///< Statistics which were current before the scope.
+		};
+
+		StageStats();
+
+		/**
+		 * Add time and bytes to a stage.
+		 * @param stage Stage to add to.
+		 * @param elapsed_ns Time in nanoseconds.
+		 * @param num_bytes Number of bytes processed.
+		 */
+		void add(stage_t stage, uint64_t elapsed_ns, uint64_t num_bytes);
+
+		/**
+		 * Count an allocation, or the reuse of memory which was allocated earlier.
+		 * @param kind Kind of memory.
+		 * @param reused Whether earlier memory was reused, instead of allocating.
+		 * @param num_bytes Number of bytes allocated (0 for reuse).
+		 */
+		void add_allocation(alloc_t kind, bool reused, uint64_t num_bytes);
+
+		/**
+		 * Count an allocation or reuse in the statistics which are current for the thread, if any.
+		 * @see add_allocation() for the parameters.
+		 */
+		static void count_allocation(alloc_t kind, bool reused, uint64_t num_bytes) {
+			if (current != nullptr)
+				current->add_allocation(kind, reused, num_bytes);
+		}
+
+		/**
+		 * Start collecting the times of a sub-tile, dropping the times collected since the last sub-tile.
+		 */
+		void begin_subtile();
+
+		/**
+		 * Record the times of the stages of the current sub-tile, for the percentiles.
+		 */
+		void end_subtile();
+
+		/**
+		 * Add the statistics of another task.
+		 * @param[in] other Reference to the statistics to add.
+		 */
+		void merge(const StageStats &other);
+
+		/**
+		 * @return Total time of a stage, in nanoseconds.
+		 */
+		uint64_t get_ns(stage_t stage) const { return ns[stage]; }
+
+		/**
+		 * @return Total number of bytes processed by a stage.
+		 */
+		uint64_t get_bytes(stage_t stage) const { return bytes[stage]; }
+
+		/**
+		 * @return Number of times the stage has run.
+		 */
+		uint64_t get_count(stage_t stage) const { return count[stage]; }
+
+		/**
+		 * @return Number of allocations of a kind of memory.
+		 */
+		uint64_t get_allocations(alloc_t kind) const { return allocs[kind]; }
+
+		/**
+		 * @return Number of times that memory of a kind was reused instead of allocated.
+		 */
+		uint64_t get_reuses(alloc_t kind) const { return reuses[kind]; }
+
+		/**
+		 * @return Number of sub-tiles recorded with end_subtile().
+		 */
+		unsigned long get_num_subtiles() const { return subtile_totals.size(); }
+
+		/**
+		 * @return Summary with the totals, throughput and per sub-tile percentiles of each stage which has run.
+		 */
+		nlohmann::json to_json() const;
+
+		/**
+		 * Find a percentile of a sample, by the nearest rank.
+		 * @param[in] samples Sample values, in any order.
+		 * @param p Percentile, between 0 and 100.
+		 * @return Value of the percentile (0 for an empty sample).
+		 */
+		static uint32_t percentile(std::vector<uint32_t> samples, double p);
+
+		/**
+		 * @return Pointer to the statistics which are current for the thread, or nullptr.
+		 */
+		static StageStats *get_current() { return current; }
+
+		/**
+		 * @return Total time of a stage in all the tasks of the process so far, in nanoseconds.
+		 */
+		static uint64_t get_live_ns(stage_t stage) { return live_ns[stage].load(std::memory_order_relaxed); }
+
+		/**
+		 * @return Total number of bytes processed by a stage in all the tasks of the process so far.
+		 */
+		static uint64_t get_live_bytes(stage_t stage) { return live_bytes[stage].load(std::memory_order_relaxed); }
+
+		/**
+		 * @return Number of sub-tiles recorded by all the tasks of the process so far.
+		 */
+		static uint64_t get_live_subtiles() { return live_subtiles.load(std::memory_order_relaxed); }
+
+	protected:
+		uint64_t ns[ST_COUNT];	///< Total time per stage, in nanoseconds.
+		uint64_t bytes[ST_COUNT];	///< Total bytes per stage.
+		uint64_t count[ST_COUNT];	///< Number of runs per stage.
+		uint64_t subtile_ns[ST_COUNT];	///< Time per stage within the current sub-tile.
+		std::vector<uint32_t> subtile_us[ST_COUNT];	///< Time per sub-tile in microseconds, for the sub-tiles which ran the stage.
+		std::vector<uint32_t> subtile_totals;	///< Time of all the stages per sub-tile, in microseconds.
+		uint64_t allocs[AL_COUNT];	///< Number of allocations per kind of memory.
+		uint64_t alloc_bytes[AL_COUNT];	///< Bytes allocated per kind of memory.
+		uint64_t reuses[AL_COUNT];	///< Number of reuses per kind of memory.
+
+		static thread_local StageStats *current;	///< Statistics of the task which the thread is running.
+		static std::atomic<uint64_t> live_ns[ST_COUNT];	///< Total time per stage in the whole process, in nanoseconds.
+		static std::atomic<uint64_t> live_bytes[ST_COUNT];	///< Total bytes per stage in the whole process.
+		static std::atomic<uint64_t> live_subtiles;	///< Number of sub-tiles recorded in the whole process.
+};
+
+
+/**
+ * @brief Adds the time from its construction to its destruction to a stage of the current statistics of the thread.
+ */
+class StageTimer {
+	public:
+		/**
+		 * @param stage Stage to add to.
+		 * @param bytes Number of bytes which the stage processes, if known up front.
+		 */
+		StageTimer(StageStats::stage_t stage, uint64_t bytes = 0): stats(StageStats::get_current()), stage(stage), bytes(bytes) {
+			if (stats != nullptr)
+				start = std::chrono::steady_clock::now();
+		}
+
+		~StageTimer() {
+			stop();
+		}
+
+		StageTimer(const StageTimer &) = delete;
+		StageTimer &operator=(const StageTimer &) = delete;
+
+		/**
+		 * Add to the number of bytes which the stage processes.
+		 */
+		void add_bytes(uint64_t n) { bytes += n; }
+
+		/**
+		 * Add the time so far to the stage, ahead of the end of the scope, and stop the timer.
+		 */
+		void stop() {
+			if (stats != nullptr)
+				stats->add(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), bytes);
+			stats = nullptr;
+		}
+
+	protected:
+		StageStats *stats;	///< Statistics to add to, or nullptr.
+		StageStats::stage_t stage;	///< Stage to add to.
+		uint64_t bytes;	///< Number of bytes processed.
+		std::chrono::steady_clock::time_point start;	///< Time of construction.
+};
@@ -0,0 +1,105 @@
+//! @file
+//! @brief Output file written to a staging copy and published with an atomic rename
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <filesystem>
+
+
+/**
+ * @brief Output file which is modified through a staging copy, so that it's never left half-written.
+ *
+ * The current content of the target, if any, is copied to the staging file, which is then written
+ * instead of the target. Publishing renames the staging file over the target, so that an interrupted
+ * process leaves either the previous or the new version of the target, never a mix of them.
+ * The staging file can be on another file system, such as a tmpfs. In that case it's first copied
+ * next to the target with a single sequential write, and then renamed over the target.
+ *
+ * The staging path depends only on the target path, so that a leftover from an interrupted run
+ * is replaced by the next run instead of piling up.
+ */
+class StagedFile {
+	public:
+		/**
+		 * @param[in] path Reference to the path of the target file.
+		 * @param[in] dir_staging Reference to the staging directory (empty to stage next to the target).
+		 */
+		StagedFile(const std::filesystem::path &path, const std::filesystem::path &dir_staging = std::filesystem::path());
+
+		/**
+		 * Remove the staging file, unless it has been published.
+		 */
+		~StagedFile();
+
+		StagedFile(const StagedFile &) = delete;
+		StagedFile &operator=(const StagedFile &) = delete;
+
+		/**
+		 * Prepare the staging file, copying the target to it if the target exists.
+		 * @return True on success.
+		 */
+		bool begin();
+
+		/**
+		 * @return True if the target existed when the staging file was prepared.
+		 */
+		bool target_existed() const { return existed; }
+
+		/**
+		 * @return Reference to the path to write to.
+		 */
+		const std::filesystem::path &get_path() const { return path_staged; }
+
+		/**
+		 * @return Reference to the path of the target file.
+		 */
+		const std::filesystem::path &get_target() const { return path_target; }
+
+		/**
+		 * Replace the target with the staging file.
+		 * @return True on success.
+		 */
+		bool publish();
+
+		/**
+		 * Remove the staging file, leaving the target as it was.
+		 */
+		void discard();
+
+		/**
+		 * Copy a file, sharing the extents of the source if the file system supports it.
+		 * @param[in] from Reference to the path of the source file.
+		 * @param[in] to Reference to the path of the destination, which is replaced if it exists.
+		 * @return True on success.
+		 */
+		static bool copy(const std::filesystem::path &from, const std::filesystem::path &to);
+
+		/**
+		 * Flush a file to the disk.
+		 * @param[in] path Reference to the path of the file.
+		 * @return True on success.
+		 */
+		static bool sync(const std::filesystem::path &path);
+
+		static const char *suffix;	///< Suffix of the staging and publishing files.
+
+	protected:
+		std::filesystem::path path_target;	///< Path of the target file.
+		std::filesystem::path path_staged;	///< Path of the staging file.
+		bool existed;	///< Whether the target existed when the staging file was prepared.
+		bool published;	///< Whether the staging file has replaced the target.
+};
@@ -0,0 +1,142 @@
+//! @file
+//! @brief Compact grid of sub-tile flags, and the order of traversing it
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "util/geometry.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief Grid of sub-tiles, with a single bit per sub-tile telling whether it's to be processed.
+ *
+ * The selected sub-tiles can be listed in several orders. The space-filling curves (Morton and Hilbert)
+ * keep consecutive sub-tiles close to each other, so that the caches of the readers and of the OS are
+ * reused between them, and so that each range of sub-tiles split by a single task covers a compact area.
+ */
+class SubtileGrid {
+	public:
+		/**
+		 * @brief Order of listing the sub-tiles.
+		 */
+		enum order_t {
+			SO_COLUMN_MAJOR = 0,	///< Column by column, from the top of each column.
+			SO_ROW_MAJOR,	///< Row by row, from the left of each row.
+			SO_MORTON,	///< Along the Z-order curve.
+			SO_HILBERT	///< Along the Hilbert curve.
+		};
+
+		/**
+		 * Initialize an empty grid.
+		 */
+		SubtileGrid();
+
+		/**
+		 * Initialize a grid with all the sub-tiles set to the same value.
+		 * @param width Number of sub-tiles along the x axis.
+		 * @param height Number of sub-tiles along the y axis.
+		 * @param value Whether the sub-tiles are selected.
+		 */
+		SubtileGrid(unsigned int width, unsigned int height, bool value);
+
+		/**
+		 * Initialize a grid from a mask, as produced by fill_poly_overlap() and fill_whole().
+		 * @param[in] mask Reference to the mask, indexed as mask[x][y], where 1 marks a selected sub-tile.
+		 */
+		SubtileGrid(const std::vector<std::vector<unsigned char>> &mask);
+
+		/**
+		 * @return Number of sub-tiles along the x axis.
+		 */
+		unsigned int get_width() const { return width; }
+
+		/**
+		 * @return Number of sub-tiles along the y axis.
+		 */
+		unsigned int get_height() const { return height; }
+
+		/**
+		 * @return True if the grid has no sub-tiles at all.
+		 */
+		bool empty() const { return width == 0 || height == 0; }
+
+		/**
+		 * @return True if the sub-tile is selected, false if it's not or if it's outside of the grid.
+		 */
+		bool get(int x, int y) const;
+
+		/**
+		 * Select or deselect a sub-tile. Sub-tiles outside of the grid are ignored.
+		 */
+		void set(int x, int y, bool value);
+
+		/**
+		 * @return Number of selected sub-tiles.
+		 */
+		size_t count() const;
+
+		/**
+		 * Drop all the sub-tiles, leaving an empty grid.
+		 */
+		void clear();
+
+		/**
+		 * Deselect the sub-tiles which are not selected in another grid, or are outside of it.
+		 * @param[in] other Reference to the grid to intersect with.
+		 */
+		void intersect(const SubtileGrid &other);
+
+		/**
+		 * List the selected sub-tiles.
+		 * The grid is split into square blocks of sub-tiles, which are traversed in the requested order,
+		 * and the sub-tiles within a block are listed column by column for SO_COLUMN_MAJOR, and row by row
+		 * otherwise. This way, the sub-tiles which fall into the same tile of the source raster are listed
+		 * one after another.
+		 * @param order Order of traversing the blocks.
+		 * @param block_size Number of sub-tiles along the side of a block (1 for no blocks).
+		 * @return List of sub-tile coordinates.
+		 */
+		std::vector<Vector<int>> get_subtiles(order_t order = SO_COLUMN_MAJOR, unsigned int block_size = 1) const;
+
+		/**
+		 * Parse the name of an order.
+		 * @param[in] name Reference to the name: "column", "row", "morton" or "hilbert".
+		 * @param[out] order Reference to the order to set.
+		 * @return True on success, false if the name is not recognized.
+		 */
+		static bool parse_order(const std::string &name, order_t &order);
+
+		/**
+		 * @return Position of the cell at \f$(x, y)\f$ along the Z-order curve.
+		 */
+		static uint64_t morton_index(uint32_t x, uint32_t y);
+
+		/**
+		 * @param n Side of the square covered by the curve, a power of 2.
+		 * @param x Column of the cell, less than n.
+		 * @param y Row of the cell, less than n.
+		 * @return Position of the cell along the Hilbert curve.
+		 */
+		static uint64_t hilbert_index(uint32_t n, uint32_t x, uint32_t y);
+
+	protected:
+		unsigned int width;	///< Number of sub-tiles along the x axis.
+		unsigned int height;	///< Number of sub-tiles along the y axis.
+		std::vector<uint64_t> bits;	///< Selection flags, row by row.
+};
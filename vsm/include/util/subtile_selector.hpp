@@ -0,0 +1,109 @@
+//! @file
+//! @brief Selection of sub-tiles by the content of their mask bands
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/**
+ * @brief Expression for selecting sub-tiles by the fractions of pixel values in 8-bit bands.
+ *
+ * An expression is a comma-separated list of terms, all of which a sub-tile has to satisfy.
+ * Each term compares the fraction of the pixels of a band, the values of which are in a set, with a threshold:
+ * `BAND[VALUES] OP FRACTION`, where VALUES is a `+`-separated list of values or inclusive ranges `FROM-TO` (with FROM <= TO),
+ * OP is one of `<`, `<=`, `>`, `>=`, and FRACTION is between 0 and 1.
+ *
+ * For example, `SCL[8+9+10]>=0.05,SCL[8+9+10]<=0.95` selects sub-tiles with 5 to 95% of cloud according to SCL,
+ * and `S2CC[50-100]>0.1` selects sub-tiles with more than 10% of pixels with a cloud probability of at least 50.
+ */
+class SubtileSelector {
+	public:
+		/**
+		 * @brief Comparison operator of a term.
+		 */
+		enum op_t {
+			OP_LT = 0,	///< Less than.
+			OP_LE,	///< Less than or equal to.
+			OP_GT,	///< Greater than.
+			OP_GE	///< Greater than or equal to.
+		};
+
+		/**
+		 * @brief A single comparison of a fraction of pixel values.
+		 */
+		class Term {
+			public:
+				std::string band;	///< Name of the band.
+				std::vector<std::pair<unsigned int, unsigned int>> ranges;	///< Inclusive ranges of the values to count.
+				op_t op;	///< Comparison operator.
+				float threshold;	///< Fraction to compare with.
+
+				/**
+				 * @return True if the value is in any of the ranges.
+				 */
+				bool has_value(unsigned int value) const;
+		};
+
+		typedef std::array<unsigned long, 256> histogram_t;	///< Number of pixels per 8-bit value.
+
+		/**
+		 * Parse an expression, replacing the current one.
+		 * @param[in] expr Reference to the expression (empty to select all the sub-tiles).
+		 * @return True on success, false if the expression is invalid.
+		 */
+		bool parse(const std::string &expr);
+
+		/**
+		 * @return True if there are no terms, so that all the sub-tiles are selected.
+		 */
+		bool empty() const { return terms.empty(); }
+
+		/**
+		 * @return Reference to the terms.
+		 */
+		const std::vector<Term> &get_terms() const { return terms; }
+
+		/**
+		 * @return Names of the bands which the terms refer to.
+		 */
+		std::set<std::string> get_bands() const;
+
+		/**
+		 * Evaluate the expression for a sub-tile.
+		 * @param[in] histograms Reference to the histograms of the sub-tile, per band name.
+		 * @return True if the sub-tile satisfies all the terms. Terms with a band which has no histogram, or an empty one
+		 * (no valid pixels in the sub-tile), are not satisfied.
+		 */
+		bool evaluate(const std::map<std::string, histogram_t> &histograms) const;
+
+		/**
+		 * Compute the fraction of the pixels with the values of a term.
+		 * @param[in] term Reference to the term.
+		 * @param[in] histogram Reference to the histogram of the band.
+		 * @return Fraction between 0 and 1 (0 for an empty histogram).
+		 */
+		static float get_fraction(const Term &term, const histogram_t &histogram);
+
+	protected:
+		std::vector<Term> terms;	///< Terms, all of which have to be satisfied.
+};
@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <filesystem>
 #include <vector>
@@ -60,6 +61,13 @@ std::string toupper(std::string const &text);
  */
 std::vector<std::string> split_str(std::string const &text, char delim);
 
+/**
+ * @brief Parse a size in bytes, with an optional binary suffix.
+ * @param[in] text Reference to the input text, for example `512M`, `4G` or `1048576`. Suffixes K, M, G and T are case-insensitive.
+ * @return Size in bytes, or 0 if the text is empty, invalid or too large.
+ */
+uintmax_t parse_size(std::string const &text);
+
 /**
  * @brief Get index and first date for .nc names from an ESA Sentinel-2 product file path.
  * @param[in] path Reference to the path to the Sentinel-2 product file, for example: `/home/user/Documents/work/S2A_MSIL1C_20170815T102021_N0205_R065_T32TMR_20200905T100047.SAFE/GRANULE/L1C_T32TMR_A011216_20170815T102513/IMG_DATA/T32TMR_20170815T102021_B03.jp2`.
@@ -0,0 +1,130 @@
+//! @file
+//! @brief Work-stealing thread pool
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * @brief A fixed-size thread pool with a task queue per worker.
+ *
+ * Tasks submitted from a worker thread are pushed to the queue of that worker and popped in LIFO order,
+ * so that the sub-tasks of a task are processed while its data is still hot.
+ * Idle workers steal the oldest tasks from the queues of other workers.
+ * Tasks submitted from outside of the pool are distributed over the worker queues in a round-robin manner.
+ */
+class WorkStealingPool {
+	public:
+		typedef std::function<void()> task_t;	///< Task to be executed by one of the workers.
+
+		/**
+		 * @param[in] num_workers Number of worker threads (0 for the number of available hardware threads).
+		 */
+		WorkStealingPool(unsigned int num_workers);
+		~WorkStealingPool();
+
+		WorkStealingPool(const WorkStealingPool &) = delete;
+		WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+		/**
+		 * Queue a task for execution.
+		 * Exceptions thrown by the task are caught and reported on std::cerr.
+		 * @param[in] task Task to execute.
+		 */
+		void submit(task_t task);
+
+		/**
+		 * Block until all of the submitted tasks, including the tasks submitted by tasks, have finished.
+		 */
+		void wait();
+
+		/**
+		 * @return Number of worker threads.
+		 */
+		unsigned int size() const;
+
+		/**
+		 * @return Number of tasks which have been aborted by an exception.
+		 */
+		unsigned int num_failed() const;
+
+		/**
+		 * @return Number of queued tasks which no worker has started yet.
+		 */
+		unsigned int get_num_queued();
+
+		/**
+		 * @return Number of submitted tasks which haven't finished yet, including the running ones.
+		 */
+		unsigned int get_num_pending();
+
+		/**
+		 * Resolve the number of workers from a command-line style value.
+		 * @param[in] num_workers Requested number of workers (0 or negative for the number of available hardware threads).
+		 * @return Number of workers, at least 1.
+		 */
+		static unsigned int resolve_num_workers(int num_workers);
+
+		/**
+		 * @return Index of the worker which runs the current thread, or -1 if called from outside of a pool.
+		 */
+		static int current_worker();
+
+	protected:
+		/**
+		 * @brief Task queue of a single worker.
+		 */
+		struct WorkerQueue {
+			std::deque<task_t> tasks;	///< Queued tasks. The owner works at the back, thieves at the front.
+			std::mutex mutex;	///< Guards the task queue.
+		};
+
+		std::vector<std::unique_ptr<WorkerQueue>> queues;	///< Task queue per worker.
+		std::vector<std::thread> threads;	///< Worker threads.
+
+		std::mutex state_mutex;	///< Guards the counters below.
+		std::condition_variable cv_work;	///< Signalled when a task is queued or the pool is stopped.
+		std::condition_variable cv_done;	///< Signalled when all of the tasks have finished.
+		unsigned int num_queued;	///< Number of queued tasks which have not been claimed by a worker.
+		unsigned int num_pending;	///< Number of tasks which have been submitted, but not finished.
+		bool stopping;	///< Whether the workers have been asked to exit.
+
+		std::atomic<unsigned int> next_queue;	///< Round-robin queue index for tasks submitted from outside of the pool.
+		std::atomic<unsigned int> failed;	///< Number of tasks which have thrown an exception.
+
+		/**
+		 * Main loop of a worker thread.
+		 * @param[in] id Index of the worker.
+		 */
+		void run(unsigned int id);
+
+		/**
+		 * Take a task from the back of own queue, or steal one from the front of another queue.
+		 * @param[in] id Index of the worker.
+		 * @param[out] task Reference to the task to fill.
+		 * @return True if a task was found, otherwise false.
+		 */
+		bool take(unsigned int id, task_t &task);
+};
@@ -0,0 +1,120 @@
+//! @file
+//! @brief Buffers which each worker thread reuses from sub-tile to sub-tile
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+
+/**
+ * @brief Scratch buffers of a thread, one per purpose, which only grow.
+ *
+ * Each thread has an arena of its own, so that the buffers are used without locking. A buffer is reallocated
+ * only when a larger one is asked for, so that once the buffers have grown to the size of the largest window,
+ * tile and sub-tile, the split loop no longer allocates them. The allocations and reuses are counted in the
+ * current StageStats of the thread, for the report.
+ *
+ * A buffer stays valid until the next request for the same slot on the same thread, and its content is
+ * not preserved when it grows. The buffers which outgrow max_kept_bytes are freed by trim(), which the
+ * workers call once they've finished a band.
+ */
+class WorkerArena {
+	public:
+		/**
+		 * @brief Purpose of a buffer.
+		 */
+		enum slot_t {
+			SLOT_PLANES = 0,	///< Samples of a decoded window, before they're converted into pixels.
+			SLOT_JP2_TILE,	///< Data of a decoded JP2 tile.
+			SLOT_NC_LAYERS,	///< Content of the NetCDF layers of a sub-tile, after conversion.
+			SLOT_FUSED,	///< Output of the fused transforms of the mask sub-tiles.
+			SLOT_COUNT
+		};
+
+		WorkerArena() = default;
+		WorkerArena(const WorkerArena &) = delete;
+		WorkerArena &operator=(const WorkerArena &) = delete;
+
+		/**
+		 * @return Reference to the arena of the calling thread.
+		 */
+		static WorkerArena &get_current();
+
+		/**
+		 * Get a buffer of at least a number of bytes, growing it if needed.
+		 * @param slot Purpose of the buffer.
+		 * @param num_bytes Number of bytes needed.
+		 * @return Pointer to the buffer, aligned for any fundamental type.
+		 */
+		void *get_bytes(slot_t slot, size_t num_bytes);
+
+		/**
+		 * Get a buffer of at least a number of elements.
+		 * @tparam T Type of the elements.
+		 * @param slot Purpose of the buffer.
+		 * @param n Number of elements needed.
+		 * @return Pointer to the buffer.
+		 */
+		template<typename T>
+		T *get(slot_t slot, size_t n) {
+			return static_cast<T *>(get_bytes(slot, n * sizeof(T)));
+		}
+
+		/**
+		 * Grow a buffer ahead of time, for example to the size of a sub-tile before splitting a raster.
+		 * @param slot Purpose of the buffer.
+		 * @param num_bytes Number of bytes to have room for.
+		 */
+		void reserve(slot_t slot, size_t num_bytes);
+
+		/**
+		 * @return Size of a buffer, in bytes.
+		 */
+		size_t get_capacity(slot_t slot) const { return buffers[slot].capacity; }
+
+		/**
+		 * Free all the buffers of the arena.
+		 */
+		void release();
+
+		/**
+		 * Free the buffers which have grown beyond a size, such as the tile buffer of an untiled JP2 file,
+		 * so that a thread doesn't keep them for the rest of its life.
+		 * @param max_bytes Largest buffer to keep, in bytes.
+		 */
+		void trim(size_t max_bytes = max_kept_bytes);
+
+		static const size_t max_kept_bytes;	///< Largest buffer which trim() keeps by default.
+
+	protected:
+		/**
+		 * @brief Buffer of a slot.
+		 */
+		struct Buffer {
+			std::unique_ptr<max_align_t[]> data;	///< Content of the buffer.
+			size_t capacity = 0;	///< Size of the buffer, in bytes.
+		};
+
+		Buffer buffers[SLOT_COUNT];	///< Buffer per slot.
+
+		/**
+		 * Reallocate a buffer, if it's smaller than needed.
+		 * @return True if the buffer was reallocated.
+		 */
+		bool grow(slot_t slot, size_t num_bytes);
+};
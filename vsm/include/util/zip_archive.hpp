@@ -0,0 +1,194 @@
+//! @file
+//! @brief Reading of files within ZIP archives
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct z_stream_s;
+
+
+/**
+ * @brief Central directory of a ZIP archive.
+ *
+ * Files within an archive are addressed with GDAL-style virtual paths, `/vsizip/ARCHIVE.zip/MEMBER`,
+ * so that the same path works with GDAL, too. Supports stored and deflated members, and ZIP64.
+ */
+class ZipArchive {
+	public:
+		/**
+		 * @brief A file or directory within the archive.
+		 */
+		class Entry {
+			public:
+				std::string name;	///< Path within the archive, with a trailing slash for directories.
+				uint64_t header_offset;	///< Offset of the local file header.
+				uint64_t compressed_size;	///< Size of the stored data, in bytes.
+				uint64_t size;	///< Size of the file, in bytes.
+				uint16_t method;	///< Compression method (0 for stored, 8 for deflated).
+				uint16_t flags;	///< General purpose flags.
+
+				/**
+				 * @return True if the entry is a directory.
+				 */
+				bool is_directory() const { return !name.empty() && name.back() == '/'; }
+		};
+
+		/**
+		 * Read the central directory of an archive.
+		 * @param[in] path Reference to the archive path.
+		 * @return True on success, false if the file could not be read or is not a ZIP archive.
+		 */
+		bool open(const std::filesystem::path &path);
+
+		/**
+		 * @return Path of the archive.
+		 */
+		const std::filesystem::path &get_path() const { return path; }
+
+		/**
+		 * @return Reference to the entries, in the order of the central directory.
+		 */
+		const std::vector<Entry> &get_entries() const { return entries; }
+
+		/**
+		 * @param[in] name Reference to the path within the archive.
+		 * @return Pointer to the entry, or nullptr if there's no such entry.
+		 */
+		const Entry *find(const std::string &name) const;
+
+		/**
+		 * Get the central directory of an archive, reading it only on the first call for the archive.
+		 * @param[in] path Reference to the archive path.
+		 * @return Shared pointer to the archive, or nullptr on failure.
+		 */
+		static std::shared_ptr<const ZipArchive> get(const std::filesystem::path &path);
+
+		/**
+		 * @param[in] path Reference to a path.
+		 * @return True if the path is a regular file with the `.zip` extension.
+		 */
+		static bool is_zip_file(const std::filesystem::path &path);
+
+		/**
+		 * @param[in] path Reference to a path.
+		 * @return True if the path is a virtual path of a file within an archive.
+		 */
+		static bool is_member_path(const std::filesystem::path &path);
+
+		/**
+		 * Build the virtual path of a file within an archive.
+		 * @param[in] path_zip Reference to the archive path.
+		 * @param[in] name Reference to the path within the archive.
+		 * @return Virtual path.
+		 */
+		static std::filesystem::path make_member_path(const std::filesystem::path &path_zip, const std::string &name);
+
+		/**
+		 * Split the virtual path of a file within an archive.
+		 * @param[in] path Reference to the virtual path.
+		 * @param[out] path_zip Reference to the archive path.
+		 * @param[out] name Reference to the path within the archive.
+		 * @return True if the path is a virtual path.
+		 */
+		static bool split_member_path(const std::filesystem::path &path, std::filesystem::path &path_zip, std::string &name);
+
+		/**
+		 * Read a whole file from an archive into RAM.
+		 * @param[in] path Reference to the virtual path.
+		 * @param[out] data Reference to the buffer to fill.
+		 * @return True on success.
+		 */
+		static bool read_member(const std::filesystem::path &path, std::vector<unsigned char> &data);
+
+	protected:
+		std::filesystem::path path;	///< Path of the archive.
+		std::vector<Entry> entries;	///< Entries of the central directory.
+};
+
+
+/**
+ * @brief Reader of a single file within a ZIP archive, with the interface of a seekable file.
+ *
+ * Stored files are read directly from the archive. Deflated files are inflated on the fly,
+ * and seeking backwards inflates them again from the beginning.
+ */
+class ZipMemberReader {
+	public:
+		ZipMemberReader();
+		~ZipMemberReader();
+
+		ZipMemberReader(const ZipMemberReader &) = delete;
+		ZipMemberReader &operator=(const ZipMemberReader &) = delete;
+
+		/**
+		 * Open a file within an archive.
+		 * @param[in] path Reference to the virtual path of the file.
+		 * @return True on success.
+		 */
+		bool open(const std::filesystem::path &path);
+
+		/**
+		 * Close the file.
+		 */
+		void close();
+
+		/**
+		 * Read from the current position.
+		 * @param[out] dst Pointer to the buffer to fill.
+		 * @param n Number of bytes to read.
+		 * @return Number of bytes read, less than n at the end of the file or on failure.
+		 */
+		size_t read(void *dst, size_t n);
+
+		/**
+		 * Move to a position within the file.
+		 * @param offset Position from the beginning of the file.
+		 * @return True on success.
+		 */
+		bool seek(uint64_t offset);
+
+		/**
+		 * @return Current position within the file.
+		 */
+		uint64_t tell() const { return position; }
+
+		/**
+		 * @return Size of the file, in bytes.
+		 */
+		uint64_t size() const { return entry.size; }
+
+	protected:
+		FILE *fp;	///< Open archive.
+		ZipArchive::Entry entry;	///< Entry of the file.
+		uint64_t data_offset;	///< Offset of the stored data within the archive.
+		uint64_t position;	///< Current position within the file.
+		z_stream_s *zs;	///< Inflate state of a deflated file.
+		uint64_t compressed_read;	///< Number of stored bytes passed to inflate.
+		std::vector<unsigned char> in_buf;	///< Buffer of stored bytes for inflate.
+
+		/**
+		 * Start inflating from the beginning of the file.
+		 * @return True on success.
+		 */
+		bool restart();
+};
@@ -20,7 +20,7 @@
 //! @brief Library / tool name.
 #define CM_CONVERTER_NAME_STR		"cm-vsm"
 //! @brief Library version.
-#define CM_CONVERTER_VERSION_STR	"0.3.7"
+#define CM_CONVERTER_VERSION_STR	"0.3.32"
 
 /** \page Changelog
  * \par Changelog
@@ -29,6 +29,31 @@
  *
  * Version | Changes
  * --------|--------
+ * 0.3.32  | Reuse the decode, conversion and NetCDF buffers and the subset images of each worker thread from sub-tile to sub-tile, and report the allocations.
+ * 0.3.31  | Remap, resample and convert the sub-tiles of classification masks for NetCDF in a single pass.
+ * 0.3.30  | Vectorize the remapping of classes and the conversions of pixels for AVX2 and AVX-512, selected at start-up (`--force-isa`).
+ * 0.3.29  | Time the pixel kernels in isolation, and check them against reference implementations, with `cm_vsm_microbench`.
+ * 0.3.28  | Benchmark the splitting of a synthetic Sentinel-2 product with `cm_vsm_bench`.
+ * 0.3.27  | Export the progress and throughput of a batch in the Prometheus text format, with `--metrics`.
+ * 0.3.26  | Report the time per stage of splitting, per product and band, in `cm_vsm_report.json` and with `--report`.
+ * 0.3.25  | Write the NetCDF files through staging copies which replace them atomically, with `--staging`.
+ * 0.3.24  | Skip the stored sub-tiles on reruns by a manifest of the output directory. Fixed the check for existing layers.
+ * 0.3.23  | Split only the sub-tiles which satisfy conditions on the mask bands, with `--select`.
+ * 0.3.22  | Skip the sub-tiles with too few valid pixels in all the bands, with `--min-valid`.
+ * 0.3.21  | Split sub-tiles in blocks of JP2 tiles, along a Hilbert curve by default (`--order`).
+ * 0.3.20  | Decode only the window of the selected sub-tiles from JP2 files which are read as a whole.
+ * 0.3.19  | Read the upcoming band files into the page cache in the background, with `--prefetch`.
+ * 0.3.18  | Read zipped Sentinel-2 products without extracting them.
+ * 0.3.17  | Stream PNG files row by row, decoding each of them once per band.
+ * 0.3.16  | Optionally read bands through GDAL, with `--gdal`.
+ * 0.3.15  | Decode all the channels of a KappaZeta TIF subtile in a single pass.
+ * 0.3.14  | Support tiled and integer KappaZeta TIF files.
+ * 0.3.13  | Read TIF sub-tiles with libtiff, decoding only the strips or tiles which cover the sub-tile.
+ * 0.3.12  | Choose between whole and tiled JP2 reading per band, within a memory budget set with `--max-memory`.
+ * 0.3.11  | Compute sub-tile windows and output paths once per resolution, and create the output directories in a single pass.
+ * 0.3.10  | Split JP2, TIF and PNG rasters with a single generic sub-tile splitter. Fix out-of-bounds read when remapping BHC, FMC, GSFC, DL-L8S2-UV, SS2C and FMSC classes.
+ * 0.3.9   | Find the bands of a product with a single scan of the product directory.
+ * 0.3.8   | Process several products in one run (`-d` repeated or `--list`), split with a shared pool of `-w` workers.
  * 0.3.7   | Support linear, hermite, hanning, hamming, blackman, gaussian, quadratic, catrom, mitchell, lanczos, bessel resampling methods.
  * 0.3.6   | Fix crash with empty geocoordinates string.
  * 0.3.5   | Fix crash without -T argument.
@@ -22,6 +22,25 @@ CNES_MAJA_CLM_TIF::~CNES_MAJA_CLM_TIF() {}
 
 
 RasterImage *CNES_MAJA_CLM_TIF::remap_majac_values(RasterImage *img, clm_format_t flags_fmt) {
+	if (img != nullptr && img->subset != nullptr) {
+		unsigned int w = img->subset->columns();
+		unsigned int h = img->subset->rows();
+		unsigned int size = w * h;
+
+		Magick::PixelPacket *px = img->subset->getPixels(0, 0, w, h);
+
+		// Classify each 8-bit flag combination once, and look the pixels up.
+		PixelKernels::class_table_t table;
+		make_class_table(flags_fmt, table);
+		PixelKernels::remap_classes(px, size, table);
+
+		img->subset->syncPixels();
+	}
+
+	return img;
+}
+
+void CNES_MAJA_CLM_TIF::make_class_table(clm_format_t flags_fmt, PixelKernels::class_table_t &table) {
 	const float v_cloud = ESA_S2_SCL_JP2_Image::SCL_CLOUD_HIGH_PROBABILITY / 255.0f;
 	const float v_shadow = ESA_S2_SCL_JP2_Image::SCL_CLOUD_SHADOWS / 255.0f;
 	const float v_cirrus = ESA_S2_SCL_JP2_Image::SCL_THIN_CIRRUS / 255.0f;
@@ -40,38 +59,20 @@ RasterImage *CNES_MAJA_CLM_TIF::remap_majac_values(RasterImage *img, clm_format_
 		f_cirrus = CLM_MAJA_THIN_CLOUDS;
 	}
 
-	if (img != nullptr && img->subset != nullptr) {
-		unsigned int w = img->subset->columns();
-		unsigned int h = img->subset->rows();
-		unsigned int size = w * h;
-
-		Magick::PixelPacket *px = img->subset->getPixels(0, 0, w, h);
-
-		float src_val, dst_val;
-
-		for (unsigned int i=0; i<size; i++) {
-			src_val = Magick::ColorGray(px[i]).shade();
-
-			unsigned char value = (unsigned char) (255 * src_val);
-
-			if (value == 0) {
-				dst_val = v_clear;
-			} else if ((value & f_cloud) != 0) {
-				dst_val = v_cloud;
-			} else if ((value & f_shadow) != 0) {
-				dst_val = v_shadow;
-			} else if ((value & f_cirrus) != 0) {
-				dst_val = v_cirrus;
-			} else {
-				dst_val = v_unsure;
-			}
-
-			px[i] = Magick::ColorGray(dst_val);
+	float dst_val;
+	for (unsigned int value=0; value<256; value++) {
+		if (value == 0) {
+			dst_val = v_clear;
+		} else if ((value & f_cloud) != 0) {
+			dst_val = v_cloud;
+		} else if ((value & f_shadow) != 0) {
+			dst_val = v_shadow;
+		} else if ((value & f_cirrus) != 0) {
+			dst_val = v_cirrus;
+		} else {
+			dst_val = v_unsure;
 		}
 
-		img->subset->syncPixels();
+		table[value] = Magick::ColorGray(dst_val);
 	}
-
-	return img;
 }
-
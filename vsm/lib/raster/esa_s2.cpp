@@ -23,9 +23,18 @@
 #include "raster/netcdf_interface.hpp"
 
 #include "util/text.hpp"
+#include "util/worker_arena.hpp"
+#include "util/zip_archive.hpp"
+#include "version.hpp"
 #include <algorithm>
+#include <exception>
+#include <fstream>
+#include <functional>
 #include <math.h>
+#include <sstream>
 #include <set>
+#include <memory>
+#include <mutex>
 
 // GDAL
 #include <ogrsf_frmts.h>
@@ -94,9 +103,76 @@ const unsigned char ESA_S2_Image_Operator::dl_l8s2_uv_scl_value_map[4] = {
 	0   // 3 - 255                     -> NO_DATA
 };
 
+//! Band files within an ESA S2 product. Bands which can be found in several forms are listed in the order of preference.
+const std::vector<ESA_S2_Band_Descriptor> ESA_S2_Image::band_descriptors = {
+	// L2A product, 10 m resolution.
+	{"IMG_DATA/R10m", "_TCI_10m.jp2", true, ESA_S2_Image_Operator::DT_TCI, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R10m", "_AOT_10m.jp2", true, ESA_S2_Image_Operator::DT_AOT, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R10m", "_WVP_10m.jp2", true, ESA_S2_Image_Operator::DT_WVP, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R10m", "_B02_10m.jp2", true, ESA_S2_Image_Operator::DT_B02, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R10m", "_B03_10m.jp2", true, ESA_S2_Image_Operator::DT_B03, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R10m", "_B04_10m.jp2", true, ESA_S2_Image_Operator::DT_B04, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R10m", "_B08_10m.jp2", true, ESA_S2_Image_Operator::DT_B08, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	// L1C product, 10 m resolution.
+	{"IMG_DATA", "_TCI.jp2", true, ESA_S2_Image_Operator::DT_TCI, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA", "_B02.jp2", true, ESA_S2_Image_Operator::DT_B02, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA", "_B03.jp2", true, ESA_S2_Image_Operator::DT_B03, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA", "_B04.jp2", true, ESA_S2_Image_Operator::DT_B04, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA", "_B08.jp2", true, ESA_S2_Image_Operator::DT_B08, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_JP2},
+	// Sinergise's S2Cloudless classification map, 10 m resolution.
+	{"S2CLOUDLESS_DATA/R10m", "_prediction.png", true, ESA_S2_Image_Operator::DT_SS2C, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_PNG},
+	{"S2CLOUDLESS_DATA/R10m", "_probability.png", true, ESA_S2_Image_Operator::DT_SS2CC, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_PNG},
+	// CNES MAJA classification map, 10 m resolution.
+	{"MAJA_DATA", "_CLM_R1.tif", true, ESA_S2_Image_Operator::DT_MAJAC, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_TIF},
+	// L2A product, 20 m resolution.
+	{"IMG_DATA/R20m", "_SCL_20m.jp2", true, ESA_S2_Image_Operator::DT_SCL, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R20m", "_B05_20m.jp2", true, ESA_S2_Image_Operator::DT_B05, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R20m", "_B06_20m.jp2", true, ESA_S2_Image_Operator::DT_B06, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R20m", "_B07_20m.jp2", true, ESA_S2_Image_Operator::DT_B07, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R20m", "_B8A_20m.jp2", true, ESA_S2_Image_Operator::DT_B8A, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R20m", "_B11_20m.jp2", true, ESA_S2_Image_Operator::DT_B11, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R20m", "_B12_20m.jp2", true, ESA_S2_Image_Operator::DT_B12, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	// L1C product, 20 m resolution.
+	{"IMG_DATA", "_B05.jp2", true, ESA_S2_Image_Operator::DT_B05, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA", "_B06.jp2", true, ESA_S2_Image_Operator::DT_B06, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA", "_B07.jp2", true, ESA_S2_Image_Operator::DT_B07, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA", "_B8A.jp2", true, ESA_S2_Image_Operator::DT_B8A, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA", "_B11.jp2", true, ESA_S2_Image_Operator::DT_B11, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA", "_B12.jp2", true, ESA_S2_Image_Operator::DT_B12, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	// Sen2cor cloud and snow probabilities, 20 m resolution.
+	{"QI_DATA", "MSK_CLDPRB_20m.jp2", true, ESA_S2_Image_Operator::DT_S2CC, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	{"QI_DATA", "MSK_SNWPRB_20m.jp2", true, ESA_S2_Image_Operator::DT_S2CS, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_JP2},
+	// Fmask4 classification map, 20 m resolution.
+	{"FMASK_DATA", "_Fmask4.tif", true, ESA_S2_Image_Operator::DT_FMC, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_TIF},
+	// Sinergise's S2Cloudless classification map, 20 m resolution.
+	{"S2CLOUDLESS_DATA/R20m", "_prediction.png", true, ESA_S2_Image_Operator::DT_SS2C, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_PNG},
+	{"S2CLOUDLESS_DATA/R20m", "_probability.png", true, ESA_S2_Image_Operator::DT_SS2CC, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_PNG},
+	// CNES MAJA classification map, 20 m resolution.
+	{"MAJA_DATA", "_CLM_R2.tif", true, ESA_S2_Image_Operator::DT_MAJAC, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_TIF},
+	// L2A product, 60 m resolution.
+	{"IMG_DATA/R60m", "_B01_60m.jp2", true, ESA_S2_Image_Operator::DT_B01, ESA_S2_Image_Operator::DR_60M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA/R60m", "_B09_60m.jp2", true, ESA_S2_Image_Operator::DT_B09, ESA_S2_Image_Operator::DR_60M, ESA_S2_Band::RF_JP2},
+	// L1C product, 60 m resolution.
+	{"IMG_DATA", "_B01.jp2", true, ESA_S2_Image_Operator::DT_B01, ESA_S2_Image_Operator::DR_60M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA", "_B09.jp2", true, ESA_S2_Image_Operator::DT_B09, ESA_S2_Image_Operator::DR_60M, ESA_S2_Band::RF_JP2},
+	{"IMG_DATA", "_B10.jp2", true, ESA_S2_Image_Operator::DT_B10, ESA_S2_Image_Operator::DR_60M, ESA_S2_Band::RF_JP2},
+	// Sinergise's S2Cloudless classification map, 60 m resolution.
+	{"S2CLOUDLESS_DATA/R60m", "_prediction.png", true, ESA_S2_Image_Operator::DT_SS2C, ESA_S2_Image_Operator::DR_60M, ESA_S2_Band::RF_PNG},
+	{"S2CLOUDLESS_DATA/R60m", "_probability.png", true, ESA_S2_Image_Operator::DT_SS2CC, ESA_S2_Image_Operator::DR_60M, ESA_S2_Band::RF_PNG},
+	// NASA GSFC labels, 10 m resolution.
+	{"GSFC", "label.tif", true, ESA_S2_Image_Operator::DT_GSFC, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_TIF},
+	// Baetens & Hagolle classification map, 60 m resolution.
+	{"ref_dataset/Classification", "classification_map.tif", false, ESA_S2_Image_Operator::DT_BHC, ESA_S2_Image_Operator::DR_60M, ESA_S2_Band::RF_TIF},
+	// Francis & Mrziglod & Sidiropoulos classification map, 20 m resolution.
+	{"ref_dataset_mrziglod20", "classification_map.png", false, ESA_S2_Image_Operator::DT_FMSC, ESA_S2_Image_Operator::DR_20M, ESA_S2_Band::RF_PNG},
+	// IPL-UV DL-L8S2-UV classification map, 10 m resolution.
+	{"", "dluvclouds_rgbiswir.tif", false, ESA_S2_Image_Operator::DT_DL_L8S2_UV, ESA_S2_Image_Operator::DR_10M, ESA_S2_Band::RF_TIF}
+};
+
 ESA_S2_Image::ESA_S2_Image():
 	tile_size(512), scl_value_map(nullptr), max_scl_value(12), f_downscale(1), f_overlap(0.0f),
-	store_png(false), read_tiled(false), num_threads(0), geo_extracted(false) {
+	store_png(false), read_tiled(false), num_threads(0), num_workers(1), max_memory(0), prefetcher(512 << 20), subtiles_per_task(16),
+	subtile_order(SubtileGrid::SO_HILBERT), min_valid(0.0f), metrics_interval(15), products_scanned(0), subtiles_planned(0), subtiles_finished(0) {
 }
 ESA_S2_Image::~ESA_S2_Image() {}
 
@@ -144,6 +220,35 @@ void ESA_S2_Image::set_num_threads(int num_threads) {
 	this->num_threads = num_threads;
 }
 
+void ESA_S2_Image::set_num_workers(int num_workers) {
+	this->num_workers = num_workers;
+}
+
+void ESA_S2_Image::set_max_memory(uintmax_t max_memory) {
+	this->max_memory = max_memory;
+}
+
+void ESA_S2_Image::set_prefetch_window(uintmax_t bytes) {
+	prefetcher.set_window(bytes);
+}
+
+void ESA_S2_Image::set_subtile_order(SubtileGrid::order_t order) {
+	subtile_order = order;
+}
+
+void ESA_S2_Image::set_min_valid(float min_valid) {
+	this->min_valid = min_valid;
+}
+
+bool ESA_S2_Image::set_selection(const std::string &expr) {
+	return selector.parse(expr);
+}
+
+void ESA_S2_Image::set_gdal_bands(const std::vector<std::string> &bands) {
+	gdal_bands.clear();
+	gdal_bands.insert(bands.begin(), bands.end());
+}
+
 void ESA_S2_Image::set_aoi_geometry(const std::string &wkt_geom) {
 	wkt_geom_aoi = wkt_geom;
 }
@@ -164,6 +269,15 @@ void ESA_S2_Image::set_subtiles(const std::vector<Vector<int>> &subtiles) {
 	limit_to_subtiles = subtiles;
 }
 
+void ESA_S2_Image::set_report_path(const std::filesystem::path &path) {
+	path_report = path;
+}
+
+void ESA_S2_Image::set_metrics(const std::filesystem::path &path, unsigned int interval) {
+	path_metrics = path;
+	metrics_interval = interval;
+}
+
 std::string ESA_S2_Image::get_product_name_from_path(const std::filesystem::path &path) {
 	for (auto it = path.begin(); it != path.end(); ++it) {
 		if (endswith(*it, ".SAFE"))
@@ -173,623 +287,966 @@ std::string ESA_S2_Image::get_product_name_from_path(const std::filesystem::path
 }
 
 bool ESA_S2_Image::process(const std::filesystem::path &path_dir_in, const std::filesystem::path &path_dir_out, ESA_S2_Image_Operator &op, std::vector<std::string> bands) {
-	ESA_S2_Image_Operator::data_resolution_t data_resolution;
+	std::vector<std::pair<std::filesystem::path, std::filesystem::path>> products;
+	products.emplace_back(path_dir_in, path_dir_out);
+	return process_batch(products, op, bands);
+}
+
+bool ESA_S2_Image::process_batch(const std::vector<std::pair<std::filesystem::path, std::filesystem::path>> &products, ESA_S2_Image_Operator &op, std::vector<std::string> bands) {
 	std::vector<bool> b(ESA_S2_Image_Operator::DT_COUNT, false);
 
 	// Build a vector of booleans to indicate the bands to be processed.
 	for (std::vector<std::string>::iterator it = bands.begin(); it != bands.end(); it++) {
+		bool known = false;
 		for (int i=0; i<ESA_S2_Image_Operator::DT_COUNT; i++) {
 			if (*it == ESA_S2_Image_Operator::data_type_name[i]) {
 				b[i] = true;
+				known = true;
 			}
 		}
+		if (!known)
+			std::cerr << "WARNING: Unknown band " << *it << std::endl;
 	}
 
-	// TODO:: Generalize the following.
-
-	for (const auto &granule_entry: std::filesystem::directory_iterator(path_dir_in.string() + "/GRANULE/")) {
-		data_resolution = ESA_S2_Image_Operator::DR_10M;
-		// Files within an L2A product with a 10 m resolution.
-		if (std::filesystem::is_directory(granule_entry.path().string() + "/IMG_DATA/R10m/")) {
-			for (const auto &r10m_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/IMG_DATA/R10m/")) {
-				//! \todo Map these
-				if (endswith(r10m_entry.path().string(), "_TCI_10m.jp2") && b[ESA_S2_Image_Operator::DT_TCI]) {
-					splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_TCI, data_resolution);
-				} else if (endswith(r10m_entry.path().string(), "_AOT_10m.jp2") && b[ESA_S2_Image_Operator::DT_AOT]) {
-					splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_AOT, data_resolution);
-				} else if (endswith(r10m_entry.path().string(), "_WVP_10m.jp2") && b[ESA_S2_Image_Operator::DT_WVP]) {
-					splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_WVP, data_resolution);
-				} else if (endswith(r10m_entry.path().string(), "_B02_10m.jp2") && b[ESA_S2_Image_Operator::DT_B02]) {
-					splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B02, data_resolution);
-				} else if (endswith(r10m_entry.path().string(), "_B03_10m.jp2") && b[ESA_S2_Image_Operator::DT_B03]) {
-					splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B03, data_resolution);
-				} else if (endswith(r10m_entry.path().string(), "_B04_10m.jp2") && b[ESA_S2_Image_Operator::DT_B04]) {
-					splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B04, data_resolution);
-				} else if (endswith(r10m_entry.path().string(), "_B08_10m.jp2") && b[ESA_S2_Image_Operator::DT_B08]) {
-					splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B08, data_resolution);
+	WorkStealingPool pool(WorkStealingPool::resolve_num_workers(num_workers));
+	std::cout << "Processing " << products.size() << " product(s) with " << pool.size() << " worker(s)." << std::endl;
+	memory_budget.reset(new MemoryBudget(max_memory));
+	if (max_memory > 0)
+		std::cout << "Memory budget: " << (max_memory >> 20) << " MiB." << std::endl;
+	if (max_memory > 0 && !gdal_bands.empty()) {
+		// Keep the GDAL block cache within a quarter of the budget.
+		GDAL_Image::set_cache_max(max_memory / 4);
+	}
+
+	products_scanned = 0;
+	subtiles_planned = 0;
+	subtiles_finished = 0;
+	MetricsExporter metrics;
+	if (!path_metrics.empty()) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		metrics.start(path_metrics, metrics_interval, [this, &pool, &products, start](std::ostream &os) {
+			format_metrics(os, pool, products.size(), start);
+		});
+	}
+
+	// Each product is scanned by a task of its own, which then queues the splitting of its bands.
+	for (auto it = products.begin(); it != products.end(); it++) {
+		std::shared_ptr<ESA_S2_Product> product = std::make_shared<ESA_S2_Product>(it->first, it->second);
+		pool.submit([this, &pool, product, &op, &b]() {
+			StageStats stats;
+			std::exception_ptr error;
+			{
+				StageStats::Scope scope(stats);
+				try {
+					schedule_product(pool, product, op, b);
+				} catch (...) {
+					error = std::current_exception();
 				}
 			}
+			add_stage_stats(*product, "schedule", stats);
+			products_scanned++;
+			// The pool counts the products which failed to be scheduled, for the exit code.
+			if (error)
+				std::rethrow_exception(error);
+		});
+	}
+	pool.wait();
+	metrics.stop();
+
+	write_stage_report(products);
+
+	return pool.num_failed() == 0;
+}
+
+void ESA_S2_Image::add_stage_stats(const ESA_S2_Product &product, const std::string &name, const StageStats &stats) {
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	stage_stats[product.path_dir_out][name].merge(stats);
+}
+
+bool ESA_S2_Image::write_stage_report(const std::vector<std::pair<std::filesystem::path, std::filesystem::path>> &products) {
+	bool retval = true;
+	nlohmann::json report;
+	report["version"] = CM_CONVERTER_VERSION_STR;
+	report["products"] = nlohmann::json::array();
+
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	for (auto it = products.begin(); it != products.end(); it++) {
+		auto sit = stage_stats.find(it->second);
+		if (sit == stage_stats.end())
+			continue;
+
+		StageStats total;
+		nlohmann::json bands = nlohmann::json::object();
+		for (auto bit = sit->second.begin(); bit != sit->second.end(); bit++) {
+			total.merge(bit->second);
+			bands[bit->first] = bit->second.to_json();
 		}
-		// Files within an L1C product with a 10 m resolution.
-		for (const auto &r10m_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/IMG_DATA/")) {
-			//! \todo Map these
-			if (endswith(r10m_entry.path().string(), "_TCI.jp2") && b[ESA_S2_Image_Operator::DT_TCI]) {
-				splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_TCI, data_resolution);
-			} else if (endswith(r10m_entry.path().string(), "_B02.jp2") && b[ESA_S2_Image_Operator::DT_B02]) {
-				splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B02, data_resolution);
-			} else if (endswith(r10m_entry.path().string(), "_B03.jp2") && b[ESA_S2_Image_Operator::DT_B03]) {
-				splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B03, data_resolution);
-			} else if (endswith(r10m_entry.path().string(), "_B04.jp2") && b[ESA_S2_Image_Operator::DT_B04]) {
-				splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B04, data_resolution);
-			} else if (endswith(r10m_entry.path().string(), "_B08.jp2") && b[ESA_S2_Image_Operator::DT_B08]) {
-				splitJP2(r10m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B08, data_resolution);
+
+		nlohmann::json j;
+		j["version"] = CM_CONVERTER_VERSION_STR;
+		j["path_in"] = it->first.string();
+		j["path_out"] = it->second.string();
+		j["total"] = total.to_json();
+		j["bands"] = bands;
+
+		// Products which failed before their output directory was created have no report of their own.
+		std::error_code ec;
+		if (std::filesystem::is_directory(it->second, ec)) {
+			std::ofstream f(it->second / "cm_vsm_report.json");
+			f << j.dump(1, '\t') << std::endl;
+			if (!f) {
+				std::cerr << "ERROR: Failed to write the timing report of " << it->second << std::endl;
+				retval = false;
 			}
 		}
-		// Sinergise's S2Cloudless classification map within an L1C product, with a 10 m resolution.
-		if (std::filesystem::is_directory(granule_entry.path().string() + "/S2CLOUDLESS_DATA/R10m/")) {
-			for (const auto &s2c_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/S2CLOUDLESS_DATA/R10m/")) {
-				if (endswith(s2c_entry.path().string(), "_prediction.png") && b[ESA_S2_Image_Operator::DT_SS2C]) {
-					splitPNG(s2c_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_SS2C, data_resolution);
-				} else if (endswith(s2c_entry.path().string(), "_probability.png") && b[ESA_S2_Image_Operator::DT_SS2CC]) {
-					splitPNG(s2c_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_SS2CC, data_resolution);
-				}
-			}
+
+		j.erase("version");
+		report["products"].push_back(j);
+	}
+
+	if (!path_report.empty()) {
+		std::ofstream f(path_report);
+		f << report.dump(1, '\t') << std::endl;
+		if (!f) {
+			std::cerr << "ERROR: Failed to write the timing report " << path_report << std::endl;
+			retval = false;
 		}
-		// CNES MAJA classification map within an L1C / L2A product, with a 10 m resolution.
-		if (std::filesystem::is_directory(granule_entry.path().string() + "/MAJA_DATA/")) {
-			for (const auto &majac_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/MAJA_DATA/")) {
-				if (endswith(majac_entry.path().string(), "_CLM_R1.tif") && b[ESA_S2_Image_Operator::DT_MAJAC]) {
-					splitTIF(majac_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_MAJAC, data_resolution);
-				}
-			}
+	}
+
+	return retval;
+}
+
+void ESA_S2_Image::format_metrics(std::ostream &os, WorkStealingPool &pool, size_t num_products, std::chrono::steady_clock::time_point start) {
+	typedef MetricsExporter M;
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	uint64_t stored = StageStats::get_live_subtiles();
+	uint64_t planned = subtiles_planned;
+	uint64_t finished = subtiles_finished;
+
+	M::write_metric(os, "cm_vsm_elapsed_seconds", "gauge", "Time since the start of the batch.", elapsed);
+	M::write_metric(os, "cm_vsm_products", "gauge", "Number of products in the batch.", num_products);
+	M::write_metric(os, "cm_vsm_products_scanned", "gauge", "Number of products which have been scanned and queued for splitting.", products_scanned);
+
+	// Progress, counted in sub-tiles of single bands.
+	M::write_metric(os, "cm_vsm_subtiles_stored_total", "counter", "Number of sub-tiles of single bands which have been stored.", stored);
+	M::write_metric(os, "cm_vsm_subtiles_per_second", "gauge", "Average number of sub-tiles of single bands stored per second since the start of the batch.",
+		elapsed > 0.0 ? stored / elapsed : 0.0);
+	M::write_metric(os, "cm_vsm_subtiles_planned", "gauge", "Number of sub-tiles of single bands queued for splitting in the products scanned so far.", planned);
+	M::write_metric(os, "cm_vsm_subtiles_finished", "gauge", "Number of sub-tiles of single bands which the finished tasks have been given, including the skipped ones.", finished);
+	// Until the first task has finished, there's nothing to extrapolate from.
+	double eta = finished > 0 ? (planned - finished) * elapsed / finished : std::nan("");
+	M::write_metric(os, "cm_vsm_eta_seconds", "gauge", "Estimated time until the sub-tiles queued so far have been split.", eta);
+
+	// Throughput.
+	M::write_metric(os, "cm_vsm_bytes_decoded_total", "counter", "Number of bytes of decoded raster windows.",
+		StageStats::get_live_bytes(StageStats::ST_DECODE));
+	M::write_metric(os, "cm_vsm_bytes_written_total", "counter", "Number of bytes of NetCDF variables (before compression) and PNG files written.",
+		StageStats::get_live_bytes(StageStats::ST_NC_WRITE) + StageStats::get_live_bytes(StageStats::ST_PNG));
+	M::write_header(os, "cm_vsm_stage_seconds_total", "counter", "Time spent in each stage of splitting, summed over the workers.");
+	for (int i=0; i<StageStats::ST_COUNT; i++)
+		M::write_sample(os, "cm_vsm_stage_seconds_total", StageStats::get_live_ns((StageStats::stage_t) i) / 1e9, std::string("stage=\"") + StageStats::stage_name[i] + "\"");
+	M::write_header(os, "cm_vsm_stage_bytes_total", "counter", "Number of bytes processed by each stage of splitting.");
+	for (int i=0; i<StageStats::ST_COUNT; i++)
+		M::write_sample(os, "cm_vsm_stage_bytes_total", StageStats::get_live_bytes((StageStats::stage_t) i), std::string("stage=\"") + StageStats::stage_name[i] + "\"");
+
+	// Queues and caches.
+	M::write_metric(os, "cm_vsm_workers", "gauge", "Number of workers.", pool.size());
+	M::write_metric(os, "cm_vsm_tasks_queued", "gauge", "Number of tasks which no worker has started yet.", pool.get_num_queued());
+	M::write_metric(os, "cm_vsm_tasks_pending", "gauge", "Number of tasks which haven't finished yet, including the running ones.", pool.get_num_pending());
+	M::write_metric(os, "cm_vsm_memory_budget_bytes", "gauge", "Memory budget for decoded rasters (0 for unlimited).", max_memory);
+	M::write_metric(os, "cm_vsm_memory_budget_in_use_bytes", "gauge", "Memory reserved for decoded rasters.", memory_budget->get_in_use());
+	unsigned long hits = prefetcher.get_num_hits();
+	unsigned long misses = prefetcher.get_num_misses();
+	M::write_metric(os, "cm_vsm_prefetch_hits_total", "counter", "Number of band files which had been read ahead by the time they were split.", hits);
+	M::write_metric(os, "cm_vsm_prefetch_misses_total", "counter", "Number of band files which hadn't been read ahead by the time they were split.", misses);
+	M::write_metric(os, "cm_vsm_prefetch_hit_ratio", "gauge", "Fraction of the band files which had been read ahead by the time they were split.",
+		hits + misses > 0 ? (double) hits / (hits + misses) : std::nan(""));
+	M::write_metric(os, "cm_vsm_resident_memory_max_bytes", "gauge", "Peak resident set size of the process.", MetricsExporter::get_max_rss());
+}
+
+std::vector<ESA_S2_Band> ESA_S2_Image::scan_product(const std::filesystem::path &path_dir_in) {
+	// Directories to descend into, relative to the product, with `*` in place of the granule name.
+	std::set<std::string> dir_prefixes;
+	for (auto dit = band_descriptors.begin(); dit != band_descriptors.end(); dit++) {
+		std::filesystem::path d = dit->in_granule ? std::filesystem::path("GRANULE/*") / dit->dir : std::filesystem::path(dit->dir);
+		std::filesystem::path prefix;
+		for (auto cit = d.begin(); cit != d.end(); cit++) {
+			prefix /= *cit;
+			dir_prefixes.insert(prefix.string());
 		}
+	}
 
-		data_resolution = ESA_S2_Image_Operator::DR_20M;
-		// Files within an L2A product with a 20 m resolution.
-		if (std::filesystem::is_directory(granule_entry.path().string() + "/IMG_DATA/R20m/")) {
-			for (const auto &r20m_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/IMG_DATA/R20m/")) {
-				if (endswith(r20m_entry.path().string(), "_SCL_20m.jp2") && b[ESA_S2_Image_Operator::DT_SCL]) {
-					splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_SCL, data_resolution);
-				} else if (endswith(r20m_entry.path().string(), "_B05_20m.jp2") && b[ESA_S2_Image_Operator::DT_B05]) {
-					splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B05, data_resolution);
-				} else if (endswith(r20m_entry.path().string(), "_B06_20m.jp2") && b[ESA_S2_Image_Operator::DT_B06]) {
-					splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B06, data_resolution);
-				} else if (endswith(r20m_entry.path().string(), "_B07_20m.jp2") && b[ESA_S2_Image_Operator::DT_B07]) {
-					splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B07, data_resolution);
-				} else if (endswith(r20m_entry.path().string(), "_B8A_20m.jp2") && b[ESA_S2_Image_Operator::DT_B8A]) {
-					splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B8A, data_resolution);
-				} else if (endswith(r20m_entry.path().string(), "_B11_20m.jp2") && b[ESA_S2_Image_Operator::DT_B11]) {
-					splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B11, data_resolution);
-				} else if (endswith(r20m_entry.path().string(), "_B12_20m.jp2") && b[ESA_S2_Image_Operator::DT_B12]) {
-					splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B12, data_resolution);
-				}
-			}
+	// Replace the granule name in a relative path with `*`, to match it against the descriptors.
+	auto granule_pattern = [](const std::filesystem::path &rel) {
+		std::filesystem::path pattern;
+		unsigned int i = 0;
+		for (auto cit = rel.begin(); cit != rel.end(); cit++, i++) {
+			if (i == 1 && *rel.begin() == "GRANULE")
+				pattern /= "*";
+			else
+				pattern /= *cit;
 		}
-		// Files within an L1C product with a 20 m resolution.
-		for (const auto &r20m_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/IMG_DATA/")) {
-			if (endswith(r20m_entry.path().string(), "_B05.jp2") && b[ESA_S2_Image_Operator::DT_B05]) {
-				splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B05, data_resolution);
-			} else if (endswith(r20m_entry.path().string(), "_B06.jp2") && b[ESA_S2_Image_Operator::DT_B06]) {
-				splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B06, data_resolution);
-			} else if (endswith(r20m_entry.path().string(), "_B07.jp2") && b[ESA_S2_Image_Operator::DT_B07]) {
-				splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B07, data_resolution);
-			} else if (endswith(r20m_entry.path().string(), "_B8A.jp2") && b[ESA_S2_Image_Operator::DT_B8A]) {
-				splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B8A, data_resolution);
-			} else if (endswith(r20m_entry.path().string(), "_B11.jp2") && b[ESA_S2_Image_Operator::DT_B11]) {
-				splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B11, data_resolution);
-			} else if (endswith(r20m_entry.path().string(), "_B12.jp2") && b[ESA_S2_Image_Operator::DT_B12]) {
-				splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B12, data_resolution);
+		return pattern;
+	};
+
+	// Matches, with the index of the matching descriptor.
+	std::vector<std::pair<size_t, ESA_S2_Band>> matches;
+	std::vector<size_t> best(ESA_S2_Image_Operator::DT_COUNT, band_descriptors.size());
+
+	// Match a file, by its path relative to the product, against the descriptors.
+	auto match = [&](const std::filesystem::path &rel, const std::filesystem::path &path, uintmax_t file_size) {
+		std::string dir = granule_pattern(rel.parent_path()).string();
+		std::string name = rel.filename().string();
+		for (size_t di=0; di<band_descriptors.size(); di++) {
+			const ESA_S2_Band_Descriptor &d = band_descriptors[di];
+			std::string d_dir = d.in_granule ? (std::filesystem::path("GRANULE/*") / d.dir).string() : std::filesystem::path(d.dir).string();
+			if (dir == d_dir && endswith(name, d.suffix)) {
+				matches.emplace_back(di, ESA_S2_Band(path, d.data_type, d.data_resolution, d.format, file_size));
+				best[d.data_type] = std::min(best[d.data_type], di);
+				break;
 			}
 		}
-		// Split Sen2cor cloudmask probabilities.
-		for (const auto &r20m_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/QI_DATA")) {
-			if (endswith(r20m_entry.path().string(), "MSK_CLDPRB_20m.jp2") && b[ESA_S2_Image_Operator::DT_S2CC]) {
-				splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_S2CC, data_resolution);
-			} else if (endswith(r20m_entry.path().string(), "MSK_SNWPRB_20m.jp2") && b[ESA_S2_Image_Operator::DT_S2CS]) {
-				splitJP2(r20m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_S2CS, data_resolution);
-			}
+	};
+
+	if (ZipArchive::is_zip_file(path_dir_in)) {
+		// A zipped product is scanned from the central directory, and its files are addressed by virtual paths.
+		std::shared_ptr<const ZipArchive> archive = ZipArchive::get(path_dir_in);
+		if (archive == nullptr)
+			return std::vector<ESA_S2_Band>();
+
+		for (const ZipArchive::Entry &e: archive->get_entries()) {
+			if (e.is_directory())
+				continue;
+			// Paths within the archive usually start with the .SAFE directory.
+			std::filesystem::path name(e.name);
+			std::filesystem::path rel = name;
+			if (endswith(name.begin()->string(), ".SAFE"))
+				rel = name.lexically_relative(*name.begin());
+			match(rel, ZipArchive::make_member_path(path_dir_in, e.name), e.size);
 		}
-		// Fmask4 classification map within an L1C product, with a 20 m resolution.
-		if (std::filesystem::is_directory(granule_entry.path().string() + "/FMASK_DATA/")) {
-			for (const auto &fmask_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/FMASK_DATA/")) {
-				if (endswith(fmask_entry.path().string(), "_Fmask4.tif") && b[ESA_S2_Image_Operator::DT_FMC]) {
-					splitTIF(fmask_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_FMC, data_resolution);
-				}
-			}
+	} else {
+		std::error_code ec;
+		std::filesystem::recursive_directory_iterator it(path_dir_in,
+		std::filesystem::directory_options::follow_directory_symlink | std::filesystem::directory_options::skip_permission_denied, ec);
+		if (ec) {
+			std::cerr << "ERROR: Failed to scan " << path_dir_in << ": " << ec.message() << std::endl;
+			return std::vector<ESA_S2_Band>();
 		}
-		// Sinergise's S2Cloudless classification map within an L1C product, with a 20 m resolution.
-		if (std::filesystem::is_directory(granule_entry.path().string() + "/S2CLOUDLESS_DATA/R20m/")) {
-			for (const auto &s2c_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/S2CLOUDLESS_DATA/R20m/")) {
-				if (endswith(s2c_entry.path().string(), "_prediction.png") && b[ESA_S2_Image_Operator::DT_SS2C]) {
-					splitPNG(s2c_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_SS2C, data_resolution);
-				} else if (endswith(s2c_entry.path().string(), "_probability.png") && b[ESA_S2_Image_Operator::DT_SS2CC]) {
-					splitPNG(s2c_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_SS2CC, data_resolution);
-				}
+
+		for (; it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+			if (ec) {
+				std::cerr << "ERROR: Failed to scan " << path_dir_in << ": " << ec.message() << std::endl;
+				break;
 			}
-		}
-		// CNES MAJA classification map within an L1C / L2A product, with a 20 m resolution.
-		if (std::filesystem::is_directory(granule_entry.path().string() + "/MAJA_DATA/")) {
-			for (const auto &majac_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/MAJA_DATA/")) {
-				if (endswith(majac_entry.path().string(), "_CLM_R2.tif") && b[ESA_S2_Image_Operator::DT_MAJAC]) {
-					splitTIF(majac_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_MAJAC, data_resolution);
-				}
+			std::filesystem::path rel = it->path().lexically_relative(path_dir_in);
+
+			if (it->is_directory(ec)) {
+				// Skip the directories which can't contain any of the bands, such as AUX_DATA or HTML.
+				if (!dir_prefixes.count(granule_pattern(rel).string()))
+					it.disable_recursion_pending();
+				continue;
 			}
+
+			match(rel, it->path(), it->file_size(ec));
 		}
+	}
+
+	// Keep the preferred form of each band, in the order of the descriptor table.
+	std::sort(matches.begin(), matches.end(), [](const std::pair<size_t, ESA_S2_Band> &a, const std::pair<size_t, ESA_S2_Band> &b) {
+		return a.first < b.first || (a.first == b.first && a.second.path < b.second.path);
+	});
+	std::vector<ESA_S2_Band> found;
+	for (auto mit = matches.begin(); mit != matches.end(); mit++) {
+		if (mit->first == best[mit->second.data_type])
+			found.push_back(mit->second);
+	}
+
+	return found;
+}
+
+float ESA_S2_Image::get_resolution_factor(ESA_S2_Image_Operator::data_resolution_t data_resolution) {
+	if (data_resolution == ESA_S2_Image_Operator::DR_20M)
+		return 2.0f;
+	else if (data_resolution == ESA_S2_Image_Operator::DR_60M)
+		return 6.0f;
+	return 1.0f;
+}
+
+float ESA_S2_Image::get_tile_size_div(ESA_S2_Image_Operator::data_resolution_t data_resolution) const {
+	// With increased overlap, the effective subtile size is reduced.
+	return (tile_size - tile_size * f_overlap) / get_resolution_factor(data_resolution);
+}
+
+void ESA_S2_Image::schedule_product(WorkStealingPool &pool, std::shared_ptr<ESA_S2_Product> product, ESA_S2_Image_Operator &op, const std::vector<bool> &b) {
+	std::vector<ESA_S2_Band> inventory = scan_product(product->path_dir_in);
+
+	// Limit the inventory to the requested bands.
+	std::vector<ESA_S2_Band> found;
+	std::vector<bool> b_found(ESA_S2_Image_Operator::DT_COUNT, false);
+	for (auto it = inventory.begin(); it != inventory.end(); it++) {
+		b_found[it->data_type] = true;
+		if (b[it->data_type])
+			found.push_back(*it);
+	}
+	for (int i=0; i<ESA_S2_Image_Operator::DT_COUNT; i++) {
+		if (b[i] && !b_found[i] && i != ESA_S2_Image_Operator::DT_GML)
+			std::cout << "Band " << ESA_S2_Image_Operator::data_type_name[i] << " not found in " << product->path_dir_in << std::endl;
+	}
+	std::cout << "Found " << found.size() << " band(s) to process in " << product->path_dir_in << std::endl;
 
-		data_resolution = ESA_S2_Image_Operator::DR_60M;
-		// Files within an L2A product with a 60 m resolution.
-		if (std::filesystem::is_directory(granule_entry.path().string() + "/IMG_DATA/R60m/")) {
-			for (const auto &r60m_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/IMG_DATA/R60m/")) {
-				if (endswith(r60m_entry.path().string(), "_B01_60m.jp2") && b[ESA_S2_Image_Operator::DT_B01]) {
-					splitJP2(r60m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B01, data_resolution);
-				} else if (endswith(r60m_entry.path().string(), "_B09_60m.jp2") && b[ESA_S2_Image_Operator::DT_B09]) {
-					splitJP2(r60m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B09, data_resolution);
+	// Extract image geo-coordinates, project area of interest polygon into pixel coordinates,
+	// and produce a subtile mask from the first JP2 file, before any of the bands is split.
+	for (auto it = found.begin(); it != found.end() && !product->geo_extracted; it++) {
+		if (it->format != ESA_S2_Band::RF_JP2)
+			continue;
+
+		ESA_S2_Band_JP2_Image img_hdr;
+		if (!img_hdr.load_header(it->path))
+			continue;
+
+		std::cout << "Extracting geo-coordinates from " << it->path << std::endl;
+		AABB<int> image_aabb(img_hdr.main_geometry);
+		float tile_size_div = get_tile_size_div(it->data_resolution);
+		extract_geo(*product, it->path, image_aabb, tile_size_div);
+		// Untiled rasters leave the whole order to the curve.
+		if (img_hdr.tile_width < img_hdr.main_geometry.width())
+			product->subtile_block_size = std::max(1L, lround(img_hdr.tile_width / tile_size_div));
+		product->geo_extracted = true;
+	}
+	// The pool counts the products which end here as failed, for the exit code.
+	if (!product->geo_extracted)
+		throw RasterException("No JP2 band to extract geo-coordinates from", product->path_dir_in);
+
+	// A mask which both --min-valid and --select use is decoded once, and freed before the splitting starts.
+	{
+		scan_cache_t decoded;
+		if (min_valid > 0.0f)
+			eliminate_empty_subtiles(*product, inventory, decoded);
+
+		// Decide which sub-tiles are worth splitting from the mask bands, before decoding any of the other bands.
+		if (!selector.empty() && !select_subtiles(*product, inventory, decoded))
+			throw RasterException("Failed to select the sub-tiles", product->path_dir_in);
+	}
+
+	// Sub-tiles within the same JP2 tile are split one after another, and so are the neighbouring tiles.
+	std::vector<Vector<int>> &subtiles = product->subtiles;
+	subtiles = product->subtile_mask.get_subtiles(subtile_order, product->subtile_block_size);
+
+	// Create the output directories of all the sub-tiles in a single pass.
+	{
+		StageTimer timer(StageStats::ST_DIRECTORIES);
+		SubtilePlan::create_directories(product->path_dir_out, subtiles);
+	}
+
+	// Leave out the bands which an earlier run has already split with the same parameters.
+	if (!product->manifest.open(product->path_dir_out))
+		std::cerr << "ERROR: Failed to open the manifest of " << product->path_dir_out << ", probing the NetCDF files instead" << std::endl;
+	if (!overwrite_subtiles && product->manifest.existed()) {
+		auto it_done = std::remove_if(found.begin(), found.end(), [this, &product](const ESA_S2_Band &band) {
+			return is_done(*product, band, 0, product->subtiles.size());
+		});
+		for (auto it = it_done; it != found.end(); it++)
+			std::cout << "Skipping " << it->path.filename() << ", which has already been split" << std::endl;
+		found.erase(it_done, found.end());
+	}
+
+	// Queue the cheapest bands first, so that the owner of the queue starts with the most expensive ones,
+	// while the cheap ones are left for the idle workers to steal.
+	std::stable_sort(found.begin(), found.end(), [](const ESA_S2_Band &a, const ESA_S2_Band &b) {
+		return a.file_size < b.file_size;
+	});
+
+	// The worker which queues the bands starts with the last one, so read ahead in the reverse order.
+	// Whatever the tasks don't read is released from the read-ahead window once the product is done with.
+	product->prefetcher = &prefetcher;
+	for (auto it = found.rbegin(); it != found.rend(); it++) {
+		prefetcher.enqueue(it->path, it->file_size);
+		product->prefetched.push_back(it->path);
+	}
+
+	std::vector<std::tuple<ESA_S2_Band, size_t, size_t>> tasks;
+	for (auto it = found.begin(); it != found.end(); it++) {
+		choose_read_strategy(*product, *it, pool.size());
+
+		// A JP2 file which is decoded as a whole is split by a single task, and so is a PNG file,
+		// which would otherwise be decoded once per task. Everything else is split in ranges
+		// of sub-tiles, which idle workers can steal.
+		size_t n = subtiles_per_task;
+		if (it->read_whole || it->format == ESA_S2_Band::RF_PNG)
+			n = subtiles.size();
+		if (n == 0)
+			n = 1;
+
+		for (size_t i=0; i<subtiles.size(); i+=n) {
+			size_t last = std::min<size_t>(i + n, subtiles.size());
+			if (!overwrite_subtiles && is_done(*product, *it, i, last))
+				continue;
+			tasks.emplace_back(*it, i, last);
+		}
+	}
+
+	// With staging, the NetCDF file of a sub-tile is published once all of the tasks which cover it have finished.
+	for (const std::tuple<ESA_S2_Band, size_t, size_t> &task: tasks) {
+		for (size_t i=std::get<1>(task); i<std::get<2>(task); i++)
+			NetCDFInterface::begin_batch(SubtilePlan::get_nc_path(product->path_dir_out, extract_index_date(std::get<0>(task).path), subtiles[i]), 1);
+	}
+
+	for (const std::tuple<ESA_S2_Band, size_t, size_t> &task: tasks) {
+		const ESA_S2_Band &band = std::get<0>(task);
+		size_t i = std::get<1>(task), last = std::get<2>(task);
+		subtiles_planned += last - i;
+		pool.submit([this, product, band, i, last, &op]() {
+			StageStats stats;
+			bool ok = false;
+			{
+				StageStats::Scope scope(stats);
+				// Buffers which have grown for the band, such as the tile of an untiled JP2 file, aren't kept for the next one.
+				try {
+					ok = split_band(*product, band, i, last, op);
+				} catch (...) {
+					end_batches(*product, band, i, last);
+					WorkerArena::get_current().trim();
+					throw;
 				}
+				ok = end_batches(*product, band, i, last) && ok;
+				WorkerArena::get_current().trim();
 			}
-		}
-		// Files within an L1C product with a 60 m resolution.
-		for (const auto &r60m_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/IMG_DATA/")) {
-			if (endswith(r60m_entry.path().string(), "_B01.jp2") && b[ESA_S2_Image_Operator::DT_B01]) {
-				splitJP2(r60m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B01, data_resolution);
-			} else if (endswith(r60m_entry.path().string(), "_B09.jp2") && b[ESA_S2_Image_Operator::DT_B09]) {
-				splitJP2(r60m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B09, data_resolution);
-			} else if (endswith(r60m_entry.path().string(), "_B10.jp2") && b[ESA_S2_Image_Operator::DT_B10]) {
-				splitJP2(r60m_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_B10, data_resolution);
+			add_stage_stats(*product, ESA_S2_Image_Operator::data_type_name[band.data_type], stats);
+			subtiles_finished += last - i;
+			// The pool counts the failed tasks for the exit code. Stopping at the request of the image operator isn't a failure.
+			if (!ok && !product->aborted)
+				throw RasterException("Failed to split sub-tiles " + std::to_string(i) + " to " + std::to_string(last), band.path);
+		});
+	}
+}
+
+bool ESA_S2_Image::end_batches(ESA_S2_Product &product, const ESA_S2_Band &band, size_t first, size_t last) {
+	bool retval = true;
+	std::string nc_prefix = extract_index_date(band.path);
+	for (size_t i=first; i<last && i<product.subtiles.size(); i++)
+		retval = NetCDFInterface::end_batch(SubtilePlan::get_nc_path(product.path_dir_out, nc_prefix, product.subtiles[i])) && retval;
+	return retval;
+}
+
+uintmax_t ESA_S2_Image::estimate_decoded_memory(unsigned int width, unsigned int height, unsigned int num_components) {
+	return (uintmax_t) width * height * (num_components * sizeof(int32_t) + sizeof(Magick::PixelPacket));
+}
+
+float ESA_S2_Image::get_valid_fraction(const Magick::PixelPacket *px, size_t n) {
+	if (px == nullptr || n == 0)
+		return 0.0f;
+	size_t num_valid = 0;
+	for (size_t i=0; i<n; i++)
+		num_valid += px[i].green != 0;
+	return (float) num_valid / n;
+}
+
+void ESA_S2_Image::choose_read_strategy(ESA_S2_Product &product, ESA_S2_Band &band, unsigned int num_workers) {
+	// GDAL reads windows through its own block cache, which is limited separately.
+	if (band.format != ESA_S2_Band::RF_PNG && (gdal_bands.count("all") || gdal_bands.count(ESA_S2_Image_Operator::data_type_name[band.data_type]))) {
+		band.read_gdal = true;
+		band.read_whole = false;
+		return;
+	}
+
+	// Without a budget, follow the --tiled switch.
+	if (max_memory == 0) {
+		band.read_whole = band.format == ESA_S2_Band::RF_JP2 && !read_tiled;
+		return;
+	}
+
+	if (band.format == ESA_S2_Band::RF_JP2) {
+		ESA_S2_Band_JP2_Image img_hdr;
+		if (!img_hdr.load_header(band.path))
+			return;
+
+		unsigned int w = img_hdr.main_geometry.width();
+		unsigned int h = img_hdr.main_geometry.height();
+
+		// A band which is read as a whole is only decoded within the window of the sub-tiles.
+		int x0, y0, x1, y1;
+		uintmax_t cost_whole = 0;
+		if (get_decode_window(product, band, img_hdr.main_geometry, 0, product.subtiles.size(), x0, y0, x1, y1))
+			cost_whole = estimate_decoded_memory(x1 - x0, y1 - y0, img_hdr.main_num_components);
+
+		// A sub-tile, including the overlap, is decoded with a margin of code-blocks around it.
+		unsigned int side = (unsigned int) ceil(get_tile_size_div(band.data_resolution) / (1.0f - f_overlap)) + 128;
+		uintmax_t cost_tiled = estimate_decoded_memory(std::min(side, w), std::min(side, h), img_hdr.main_num_components);
+
+		// A band which is read as a whole is split by a single task, while the other workers may be splitting
+		// bands tile by tile meanwhile, so it has to fit into what's left of the budget after their reservations.
+		uintmax_t cost_others = (uintmax_t) (num_workers > 0 ? num_workers - 1 : 0) * cost_tiled;
+		band.read_whole = cost_whole + cost_others <= max_memory;
+		band.memory_cost = band.read_whole ? cost_whole : cost_tiled;
+		std::cout << "Reading " << band.path.filename() << (band.read_whole ? " as a whole" : " in tiles")
+			<< " (estimated " << (band.memory_cost >> 20) << " MiB)." << std::endl;
+	} else {
+		if (band.format == ESA_S2_Band::RF_TIF) {
+			// TIF sub-tiles are read one window at a time, through a cache of decoded strips or tiles.
+			TIFWindowReader reader;
+			if (reader.open(band.path) && (reader.num_channels == 1 || reader.num_channels == 3)) {
+				unsigned int side = (unsigned int) ceil(get_tile_size_div(band.data_resolution) / (1.0f - f_overlap));
+				band.memory_cost = estimate_decoded_memory(std::min(side, reader.width), std::min(side, reader.height), reader.num_channels) +
+					(uintmax_t) reader.get_cache_size() * reader.get_block_size();
+			} else {
+				// Layouts which the window reader doesn't support are decoded as a whole by Magick.
+				TIF_Image img_hdr;
+				if (img_hdr.load_header(band.path))
+					band.memory_cost = estimate_decoded_memory(img_hdr.main_geometry.width(), img_hdr.main_geometry.height(), 0);
 			}
-		}
-		// Sinergise's S2Cloudless classification map within an L1C product, with a 60 m resolution.
-		if (std::filesystem::is_directory(granule_entry.path().string() + "/S2CLOUDLESS_DATA/R60m/")) {
-			for (const auto &s2c_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/S2CLOUDLESS_DATA/R60m/")) {
-				if (endswith(s2c_entry.path().string(), "_prediction.png") && b[ESA_S2_Image_Operator::DT_SS2C]) {
-					splitPNG(s2c_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_SS2C, data_resolution);
-				} else if (endswith(s2c_entry.path().string(), "_probability.png") && b[ESA_S2_Image_Operator::DT_SS2CC]) {
-					splitPNG(s2c_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_SS2CC, data_resolution);
-				}
+		} else {
+			// PNG files are streamed, keeping the rows of a single row of sub-tiles.
+			PNG_Image img_hdr;
+			if (img_hdr.load_header(band.path)) {
+				unsigned int rows = (unsigned int) ceil(get_tile_size_div(band.data_resolution) / (1.0f - f_overlap));
+				band.memory_cost = estimate_decoded_memory(img_hdr.main_geometry.width(), std::min<unsigned int>(rows, img_hdr.main_geometry.height()), img_hdr.main_num_components);
 			}
 		}
-		// Split NASA GSFC at 10 m resolution.
-		if (std::filesystem::is_directory(granule_entry.path().string() + "/GSFC/")) {
-			for (const auto &classification_entry: std::filesystem::directory_iterator(granule_entry.path().string() + "/GSFC/")) {
-				data_resolution = ESA_S2_Image_Operator::DR_10M;
-				if (endswith(classification_entry.path().string(), "label.tif") && b[ESA_S2_Image_Operator::DT_GSFC]) {
-					splitTIF(classification_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_GSFC, data_resolution);
-				}
-			}
+	}
+}
+
+uint64_t ESA_S2_Image::get_params_hash(const ESA_S2_Band &band) const {
+	std::ostringstream ss;
+	ss << ESA_S2_Image_Operator::data_type_name[band.data_type] << ";" << band.path.filename().string()
+		<< ";size=" << tile_size << ";downscale=" << f_downscale << ";overlap=" << f_overlap
+		<< ";resampling=" << resampling_method_name << ";maja=" << (int) maja_flags_format << ";map=";
+	if (scl_value_map != nullptr) {
+		for (unsigned int i=0; i<=max_scl_value; i++)
+			ss << (int) scl_value_map[i] << ",";
+	}
+	return ResumeManifest::hash(ss.str());
+}
+
+bool ESA_S2_Image::is_done(ESA_S2_Product &product, const ESA_S2_Band &band, size_t first, size_t last) const {
+	if (!product.manifest.is_open())
+		return false;
+	const std::string &layer = ESA_S2_Image_Operator::data_type_name[band.data_type];
+	uint64_t params_hash = get_params_hash(band);
+	std::string nc_prefix = extract_index_date(band.path);
+	for (size_t i=first; i<last && i<product.subtiles.size(); i++) {
+		const Vector<int> &p = product.subtiles[i];
+		// Files which have changed since they were recorded are probed by the task.
+		if (!product.manifest.has(p.x, p.y, layer, params_hash) || !product.manifest.is_intact(p.x, p.y, SubtilePlan::get_nc_path(product.path_dir_out, nc_prefix, p)))
+			return false;
+	}
+	return true;
+}
+
+SubtileSplitSettings ESA_S2_Image::get_split_settings(ESA_S2_Product &product, const ESA_S2_Band &band) const {
+	SubtileSplitSettings settings;
+
+	settings.output_size = (unsigned int) (tile_size / f_downscale);
+	settings.f_overlap = f_overlap;
+	settings.deflate_factor = deflate_factor;
+	settings.store_png = store_png;
+	settings.skip_existing = !overwrite_subtiles;
+	settings.manifest = product.manifest.is_open() ? &product.manifest : nullptr;
+	settings.params_hash = get_params_hash(band);
+
+	settings.png_prefix = band.path.stem().string();
+	settings.layer_name = ESA_S2_Image_Operator::data_type_name[band.data_type];
+	settings.product_name = get_product_name_from_path(band.path);
+	settings.aborted = &product.aborted;
+
+	return settings;
+}
+
+std::shared_ptr<const SubtilePlan> ESA_S2_Image::get_subtile_plan(ESA_S2_Product &product, const ESA_S2_Band &band, const Magick::Geometry &geometry) {
+	std::lock_guard<std::mutex> lock(product.plans_mutex);
+
+	std::tuple<int, unsigned int, unsigned int> key(band.data_resolution, geometry.width(), geometry.height());
+	auto it = product.plans.find(key);
+	if (it != product.plans.end())
+		return it->second;
+
+	std::shared_ptr<const SubtilePlan> plan = std::make_shared<const SubtilePlan>(
+		product.subtiles, product.path_dir_out, extract_index_date(band.path), product.aabb_buf,
+		geometry.width(), geometry.height(), tile_size, f_overlap, get_resolution_factor(band.data_resolution), product.valid_fractions);
+	product.plans[key] = plan;
+	return plan;
+}
+
+bool ESA_S2_Image::get_decode_window(ESA_S2_Product &product, const ESA_S2_Band &band, const Magick::Geometry &geometry,
+	size_t first, size_t last, int &x0, int &y0, int &x1, int &y1)
+{
+	return get_decode_window(*get_subtile_plan(product, band, geometry), geometry, first, last, x0, y0, x1, y1);
+}
+
+bool ESA_S2_Image::get_decode_window(const SubtilePlan &plan, const Magick::Geometry &geometry,
+	size_t first, size_t last, int &x0, int &y0, int &x1, int &y1)
+{
+	if (!plan.get_bounds(first, last, x0, y0, x1, y1))
+		return false;
+
+	x0 = std::max(x0, 0);
+	y0 = std::max(y0, 0);
+	x1 = std::min(x1, (int) geometry.width());
+	y1 = std::min(y1, (int) geometry.height());
+	return x1 > x0 && y1 > y0;
+}
+
+bool ESA_S2_Image::split_band(ESA_S2_Product &product, const ESA_S2_Band &band, size_t first, size_t last, ESA_S2_Image_Operator &op) {
+	typedef ESA_S2_Image_Operator O;
+
+	// Make room in the read-ahead window for the bands after this one.
+	prefetcher.consume(band.path);
+
+	if (product.aborted)
+		return false;
+
+	SubtileSplitSettings settings = get_split_settings(product, band);
+
+	// Wait until the decoded raster fits into the memory budget.
+	MemoryBudget::Reservation reservation(*memory_budget, band.memory_cost);
+
+	// Potential post-processing of each file, one sub-tile at a time.
+	auto on_subtile = [this, &product, &band, &op](const std::filesystem::path &path_dir_subtile) {
+		std::lock_guard<std::mutex> lock(op_mutex);
+		if (!op(path_dir_subtile, band.data_type)) {
+			product.aborted = true;
+			return false;
 		}
+		return true;
+	};
+
+	// Open the raster and split it with the transform which matches the data type.
+	auto split = [this, &product, &band, &settings, first, last, &on_subtile](auto &src, const auto &transform) {
+		src.image.set_deflate_level(deflate_factor);
+		src.image.set_num_threads(num_threads);
+		// Bands which are read as a whole are decoded while opening.
+		StageTimer timer_open(StageStats::ST_DECODE);
+		if (!src.open(band.path)) {
+			std::cerr << "ERROR: Failed to open " << band.path << std::endl;
+			return false;
+		}
+		timer_open.stop();
+		std::cout << "Processing " << band.path << std::endl;
+		std::shared_ptr<const SubtilePlan> plan = get_subtile_plan(product, band, src.image.main_geometry);
+		// PNG files are decoded from top to bottom, one row of sub-tiles at a time.
+		if (band.format == ESA_S2_Band::RF_PNG)
+			return split_subtiles(src, transform, band.path, settings, *plan, plan->get_row_major_order(first, last), on_subtile);
+		return split_subtiles(src, transform, band.path, settings, *plan, first, last, on_subtile);
+	};
+
+	SpectralTransform spectral(resampling_method_name);
+	ClassMapTransform scl(nullptr, 0, scl_value_map, max_scl_value);
+
+	// Bands which are read through GDAL are resampled by GDAL, too, except for the classification masks.
+	GDALRasterSource src_gdal;
+	if (band.read_gdal) {
+		src_gdal.output_size = settings.output_size;
+		src_gdal.resampling_method_name = resampling_method_name;
 	}
 
-	// Split Baetens & Hagolle classification maps with a 60 m resolution.
-	if (std::filesystem::is_directory(path_dir_in.string() + "/ref_dataset/Classification/")) {
-		for (const auto &classification_entry: std::filesystem::directory_iterator(path_dir_in.string() + "/ref_dataset/Classification/")) {
-			data_resolution = ESA_S2_Image_Operator::DR_60M;
-			if (endswith(classification_entry.path().string(), "classification_map.tif") && b[ESA_S2_Image_Operator::DT_BHC]) {
-				splitTIF(classification_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_BHC, data_resolution);
+	switch (band.format) {
+		case ESA_S2_Band::RF_JP2: {
+			if (band.read_gdal && band.data_type == O::DT_SCL) {
+				src_gdal.output_size = 0;
+				return split(src_gdal, scl);
+			} else if (band.read_gdal) {
+				return split(src_gdal, spectral);
 			}
+			JP2RasterSource src(!band.read_whole);
+			if (band.read_whole && src.image.load_header(band.path))
+				get_decode_window(product, band, src.image.main_geometry, first, last, src.decode_x0, src.decode_y0, src.decode_x1, src.decode_y1);
+			if (band.data_type == O::DT_SCL)
+				return split(src, scl);
+			return split(src, spectral);
 		}
-	}
-	// Split Francis & Mrziglod & Sidiropoulos classification maps with a 20 m resolution.
-	if (std::filesystem::is_directory(path_dir_in.string() + "/ref_dataset_mrziglod20/")) {
-		for (const auto &classification_entry: std::filesystem::directory_iterator(path_dir_in.string() + "/ref_dataset_mrziglod20/")) {
-			data_resolution = ESA_S2_Image_Operator::DR_20M;
-			if (endswith(classification_entry.path().string(), "classification_map.png") && b[ESA_S2_Image_Operator::DT_FMSC]) {
-				splitPNG(classification_entry.path(), path_dir_out, op, ESA_S2_Image_Operator::DT_FMSC, data_resolution);
+		case ESA_S2_Band::RF_TIF: {
+			TIFRasterSource src_tif;
+			auto split_tif = [&split, &band, &src_tif, &src_gdal](const auto &transform, bool spectral) {
+				if (!band.read_gdal)
+					return split(src_tif, transform);
+				if (!spectral)
+					src_gdal.output_size = 0;
+				return split(src_gdal, transform);
+			};
+			switch (band.data_type) {
+				case O::DT_BHC:
+					return split_tif(ClassMapTransform(O::bhc_scl_value_map, sizeof(O::bhc_scl_value_map), scl_value_map, max_scl_value), false);
+				case O::DT_FMC:
+					return split_tif(ClassMapTransform(O::fmc_scl_value_map, sizeof(O::fmc_scl_value_map), scl_value_map, max_scl_value), false);
+				case O::DT_GSFC:
+					return split_tif(ClassMapTransform(O::gsfc_scl_value_map, sizeof(O::gsfc_scl_value_map), scl_value_map, max_scl_value), false);
+				case O::DT_DL_L8S2_UV:
+					return split_tif(ClassMapTransform(O::dl_l8s2_uv_scl_value_map, sizeof(O::dl_l8s2_uv_scl_value_map), scl_value_map, max_scl_value), false);
+				case O::DT_MAJAC:
+					return split_tif(MajaClassMapTransform(maja_flags_format, scl_value_map, max_scl_value), false);
+				default:
+					return split_tif(spectral, true);
 			}
 		}
+		case ESA_S2_Band::RF_PNG: {
+			ESA_S2_Band band_cost = band;
+			choose_read_strategy(product, band_cost, 1);
+			MemoryBudget::Reservation reservation(*memory_budget, band_cost.memory_cost);
+			PNGRasterSource src;
+			switch (band.data_type) {
+				case O::DT_SS2C:
+					return split(src, ClassMapTransform(O::ss2c_scl_value_map, sizeof(O::ss2c_scl_value_map), scl_value_map, max_scl_value));
+				case O::DT_FMSC:
+					return split(src, ClassMapTransform(O::fmsc_scl_value_map, sizeof(O::fmsc_scl_value_map), scl_value_map, max_scl_value));
+				default:
+					return split(src, spectral);
+			}
+		}
+		default:
+			std::cerr << "ERROR: Unsupported file format " << band.path << std::endl;
 	}
-	// Split IPL-UV DL-L8S2-UV classification maps with a 10 m resolution.
-	if (std::filesystem::is_regular_file(path_dir_in.string() + "/dluvclouds_rgbiswir.tif") && b[ESA_S2_Image_Operator::DT_DL_L8S2_UV]) {
-		std::filesystem::path fpath(path_dir_in.string() + "/dluvclouds_rgbiswir.tif");
-		data_resolution = ESA_S2_Image_Operator::DR_10M;
-		splitTIF(fpath, path_dir_out, op, ESA_S2_Image_Operator::DT_DL_L8S2_UV, data_resolution);
-	}
-
-	return true;
+	return false;
 }
 
 /**
  * @brief Extract the projection, geo-coordinates from the Sentinel-2 product. Produce the subtile mask for processing a subset of the product.
+ * @param[in,out] product Reference to the product to store the subtile mask in.
  * @param[in] path_in Reference to the axis-aligned bounding box of the whole product.
  * @param[in] image_aabb Reference to the axis-aligned bounding box of the whole product.
  * @param[in] tile_size_div Effective pixel size, accounting the overlap.
  */
-void ESA_S2_Image::extract_geo(const std::filesystem::path &path_in, const AABB<int> &image_aabb, float tile_size_div) {
+void ESA_S2_Image::extract_geo(ESA_S2_Product &product, const std::filesystem::path &path_in, const AABB<int> &image_aabb, float tile_size_div) {
 	GDALDataset *p_dataset = (GDALDataset *) GDALOpen(path_in.string().c_str(), GA_ReadOnly);
 	if (p_dataset == NULL)
 		throw RasterException(path_in, "Failed to load with GDAL");
+	// The exceptions below only end the current product in batch mode, so the dataset is closed on every path.
+	std::unique_ptr<GDALDataset, void (*)(GDALDataset *)> dataset_guard(p_dataset, [](GDALDataset *d) { GDALClose(d); });
 	if (p_dataset->GetProjectionRef() != NULL) {
 		std::cout << "Projection: " << p_dataset->GetProjectionRef() << std::endl;
 	}
 
-	aabb_buf = AABB<float>(0, 0, 1, 1);
+	product.aabb_buf = AABB<float>(0, 0, 1, 1);
 
 	// If there's an area of interest polygon, then fill the subtile mask with the polygon.
-	subtile_mask.clear();
+	product.subtile_mask.clear();
 	if (wkt_geom_aoi.length() > 0) {
 		std::cout << "Projecting AOI polygon into pixel coordinates." << std::endl;
 
 		OGRGeometry *p_geom = nullptr;
 
 		wkt_to_geom(wkt_geom_aoi, &p_geom);
-		aoi_poly = proj_coords_to_raster<int>(p_geom, p_dataset);
+		product.aoi_poly = proj_coords_to_raster<int>(p_geom, p_dataset);
 		// Remove the last point, which is identical to the first.
-		aoi_poly.remove(aoi_poly.size() - 1);
+		product.aoi_poly.remove(product.aoi_poly.size() - 1);
 		// Increase the size of the polygon, to include overlap.
-		aoi_poly.scale(1.0f + f_overlap);
+		product.aoi_poly.scale(1.0f + f_overlap);
 		// Only keep the part of the polygon which is inside the raster.
-		aoi_poly.clip_to_aabb(image_aabb);
+		product.aoi_poly.clip_to_aabb(image_aabb);
 
-		//! \todo Use GDAL for reading raster data, too.
-
-		if (aoi_poly.area() > 0.00001) {
-			subtile_mask = fill_poly_overlap(image_aabb, aoi_poly, tile_size_div, true);
+		if (product.aoi_poly.area() > 0.00001) {
+			product.subtile_mask = SubtileGrid(fill_poly_overlap(image_aabb, product.aoi_poly, tile_size_div, true));
 
 			// Ensure that we have at least one subtile to process.
-			Vector<int> p;
-			unsigned int num_subtiles = 0;
-			for (p.x=0; p.x<(int)subtile_mask.size(); p.x++) {
-				for (p.y=0; p.y<(int)subtile_mask[p.x].size(); p.y++) {
-					num_subtiles += subtile_mask[p.x][p.y];
-				}
-			}
+			size_t num_subtiles = product.subtile_mask.count();
 			if (!num_subtiles)
 				throw RasterException("No subtiles for the overlap between the area of interest polygon and raster", path_in);
 			else
 				std::cout << "Number of subtiles in the area of interest polygon: " << num_subtiles << std::endl;
 		} else {
-			GDALClose(p_dataset);
 			throw RasterException("No overlap between the area of interest polygon and raster", path_in);
 		}
 	// Otherwise take all the subtiles.
 	} else {
-		subtile_mask = fill_whole(image_aabb, tile_size_div, 1);
-		if (subtile_mask.empty())
+		product.subtile_mask = SubtileGrid(fill_whole(image_aabb, tile_size_div, 1));
+		if (product.subtile_mask.empty())
 			throw RasterException("No subtiles for the raster", path_in);
 	}
-	GDALClose(p_dataset);
+	dataset_guard.reset();
 
 	// Apply a mask to the subtiles mask, if provided.
 	if (!limit_to_subtiles.empty()) {
-		std::vector<std::vector<unsigned char>> mask = fill_whole(image_aabb, tile_size_div, 0);
+		SubtileGrid mask(product.subtile_mask.get_width(), product.subtile_mask.get_height(), false);
 		for (unsigned int i=0; i<limit_to_subtiles.size(); i++) {
-			mask[limit_to_subtiles[i].x][limit_to_subtiles[i].y] = 1;
+			mask.set(limit_to_subtiles[i].x, limit_to_subtiles[i].y, true);
 		}
-		subtile_mask = apply_mask(subtile_mask, mask);
+		product.subtile_mask.intersect(mask);
 	}
 }
 
-//! \todo Generalize the splitting logic, to deduplicate code.
-
-bool ESA_S2_Image::splitJP2(const std::filesystem::path &path_in, const std::filesystem::path &path_dir_out, ESA_S2_Image_Operator &op, ESA_S2_Image_Operator::data_type_t data_type, ESA_S2_Image_Operator::data_resolution_t data_resolution) {
-	ESA_S2_Band_JP2_Image img_src;
-	NetCDFInterface nci;
-	bool retval = true;
-
-	float div_f = 1.0f;
-	if (data_resolution == ESA_S2_Image_Operator::DR_20M)
-		div_f = 2.0f;
-	else if (data_resolution == ESA_S2_Image_Operator::DR_60M)
-		div_f = 6.0f;
-
-	// With increased overlap, the effective subtile size is reduced.
-	float tile_size_div = (tile_size - tile_size * f_overlap) / div_f;
-
-	img_src.set_deflate_level(deflate_factor);
-	img_src.set_num_threads(num_threads);
-	nci.set_deflate_level(deflate_factor);
-
-	// Propagate overlap factor for NetCDF metadata.
-	img_src.f_overlap = f_overlap;
-	// Assign product name from the input path.
-	img_src.product_name = get_product_name_from_path(path_in);
-
-	// Either load the full image or load only the header.
-	if (read_tiled)
-		retval &= img_src.load_header(path_in);
-	else
-		retval &= img_src.load_whole(path_in);
-
-	std::cout << "Processing " << path_in << std::endl;
-
-	Vector<int> p;
-
-	// Extract image geo-coordinates, project area of interest polygon into pixel coordinates,
-	// and produce a subtile mask, unless all of this has already been done.
-	if (!geo_extracted) {
-		std::cout << "Extracting geo-coordinates." << std::endl;
-		AABB<int> image_aabb(img_src.main_geometry);
-		extract_geo(path_in, image_aabb, tile_size_div);
-		geo_extracted = true;
-	}
-
-	for (p.x=0; p.x<(int)subtile_mask.size(); p.x++) {
-		for (p.y=0; p.y<(int)subtile_mask[p.x].size(); p.y++) {
-			if (subtile_mask[p.x][p.y] == 1) {
-				std::ostringstream ss_path_out, ss_path_out_png, ss_path_out_nc;
-				ss_path_out << path_dir_out.string() << "/tile_" << p.x << "_" << p.y << "/";
-				ss_path_out_png << ss_path_out.str() << path_in.stem().string() << "_" << "tile" << "_" << p.x << "_" << p.y << ".png";
-				ss_path_out_nc << ss_path_out.str() << extract_index_date(path_in) << "_" << "tile" << "_" << p.x << "_" << p.y << ".nc";
-
-				std::filesystem::create_directories(ss_path_out.str());
-
-				// Skip the subtile if it's already stored in the NetCDF file and we haven't been asked to overwrite subtiles.
-				if (nci.has_layer(ss_path_out_nc.str(), ESA_S2_Image_Operator::data_type_name[data_type]) && !overwrite_subtiles)
-					continue;
+bool ESA_S2_Image::scan_subtiles(ESA_S2_Product &product, const ESA_S2_Band &band, scan_cache_t &decoded,
+	const std::function<void(const Vector<int> &p, const Magick::PixelPacket *px, size_t n)> &fn)
+{
+	// Only the band which is scanned now is kept, so that the task never waits for the memory budget
+	// while it holds a reservation of its own.
+	for (auto it = decoded.begin(); it != decoded.end();) {
+		if (it->first != band.path)
+			it = decoded.erase(it);
+		else
+			it++;
+	}
 
-				// Coordinates in the source image (possibly with different dimensions).
-				int sx0 = aabb_buf.vmin.x * img_src.main_geometry.width() + floor(tile_size_div * p.x);
-				int sy0 = aabb_buf.vmin.y * img_src.main_geometry.height() + floor(tile_size_div * p.y);
-				int sx1 = ceil(sx0 + tile_size_div);
-				int sy1 = ceil(sy0 + tile_size_div);
-
-				// It's possible that due to rounding errors, the tile would no longer be square.
-				// For this case, we'll crop the additional row / column of pixels to square the tile once again.
-				if (sx1 - sx0 > sy1 - sy0)
-					sx1 = sx0 + sy1 - sy0;
-				else if (sy1 - sy0 > sx1 - sx0)
-					sy1 = sy0 + sx1 - sx0;
-
-				// Account for overlap.
-				sx1 += tile_size * f_overlap / div_f;
-				sy1 += tile_size * f_overlap / div_f;
-
-				// Subset the source image.
-				if (read_tiled)
-					img_src.load_subset(path_in, sx0, sy0, sx1, sy1);
-				else
-					img_src.subset_whole(sx0, sy0, sx1, sy1);
-
-				// Remap pixel values for SCL.
-				if (data_type == ESA_S2_Image_Operator::DT_SCL) {
-					if (scl_value_map != nullptr)
-						img_src.remap_values(scl_value_map, max_scl_value);
-					// Scale SCL with point filter.
-					img_src.set_resampling_filter("point");
-					img_src.scale_to((unsigned int) (tile_size / f_downscale));
-				} else {
-					// Scale other images with sinc filter.
-					img_src.set_resampling_filter(resampling_method_name);
-					img_src.scale_to((unsigned int) (tile_size / f_downscale));
+	// From top to bottom, for the PNG files, which are decoded row by row.
+	std::vector<Vector<int>> subtiles = product.subtile_mask.get_subtiles(SubtileGrid::SO_ROW_MAJOR);
+
+	auto scan = [this, &product, &band, &subtiles, &fn](auto &src) {
+		const Magick::Geometry &geometry = src.image.main_geometry;
+		SubtilePlan plan(subtiles, product.path_dir_out, "", product.aabb_buf, geometry.width(), geometry.height(),
+			tile_size, f_overlap, get_resolution_factor(band.data_resolution));
+		for (size_t i=0; i<plan.size(); i++) {
+			const SubtileWindow &w = plan[i];
+			if (!w.skip && src.load(band.path, w.x0, w.y0, w.x1, w.y1) && src.image.subset != nullptr) {
+				unsigned int ww = w.x1 - w.x0;
+				unsigned int wh = w.y1 - w.y0;
+				fn(w.p, src.image.subset->getConstPixels(0, 0, ww, wh), (size_t) ww * wh);
+			} else {
+				fn(w.p, nullptr, 0);
+			}
+		}
+		return true;
+	};
+
+	switch (band.format) {
+		case ESA_S2_Band::RF_JP2: {
+			std::unique_ptr<JP2RasterSource> &src = decoded[band.path].src;
+			if (src == nullptr) {
+				src.reset(new JP2RasterSource(false));
+				src->image.set_num_threads(num_threads);
+				if (!src->image.load_header(band.path)) {
+					std::cerr << "ERROR: Failed to load " << band.path << std::endl;
+					decoded.erase(band.path);
+					return false;
 				}
 
-				if (img_src.subset->rows() != tile_size || img_src.subset->columns() != tile_size) {
-					std::cout << "Invalid geometry " << img_src.subset->rows() << "x" << img_src.subset->columns() << " for subtile " << p.x << ", " << p.y << std::endl;
+				// Only the part of the band which the sub-tiles cover is decoded, as in split_band().
+				const Magick::Geometry &geometry = src->image.main_geometry;
+				SubtilePlan plan(subtiles, product.path_dir_out, "", product.aabb_buf, geometry.width(), geometry.height(),
+					tile_size, f_overlap, get_resolution_factor(band.data_resolution));
+				if (get_decode_window(plan, geometry, 0, plan.size(), src->decode_x0, src->decode_y0, src->decode_x1, src->decode_y1)) {
+					// The decoded band is kept for the later scans, and so is its reservation.
+					uintmax_t cost = estimate_decoded_memory(src->decode_x1 - src->decode_x0, src->decode_y1 - src->decode_y0, src->image.main_num_components);
+					decoded[band.path].reservation.reset(new MemoryBudget::Reservation(*memory_budget, cost));
+					StageTimer timer_decode(StageStats::ST_DECODE);
+					if (!src->open(band.path)) {
+						std::cerr << "ERROR: Failed to load " << band.path << std::endl;
+						decoded.erase(band.path);
+						return false;
+					}
 				}
-
-				// Save PNG.
-				if (store_png)
-					img_src.save(ss_path_out_png.str());
-				// Add to NetCDF.
-				nci.add_to_file(ss_path_out_nc.str(), ESA_S2_Image_Operator::data_type_name[data_type], img_src);
-
-				// Potential post-processing of the file.
-				if (!op(ss_path_out.str(), data_type))
-					return false;
 			}
+			return scan(*src);
+		}
+		case ESA_S2_Band::RF_TIF: {
+			// TIF and PNG files are read window by window, so there's nothing to keep for the later scans.
+			ESA_S2_Band band_cost = band;
+			choose_read_strategy(product, band_cost, 1);
+			MemoryBudget::Reservation reservation(*memory_budget, band_cost.memory_cost);
+			TIFRasterSource src;
+			if (!src.open(band.path)) {
+				std::cerr << "ERROR: Failed to load " << band.path << std::endl;
+				return false;
+			}
+			return scan(src);
+		}
+		case ESA_S2_Band::RF_PNG: {
+			ESA_S2_Band band_cost = band;
+			choose_read_strategy(product, band_cost, 1);
+			MemoryBudget::Reservation reservation(*memory_budget, band_cost.memory_cost);
+			PNGRasterSource src;
+			if (!src.open(band.path)) {
+				std::cerr << "ERROR: Failed to load " << band.path << std::endl;
+				return false;
+			}
+			return scan(src);
 		}
+		default:
+			std::cerr << "ERROR: Unsupported file format " << band.path << std::endl;
 	}
-
-	return retval;
+	return false;
 }
 
-bool ESA_S2_Image::splitTIF(const std::filesystem::path &path_in, const std::filesystem::path &path_dir_out, ESA_S2_Image_Operator &op, ESA_S2_Image_Operator::data_type_t data_type, ESA_S2_Image_Operator::data_resolution_t data_resolution) {
-	ESA_S2_Image_Operator::data_type_t tmp_data_type = data_type;
-	TIF_Image img_src;
-	NetCDFInterface nci;
-	bool retval = true;
-
-	float div_f = 1.0f;
-	if (data_resolution == ESA_S2_Image_Operator::DR_20M)
-		div_f = 2.0f;
-	else if (data_resolution == ESA_S2_Image_Operator::DR_60M)
-		div_f = 6.0f;
-
-	float tile_size_div = (tile_size - tile_size * f_overlap) / div_f;
-
-	img_src.set_deflate_level(deflate_factor);
-	img_src.set_num_threads(num_threads);
-	nci.set_deflate_level(deflate_factor);
-
-	// Propagate overlap factor for NetCDF metadata.
-	img_src.f_overlap = f_overlap;
-
-	// Get image dimensions.
-	retval &= img_src.load_header(path_in);
-
-	std::cout << "Processing " << path_in << std::endl;
-
-	// NOTE:: Assume square images and square tiles.
-	int sx0, sy0, sx1, sy1;
-
-	// Iterate over tiles in the output raster.
-	Vector<int> p;
-	for (p.x=0; p.x<(int)subtile_mask.size(); p.x++) {
-		for (p.y=0; p.y<(int)subtile_mask[p.x].size(); p.y++) {
-			if (subtile_mask[p.x][p.y] == 1) {
-				std::ostringstream ss_path_out, ss_path_out_png, ss_path_out_nc;
-				ss_path_out << path_dir_out.string() << "/tile_" << p.x << "_" << p.y << "/";
-				ss_path_out_png << ss_path_out.str() << path_in.stem().string() << "_" << "tile" << "_" << p.x << "_" << p.y << ".png";
-				ss_path_out_nc << ss_path_out.str() << extract_index_date(path_in) << "_" << "tile" << "_" << p.x << "_" << p.y << ".nc";
-
-				std::filesystem::create_directories(ss_path_out.str());
-
-				// Skip the subtile if it's already stored in the NetCDF file and we haven't been asked to overwrite subtiles.
-				if (nci.has_layer(ss_path_out_nc.str(), ESA_S2_Image_Operator::data_type_name[data_type]) && !overwrite_subtiles)
-					continue;
-
-				// Coordinates in the source image (possibly with different dimensions).
-				sx0 = aabb_buf.vmin.x * img_src.main_geometry.width() + floor(tile_size_div * p.x);
-				sy0 = aabb_buf.vmin.y * img_src.main_geometry.height() + floor(tile_size_div * p.y);
-				sx1 = ceil(sx0 + tile_size_div);
-				sy1 = ceil(sy0 + tile_size_div);
-
-				// It's possible that due to rounding errors, the tile would no longer be square.
-				// For this case, we'll crop the additional row / column of pixels to square the tile once again.
-				if (sx1 - sx0 > sy1 - sy0)
-					sx1 = sx0 + sy1 - sy0;
-				else if (sy1 - sy0 > sx1 - sx0)
-					sy1 = sy0 + sx1 - sx0;
-
-				// Account for overlap.
-				sx1 += tile_size * f_overlap / div_f;
-				sy1 += tile_size * f_overlap / div_f;
-
-				// Load the source image.
-				img_src.load_subset(path_in, sx0, sy0, sx1, sy1);
-
-				// Remap pixel values from BHC, FMC or MAJAC into SCL and then from SCL into the desired classes.
-				// This helps to ensure that there's only a single place in code which is responsible for the mapping
-				// and that the mapping is configurable.
-				if (data_type == ESA_S2_Image_Operator::DT_BHC) {
-					img_src.remap_values(ESA_S2_Image_Operator::bhc_scl_value_map, sizeof(ESA_S2_Image_Operator::bhc_scl_value_map));
-					tmp_data_type = ESA_S2_Image_Operator::DT_SCL;
-				} else if (data_type == ESA_S2_Image_Operator::DT_FMC) {
-					img_src.remap_values(ESA_S2_Image_Operator::fmc_scl_value_map, sizeof(ESA_S2_Image_Operator::fmc_scl_value_map));
-					tmp_data_type = ESA_S2_Image_Operator::DT_SCL;
-				} else if (data_type == ESA_S2_Image_Operator::DT_MAJAC) {
-					CNES_MAJA_CLM_TIF::remap_majac_values(&img_src, maja_flags_format);
-					tmp_data_type = ESA_S2_Image_Operator::DT_SCL;
-				} else if (data_type == ESA_S2_Image_Operator::DT_GSFC) {
-					img_src.remap_values(ESA_S2_Image_Operator::gsfc_scl_value_map, sizeof(ESA_S2_Image_Operator::gsfc_scl_value_map));
-					tmp_data_type = ESA_S2_Image_Operator::DT_SCL;
-				} else if (data_type == ESA_S2_Image_Operator::DT_DL_L8S2_UV) {
-					img_src.remap_values(ESA_S2_Image_Operator::dl_l8s2_uv_scl_value_map, sizeof(ESA_S2_Image_Operator::dl_l8s2_uv_scl_value_map));
-					tmp_data_type = ESA_S2_Image_Operator::DT_SCL;
-				}
-				if (tmp_data_type == ESA_S2_Image_Operator::DT_SCL) {
-					if (scl_value_map != nullptr)
-						img_src.remap_values(scl_value_map, max_scl_value);
-					// Scale with point filter.
-					img_src.set_resampling_filter("point");
-					img_src.scale_to((unsigned int) (tile_size / f_downscale));
-				} else {
-					// Scale other images with sinc filter.
-					img_src.set_resampling_filter(resampling_method_name);
-					img_src.scale_to((unsigned int) (tile_size / f_downscale));
-				}
-
-				if (img_src.subset->rows() != tile_size || img_src.subset->columns() != tile_size) {
-					std::cout << "Invalid geometry " << img_src.subset->rows() << "x" << img_src.subset->columns() << " for subtile " << p.x << ", " << p.y << std::endl;
-				}
-
-				// Save PNG.
-				if (store_png)
-					img_src.save(ss_path_out_png.str());
-				// Add to NetCDF.
-				nci.add_to_file(ss_path_out_nc.str(), ESA_S2_Image_Operator::data_type_name[data_type], img_src);
+void ESA_S2_Image::eliminate_empty_subtiles(ESA_S2_Product &product, const std::vector<ESA_S2_Band> &inventory, scan_cache_t &decoded) {
+	// The smallest of the bands which mark no-data with 0, whether they're to be split or not.
+	const ESA_S2_Band *src_band = nullptr;
+	for (const ESA_S2_Band &band: inventory) {
+		if (band.format != ESA_S2_Band::RF_JP2 || (band.data_type != ESA_S2_Image_Operator::DT_B01 && band.data_type != ESA_S2_Image_Operator::DT_SCL))
+			continue;
+		if (src_band == nullptr || band.file_size < src_band->file_size)
+			src_band = &band;
+	}
+	if (src_band == nullptr) {
+		std::cerr << "WARNING: No B01 or SCL band to find the empty sub-tiles with in " << product.path_dir_in << ", keeping all of them" << std::endl;
+		return;
+	}
 
-				// Potential post-processing of the file.
-				if (!op(ss_path_out.str(), data_type))
-					return false;
-			}
+	// Windows outside of the raster count as no-data.
+	size_t num_subtiles = product.subtile_mask.count(), num_dropped = 0;
+	bool retval = scan_subtiles(product, *src_band, decoded, [this, &product, &num_dropped](const Vector<int> &p, const Magick::PixelPacket *px, size_t n) {
+		float fraction = get_valid_fraction(px, n);
+		if (fraction < min_valid) {
+			product.subtile_mask.set(p.x, p.y, false);
+			num_dropped++;
+		} else {
+			product.valid_fractions[std::make_pair(p.x, p.y)] = fraction;
 		}
+	});
+	if (!retval) {
+		std::cerr << "ERROR: Keeping all the sub-tiles of " << product.path_dir_in << std::endl;
+		return;
 	}
 
-	return retval;
+	std::cout << "Skipping " << num_dropped << " of " << num_subtiles << " sub-tiles with less than "
+		<< min_valid * 100.0f << "% of valid pixels in " << src_band->path.filename() << std::endl;
 }
 
-bool ESA_S2_Image::splitPNG(const std::filesystem::path &path_in, const std::filesystem::path &path_dir_out, ESA_S2_Image_Operator &op, ESA_S2_Image_Operator::data_type_t data_type, ESA_S2_Image_Operator::data_resolution_t data_resolution) {
-	ESA_S2_Image_Operator::data_type_t tmp_data_type = data_type;
-	PNG_Image img_src;
-	NetCDFInterface nci;
-	bool retval = true;
-
-	float div_f = 1.0f;
-	if (data_resolution == ESA_S2_Image_Operator::DR_20M)
-		div_f = 2.0f;
-	else if (data_resolution == ESA_S2_Image_Operator::DR_60M)
-		div_f = 6.0f;
-
-	float tile_size_div = (tile_size - tile_size * f_overlap) / div_f;
-
-	// Propagate overlap factor for NetCDF metadata.
-	img_src.f_overlap = f_overlap;
-
-	img_src.set_deflate_level(deflate_factor);
-	img_src.set_num_threads(num_threads);
-	nci.set_deflate_level(deflate_factor);
-
-	// Get image dimensions.
-	retval &= img_src.load_header(path_in);
-
-	std::cout << "Processing " << path_in << std::endl;
-
-	// NOTE:: Assume square images and square tiles.
-	int sx0, sy0, sx1, sy1;
-
-	// Iterate over tiles in the output raster.
-	Vector<int> p;
-	for (p.x=0; p.x<(int)subtile_mask.size(); p.x++) {
-		for (p.y=0; p.y<(int)subtile_mask[p.x].size(); p.y++) {
-			if (subtile_mask[p.x][p.y] == 1) {
-				std::ostringstream ss_path_out, ss_path_out_png, ss_path_out_nc;
-				ss_path_out << path_dir_out.string() << "/tile_" << p.x << "_" << p.y << "/";
-				ss_path_out_png << ss_path_out.str() << path_in.stem().string() << "_" << "tile" << "_" << p.x << "_" << p.y << ".png";
-				ss_path_out_nc << ss_path_out.str() << extract_index_date(path_in) << "_" << "tile" << "_" << p.x << "_" << p.y << ".nc";
+bool ESA_S2_Image::select_subtiles(ESA_S2_Product &product, const std::vector<ESA_S2_Band> &inventory, scan_cache_t &decoded) {
+	typedef ESA_S2_Image_Operator O;
 
-				std::filesystem::create_directories(ss_path_out.str());
+	// Histograms of the 8-bit values of each band, per sub-tile.
+	std::map<std::pair<int, int>, std::map<std::string, SubtileSelector::histogram_t>> histograms;
 
-				// Skip the subtile if it's already stored in the NetCDF file and we haven't been asked to overwrite subtiles.
-				if (nci.has_layer(ss_path_out_nc.str(), ESA_S2_Image_Operator::data_type_name[data_type]) && !overwrite_subtiles)
+	for (const std::string &name: selector.get_bands()) {
+		auto it = std::find_if(inventory.begin(), inventory.end(), [&name](const ESA_S2_Band &band) {
+			return O::data_type_name[band.data_type] == name;
+		});
+		if (it == inventory.end()) {
+			std::cerr << "ERROR: No " << name << " band to select the sub-tiles with in " << product.path_dir_in << std::endl;
+			return false;
+		}
+		// Classes of the scene classification are compared after the mapping into the desired classes.
+		const unsigned char *value_map = it->data_type == O::DT_SCL ? scl_value_map : nullptr;
+
+		// Pixels of the classes which the band marks as no-data are left out of the fractions,
+		// so that the sub-tiles at the edges of the swath aren't diluted by them.
+		std::array<bool, 256> no_data;
+		no_data.fill(false);
+		const unsigned char *class_map = nullptr;
+		size_t class_map_size = 0;
+		switch (it->data_type) {
+			case O::DT_SCL: no_data[0] = true; break;
+			case O::DT_BHC: class_map = O::bhc_scl_value_map; class_map_size = sizeof(O::bhc_scl_value_map); break;
+			case O::DT_FMC: class_map = O::fmc_scl_value_map; class_map_size = sizeof(O::fmc_scl_value_map); break;
+			case O::DT_SS2C: class_map = O::ss2c_scl_value_map; class_map_size = sizeof(O::ss2c_scl_value_map); break;
+			case O::DT_FMSC: class_map = O::fmsc_scl_value_map; class_map_size = sizeof(O::fmsc_scl_value_map); break;
+			case O::DT_GSFC: class_map = O::gsfc_scl_value_map; class_map_size = sizeof(O::gsfc_scl_value_map); break;
+			case O::DT_DL_L8S2_UV: class_map = O::dl_l8s2_uv_scl_value_map; class_map_size = sizeof(O::dl_l8s2_uv_scl_value_map); break;
+			default: break;
+		}
+		// The last class of a map stands for all the values from its index up.
+		for (size_t v=0; class_map != nullptr && v<no_data.size(); v++)
+			no_data[v] = class_map[std::min(v, class_map_size - 1)] == 0;
+
+		bool retval = scan_subtiles(product, *it, decoded, [this, &histograms, &name, value_map, &no_data](const Vector<int> &p, const Magick::PixelPacket *px, size_t n) {
+			SubtileSelector::histogram_t &h = histograms[std::make_pair(p.x, p.y)][name];
+			h.fill(0);
+			for (size_t i=0; i<n; i++) {
+				unsigned char v = (unsigned char) lround(255.0 * px[i].green / MaxRGB);
+				if (no_data[v])
 					continue;
-
-				// Coordinates in the source image (possibly with different dimensions).
-				sx0 = aabb_buf.vmin.x * img_src.main_geometry.width() + floor(tile_size_div * p.x);
-				sy0 = aabb_buf.vmin.y * img_src.main_geometry.height() + floor(tile_size_div * p.y);
-				sx1 = ceil(sx0 + tile_size_div);
-				sy1 = ceil(sy0 + tile_size_div);
-
-				// It's possible that due to rounding errors, the tile would no longer be square.
-				// For this case, we'll crop the additional row / column of pixels to square the tile once again.
-				if (sx1 - sx0 > sy1 - sy0)
-					sx1 = sx0 + sy1 - sy0;
-				else if (sy1 - sy0 > sx1 - sx0)
-					sy1 = sy0 + sx1 - sx0;
-
-				// Account for overlap.
-				sx1 += tile_size * f_overlap / div_f;
-				sy1 += tile_size * f_overlap / div_f;
-
-				// Load the source image.
-				img_src.load_subset(path_in, sx0, sy0, sx1, sy1);
-
-				// Remap pixel values from SS2C or FMSC into SCL and then from SCL into the desired classes.
-				// This helps to ensure that there's only a single place in code which is responsible for the mapping
-				// and that the mapping is configurable.
-				if (data_type == ESA_S2_Image_Operator::DT_SS2C) {
-					img_src.remap_values(ESA_S2_Image_Operator::ss2c_scl_value_map, sizeof(ESA_S2_Image_Operator::ss2c_scl_value_map));
-					tmp_data_type = ESA_S2_Image_Operator::DT_SCL;
-				} else if (data_type == ESA_S2_Image_Operator::DT_FMSC) {
-					img_src.remap_values(ESA_S2_Image_Operator::fmsc_scl_value_map, sizeof(ESA_S2_Image_Operator::fmsc_scl_value_map));
-					tmp_data_type = ESA_S2_Image_Operator::DT_SCL;
-				}
-				if (tmp_data_type == ESA_S2_Image_Operator::DT_SCL) {
-					if (scl_value_map != nullptr)
-						img_src.remap_values(scl_value_map, max_scl_value);
-					// Scale with point filter.
-					img_src.set_resampling_filter("point");
-					img_src.scale_to((unsigned int) (tile_size / f_downscale));
-				} else {
-					// Scale other images with sinc filter.
-					img_src.set_resampling_filter(resampling_method_name);
-					img_src.scale_to((unsigned int) (tile_size / f_downscale));
-				}
-
-				if (img_src.subset->rows() != tile_size || img_src.subset->columns() != tile_size) {
-					std::cout << "Invalid geometry " << img_src.subset->rows() << "x" << img_src.subset->columns() << " for subtile " << p.x << ", " << p.y << std::endl;
-				}
-
-				// Save PNG.
-				if (store_png)
-					img_src.save(ss_path_out_png.str());
-				// Add to NetCDF.
-				nci.add_to_file(ss_path_out_nc.str(), ESA_S2_Image_Operator::data_type_name[data_type], img_src);
-
-				// Potential post-processing of the file.
-				if (!op(ss_path_out.str(), data_type))
-					return false;
+				if (value_map != nullptr)
+					v = value_map[std::min(v, max_scl_value)];
+				h[v]++;
 			}
-		}
+		});
+		if (!retval)
+			return false;
 	}
 
-	return retval;
+	size_t num_subtiles = product.subtile_mask.count(), num_selected = 0;
+	for (const Vector<int> &p: product.subtile_mask.get_subtiles()) {
+		if (selector.evaluate(histograms[std::make_pair(p.x, p.y)]))
+			num_selected++;
+		else
+			product.subtile_mask.set(p.x, p.y, false);
+	}
+	std::cout << "Selected " << num_selected << " of " << num_subtiles << " sub-tiles in " << product.path_dir_in << std::endl;
+	return true;
 }
@@ -0,0 +1,70 @@
+// Remapping, resampling and conversion of classification masks in a single pass
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "raster/fused_class_map.hpp"
+#include "util/stage_stats.hpp"
+#include "util/worker_arena.hpp"
+
+
+FusedClassMap::FusedClassMap(): num_maps(0) {}
+
+void FusedClassMap::add_classes(const PixelKernels::class_table_t &table) {
+	if (num_maps == 0) {
+		classes = table;
+	} else {
+		// The next map looks up the 8-bit value of the pixel which the previous maps produced.
+		const uint8_t *lut = PixelKernels::get_value_lut();
+		for (unsigned int i=0; i<256; i++)
+			classes[i] = table[lut[classes[i].green]];
+	}
+	num_maps++;
+
+	PixelKernels::pixels_to_ubyte(classes.data(), classes.size(), values_ubyte.data());
+	PixelKernels::pixels_to_float(classes.data(), classes.size(), values_float.data());
+}
+
+bool FusedClassMap::apply(RasterImage &image, unsigned int size, const void *&px_out) const {
+	if (num_maps == 0 || image.subset == nullptr || image.subset->type() != Magick::GrayscaleType)
+		return false;
+
+	// Non-square subsets would be resized with their aspect ratio kept.
+	unsigned int w = image.subset->columns();
+	unsigned int h = image.subset->rows();
+	// The index only changes with the size of the subset, so its memory is kept by the thread.
+	static thread_local std::vector<uint32_t> index;
+	if (w != h || !PixelKernels::point_sample_index(w, size, index))
+		return false;
+
+	image.set_resampling_filter("point");
+	if (w != size)
+		image.scaling_factor = ((float) size) / ((float) w);
+
+	StageTimer timer(StageStats::ST_REMAP, (uint64_t) w * h * sizeof(Magick::PixelPacket));
+	const Magick::PixelPacket *px = image.subset->getConstPixels(0, 0, w, h);
+	const uint8_t *lut = PixelKernels::get_value_lut();
+	size_t n = (size_t) size * size;
+	WorkerArena &arena = WorkerArena::get_current();
+	if (image.main_depth > 8) {
+		float *dst = arena.get<float>(WorkerArena::SLOT_FUSED, n);
+		PixelKernels::remap_resample(px, w, lut, values_float.data(), index, index, dst);
+		px_out = dst;
+	} else {
+		unsigned char *dst = arena.get<unsigned char>(WorkerArena::SLOT_FUSED, n);
+		PixelKernels::remap_resample(px, w, lut, values_ubyte.data(), index, index, dst);
+		px_out = dst;
+	}
+	return true;
+}
@@ -0,0 +1,185 @@
+// Windowed loading of any raster supported by GDAL
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "raster/gdal_image.hpp"
+#include "util/worker_arena.hpp"
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <vector>
+
+// GDAL
+#include <gdal_priv.h>
+
+
+GDAL_Image::GDAL_Image(): dataset(nullptr), sample_scale(1.0f) {}
+
+GDAL_Image::~GDAL_Image() {
+	close_dataset();
+}
+
+void GDAL_Image::set_cache_max(uintmax_t bytes) {
+	GDALSetCacheMax64((GIntBig) bytes);
+}
+
+bool GDAL_Image::open_dataset(const std::filesystem::path &path) {
+	if (dataset != nullptr && dataset_path == path)
+		return true;
+	close_dataset();
+
+	dataset = (GDALDataset *) GDALOpen(path.string().c_str(), GA_ReadOnly);
+	if (dataset == nullptr) {
+		std::cerr << "ERROR: GDAL: Failed to open " << path << std::endl;
+		return false;
+	}
+	if (dataset->GetRasterCount() < 1) {
+		std::cerr << "ERROR: GDAL: No raster bands in " << path << std::endl;
+		close_dataset();
+		return false;
+	}
+	dataset_path = path;
+	return true;
+}
+
+void GDAL_Image::close_dataset() {
+	if (dataset != nullptr)
+		GDALClose(dataset);
+	dataset = nullptr;
+	dataset_path.clear();
+}
+
+bool GDAL_Image::get_gdal_resampling(const std::string &resampling_name, int &alg) {
+	if (resampling_name == "point")
+		alg = GRIORA_NearestNeighbour;
+	else if (resampling_name == "box")
+		alg = GRIORA_Average;
+	else if (resampling_name == "linear")
+		alg = GRIORA_Bilinear;
+	else if (resampling_name == "cubic")
+		alg = GRIORA_Cubic;
+	else if (resampling_name == "lanczos")
+		alg = GRIORA_Lanczos;
+	else if (resampling_name == "gaussian")
+		alg = GRIORA_Gauss;
+	else
+		return false;
+	return true;
+}
+
+bool GDAL_Image::load_header(const std::filesystem::path &path) {
+	if (subset != nullptr)
+		clear();
+
+	if (!open_dataset(path))
+		return false;
+
+	main_geometry.width(dataset->GetRasterXSize());
+	main_geometry.height(dataset->GetRasterYSize());
+	main_num_components = dataset->GetRasterCount() == 3 ? 3 : 1;
+
+	GDALDataType type = dataset->GetRasterBand(1)->GetRasterDataType();
+	main_depth = std::min(GDALGetDataTypeSizeBytes(type) * 8, 16);
+
+	// Normalize integers the same way as the other loaders do.
+	switch (type) {
+		case GDT_Byte: sample_scale = 1.0f / 255.0f; break;
+		case GDT_UInt16: sample_scale = 1.0f / 65535.0f; break;
+		case GDT_Int16: sample_scale = 1.0f / 32767.0f; break;
+		case GDT_UInt32: sample_scale = 1.0f / 4294967295.0f; break;
+		case GDT_Int32: sample_scale = 1.0f / 2147483647.0f; break;
+		default: sample_scale = 1.0f;
+	}
+
+	return true;
+}
+
+bool GDAL_Image::load_subset(const std::filesystem::path &path, unsigned int da_x0, unsigned int da_y0, unsigned int da_x1, unsigned int da_y1,
+	unsigned int out_size, const std::string &resampling_name)
+{
+	if (dataset == nullptr || dataset_path != path) {
+		if (!load_header(path))
+			return false;
+	}
+
+	unsigned int width = main_geometry.width();
+	unsigned int height = main_geometry.height();
+	if (da_x0 >= width || da_y0 >= height || da_x1 <= da_x0 || da_y1 <= da_y0)
+		return false;
+
+	unsigned int w = da_x1 - da_x0;
+	unsigned int h = da_y1 - da_y0;
+
+	// Let GDAL resample (from an overview, when downscaling) if it has a matching method.
+	GDALRasterIOExtraArg extra;
+	INIT_RASTERIO_EXTRA_ARG(extra);
+	int alg = GRIORA_NearestNeighbour;
+	unsigned int ow = w, oh = h;
+	if (out_size > 0 && get_gdal_resampling(resampling_name, alg)) {
+		extra.eResampleAlg = (GDALRIOResampleAlg) alg;
+		ow = oh = out_size;
+	}
+
+	// Only the part within the raster is read, the rest is left at 0.
+	unsigned int cw = std::min(da_x1, width) - da_x0;
+	unsigned int ch = std::min(da_y1, height) - da_y0;
+	unsigned int ocw = std::min(ow, (unsigned int) lround((double) cw * ow / w));
+	unsigned int och = std::min(oh, (unsigned int) lround((double) ch * oh / h));
+	if (ocw == 0 || och == 0)
+		return false;
+
+	size_t size = (size_t) ow * oh;
+	float *buf = WorkerArena::get_current().get<float>(WorkerArena::SLOT_PLANES, size * main_num_components);
+	if (ocw < ow || och < oh)
+		std::fill(buf, buf + size * main_num_components, 0.0f);
+	float *planes[3] = {buf, buf + size, buf + (main_num_components == 3 ? 2 * size : 0)};
+	for (unsigned int c = 0; c < main_num_components; c++) {
+		CPLErr err = dataset->GetRasterBand(c + 1)->RasterIO(GF_Read, da_x0, da_y0, cw, ch, planes[c], ocw, och,
+			GDT_Float32, sizeof(float), (GSpacing) ow * sizeof(float), &extra);
+		if (err != CE_None) {
+			std::cerr << "ERROR: GDAL: Failed to read " << da_x0 << ", " << da_y0 << ", " << da_x1 << ", " << da_y1
+				<< " of " << path << ": " << CPLGetLastErrorMsg() << std::endl;
+			return false;
+		}
+	}
+
+	reset_subset(ow, oh);
+	if (main_num_components == 1)
+		subset->type(Magick::GrayscaleType);
+	else
+		subset->type(Magick::TrueColorType);
+	subset->quiet(false);
+	subset->depth((int) main_depth);
+	subset->endian(Magick::LSBEndian);
+	// Set on every load, as the same raster may be reused for windows which aren't resampled.
+	scaling_factor = ((float) ow) / ((float) w);
+
+	auto sample = [this](float v) {
+		v *= sample_scale;
+		return v < 0 ? 0.0f : v;
+	};
+
+	Magick::PixelPacket *px = subset->getPixels(0, 0, ow, oh);
+	if (main_num_components == 1) {
+		for (size_t i = 0; i < size; i++)
+			px[i] = Magick::ColorGray(sample(planes[0][i]));
+	} else {
+		for (size_t i = 0; i < size; i++)
+			px[i] = Magick::ColorRGB(sample(planes[0][i]), sample(planes[1][i]), sample(planes[2][i]));
+	}
+	subset->syncPixels();
+
+	return true;
+}
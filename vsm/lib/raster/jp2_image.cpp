@@ -15,13 +15,67 @@
 // limitations under the License.
 
 #include "raster/jp2_image.hpp"
+#include "raster/pixel_kernels.hpp"
+#include "util/worker_arena.hpp"
+#include "util/zip_archive.hpp"
 #include <openjpeg.h>
+#include <algorithm>
 #include <cstring>
+#include <vector>
 
 #define JP2_CFMT	1
 
 
-JP2_Image::JP2_Image(): whole_image(nullptr) {}
+static OPJ_SIZE_T zip_stream_read(void *buffer, OPJ_SIZE_T n, void *user_data) {
+	size_t r = ((ZipMemberReader *) user_data)->read(buffer, n);
+	return r > 0 ? r : (OPJ_SIZE_T) -1;
+}
+
+static OPJ_OFF_T zip_stream_skip(OPJ_OFF_T n, void *user_data) {
+	ZipMemberReader *reader = (ZipMemberReader *) user_data;
+	if (!reader->seek(reader->tell() + n))
+		return -1;
+	return n;
+}
+
+static OPJ_BOOL zip_stream_seek(OPJ_OFF_T offset, void *user_data) {
+	return ((ZipMemberReader *) user_data)->seek(offset) ? OPJ_TRUE : OPJ_FALSE;
+}
+
+static void zip_stream_free(void *user_data) {
+	delete (ZipMemberReader *) user_data;
+}
+
+/**
+ * Create an OpenJPEG stream from a JP2 file, or from a file within a ZIP archive.
+ * @param[in] path Reference to the file path or the virtual path of a file within an archive.
+ * @return Pointer to the stream, or nullptr on failure.
+ */
+static opj_stream_t *create_stream(const std::filesystem::path &path) {
+	if (!ZipArchive::is_member_path(path))
+		return opj_stream_create_default_file_stream(path.string().c_str(), OPJ_TRUE);
+
+	ZipMemberReader *reader = new ZipMemberReader();
+	if (!reader->open(path)) {
+		delete reader;
+		return nullptr;
+	}
+
+	opj_stream_t *l_stream = opj_stream_create(OPJ_J2K_STREAM_CHUNK_SIZE, OPJ_TRUE);
+	if (!l_stream) {
+		delete reader;
+		return nullptr;
+	}
+	opj_stream_set_read_function(l_stream, zip_stream_read);
+	opj_stream_set_skip_function(l_stream, zip_stream_skip);
+	opj_stream_set_seek_function(l_stream, zip_stream_seek);
+	opj_stream_set_user_data(l_stream, reader, zip_stream_free);
+	opj_stream_set_user_data_length(l_stream, reader->size());
+	return l_stream;
+}
+
+
+JP2_Image::JP2_Image(): tile_width(0), tile_height(0), whole_image(nullptr), whole_x0(0), whole_y0(0) {}
 JP2_Image::~JP2_Image() {
 	if (whole_image != nullptr)
 		delete whole_image;
@@ -57,7 +111,7 @@ bool JP2_Image::load_header(const std::filesystem::path &path) {
 
 	try {
 		// Create a stream from the file.
-		l_stream = opj_stream_create_default_file_stream(path.string().c_str(), OPJ_TRUE);
+		l_stream = create_stream(path);
 		if (!l_stream) {
 			std::cerr << "ERROR: OpenJPEG: Failed to create stream from " << path << std::endl;
 			throw std::exception();
@@ -103,6 +157,18 @@ bool JP2_Image::load_header(const std::filesystem::path &path) {
 			main_depth = 16;
 
 		main_num_components = l_image->numcomps;
+
+		// The tile grid of the codestream, which sub-tiles are best processed along.
+		tile_width = main_geometry.width();
+		tile_height = main_geometry.height();
+		opj_codestream_info_v2_t *cstr_info = opj_get_cstr_info(l_codec);
+		if (cstr_info != nullptr) {
+			if (cstr_info->tdx > 0 && cstr_info->tdy > 0) {
+				tile_width = cstr_info->tdx;
+				tile_height = cstr_info->tdy;
+			}
+			opj_destroy_cstr_info(&cstr_info);
+		}
 		
 		std::cout << "INFO: Image size: " << l_image->x0 << ", " << l_image->y0 << ", " << l_image->x1 << ", " << l_image->y1 << std::endl;
 		std::cout << "INFO: Number of pixel components: " << l_image->numcomps << " with depth: " << (int) main_depth << std::endl;
@@ -132,8 +198,9 @@ bool JP2_Image::load_subset(const std::filesystem::path &path, int da_x0, int da
 	opj_image_t* l_image = nullptr;
 
 	opj_stream_t* l_stream = nullptr;
-	OPJ_BYTE* l_data = (OPJ_BYTE *) malloc(10 * 1024 * 1024);
-	OPJ_UINT32 l_max_data_size = 10 * 1024 * 1024;
+	// The tile buffer of the thread is kept from one window to the next.
+	WorkerArena &arena = WorkerArena::get_current();
+	OPJ_BYTE* l_data = nullptr;
 	OPJ_UINT32 l_data_size;
 	OPJ_UINT32 l_tile_index;
 	OPJ_INT32 l_ctile_x0, l_ctile_y0, l_ctile_x1, l_ctile_y1;
@@ -142,7 +209,7 @@ bool JP2_Image::load_subset(const std::filesystem::path &path, int da_x0, int da
 
 	try {
 		// Create a stream from the file.
-		l_stream = opj_stream_create_default_file_stream(path.string().c_str(), OPJ_TRUE);
+		l_stream = create_stream(path);
 		if (!l_stream) {
 			std::cerr << "ERROR: OpenJPEG: Failed to create stream from " << path << std::endl;
 			throw std::exception();
@@ -169,6 +236,13 @@ bool JP2_Image::load_subset(const std::filesystem::path &path, int da_x0, int da
 			throw std::exception();
 		}
 
+		// Grow the tile buffer to a whole tile of the codestream once, rather than tile by tile.
+		opj_codestream_info_v2_t *cstr_info = opj_get_cstr_info(l_codec);
+		if (cstr_info != nullptr) {
+			arena.reserve(WorkerArena::SLOT_JP2_TILE, (size_t) cstr_info->tdx * cstr_info->tdy * cstr_info->nbcomps * sizeof(OPJ_INT32));
+			opj_destroy_cstr_info(&cstr_info);
+		}
+
 		//! \note ESA S2 JP2 headers lack colorspace info. It seems that pixels are stored as RGB instead of YUV.
 
 		int da_x1_clamped = da_x1, da_y1_clamped = da_y1;
@@ -187,16 +261,11 @@ bool JP2_Image::load_subset(const std::filesystem::path &path, int da_x0, int da
 			throw std::exception();
 		}
 
-		if (subset != nullptr)
-			clear();
-
-		if (main_num_components == 1) {
-			subset = new Magick::Image(Magick::Geometry(w, h), Magick::ColorGray(0));
+		reset_subset(w, h);
+		if (main_num_components == 1)
 			subset->type(Magick::GrayscaleType);
-		} else if (main_num_components == 3) {
-			subset = new Magick::Image(Magick::Geometry(w, h), Magick::ColorRGB(0, 0, 0));
+		else if (main_num_components == 3)
 			subset->type(Magick::TrueColorType);
-		}
 		subset->quiet(false);
 		subset->depth((int) main_depth);
 		subset->endian(Magick::LSBEndian);
@@ -213,17 +282,8 @@ bool JP2_Image::load_subset(const std::filesystem::path &path, int da_x0, int da
 
 			// Process until we run out of tiles.
 			if (l_continue) {
-				// We have a tile which is larger than the buffer which we have allocated?
-				if (l_data_size > l_max_data_size) {
-					OPJ_BYTE *l_new_data = (OPJ_BYTE *) realloc(l_data, l_data_size);
-					if (!l_new_data) {
-						std::cerr << "ERROR: OpenJPEG: Failed to reallocate from "
-							<< l_max_data_size << " to " << l_data_size << std::endl;
-						throw std::exception();
-					}
-					l_data = l_new_data;
-					l_max_data_size = l_data_size;
-				}
+				// Grows the buffer, if the tile is larger than any before it.
+				l_data = arena.get<OPJ_BYTE>(WorkerArena::SLOT_JP2_TILE, l_data_size);
 
 				// Read and decompress tile contents.
 				if (!opj_decode_tile_data(l_codec, l_tile_index, l_data, l_data_size, l_stream)) {
@@ -292,8 +352,6 @@ bool JP2_Image::load_subset(const std::filesystem::path &path, int da_x0, int da
 	}
 
 	// Free the allocated memory (if any).
-	if (l_data != nullptr)
-		free(l_data);
 	if (l_stream != nullptr)
 		opj_stream_destroy(l_stream);
 	if (l_codec != nullptr)
@@ -303,7 +361,7 @@ bool JP2_Image::load_subset(const std::filesystem::path &path, int da_x0, int da
 	return retval;
 }
 
-bool JP2_Image::load_whole(const std::filesystem::path &path) {
+bool JP2_Image::load_whole(const std::filesystem::path &path, int da_x0, int da_y0, int da_x1, int da_y1) {
 	// Used as reference:
 	//  https://github.com/uclouvain/openjpeg/blob/master/tests/unit/testempty2.c
 	//  https://web.archive.org/web/20180423091842/http://www.equasys.de/colorconversion.html
@@ -318,7 +376,7 @@ bool JP2_Image::load_whole(const std::filesystem::path &path) {
 
 	try {
 		// Create a stream from the file.
-		l_stream = opj_stream_create_default_file_stream(path.string().c_str(), OPJ_TRUE);
+		l_stream = create_stream(path);
 		if (!l_stream) {
 			std::cerr << "ERROR: OpenJPEG: Failed to create stream from " << path << std::endl;
 			throw std::exception();
@@ -354,25 +412,47 @@ bool JP2_Image::load_whole(const std::filesystem::path &path) {
 
 		if (whole_image != nullptr)
 			delete whole_image;
+		whole_image = nullptr;
 		if (subset != nullptr)
 			clear();
 
 		int w = l_image->x1 - l_image->x0;
 		int h = l_image->y1 - l_image->y0;
-		unsigned long size = w * h;
 
 		main_geometry.xOff(l_image->x0);
 		main_geometry.yOff(l_image->y0);
 		main_geometry.width(w);
 		main_geometry.height(h);
 
+		// Decode only the window, if there is one within the image.
+		da_x0 = std::max(da_x0, 0);
+		da_y0 = std::max(da_y0, 0);
+		da_x1 = std::min(da_x1, w);
+		da_y1 = std::min(da_y1, h);
+		if (da_x1 > da_x0 && da_y1 > da_y0 && (da_x1 - da_x0 < w || da_y1 - da_y0 < h)) {
+			if (!opj_set_decode_area(l_codec, l_image, da_x0, da_y0, da_x1, da_y1)) {
+				std::cerr << "ERROR: OpenJPEG: Failed to set decoded area " <<
+					da_x0 << ", " << da_y0 << ", " << da_x1 << ", " << da_y1 << " for " << path << std::endl;
+				throw std::exception();
+			}
+			std::cout << "INFO: Decode window: " << da_x0 << ", " << da_y0 << ", " << da_x1 << ", " << da_y1 << std::endl;
+			whole_x0 = da_x0;
+			whole_y0 = da_y0;
+		} else {
+			whole_x0 = 0;
+			whole_y0 = 0;
+		}
+
 		float f;
+		uint32_t num_values;
 		if (l_image->comps->prec <= 8) {
 			main_depth = 8;
 			f = 1 / 255.0f;
+			num_values = 256;
 		} else {
 			main_depth = 16;
 			f = 1 / 65535.0f;
+			num_values = 65536;
 		}
 
 		main_num_components = l_image->numcomps;
@@ -386,6 +466,11 @@ bool JP2_Image::load_whole(const std::filesystem::path &path) {
 			throw std::exception();
 		}
 
+		// Size of the decoded window.
+		w = l_image->comps[0].w;
+		h = l_image->comps[0].h;
+		unsigned long size = (unsigned long) w * h;
+
 		if (main_num_components == 1) {
 			whole_image = new Magick::Image(Magick::Geometry(w, h), Magick::ColorGray(0));
 			whole_image->type(Magick::GrayscaleType);
@@ -393,12 +478,7 @@ bool JP2_Image::load_whole(const std::filesystem::path &path) {
 			whole_image->depth((int) main_depth);
 			whole_image->endian(Magick::LSBEndian);
 
-			Magick::ColorGray col;
-			Magick::PixelPacket *px = whole_image->getPixels(0, 0, w, h);
-			for (unsigned long i=0; i<size; i++) {
-				col.shade(l_image->comps[0].data[i] * f);
-				px[i] = col;
-			}
+			component_to_pixels(l_image->comps[0].data, size, f, num_values, whole_image->getPixels(0, 0, w, h));
 		} else if (main_num_components == 3) {
 			whole_image = new Magick::Image(Magick::Geometry(w, h), Magick::ColorRGB(0, 0, 0));
 			whole_image->type(Magick::TrueColorType);
@@ -440,44 +520,69 @@ bool JP2_Image::load_whole(const std::filesystem::path &path) {
 
 bool JP2_Image::subset_whole(int da_x0, int da_y0, int da_x1, int da_y1) {
 	Magick::Geometry f_geom = whole_image->size();
-	unsigned long w = da_x1 - da_x0;
-	unsigned long h = da_y1 - da_y0;
-	unsigned long w_clamped = w, h_clamped = h;
+	int w = da_x1 - da_x0;
+	int h = da_y1 - da_y0;
 
 	// Region of interest outside the image?
-	if (da_x0 > (int) f_geom.width() || da_y0 > (int) f_geom.height())
+	if (da_x0 > (int) main_geometry.width() || da_y0 > (int) main_geometry.height())
 		return false;
 
-	if (da_x0 + w >= f_geom.width())
-		w_clamped = f_geom.width() - da_x0;
-	if (da_y0 + h >= f_geom.height())
-		h_clamped = f_geom.height() - da_y0;
-
-	if (subset != nullptr)
-		clear();
+	// Intersection of the region of interest and the decoded window, relative to the window.
+	int ix0 = std::max(da_x0 - whole_x0, 0);
+	int iy0 = std::max(da_y0 - whole_y0, 0);
+	int ix1 = std::min(da_x1 - whole_x0, (int) f_geom.width());
+	int iy1 = std::min(da_y1 - whole_y0, (int) f_geom.height());
 
-	if (main_num_components == 1) {
-		subset = new Magick::Image(Magick::Geometry(w, h), Magick::ColorGray(0));
+	reset_subset(w, h);
+	if (main_num_components == 1)
 		subset->type(Magick::GrayscaleType);
-	} else if (main_num_components == 3) {
-		subset = new Magick::Image(Magick::Geometry(w, h), Magick::ColorRGB(0, 0, 0));
+	else if (main_num_components == 3)
 		subset->type(Magick::TrueColorType);
-	}
 	subset->quiet(false);
 	subset->depth((int) main_depth);
 	subset->endian(Magick::LSBEndian);
 
+	if (ix1 <= ix0 || iy1 <= iy0)
+		return true;
+
 	// Blit the tile on the subset image.
-	const Magick::PixelPacket *px_src = whole_image->getConstPixels(da_x0, da_y0, w_clamped, h_clamped);
+	unsigned long w_src = ix1 - ix0;
+	unsigned long h_src = iy1 - iy0;
+	unsigned long dx = ix0 + whole_x0 - da_x0;
+	unsigned long dy = iy0 + whole_y0 - da_y0;
+	const Magick::PixelPacket *px_src = whole_image->getConstPixels(ix0, iy0, w_src, h_src);
 	Magick::PixelPacket *px_dst = subset->getPixels(0, 0, w, h);
+	blit(px_src, w_src, h_src, px_dst, w, dx, dy);
+	subset->syncPixels();
 
-	for (unsigned long y=0; y<h_clamped; y++) {
-		for (unsigned long x=0; x<w_clamped; x++) {
-			px_dst[x + y * w] = px_src[x + y * w_clamped];
+	return true;
+}
+
+void JP2_Image::component_to_pixels(const int32_t *data, unsigned long n, float f, uint32_t num_values, Magick::PixelPacket *px) {
+	Magick::ColorGray col;
+
+	// Tabulating the pixels only pays off for windows much larger than the table.
+	if (n >= 4 * (unsigned long) num_values) {
+		std::vector<Magick::PixelPacket> table(num_values);
+		for (uint32_t v=0; v<num_values; v++) {
+			col.shade(v * f);
+			table[v] = col;
 		}
+		if (PixelKernels::samples_to_pixels(data, n, table.data(), num_values, px))
+			return;
 	}
-	subset->syncPixels();
 
-	return true;
+	for (unsigned long i=0; i<n; i++) {
+		col.shade(data[i] * f);
+		px[i] = col;
+	}
+}
+
+void JP2_Image::blit(const Magick::PixelPacket *src, unsigned long w_src, unsigned long h_src, Magick::PixelPacket *dst, unsigned long w_dst, unsigned long dx, unsigned long dy) {
+	for (unsigned long y=0; y<h_src; y++) {
+		for (unsigned long x=0; x<w_src; x++) {
+			dst[dx + x + (dy + y) * w_dst] = src[x + y * w_src];
+		}
+	}
 }
 
@@ -17,6 +17,7 @@
 #include "raster/kz_s2_tif.hpp"
 #include "raster/tif_image.hpp"
 #include "raster/png_image.hpp"
+#include "raster/subtile_splitter.hpp"
 
 #include "util/text.hpp"
 #include <algorithm>
@@ -94,7 +95,7 @@ std::string extract_index_date_kz(const std::filesystem::path &path) {
 	// Path example: "/home/kappazeta/Documents/data/ams_data/1_036_20200504T094029_T34VEK.tif"
 	std::string index_firstdate_result;
 	std::string path_string = path.string();
-	std::regex regexp("(?:\\d+)_(\\d+)_(\\d+T\\d+)_(T[\\dA-Z]+).*"); // Expression extracts ...ron_firstdate_index... from a full path file name
+	static const std::regex regexp("(?:\\d+)_(\\d+)_(\\d+T\\d+)_(T[\\dA-Z]+).*"); // Expression extracts ...ron_firstdate_index... from a full path file name
 	std::smatch matches;
 
 	std::regex_search(path_string, matches, regexp);
@@ -149,7 +150,7 @@ void KZ_S2_TIF_Image::extract_geo(const std::filesystem::path &path_in, const AA
 		//! \todo Use GDAL for reading raster data, too.
 
 		if (aoi_poly.size() > 0) {
-			subtile_mask = fill_poly_overlap(aoi_poly, tile_size_div);
+			subtile_mask = SubtileGrid(fill_poly_overlap(aoi_poly, tile_size_div));
 		} else {
 			GDALClose(p_dataset);
 			throw RasterException(path_in, "No overlap between the area of interest polygon and raster");
@@ -157,7 +158,7 @@ void KZ_S2_TIF_Image::extract_geo(const std::filesystem::path &path_in, const AA
 	// Otherwise take all the subtiles.
 	} else {
 		aabb_buf = AABB<float>(0, 0, 1, 1);
-		subtile_mask = fill_whole(image_aabb, tile_size_div, 1);
+		subtile_mask = SubtileGrid(fill_whole(image_aabb, tile_size_div, 1));
 	}
 	GDALClose(p_dataset);
 }
@@ -192,105 +193,71 @@ bool KZ_S2_TIF_Image::process(const std::filesystem::path &path_in, const std::f
 }
 
 bool KZ_S2_TIF_Image::split_tiff(const std::filesystem::path &path_in, const std::filesystem::path &path_dir_out, KZ_S2_TIF_Image_Operator &op, std::vector<unsigned int> band_ids) {
-	TIF_Image img_src;
+	TIFChannelRasterSource src;
+	SubtileSplitSettings settings;
+	std::atomic<bool> aborted(false);
 	bool retval = true;
 
-	float div_f = 1.0f;
-	float tile_size_div = (tile_size - tile_size * f_overlap) / div_f;
-
-	img_src.set_deflate_level(deflate_factor);
-	img_src.set_num_threads(num_threads);
-
-	// Propagate overlap factor for NetCDF metadata.
-	img_src.f_overlap = f_overlap;
-	// Assign product name from the input path.
-	img_src.product_name = get_product_name_from_path(path_in);
+	src.image.set_deflate_level(deflate_factor);
+	src.image.set_num_threads(num_threads);
 
 	// Get image dimensions.
-	retval &= img_src.load_header(path_in);
+	retval &= src.open(path_in);
 
 	std::cout << "Processing " << path_in << std::endl;
 
+	settings.output_size = tile_size;
+	settings.f_overlap = f_overlap;
+	settings.deflate_factor = deflate_factor;
+	settings.store_png = store_png;
+	settings.product_name = get_product_name_from_path(path_in);
+	settings.aborted = &aborted;
+
 	// Extract image geo-coordinates, project area of interest polygon into pixel coordinates,
 	// and produce a subtile mask, unless all of this has already been done.
 	if (!geo_extracted) {
 		std::cout << "Extracting geo-coordinates." << std::endl;
-		AABB<int> image_aabb(img_src.main_geometry);
-		extract_geo(path_in, image_aabb, tile_size_div);
+		AABB<int> image_aabb(src.image.main_geometry);
+		extract_geo(path_in, image_aabb, tile_size - tile_size * f_overlap);
 		geo_extracted = true;
 	}
 
-	// NOTE:: Assume square tiles.
-	int sx0, sy0, sx1, sy1, c;
-
-	// Iterate over tiles in the output raster.
-	Vector<int> p;
-	std::vector<unsigned int>::iterator cit;
-	for (p.x=0; p.x<(int)subtile_mask.size(); p.x++) {
-		for (p.y=0; p.y<(int)subtile_mask[p.x].size(); p.y++) {
-			if (subtile_mask[p.x][p.y] == 1) {
-				// Coordinates in the source image (possibly with different dimensions).
-				sx0 = aabb_buf.vmin.x * img_src.main_geometry.width() + floor(tile_size_div * p.x);
-				sy0 = aabb_buf.vmin.y * img_src.main_geometry.height() + floor(tile_size_div * p.y);
-				sx1 = ceil(sx0 + tile_size_div);
-				sy1 = ceil(sy0 + tile_size_div);
-
-				// It's possible that due to rounding errors, the tile would no longer be square.
-				// For this case, we'll crop the additional row / column of pixels to square the tile once again.
-				if (sx1 - sx0 > sy1 - sy0)
-					sx1 = sx0 + sy1 - sy0;
-				else if (sy1 - sy0 > sx1 - sx0)
-					sy1 = sy0 + sx1 - sx0;
-
-				// std::cout << "tile_" << p.x << "_" << p.y << ": " << sx0 << ", " << sy0 << ", " << sx1 << ", " << sy1 << std::endl;
-
-				// Account for overlap.
-				sx1 += tile_size * f_overlap / div_f;
-				sy1 += tile_size * f_overlap / div_f;
-
-				// Process all the bands.
-				for (cit=band_ids.begin(); cit!=band_ids.end(); cit++) {
-					c = *cit;
-					if (c == KZ_S2_TIF_Image_Operator::DT_KZ_LABEL)
-						c = 0;
-
-					// Load the source image.
-					retval = img_src.load_subset_channel(path_in, sx0, sy0, sx1, sy1, c);
-					if (!retval) {
-						std::cerr << "Failed to load subset " << "tile_" << p.x << "_" << p.y << ": " << sx0 << ", " << sy0 << ", " << sx1 << ", " << sy1 << std::endl;
-						continue;
-					}
-
-					// "Normalize" the image.
-					img_src.multiply(1.0f / KZ_S2_TIF_Image_Operator::scale_max[c]);
-
-					if (img_src.subset->rows() != tile_size || img_src.subset->columns() != tile_size) {
-						std::cerr << "Invalid geometry " << img_src.subset->rows() << "x" << img_src.subset->columns() << " for subtile " << p.x << ", " << p.y << std::endl;
-					}
-
-					std::ostringstream ss_path_out, ss_path_out_png, ss_path_out_nc;
-					ss_path_out << path_dir_out.string() << "/tile_" << p.x << "_" << p.y << "/";
-					std::filesystem::create_directories(ss_path_out.str());
-
-					// Add to NetCDF.
-					ss_path_out_nc << ss_path_out.str() << extract_index_date_kz(path_in) << "_" << "tile" << "_" << p.x << "_" << p.y << ".nc";
-					img_src.add_to_netcdf(ss_path_out_nc.str(), KZ_S2_TIF_Image_Operator::data_type_name[*cit]);
-
-					// Save PNG.
-					if (store_png) {
-						ss_path_out_png << ss_path_out.str() << path_in.stem().string() << "_" << KZ_S2_TIF_Image_Operator::data_type_name[*cit];
-						ss_path_out_png << "_" << "tile" << "_" << p.x << "_" << p.y << ".png";
-						img_src.save(ss_path_out_png.str());
-					}
-
-					// Potential post-processing of the file.
-					if (!op(ss_path_out.str()))
-						return false;
-				}
-			}
+	// Neighbouring sub-tiles are split one after another, so that they share the cached blocks of the TIFF.
+	std::vector<Vector<int>> subtiles = subtile_mask.get_subtiles(SubtileGrid::SO_HILBERT);
+
+	// Windows and output paths are shared by all the channels.
+	SubtilePlan::create_directories(path_dir_out, subtiles);
+	SubtilePlan plan(subtiles, path_dir_out, extract_index_date_kz(path_in), aabb_buf,
+		src.image.main_geometry.width(), src.image.main_geometry.height(), tile_size, f_overlap, 1.0f);
+
+	// Potential post-processing of the file.
+	auto on_subtile = [&op, &aborted](const std::filesystem::path &path_dir_subtile) {
+		if (!op(path_dir_subtile)) {
+			aborted = true;
+			return false;
 		}
+		return true;
+	};
+
+	// All the requested channels of a subtile are decoded in a single pass, normalized on the way.
+	for (auto cit=band_ids.begin(); cit!=band_ids.end(); cit++) {
+		unsigned int c = *cit;
+		if (c == KZ_S2_TIF_Image_Operator::DT_KZ_LABEL)
+			c = 0;
+		src.channels.push_back(c);
+		src.scales.push_back(1.0f / KZ_S2_TIF_Image_Operator::scale_max[c]);
 	}
 
-	return retval;
+	IdentityTransform identity;
+	for (size_t i=0; i<plan.size() && !aborted; i++) {
+		for (size_t k=0; k<band_ids.size() && !aborted; k++) {
+			src.current = k;
+			settings.layer_name = KZ_S2_TIF_Image_Operator::data_type_name[band_ids[k]];
+			settings.png_prefix = path_in.stem().string() + "_" + KZ_S2_TIF_Image_Operator::data_type_name[band_ids[k]];
+			retval &= split_subtiles(src, identity, path_in, settings, plan, i, i + 1, on_subtile);
+		}
+	}
+
+	return retval && !aborted;
 }
 
@@ -15,13 +15,22 @@
 // limitations under the License.
 
 #include "raster/netcdf_interface.hpp"
+#include "raster/pixel_kernels.hpp"
 #include "util/datetime.hpp"
+#include "util/stage_stats.hpp"
+#include "util/worker_arena.hpp"
 #include "version.hpp"
 #include <climits>
 #include <cstring>
 #include <netcdf.h>
 
 
+std::mutex NetCDFInterface::nc_mutex;
+std::mutex NetCDFInterface::staging_mutex;
+bool NetCDFInterface::staging_enabled = true;
+std::filesystem::path NetCDFInterface::dir_staging;
+std::map<std::filesystem::path, std::shared_ptr<NetCDFInterface::StagedBatch>> NetCDFInterface::batches;
+
 NetCDFInterface::NetCDFInterface():
 	deflate_level(9)
 {
@@ -38,12 +47,75 @@ unsigned int NetCDFInterface::set_deflate_level(unsigned int level) {
 	return deflate_level;
 }
 
+void NetCDFInterface::set_staging(bool enabled, const std::filesystem::path &dir) {
+	std::lock_guard<std::mutex> lock(staging_mutex);
+	staging_enabled = enabled;
+	dir_staging = dir;
+}
+
+void NetCDFInterface::begin_batch(const std::filesystem::path &path, unsigned int num_writers) {
+	std::lock_guard<std::mutex> lock(staging_mutex);
+	if (!staging_enabled || num_writers == 0)
+		return;
+	std::shared_ptr<StagedBatch> &batch = batches[path];
+	if (batch == nullptr)
+		batch = std::make_shared<StagedBatch>(path, dir_staging);
+	batch->num_writers += num_writers;
+}
+
+bool NetCDFInterface::end_batch(const std::filesystem::path &path) {
+	std::shared_ptr<StagedBatch> batch;
+	{
+		std::lock_guard<std::mutex> lock(staging_mutex);
+		auto it = batches.find(path);
+		if (it == batches.end())
+			return true;
+		if (--it->second->num_writers > 0)
+			return true;
+		batch = it->second;
+		batches.erase(it);
+	}
+
+	// The last writer publishes the file outside of the locks, so that the others can go on meanwhile.
+	std::lock_guard<std::mutex> lock(batch->mutex);
+	if (!batch->begun)
+		return true;
+	if (batch->failed) {
+		std::cerr << "ERROR: Discarding the staged updates of " << path << ", some of which failed" << std::endl;
+		return false;
+	}
+	StageTimer timer_close(StageStats::ST_NC_CLOSE);
+	if (!batch->file.publish())
+		return false;
+	timer_close.stop();
+
+	for (const std::function<void()> &fn: batch->on_published)
+		fn();
+	return true;
+}
+
+void NetCDFInterface::on_published(const std::filesystem::path &path, std::function<void()> fn) {
+	{
+		std::lock_guard<std::mutex> lock(staging_mutex);
+		auto it = batches.find(path);
+		if (it != batches.end()) {
+			it->second->on_published.push_back(std::move(fn));
+			return;
+		}
+	}
+	fn();
+}
+
 bool NetCDFInterface::has_layer(const std::filesystem::path &path, const std::string &name_in_netcdf) {
-	int retval;
 	int ncid = 0, varid = 0;
 	bool layer_exists = false;
 
-	if (nc_open(path.string().c_str(), NC_WRITE, &ncid)) {
+	std::error_code ec;
+	if (!std::filesystem::exists(path, ec))
+		return false;
+
+	std::lock_guard<std::mutex> lock(nc_mutex);
+	if (nc_open(path.string().c_str(), NC_NOWRITE, &ncid) == NC_NOERR) {
 		if (nc_inq_varid(ncid, name_in_netcdf.c_str(), &varid) == NC_NOERR)
 			layer_exists = true;
 
@@ -63,6 +135,7 @@ int NetCDFInterface::add_layer_to_file(int ncid, const std::filesystem::path &pa
 		dt = NC_UBYTE;
 
 	// Define the variable.
+	StageTimer timer_define(StageStats::ST_NC_DEFINE);
 	if (nc_inq_varid(ncid, name_in_netcdf.c_str(), &varid) != NC_NOERR) {
 		retval = nc_def_var(ncid, name_in_netcdf.c_str(), dt, nd, dimids, &varid);
 		if (retval != NC_NOERR && retval != NC_ENAMEINUSE) {
@@ -81,7 +154,10 @@ int NetCDFInterface::add_layer_to_file(int ncid, const std::filesystem::path &pa
 		}
 	}
 
+	timer_define.stop();
+
 	// Store content.
+	StageTimer timer_write(StageStats::ST_NC_WRITE, (uint64_t) w * h * (image.main_depth > 8 ? sizeof(float) : 1));
 	if (image.main_depth > 8) {
 		if ((retval = nc_put_var_float(ncid, varid, (const float *) src_px))) {
 			std::ostringstream ss;
@@ -95,6 +171,9 @@ int NetCDFInterface::add_layer_to_file(int ncid, const std::filesystem::path &pa
 			throw NCException(ss.str(), path, retval);
 		}
 	}
+	timer_write.stop();
+
+	StageTimer timer_attributes(StageStats::ST_NC_DEFINE);
 
 	// Variable attribute for scaling_factor.
 	float scaling_factor = image.scaling_factor;
@@ -114,10 +193,6 @@ int NetCDFInterface::add_layer_to_file(int ncid, const std::filesystem::path &pa
 }
 
 bool NetCDFInterface::add_to_file(const std::filesystem::path &path, const std::string &name_in_netcdf, const RasterImage &image) {
-	int ncid = 0;
-	int dimids[2] = {0, 0};
-	int retval;
-
 	if (image.subset == nullptr) {
 		std::cerr << "Nothing to add to NetCDF file \"" << path << "\", for the subset is empty" << std::endl;
 		return false;
@@ -125,24 +200,126 @@ bool NetCDFInterface::add_to_file(const std::filesystem::path &path, const std::
 
 	unsigned int w = image.subset->columns();
 	unsigned int h = image.subset->rows();
-	unsigned int c;
 	unsigned int size = w * h;
 
-	try {
-		Magick::ImageType imgtype = image.subset->type();
+	// Convert the content before taking the lock, so that other threads can write meanwhile.
+	// The converted layers go into a buffer of the thread, which is reused for the next sub-tiles.
+	Magick::ImageType imgtype = image.subset->type();
+	Magick::PixelPacket *src_px = image.subset->getPixels(0, 0, w, h);
+	WorkerArena &arena = WorkerArena::get_current();
+
+	if (imgtype == Magick::GrayscaleType) {
+		if (image.main_depth > 8) {
+			StageTimer timer_convert(StageStats::ST_NC_WRITE);
+			float *dst_px = arena.get<float>(WorkerArena::SLOT_NC_LAYERS, size);
+			PixelKernels::pixels_to_float(src_px, size, dst_px);
+			timer_convert.stop();
+			return write_layers(path, image, w, h, {{name_in_netcdf, (const void *) dst_px}});
+		} else {
+			StageTimer timer_convert(StageStats::ST_NC_WRITE);
+			unsigned char *dst_px = arena.get<unsigned char>(WorkerArena::SLOT_NC_LAYERS, size);
+			PixelKernels::pixels_to_ubyte(src_px, size, dst_px);
+			timer_convert.stop();
+			return write_layers(path, image, w, h, {{name_in_netcdf, (const void *) dst_px}});
+		}
+
+	} else if (imgtype == Magick::TrueColorType) {
+		StageTimer timer_convert(StageStats::ST_NC_WRITE);
+		unsigned char *dst_r = arena.get<unsigned char>(WorkerArena::SLOT_NC_LAYERS, 3 * (size_t) size);
+		unsigned char *dst_g = dst_r + size;
+		unsigned char *dst_b = dst_g + size;
+		unsigned int yw;
+
+		for (unsigned int y=0; y<h; y++) {
+			yw = y * w;
+			for (unsigned int x=0; x<w; x++) {
+				//! \todo TODO:: Figure out why pixels of an 8-bit image are stored as 16-bit values.
+				// Is it due to the TrueColorType?
+				dst_r[yw + x] = (int) (src_px[yw + x].red * 255 / 65535.0f);
+				dst_g[yw + x] = (int) (src_px[yw + x].green * 255 / 65535.0f);
+				dst_b[yw + x] = (int) (src_px[yw + x].blue * 255 / 65535.0f);
+			}
+		}
+		timer_convert.stop();
 
-		if (imgtype == Magick::GrayscaleType)
-			c = 1;
-		else if (imgtype == Magick::TrueColorType)
-			c = 3;
+		return write_layers(path, image, w, h, {
+			{name_in_netcdf + "_R", (const void *) dst_r},
+			{name_in_netcdf + "_G", (const void *) dst_g},
+			{name_in_netcdf + "_B", (const void *) dst_b}
+		});
+	}
+
+	return write_layers(path, image, w, h, {});
+}
 
+bool NetCDFInterface::add_to_file(const std::filesystem::path &path, const std::string &name_in_netcdf, const RasterImage &image, const void *px, unsigned int w, unsigned int h) {
+	return write_layers(path, image, w, h, {{name_in_netcdf, px}});
+}
+
+bool NetCDFInterface::write_layers(const std::filesystem::path &path, const RasterImage &image, unsigned int w, unsigned int h, const std::vector<std::pair<std::string, const void *>> &layers) {
+	// Write to a staging copy, so that an interrupted process never leaves a half-written file behind.
+	// An update outside of a batch is a batch of its own, which is published right away.
+	std::shared_ptr<StagedBatch> batch;
+	{
+		std::lock_guard<std::mutex> lock(staging_mutex);
+		if (staging_enabled) {
+			std::shared_ptr<StagedBatch> &entry = batches[path];
+			if (entry == nullptr)
+				entry = std::make_shared<StagedBatch>(path, dir_staging);
+			entry->num_writers++;
+			batch = entry;
+		}
+	}
+	// Files written in place are synced, so that the layers are on the disk before anything relies on them.
+	if (batch == nullptr) {
+		if (!write_nc(path, path, image, w, h, layers))
+			return false;
+		StageTimer timer_close(StageStats::ST_NC_CLOSE);
+		if (!StagedFile::sync(path)) {
+			std::cerr << "ERROR: Failed to sync " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// The staging copy is made and published outside of the NetCDF lock, so that other files can be written meanwhile.
+	bool retval = false;
+	{
+		std::lock_guard<std::mutex> lock(batch->mutex);
+		if (!batch->begun) {
+			StageTimer timer_open(StageStats::ST_NC_OPEN);
+			batch->begun = true;
+			batch->failed = !batch->file.begin();
+		}
+		if (!batch->failed) {
+			retval = write_nc(batch->file.get_path(), path, image, w, h, layers);
+			batch->failed = !retval;
+		}
+	}
+
+	return end_batch(path) && retval;
+}
+
+bool NetCDFInterface::write_nc(const std::filesystem::path &path_write, const std::filesystem::path &path, const RasterImage &image, unsigned int w, unsigned int h, const std::vector<std::pair<std::string, const void *>> &layers) {
+	int ncid = 0;
+	int dimids[2] = {0, 0};
+	int retval;
+
+	std::lock_guard<std::mutex> lock(nc_mutex);
+
+	StageTimer timer_open(StageStats::ST_NC_OPEN);
+	bool exists = std::filesystem::exists(path_write);
+
+	try {
 		// Open or create the file.
-		if (std::filesystem::exists(path)) {
-			if ((retval = nc_open(path.string().c_str(), NC_WRITE, &ncid)))
+		if (exists) {
+			if ((retval = nc_open(path_write.string().c_str(), NC_WRITE, &ncid)))
 				throw NCException("failed to open", path, retval);
+			timer_open.stop();
 		} else {
-			if ((retval = nc_create(path.string().c_str(), NC_NOCLOBBER | NC_NETCDF4, &ncid)))
+			if ((retval = nc_create(path_write.string().c_str(), NC_NOCLOBBER | NC_NETCDF4, &ncid)))
 				throw NCException("failed to create", path, retval);
+			timer_open.stop();
 			// Global attribute for version number.
 			if ((retval = nc_put_att_text(ncid, NC_GLOBAL, "version", strlen(CM_CONVERTER_VERSION_STR), CM_CONVERTER_VERSION_STR)))
 				throw NCException("failed to put global attribute version", path, retval);
@@ -155,7 +332,16 @@ bool NetCDFInterface::add_to_file(const std::filesystem::path &path, const std::
 				throw NCException("failed to put global attribute overlap", path, retval);
 		}
 
+		// Global attribute for the fraction of valid pixels, if known, also for the files of earlier runs without it.
+		float valid_fraction = image.valid_fraction, valid_fraction_stored = -1.0f;
+		if (valid_fraction >= 0.0f &&
+			(nc_get_att_float(ncid, NC_GLOBAL, "valid_fraction", &valid_fraction_stored) != NC_NOERR || valid_fraction_stored != valid_fraction)) {
+			if ((retval = nc_put_att(ncid, NC_GLOBAL, "valid_fraction", NC_FLOAT, 1, &valid_fraction)))
+				throw NCException("failed to put global attribute valid_fraction", path, retval);
+		}
+
 		// Define dimensions.
+		StageTimer timer_define(StageStats::ST_NC_DEFINE);
 		if (nc_inq_dimid(ncid, "x", &dimids[0]) != NC_NOERR) {
 			retval = nc_def_dim(ncid, "x", w, &dimids[0]);
 			if (retval != NC_NOERR && retval != NC_ENAMEINUSE) {
@@ -178,51 +364,11 @@ bool NetCDFInterface::add_to_file(const std::filesystem::path &path, const std::
 		// Variable dimensions and data type.
 		int nd = sizeof(dimids) / sizeof(dimids[0]);
 
-		Magick::PixelPacket *src_px = image.subset->getPixels(0, 0, w, h);
-		unsigned int yw;
+		timer_define.stop();
 
 		// Store content.
-		if (c == 1) {
-			if (image.main_depth > 8) {
-				RasterBufferPan<float> dst_px(size);
-
-				for (unsigned int y=0; y<h; y++) {
-					yw = y * w;
-					for (unsigned int x=0; x<w; x++) {
-						dst_px.v[yw + x] = ((float) src_px[yw + x].green) / MaxRGB;
-					}
-				}
-				add_layer_to_file(ncid, path, name_in_netcdf, w, h, dimids, nd, (const void *) dst_px.v, image);
-			} else {
-				RasterBufferPan<unsigned char> dst_px(size);
-
-				for (unsigned int y=0; y<h; y++) {
-					yw = y * w;
-					for (unsigned int x=0; x<w; x++) {
-						dst_px.v[yw + x] = (int) (src_px[yw + x].green * 255 / MaxRGB);
-					}
-				}
-				add_layer_to_file(ncid, path, name_in_netcdf, w, h, dimids, nd, (const void *) dst_px.v, image);
-			}
-
-		} else if (c == 3) {
-			RasterBufferRGB<unsigned char> dst_px(size);
-
-			for (unsigned int y=0; y<h; y++) {
-				yw = y * w;
-				for (unsigned int x=0; x<w; x++) {
-					//! \todo TODO:: Figure out why pixels of an 8-bit image are stored as 16-bit values.
-					// Is it due to the TrueColorType?
-					dst_px.r[yw + x] = (int) (src_px[yw + x].red * 255 / 65535.0f);
-					dst_px.g[yw + x] = (int) (src_px[yw + x].green * 255 / 65535.0f);
-					dst_px.b[yw + x] = (int) (src_px[yw + x].blue * 255 / 65535.0f);
-				}
-			}
-
-			add_layer_to_file(ncid, path, name_in_netcdf + "_R", w, h, dimids, nd, (const void *) dst_px.r, image);
-			add_layer_to_file(ncid, path, name_in_netcdf + "_G", w, h, dimids, nd, (const void *) dst_px.g, image);
-			add_layer_to_file(ncid, path, name_in_netcdf + "_B", w, h, dimids, nd, (const void *) dst_px.b, image);
-		}
+		for (const std::pair<std::string, const void *> &layer: layers)
+			add_layer_to_file(ncid, path, layer.first, w, h, dimids, nd, layer.second, image);
 
 	} catch (NCException &e) {
 		if (e.nc_retval != NC_ENAMEINUSE)
@@ -236,6 +382,7 @@ bool NetCDFInterface::add_to_file(const std::filesystem::path &path, const std::
 	}
 
 	// Close the file.
+	StageTimer timer_close(StageStats::ST_NC_CLOSE);
 	if ((retval = nc_close(ncid))) {
 		std::cerr << "Failed to close NetCDF file \"" << path << "\", error " << retval << std::endl;
 		return false;
@@ -0,0 +1,347 @@
+// Vectorized kernels for the pixels of grayscale rasters
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "raster/pixel_kernels.hpp"
+#include "util/cpu_dispatch.hpp"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+
+//! Whether the pixels are 4 16-bit quantums, as the vectorized kernels expect.
+static const bool simd_layout = sizeof(Magick::PixelPacket) == 8 && sizeof(Magick::Quantum) == 2;
+//! Position of the green quantum within a 64-bit pixel, in bits.
+static const int green_shift = offsetof(Magick::PixelPacket, green) * 8;
+
+const uint8_t *PixelKernels::get_value_lut() {
+	// The gathers load 4 bytes from the value of the last quantum.
+	static std::vector<uint8_t> lut(65536 + 3, 0);
+	static std::once_flag once;
+	std::call_once(once, [] {
+		Magick::PixelPacket px;
+		memset(&px, 0, sizeof(px));
+		for (unsigned int q=0; q<65536; q++) {
+			px.red = px.green = px.blue = q;
+			float src_val = Magick::ColorGray(px).shade();
+			lut[q] = (unsigned char) (255 * src_val);
+		}
+	});
+	return lut.data();
+}
+
+void PixelKernels::make_class_table(const unsigned char *values, unsigned char max_value, class_table_t &table) {
+	for (unsigned int i=0; i<256; i++) {
+		unsigned char idx = i > max_value ? max_value : i;
+		table[i] = Magick::ColorGray(values[idx] / 255.0f);
+	}
+}
+
+// Generic kernels.
+
+static void remap_classes_generic(Magick::PixelPacket *px, size_t n, const uint8_t *lut, const Magick::PixelPacket *table) {
+	for (size_t i=0; i<n; i++)
+		px[i] = table[lut[px[i].green]];
+}
+
+static void pixels_to_float_generic(const Magick::PixelPacket *px, size_t n, float *dst) {
+	for (size_t i=0; i<n; i++)
+		dst[i] = ((float) px[i].green) / MaxRGB;
+}
+
+static void pixels_to_ubyte_generic(const Magick::PixelPacket *px, size_t n, unsigned char *dst) {
+	for (size_t i=0; i<n; i++)
+		dst[i] = (int) (px[i].green * 255 / MaxRGB);
+}
+
+static bool samples_to_pixels_generic(const int32_t *data, size_t n, const Magick::PixelPacket *table, uint32_t num_values, Magick::PixelPacket *px) {
+	for (size_t i=0; i<n; i++) {
+		if ((uint32_t) data[i] >= num_values)
+			return false;
+		px[i] = table[data[i]];
+	}
+	return true;
+}
+
+#ifdef PIXEL_KERNELS_X86
+
+// AVX2 kernels, 4 pixels or 8 values at a time.
+
+__attribute__((target("avx2")))
+static void remap_classes_avx2(Magick::PixelPacket *px, size_t n, const uint8_t *lut, const Magick::PixelPacket *table) {
+	const __m256i mask_quantum = _mm256_set1_epi64x(0xffff);
+	const __m128i mask_value = _mm_set1_epi32(0xff);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (px + i));
+		__m256i q = _mm256_and_si256(_mm256_srli_epi64(v, green_shift), mask_quantum);
+		__m128i value = _mm_and_si128(_mm256_i64gather_epi32((const int *) lut, q, 1), mask_value);
+		_mm256_storeu_si256((__m256i *) (px + i), _mm256_i32gather_epi64((const long long *) table, value, 8));
+	}
+	remap_classes_generic(px + i, n - i, lut, table);
+}
+
+/**
+ * @return Green quantums of 8 pixels, as 32-bit integers.
+ */
+__attribute__((target("avx2")))
+static inline __m256i load_green_avx2(const Magick::PixelPacket *px) {
+	const __m256i mask_quantum = _mm256_set1_epi64x(0xffff);
+	const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	__m256i a = _mm256_and_si256(_mm256_srli_epi64(_mm256_loadu_si256((const __m256i *) px), green_shift), mask_quantum);
+	__m256i b = _mm256_and_si256(_mm256_srli_epi64(_mm256_loadu_si256((const __m256i *) (px + 4)), green_shift), mask_quantum);
+	// The lower 32 bits of each 64-bit lane, into the lower half.
+	a = _mm256_permutevar8x32_epi32(a, even);
+	b = _mm256_permutevar8x32_epi32(b, even);
+	return _mm256_permute2x128_si256(a, b, 0x20);
+}
+
+__attribute__((target("avx2")))
+static void pixels_to_float_avx2(const Magick::PixelPacket *px, size_t n, float *dst) {
+	const __m256 max_rgb = _mm256_set1_ps((float) MaxRGB);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_div_ps(_mm256_cvtepi32_ps(load_green_avx2(px + i)), max_rgb));
+	pixels_to_float_generic(px + i, n - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static void pixels_to_ubyte_avx2(const Magick::PixelPacket *px, size_t n, unsigned char *dst) {
+	// q * 255 / 65535 == q / 257 == (q * 0xff01) >> 24 for all the 16-bit quantums.
+	const __m256i m = _mm256_set1_epi32(0xff01);
+	const __m256i low_bytes = _mm256_setr_epi8(
+		0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_srli_epi32(_mm256_mullo_epi32(load_green_avx2(px + i), m), 24);
+		v = _mm256_shuffle_epi8(v, low_bytes);
+		uint32_t lo = _mm256_extract_epi32(v, 0), hi = _mm256_extract_epi32(v, 4);
+		memcpy(dst + i, &lo, 4);
+		memcpy(dst + i + 4, &hi, 4);
+	}
+	pixels_to_ubyte_generic(px + i, n - i, dst + i);
+}
+
+__attribute__((target("avx2")))
+static bool samples_to_pixels_avx2(const int32_t *data, size_t n, const Magick::PixelPacket *table, uint32_t num_values, Magick::PixelPacket *px) {
+	const __m128i last = _mm_set1_epi32(num_values - 1);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i *) (data + i));
+		// Samples below 0 or above the last value.
+		__m128i outside = _mm_or_si128(_mm_cmplt_epi32(s, _mm_setzero_si128()), _mm_cmpgt_epi32(s, last));
+		if (!_mm_testz_si128(outside, outside))
+			return false;
+		_mm256_storeu_si256((__m256i *) (px + i), _mm256_i32gather_epi64((const long long *) table, s, 8));
+	}
+	return samples_to_pixels_generic(data + i, n - i, table, num_values, px + i);
+}
+
+// AVX-512 kernels, 8 pixels or 16 values at a time.
+
+__attribute__((target("avx512f")))
+static void remap_classes_avx512(Magick::PixelPacket *px, size_t n, const uint8_t *lut, const Magick::PixelPacket *table) {
+	const __m512i mask_quantum = _mm512_set1_epi64(0xffff);
+	const __m256i mask_value = _mm256_set1_epi32(0xff);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m512i v = _mm512_loadu_si512(px + i);
+		__m512i q = _mm512_and_si512(_mm512_srli_epi64(v, green_shift), mask_quantum);
+		__m256i value = _mm256_and_si256(_mm512_i64gather_epi32(q, lut, 1), mask_value);
+		_mm512_storeu_si512(px + i, _mm512_i32gather_epi64(value, table, 8));
+	}
+	remap_classes_generic(px + i, n - i, lut, table);
+}
+
+/**
+ * @return Green quantums of 16 pixels, as 32-bit integers.
+ */
+__attribute__((target("avx512f")))
+static inline __m512i load_green_avx512(const Magick::PixelPacket *px) {
+	const __m512i mask_quantum = _mm512_set1_epi64(0xffff);
+	__m256i a = _mm512_cvtepi64_epi32(_mm512_and_si512(_mm512_srli_epi64(_mm512_loadu_si512(px), green_shift), mask_quantum));
+	__m256i b = _mm512_cvtepi64_epi32(_mm512_and_si512(_mm512_srli_epi64(_mm512_loadu_si512(px + 8), green_shift), mask_quantum));
+	return _mm512_inserti64x4(_mm512_castsi256_si512(a), b, 1);
+}
+
+__attribute__((target("avx512f")))
+static void pixels_to_float_avx512(const Magick::PixelPacket *px, size_t n, float *dst) {
+	const __m512 max_rgb = _mm512_set1_ps((float) MaxRGB);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16)
+		_mm512_storeu_ps(dst + i, _mm512_div_ps(_mm512_cvtepi32_ps(load_green_avx512(px + i)), max_rgb));
+	pixels_to_float_generic(px + i, n - i, dst + i);
+}
+
+__attribute__((target("avx512f")))
+static void pixels_to_ubyte_avx512(const Magick::PixelPacket *px, size_t n, unsigned char *dst) {
+	const __m512i m = _mm512_set1_epi32(0xff01);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512i v = _mm512_srli_epi32(_mm512_mullo_epi32(load_green_avx512(px + i), m), 24);
+		_mm_storeu_si128((__m128i *) (dst + i), _mm512_cvtepi32_epi8(v));
+	}
+	pixels_to_ubyte_generic(px + i, n - i, dst + i);
+}
+
+__attribute__((target("avx512f")))
+static bool samples_to_pixels_avx512(const int32_t *data, size_t n, const Magick::PixelPacket *table, uint32_t num_values, Magick::PixelPacket *px) {
+	const __m256i last = _mm256_set1_epi32(num_values - 1);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i *) (data + i));
+		__m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), s), _mm256_cmpgt_epi32(s, last));
+		if (!_mm256_testz_si256(outside, outside))
+			return false;
+		_mm512_storeu_si512(px + i, _mm512_i32gather_epi64(s, table, 8));
+	}
+	return samples_to_pixels_generic(data + i, n - i, table, num_values, px + i);
+}
+
+#endif
+
+/**
+ * @return Instruction set of the kernels to use.
+ */
+static CPUDispatch::isa_t get_kernel_isa() {
+	return simd_layout ? CPUDispatch::get_isa() : CPUDispatch::ISA_GENERIC;
+}
+
+void PixelKernels::remap_classes(Magick::PixelPacket *px, size_t n, const class_table_t &table) {
+	remap_classes(px, n, get_value_lut(), table);
+}
+
+void PixelKernels::remap_classes(Magick::PixelPacket *px, size_t n, const uint8_t *value_lut, const class_table_t &table) {
+	switch (get_kernel_isa()) {
+#ifdef PIXEL_KERNELS_X86
+		case CPUDispatch::ISA_AVX512:
+			return remap_classes_avx512(px, n, value_lut, table.data());
+		case CPUDispatch::ISA_AVX2:
+			return remap_classes_avx2(px, n, value_lut, table.data());
+#endif
+		default:
+			return remap_classes_generic(px, n, value_lut, table.data());
+	}
+}
+
+void PixelKernels::pixels_to_float(const Magick::PixelPacket *px, size_t n, float *dst) {
+	switch (get_kernel_isa()) {
+#ifdef PIXEL_KERNELS_X86
+		case CPUDispatch::ISA_AVX512:
+			return pixels_to_float_avx512(px, n, dst);
+		case CPUDispatch::ISA_AVX2:
+			return pixels_to_float_avx2(px, n, dst);
+#endif
+		default:
+			return pixels_to_float_generic(px, n, dst);
+	}
+}
+
+void PixelKernels::pixels_to_ubyte(const Magick::PixelPacket *px, size_t n, unsigned char *dst) {
+	switch (get_kernel_isa()) {
+#ifdef PIXEL_KERNELS_X86
+		case CPUDispatch::ISA_AVX512:
+			return pixels_to_ubyte_avx512(px, n, dst);
+		case CPUDispatch::ISA_AVX2:
+			return pixels_to_ubyte_avx2(px, n, dst);
+#endif
+		default:
+			return pixels_to_ubyte_generic(px, n, dst);
+	}
+}
+
+bool PixelKernels::samples_to_pixels(const int32_t *data, size_t n, const Magick::PixelPacket *table, uint32_t num_values, Magick::PixelPacket *px) {
+	if (num_values == 0)
+		return n == 0;
+	switch (get_kernel_isa()) {
+#ifdef PIXEL_KERNELS_X86
+		case CPUDispatch::ISA_AVX512:
+			return samples_to_pixels_avx512(data, n, table, num_values, px);
+		case CPUDispatch::ISA_AVX2:
+			return samples_to_pixels_avx2(data, n, table, num_values, px);
+#endif
+		default:
+			return samples_to_pixels_generic(data, n, table, num_values, px);
+	}
+}
+
+bool PixelKernels::point_sample_index(unsigned int n_src, unsigned int n_dst, std::vector<uint32_t> &index) {
+	if (n_src == 0 || n_dst == 0)
+		return false;
+	index.resize(n_dst);
+
+	// The resize is skipped altogether for the same size.
+	if (n_src == n_dst) {
+		for (unsigned int x=0; x<n_dst; x++)
+			index[x] = x;
+		return true;
+	}
+
+	// Same expressions as in HorizontalFilter() and VerticalFilter() of GraphicsMagick, with MagickEpsilon.
+	const double factor = (double) n_dst / n_src;
+	const double support = 0.5 + 1.0e-12;
+	for (unsigned int x=0; x<n_dst; x++) {
+		double center = (double) (x + 0.5) / factor;
+		long start = (long) std::max(center - support + 0.5, 0.0);
+		long stop = (long) std::min(center + support + 0.5, (double) n_src);
+		long found = -1;
+		for (long j=start; j<stop; j++) {
+			double d = (double) j - center + 0.5;
+			if (d >= -0.5 && d < 0.5) {
+				if (found >= 0)
+					return false;
+				found = j;
+			}
+		}
+		if (found < 0)
+			return false;
+		index[x] = found;
+	}
+	return true;
+}
+
+template<typename T>
+static void remap_resample_rows(const Magick::PixelPacket *src, unsigned int w_src, const uint8_t *lut, const T *values,
+	const std::vector<uint32_t> &x_index, const std::vector<uint32_t> &y_index, T *dst) {
+	size_t w_dst = x_index.size();
+	for (size_t y=0; y<y_index.size(); y++) {
+		T *dst_row = dst + y * w_dst;
+		// Rows which are sampled again when upsampling.
+		if (y > 0 && y_index[y] == y_index[y - 1]) {
+			memcpy(dst_row, dst_row - w_dst, w_dst * sizeof(T));
+			continue;
+		}
+		const Magick::PixelPacket *src_row = src + (size_t) y_index[y] * w_src;
+		for (size_t x=0; x<w_dst; x++)
+			dst_row[x] = values[lut[src_row[x_index[x]].green]];
+	}
+}
+
+void PixelKernels::remap_resample(const Magick::PixelPacket *src, unsigned int w_src, const uint8_t *value_lut, const unsigned char *values,
+	const std::vector<uint32_t> &x_index, const std::vector<uint32_t> &y_index, unsigned char *dst) {
+	remap_resample_rows(src, w_src, value_lut, values, x_index, y_index, dst);
+}
+
+void PixelKernels::remap_resample(const Magick::PixelPacket *src, unsigned int w_src, const uint8_t *value_lut, const float *values,
+	const std::vector<uint32_t> &x_index, const std::vector<uint32_t> &y_index, float *dst) {
+	remap_resample_rows(src, w_src, value_lut, values, x_index, y_index, dst);
+}
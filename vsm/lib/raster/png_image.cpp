@@ -15,10 +15,12 @@
 // limitations under the License.
 
 #include "raster/png_image.hpp"
+#include "util/worker_arena.hpp"
 #include <cstring>
+#include <vector>
 
 
-PNG_Image::PNG_Image() {}
+PNG_Image::PNG_Image(): reader_failed(false) {}
 PNG_Image::~PNG_Image() {}
 
 bool PNG_Image::load_header(const std::filesystem::path &path) {
@@ -27,7 +29,8 @@ bool PNG_Image::load_header(const std::filesystem::path &path) {
 
 	subset = new Magick::Image();
 	subset->quiet(false);
-	subset->ping(path.string());
+	if (!read_magick(*subset, path, true))
+		return false;
 
 	main_geometry = subset->size();
 	main_depth = subset->depth();
@@ -41,12 +44,67 @@ bool PNG_Image::load_header(const std::filesystem::path &path) {
 	return true;
 }
 
+bool PNG_Image::open_reader(const std::filesystem::path &path) {
+	if (reader.is_open() && reader.get_path() == path)
+		return true;
+	if (reader_failed && reader_path == path)
+		return false;
+
+	reader_path = path;
+	reader_failed = !reader.open(path);
+	return !reader_failed;
+}
+
 bool PNG_Image::load_subset(const std::filesystem::path &path, int da_x0, int da_y0, int da_x1, int da_y1) {
+	if (!open_reader(path))
+		return load_subset_magick(path, da_x0, da_y0, da_x1, da_y1);
+
+	if (da_x0 < 0 || da_y0 < 0 || da_x1 <= da_x0 || da_y1 <= da_y0)
+		return false;
+
+	unsigned int w = da_x1 - da_x0;
+	unsigned int h = da_y1 - da_y0;
+	size_t size = (size_t) w * h;
+
+	main_geometry.width(reader.width);
+	main_geometry.height(reader.height);
+	main_depth = reader.bit_depth;
+	main_num_components = reader.num_channels;
+
+	float *buf = WorkerArena::get_current().get<float>(WorkerArena::SLOT_PLANES, size * main_num_components);
+	float *planes[3] = {buf, buf + size, buf + (main_num_components == 3 ? 2 * size : 0)};
+	if (!reader.read_window(da_x0, da_y0, da_x1, da_y1, planes))
+		return false;
+
+	reset_subset(w, h);
+	if (main_num_components == 3)
+		subset->type(Magick::TrueColorType);
+	else
+		subset->type(Magick::GrayscaleType);
+	subset->quiet(false);
+	subset->depth(main_depth);
+
+	Magick::PixelPacket *px = subset->getPixels(0, 0, w, h);
+	if (main_num_components == 3) {
+		for (size_t i = 0; i < size; i++)
+			px[i] = Magick::ColorRGB(planes[0][i], planes[1][i], planes[2][i]);
+	} else {
+		for (size_t i = 0; i < size; i++)
+			px[i] = Magick::ColorGray(planes[0][i]);
+	}
+	subset->syncPixels();
+
+	return true;
+}
+
+bool PNG_Image::load_subset_magick(const std::filesystem::path &path, int da_x0, int da_y0, int da_x1, int da_y1) {
 	if (subset != nullptr)
 		clear();
 
-	Magick::Image img(path);
+	Magick::Image img;
 	img.quiet(false);
+	if (!read_magick(img, path))
+		return false;
 
 	Magick::ImageType imgtype = img.type();
 	if (imgtype == Magick::BilevelType)
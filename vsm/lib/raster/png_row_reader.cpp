@@ -0,0 +1,226 @@
+// Streaming reading of PNG files, row by row
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "raster/png_row_reader.hpp"
+#include "util/zip_archive.hpp"
+#include <algorithm>
+#include <iostream>
+#include <png.h>
+
+
+static void zip_read_data(png_structp png, png_bytep data, size_t length) {
+	ZipMemberReader *reader = (ZipMemberReader *) png_get_io_ptr(png);
+	if (reader->read(data, length) != length)
+		png_error(png, "Unexpected end of file");
+}
+
+
+PNGRowReader::PNGRowReader():
+	width(0), height(0), num_channels(0), bit_depth(0), file_bit_depth(0),
+	fp(nullptr), png(nullptr), info(nullptr), first_row(0), next_row(0), row_bytes(0), num_decoded_rows(0) {}
+
+PNGRowReader::~PNGRowReader() {
+	close();
+}
+
+bool PNGRowReader::open(const std::filesystem::path &path) {
+	close();
+	this->path = path;
+	if (!start()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void PNGRowReader::close() {
+	release();
+	path.clear();
+	rows.clear();
+	spare_rows.clear();
+	first_row = next_row = 0;
+	num_decoded_rows = 0;
+}
+
+void PNGRowReader::release() {
+	png_structp p = (png_structp) png;
+	png_infop i = (png_infop) info;
+	if (p != nullptr)
+		png_destroy_read_struct(&p, i != nullptr ? &i : nullptr, nullptr);
+	png = nullptr;
+	info = nullptr;
+
+	if (fp != nullptr)
+		fclose(fp);
+	fp = nullptr;
+	zip_reader.reset();
+}
+
+bool PNGRowReader::start() {
+	release();
+	for (auto &row: rows)
+		spare_rows.push_back(std::move(row));
+	rows.clear();
+	first_row = next_row = 0;
+
+	if (ZipArchive::is_member_path(path)) {
+		zip_reader.reset(new ZipMemberReader());
+		if (!zip_reader->open(path)) {
+			std::cerr << "ERROR: libpng: Failed to open " << path << std::endl;
+			return false;
+		}
+	} else {
+		fp = fopen(path.c_str(), "rb");
+		if (fp == nullptr) {
+			std::cerr << "ERROR: libpng: Failed to open " << path << std::endl;
+			return false;
+		}
+	}
+
+	png_structp p = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+	if (p == nullptr)
+		return false;
+	png = p;
+	png_infop i = png_create_info_struct(p);
+	if (i == nullptr)
+		return false;
+	info = i;
+
+	if (setjmp(png_jmpbuf(p))) {
+		std::cerr << "ERROR: libpng: Failed to read the header of " << path << std::endl;
+		return false;
+	}
+
+	if (zip_reader)
+		png_set_read_fn(p, zip_reader.get(), zip_read_data);
+	else
+		png_init_io(p, fp);
+	png_read_info(p, i);
+
+	png_uint_32 w = 0, h = 0;
+	int depth = 0, color_type = 0, interlace = 0;
+	png_get_IHDR(p, i, &w, &h, &depth, &color_type, &interlace, nullptr, nullptr);
+
+	// Interlaced files can't be decoded row by row, and palettes and alpha are left to Magick.
+	if (interlace != PNG_INTERLACE_NONE || png_get_valid(p, i, PNG_INFO_tRNS))
+		return false;
+	if (color_type == PNG_COLOR_TYPE_GRAY)
+		num_channels = 1;
+	else if (color_type == PNG_COLOR_TYPE_RGB)
+		num_channels = 3;
+	else
+		return false;
+
+	if (depth < 8)
+		png_set_expand_gray_1_2_4_to_8(p);
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (depth == 16)
+		png_set_swap(p);
+#endif
+	png_read_update_info(p, i);
+
+	width = w;
+	height = h;
+	file_bit_depth = depth;
+	bit_depth = depth == 16 ? 16 : 8;
+	row_bytes = png_get_rowbytes(p, i);
+
+	return width > 0 && height > 0;
+}
+
+bool PNGRowReader::decode_row(unsigned char *row) {
+	png_structp p = (png_structp) png;
+	if (setjmp(png_jmpbuf(p)))
+		return false;
+	png_read_row(p, row, nullptr);
+	num_decoded_rows++;
+	return true;
+}
+
+bool PNGRowReader::read_window(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, float *const *dst) {
+	if (png == nullptr || x1 <= x0 || y1 <= y0)
+		return false;
+
+	unsigned int ww = x1 - x0;
+	unsigned int wh = y1 - y0;
+	for (unsigned int c = 0; c < num_channels; c++)
+		std::fill(dst[c], dst[c] + (size_t) ww * wh, 0.0f);
+
+	// Part of the window within the raster.
+	unsigned int cx1 = std::min(x1, width);
+	unsigned int cy1 = std::min(y1, height);
+	if (x0 >= cx1 || y0 >= cy1)
+		return true;
+
+	// The rows above the window can't be decoded again without starting over.
+	unsigned int first_available = rows.empty() ? next_row : first_row;
+	if (y0 < first_available && !start())
+		return false;
+
+	// Drop the rows above the window.
+	while (!rows.empty() && first_row < y0) {
+		spare_rows.push_back(std::move(rows.front()));
+		rows.pop_front();
+		first_row++;
+	}
+
+	// Decode down to the bottom of the window, skipping the rows above it.
+	std::vector<unsigned char> skipped;
+	while (next_row < cy1) {
+		if (next_row < y0) {
+			skipped.resize(row_bytes);
+			if (!decode_row(skipped.data()))
+				return false;
+			next_row++;
+			continue;
+		}
+
+		std::vector<unsigned char> row;
+		if (!spare_rows.empty()) {
+			row = std::move(spare_rows.back());
+			spare_rows.pop_back();
+		}
+		row.resize(row_bytes);
+		if (!decode_row(row.data())) {
+			std::cerr << "ERROR: libpng: Failed to decode row " << next_row << " of " << path << std::endl;
+			return false;
+		}
+		if (rows.empty())
+			first_row = next_row;
+		rows.push_back(std::move(row));
+		next_row++;
+	}
+
+	float f = bit_depth == 16 ? 1.0f / 65535.0f : 1.0f / 255.0f;
+	for (unsigned int y = y0; y < cy1; y++) {
+		const unsigned char *row = rows[y - first_row].data();
+		size_t d = (size_t) (y - y0) * ww;
+		for (unsigned int c = 0; c < num_channels; c++) {
+			float *dc = dst[c] + d;
+			if (bit_depth == 16) {
+				const uint16_t *s = (const uint16_t *) row + c;
+				for (unsigned int x = x0; x < cx1; x++)
+					dc[x - x0] = s[(size_t) x * num_channels] * f;
+			} else {
+				const uint8_t *s = row + c;
+				for (unsigned int x = x0; x < cx1; x++)
+					dc[x - x0] = s[(size_t) x * num_channels] * f;
+			}
+		}
+	}
+
+	return true;
+}
@@ -16,8 +16,12 @@
 
 #include "raster/raster_image.hpp"
 #include "raster/netcdf_interface.hpp"
+#include "raster/pixel_kernels.hpp"
 #include "util/datetime.hpp"
+#include "util/stage_stats.hpp"
+#include "util/zip_archive.hpp"
 #include "version.hpp"
+#include <algorithm>
 #include <climits>
 #include <cstring>
 
@@ -84,7 +88,7 @@ RasterBufferRGB<T>::~RasterBufferRGB() {
 }
 
 RasterImage::RasterImage():
-	subset(nullptr), main_depth(0), main_num_components(0), f_overlap(0.0f), scaling_factor(1.0f), num_threads(0),
+	subset(nullptr), main_depth(0), main_num_components(0), subset_components(0), f_overlap(0.0f), scaling_factor(1.0f), valid_fraction(-1.0f), num_threads(0),
 	deflate_level(9)
 {
 	set_resampling_filter("");
@@ -150,9 +154,34 @@ void RasterImage::clear() {
 		delete subset;
 		subset = nullptr;
 	}
+	subset_components = 0;
 	set_resampling_filter("");
 }
 
+void RasterImage::reset_subset(unsigned int w, unsigned int h) {
+	Magick::Color background;
+	if (main_num_components == 3)
+		background = Magick::ColorRGB(0, 0, 0);
+	else
+		background = Magick::ColorGray(0);
+
+	if (subset != nullptr && subset_components == main_num_components &&
+			subset->columns() == w && subset->rows() == h) {
+		// Blank the pixels, as the loaders only blit the tiles which overlap with the window.
+		Magick::PixelPacket *px = subset->getPixels(0, 0, w, h);
+		std::fill(px, px + (size_t) w * h, (Magick::PixelPacket) background);
+		subset->syncPixels();
+		set_resampling_filter("");
+		StageStats::count_allocation(StageStats::AL_IMAGE, true, 0);
+		return;
+	}
+
+	clear();
+	subset = new Magick::Image(Magick::Geometry(w, h), background);
+	subset_components = main_num_components;
+	StageStats::count_allocation(StageStats::AL_IMAGE, false, (uint64_t) w * h * sizeof(Magick::PixelPacket));
+}
+
 std::ostream& operator<<(std::ostream &out, const RasterImage& img) {
 	if (img.subset != nullptr) {
 		Magick::Geometry geom = img.subset->size();
@@ -167,6 +196,28 @@ std::ostream& operator<<(std::ostream &out, const RasterImage& img) {
 	return out << "RasterImage()";
 }
 
+bool RasterImage::read_magick(Magick::Image &img, const std::filesystem::path &path, bool ping) {
+	if (!ZipArchive::is_member_path(path)) {
+		if (ping)
+			img.ping(path.string());
+		else
+			img.read(path.string());
+		return true;
+	}
+
+	std::vector<unsigned char> data;
+	if (!ZipArchive::read_member(path, data)) {
+		std::cerr << "ERROR: Failed to read " << path << std::endl;
+		return false;
+	}
+	Magick::Blob blob(data.data(), data.size());
+	if (ping)
+		img.ping(blob);
+	else
+		img.read(blob);
+	return true;
+}
+
 Magick::Image *RasterImage::create_grayscale(const Magick::Geometry &geometry, int pixel_depth, int background_value) {
 	clear();
 
@@ -219,6 +270,7 @@ bool RasterImage::scale_to(unsigned int size) {
 
 		scaling_factor = ((float) size) / ((float) geom_orig.width());
 
+		StageTimer timer(StageStats::ST_RESAMPLE, (uint64_t) geom_orig.width() * geom_orig.height() * sizeof(Magick::PixelPacket));
 		Magick::Geometry geom_new(size, size);
 		subset->filterType(resampling_filter);
 		subset->resize(geom_new);
@@ -233,22 +285,14 @@ void RasterImage::remap_values(const unsigned char *values, unsigned char max_va
 		unsigned int w = subset->columns();
 		unsigned int h = subset->rows();
 		unsigned int size = w * h;
+		StageTimer timer(StageStats::ST_REMAP, (uint64_t) size * sizeof(Magick::PixelPacket));
 
 		Magick::PixelPacket *px = subset->getPixels(0, 0, w, h);
 
-		float src_val, dst_val;
-
-		for (unsigned int i=0; i<size; i++) {
-			src_val = Magick::ColorGray(px[i]).shade();
-
-			//! \note The last value is reserved for the mapping of invalid values.
-			unsigned char idx = (unsigned char) (255 * src_val);
-			if (idx > max_value)
-				idx = max_value;
-
-			dst_val = values[idx] / 255.0f;
-			px[i] = Magick::ColorGray(dst_val);
-		}
+		//! \note The last value is reserved for the mapping of invalid values.
+		PixelKernels::class_table_t table;
+		PixelKernels::make_class_table(values, max_value, table);
+		PixelKernels::remap_classes(px, size, table);
 
 		subset->syncPixels();
 	}
@@ -405,23 +449,11 @@ bool RasterImage::add_to_netcdf(const std::filesystem::path &path, const std::st
 		if (c == 1) {
 			if (main_depth > 8) {
 				RasterBufferPan<float> dst_px(size);
-
-				for (unsigned int y=0; y<h; y++) {
-					yw = y * w;
-					for (unsigned int x=0; x<w; x++) {
-						dst_px.v[yw + x] = ((float) src_px[yw + x].green) / MaxRGB;
-					}
-				}
+				PixelKernels::pixels_to_float(src_px, size, dst_px.v);
 				add_layer_to_netcdf(ncid, path, name_in_netcdf, w, h, dimids, nd, (const void *) dst_px.v);
 			} else {
 				RasterBufferPan<unsigned char> dst_px(size);
-
-				for (unsigned int y=0; y<h; y++) {
-					yw = y * w;
-					for (unsigned int x=0; x<w; x++) {
-						dst_px.v[yw + x] = (int) (src_px[yw + x].green * 255 / MaxRGB);
-					}
-				}
+				PixelKernels::pixels_to_ubyte(src_px, size, dst_px.v);
 				add_layer_to_netcdf(ncid, path, name_in_netcdf, w, h, dimids, nd, (const void *) dst_px.v);
 			}
 
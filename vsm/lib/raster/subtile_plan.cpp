@@ -0,0 +1,110 @@
+// Precomputed sub-tile windows and output paths
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "raster/subtile_plan.hpp"
+#include <algorithm>
+#include <math.h>
+
+
+SubtilePlan::SubtilePlan(const std::vector<Vector<int>> &subtiles, const std::filesystem::path &path_dir_out, const std::string &nc_prefix,
+	const AABB<float> &aabb_buf, unsigned int width, unsigned int height, unsigned int tile_size, float f_overlap, float div_f,
+	const std::map<std::pair<int, int>, float> &valid_fractions)
+{
+	windows.resize(subtiles.size());
+	for (size_t i=0; i<subtiles.size(); i++) {
+		SubtileWindow &w = windows[i];
+		w.p = subtiles[i];
+		compute_window(w, aabb_buf, width, height, tile_size, f_overlap, div_f);
+
+		auto it = valid_fractions.find(std::make_pair(w.p.x, w.p.y));
+		w.valid_fraction = it != valid_fractions.end() ? it->second : -1.0f;
+
+		w.name_suffix = "_tile_" + std::to_string(w.p.x) + "_" + std::to_string(w.p.y);
+		w.path_dir = get_subtile_dir(path_dir_out, w.p);
+		w.path_nc = get_nc_path(path_dir_out, nc_prefix, w.p);
+	}
+}
+
+std::vector<size_t> SubtilePlan::get_row_major_order(size_t first, size_t last) const {
+	std::vector<size_t> order;
+	for (size_t i=first; i<last && i<windows.size(); i++)
+		order.push_back(i);
+
+	std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+		const SubtileWindow &wa = windows[a], &wb = windows[b];
+		return wa.y0 < wb.y0 || (wa.y0 == wb.y0 && wa.x0 < wb.x0);
+	});
+	return order;
+}
+
+bool SubtilePlan::get_bounds(size_t first, size_t last, int &x0, int &y0, int &x1, int &y1) const {
+	bool found = false;
+	for (size_t i=first; i<last && i<windows.size(); i++) {
+		const SubtileWindow &w = windows[i];
+		if (w.skip)
+			continue;
+		if (!found) {
+			x0 = w.x0;
+			y0 = w.y0;
+			x1 = w.x1;
+			y1 = w.y1;
+			found = true;
+		} else {
+			x0 = std::min(x0, w.x0);
+			y0 = std::min(y0, w.y0);
+			x1 = std::max(x1, w.x1);
+			y1 = std::max(y1, w.y1);
+		}
+	}
+	return found;
+}
+
+void SubtilePlan::compute_window(SubtileWindow &w, const AABB<float> &aabb_buf, unsigned int width, unsigned int height, unsigned int tile_size, float f_overlap, float div_f) {
+	// With increased overlap, the effective subtile size is reduced.
+	float tile_size_div = (tile_size - tile_size * f_overlap) / div_f;
+
+	// Coordinates in the source image (possibly with different dimensions).
+	w.x0 = aabb_buf.vmin.x * width + floor(tile_size_div * w.p.x);
+	w.y0 = aabb_buf.vmin.y * height + floor(tile_size_div * w.p.y);
+	w.x1 = ceil(w.x0 + tile_size_div);
+	w.y1 = ceil(w.y0 + tile_size_div);
+
+	// It's possible that due to rounding errors, the tile would no longer be square.
+	// For this case, we'll crop the additional row / column of pixels to square the tile once again.
+	if (w.x1 - w.x0 > w.y1 - w.y0)
+		w.x1 = w.x0 + w.y1 - w.y0;
+	else if (w.y1 - w.y0 > w.x1 - w.x0)
+		w.y1 = w.y0 + w.x1 - w.x0;
+
+	// Account for overlap.
+	w.x1 += tile_size * f_overlap / div_f;
+	w.y1 += tile_size * f_overlap / div_f;
+
+	w.skip = w.x1 <= w.x0 || w.y1 <= w.y0 || w.x0 < 0 || w.y0 < 0 || w.x0 >= (int) width || w.y0 >= (int) height;
+}
+
+std::string SubtilePlan::get_subtile_dir(const std::filesystem::path &path_dir_out, const Vector<int> &p) {
+	return path_dir_out.string() + "/tile_" + std::to_string(p.x) + "_" + std::to_string(p.y) + "/";
+}
+
+std::string SubtilePlan::get_nc_path(const std::filesystem::path &path_dir_out, const std::string &nc_prefix, const Vector<int> &p) {
+	return get_subtile_dir(path_dir_out, p) + nc_prefix + "_tile_" + std::to_string(p.x) + "_" + std::to_string(p.y) + ".nc";
+}
+
+void SubtilePlan::create_directories(const std::filesystem::path &path_dir_out, const std::vector<Vector<int>> &subtiles) {
+	for (auto it = subtiles.begin(); it != subtiles.end(); it++)
+		std::filesystem::create_directories(get_subtile_dir(path_dir_out, *it));
+}
@@ -0,0 +1,314 @@
+// Synthetic Sentinel-2 products for benchmarking
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "raster/synthetic_s2.hpp"
+#include "raster/jp2_image.hpp"
+#include "raster/esa_s2_scl_jp2.hpp"
+#include "raster/cnes_maja_clm_tif.hpp"
+#include <openjpeg.h>
+#include <png.h>
+#include <tiffio.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+
+//! Granule name, with the tile and the sensing time of the product name.
+static const std::string granule_name = "L2A_T00AAA_A000000_20200101T100000";
+//! Prefix of the band file names.
+static const std::string band_prefix = "T00AAA_20200101T100000";
+
+SyntheticS2Product::SyntheticS2Product(unsigned int size, unsigned int seed):
+	size(size), seed(seed), tile_size(1024), nodata_fraction(0.2f)
+{
+	// std::mt19937 produces the same sequence on all platforms, unlike the distributions.
+	std::mt19937 rng(seed);
+	for (unsigned int i=0; i<4; i++)
+		phase[i] = rng() / 4294967296.0f;
+}
+
+std::string SyntheticS2Product::get_name() {
+	return "S2B_MSIL2A_20200101T100000_N0213_R000_T00AAA_20200101T120000.SAFE";
+}
+
+bool SyntheticS2Product::is_valid(float x, float y) const {
+	return x >= nodata_fraction * size * (1.0f - y / size);
+}
+
+float SyntheticS2Product::get_cloud(float x, float y) const {
+	const float tau = 2.0f * M_PI;
+	float u = x / size, v = y / size;
+	float c = 0.5f + 0.3f * sinf(tau * (3.0f * u + phase[0])) * sinf(tau * (2.0f * v + phase[1]))
+		+ 0.2f * sinf(tau * (5.0f * (u + v) + phase[2]));
+	return std::min(std::max(c, 0.0f), 1.0f);
+}
+
+uint16_t SyntheticS2Product::get_reflectance(unsigned int band, float x, float y) const {
+	if (!is_valid(x, y))
+		return 0;
+
+	float u = x / size, v = y / size;
+	float surface = 800.0f + 150.0f * band + 400.0f * sinf(2.0f * M_PI * (41.0f * u + 29.0f * v + phase[3]));
+	// Clouds brighten all the bands, from the threshold of thin clouds onwards.
+	float c = std::max(get_cloud(x, y) - 0.6f, 0.0f) / 0.4f;
+	float value = surface + c * (9000.0f - surface);
+	// Some noise within the texture, so that the bands don't compress unrealistically well.
+	uint32_t h = ((uint32_t) x * 73856093u) ^ ((uint32_t) y * 19349663u) ^ (band * 83492791u);
+	return (uint16_t) (value + (h % 97));
+}
+
+unsigned char SyntheticS2Product::get_scl(float x, float y) const {
+	if (!is_valid(x, y))
+		return ESA_S2_SCL_JP2_Image::SCL_NO_DATA;
+
+	float c = get_cloud(x, y);
+	if (c >= 0.85f)
+		return ESA_S2_SCL_JP2_Image::SCL_CLOUD_HIGH_PROBABILITY;
+	else if (c >= 0.7f)
+		return ESA_S2_SCL_JP2_Image::SCL_CLOUD_MEDIUM_PROBABILITY;
+	else if (c >= 0.6f)
+		return ESA_S2_SCL_JP2_Image::SCL_THIN_CIRRUS;
+	else if (c >= 0.55f)
+		return ESA_S2_SCL_JP2_Image::SCL_CLOUD_SHADOWS;
+
+	// Patches of land cover, in a checkerboard of 8x8 patches per granule.
+	static const unsigned char land[3] = {
+		ESA_S2_SCL_JP2_Image::SCL_VEGETATION, ESA_S2_SCL_JP2_Image::SCL_NOT_VEGETATED, ESA_S2_SCL_JP2_Image::SCL_WATER
+	};
+	return land[((unsigned int) (8 * x / size) + (unsigned int) (8 * y / size)) % 3];
+}
+
+unsigned char SyntheticS2Product::get_clm(float x, float y) const {
+	if (!is_valid(x, y))
+		return 0;
+
+	float c = get_cloud(x, y);
+	if (c >= 0.7f) {
+		unsigned char flags = CNES_MAJA_CLM_TIF::CLM_THEIA_CLOUDS_SHADOWS | CNES_MAJA_CLM_TIF::CLM_THEIA_CLOUDS | CNES_MAJA_CLM_TIF::CLM_THEIA_CLOUDS_MONOTEMP;
+		if (c >= 0.85f)
+			flags |= CNES_MAJA_CLM_TIF::CLM_THEIA_HIGH_CLOUDS;
+		return flags;
+	} else if (c >= 0.6f) {
+		return CNES_MAJA_CLM_TIF::CLM_THEIA_THIN_CLOUDS;
+	} else if (c >= 0.55f) {
+		return CNES_MAJA_CLM_TIF::CLM_THEIA_CLOUDS_SHADOWS | CNES_MAJA_CLM_TIF::CLM_THEIA_CLOUD_SHADOWS;
+	}
+	return 0;
+}
+
+unsigned char SyntheticS2Product::get_cloud_probability(float x, float y, unsigned int max_value) const {
+	if (!is_valid(x, y))
+		return 0;
+	float p = std::min(std::max((get_cloud(x, y) - 0.4f) / 0.5f, 0.0f), 1.0f);
+	return (unsigned char) lroundf(p * max_value);
+}
+
+bool SyntheticS2Product::write_jp2(const std::filesystem::path &path, unsigned int factor, unsigned int precision, const pixel_fn_t &fn) const {
+	unsigned int w = (size + factor - 1) / factor;
+	unsigned int t = std::max(tile_size / factor, 1u);
+	unsigned int ntx = (w + t - 1) / t;
+
+	opj_cparameters_t params;
+	opj_set_default_encoder_parameters(&params);
+	// Lossless, with a single quality layer, like the L2A products.
+	params.tcp_numlayers = 1;
+	params.tcp_rates[0] = 0;
+	params.cp_disto_alloc = 1;
+	params.tile_size_on = OPJ_TRUE;
+	params.cp_tx0 = 0;
+	params.cp_ty0 = 0;
+	params.cp_tdx = t;
+	params.cp_tdy = t;
+	// The lowest resolution level has to be at least a pixel across in each tile.
+	params.numresolution = 1;
+	while (params.numresolution < 6 && (t >> params.numresolution) > 0)
+		params.numresolution++;
+
+	opj_image_cmptparm_t cmpt;
+	memset(&cmpt, 0, sizeof(cmpt));
+	cmpt.dx = 1;
+	cmpt.dy = 1;
+	cmpt.w = w;
+	cmpt.h = w;
+	cmpt.prec = precision;
+	cmpt.sgnd = 0;
+
+	opj_image_t *image = opj_image_tile_create(1, &cmpt, OPJ_CLRSPC_GRAY);
+	if (image == nullptr) {
+		std::cerr << "ERROR: Failed to create the image for " << path << std::endl;
+		return false;
+	}
+	image->x0 = 0;
+	image->y0 = 0;
+	image->x1 = w;
+	image->y1 = w;
+
+	opj_codec_t *codec = opj_create_compress(OPJ_CODEC_JP2);
+	opj_set_error_handler(codec, JP2_Image::error_callback, nullptr);
+	opj_stream_t *stream = nullptr;
+
+	bool retval = opj_setup_encoder(codec, &params, image);
+	if (retval) {
+		stream = opj_stream_create_default_file_stream(path.c_str(), OPJ_FALSE);
+		retval = stream != nullptr && opj_start_compress(codec, image, stream);
+	}
+
+	// Tiles are written in the order of their indices, row by row.
+	unsigned int bytes_per_sample = precision > 8 ? 2 : 1;
+	std::vector<OPJ_BYTE> tile((size_t) t * t * bytes_per_sample);
+	for (unsigned int i=0; retval && i<ntx*ntx; i++) {
+		unsigned int x0 = (i % ntx) * t, y0 = (i / ntx) * t;
+		unsigned int tw = std::min(t, w - x0), th = std::min(t, w - y0);
+		for (unsigned int y=0; y<th; y++) {
+			for (unsigned int x=0; x<tw; x++) {
+				// Pixel values are sampled at the centers of the pixels.
+				uint32_t value = fn((x0 + x + 0.5f) * factor, (y0 + y + 0.5f) * factor);
+				if (bytes_per_sample == 2)
+					((uint16_t *) tile.data())[y * tw + x] = (uint16_t) value;
+				else
+					tile[y * tw + x] = (OPJ_BYTE) value;
+			}
+		}
+		retval = opj_write_tile(codec, i, tile.data(), tw * th * bytes_per_sample, stream);
+	}
+
+	if (retval)
+		retval = opj_end_compress(codec, stream);
+	if (!retval)
+		std::cerr << "ERROR: Failed to write " << path << std::endl;
+
+	if (stream != nullptr)
+		opj_stream_destroy(stream);
+	opj_destroy_codec(codec);
+	opj_image_destroy(image);
+	return retval;
+}
+
+bool SyntheticS2Product::write_tif(const std::filesystem::path &path, unsigned int factor, const pixel_fn_t &fn) const {
+	unsigned int w = (size + factor - 1) / factor;
+
+	TIFF *ptif = TIFFOpen(path.c_str(), "w");
+	if (ptif == nullptr) {
+		std::cerr << "ERROR: Failed to create " << path << std::endl;
+		return false;
+	}
+	TIFFSetField(ptif, TIFFTAG_IMAGEWIDTH, w);
+	TIFFSetField(ptif, TIFFTAG_IMAGELENGTH, w);
+	TIFFSetField(ptif, TIFFTAG_SAMPLESPERPIXEL, 1);
+	TIFFSetField(ptif, TIFFTAG_BITSPERSAMPLE, 8);
+	TIFFSetField(ptif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+	TIFFSetField(ptif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(ptif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+	TIFFSetField(ptif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+	TIFFSetField(ptif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(ptif, 0));
+
+	bool retval = true;
+	std::vector<unsigned char> row(w);
+	for (unsigned int y=0; retval && y<w; y++) {
+		for (unsigned int x=0; x<w; x++)
+			row[x] = (unsigned char) fn((x + 0.5f) * factor, (y + 0.5f) * factor);
+		retval = TIFFWriteScanline(ptif, row.data(), y, 0) == 1;
+	}
+	TIFFClose(ptif);
+
+	if (!retval)
+		std::cerr << "ERROR: Failed to write " << path << std::endl;
+	return retval;
+}
+
+bool SyntheticS2Product::write_png(const std::filesystem::path &path, unsigned int factor, const pixel_fn_t &fn) const {
+	unsigned int w = (size + factor - 1) / factor;
+
+	FILE *fp = fopen(path.c_str(), "wb");
+	if (fp == nullptr) {
+		std::cerr << "ERROR: Failed to create " << path << std::endl;
+		return false;
+	}
+
+	// The row buffer is allocated before setjmp(), so that an error of libpng doesn't jump over its lifetime.
+	std::vector<unsigned char> row(w);
+
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+	png_infop info = png != nullptr ? png_create_info_struct(png) : nullptr;
+	if (info == nullptr || setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, info != nullptr ? &info : nullptr);
+		fclose(fp);
+		std::cerr << "ERROR: Failed to write " << path << std::endl;
+		return false;
+	}
+
+	png_init_io(png, fp);
+	png_set_IHDR(png, info, w, w, 8, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+
+	for (unsigned int y=0; y<w; y++) {
+		for (unsigned int x=0; x<w; x++)
+			row[x] = (unsigned char) fn((x + 0.5f) * factor, (y + 0.5f) * factor);
+		png_write_row(png, row.data());
+	}
+	png_write_end(png, nullptr);
+	png_destroy_write_struct(&png, &info);
+	fclose(fp);
+	return true;
+}
+
+bool SyntheticS2Product::write(const std::filesystem::path &path_dir) const {
+	std::filesystem::path path_granule = path_dir / get_name() / "GRANULE" / granule_name;
+	std::filesystem::path path_img = path_granule / "IMG_DATA";
+
+	std::error_code ec;
+	for (const char *d: {"IMG_DATA/R10m", "IMG_DATA/R20m", "IMG_DATA/R60m", "QI_DATA", "MAJA_DATA", "S2CLOUDLESS_DATA/R20m"}) {
+		std::filesystem::create_directories(path_granule / d, ec);
+		if (ec) {
+			std::cerr << "ERROR: Failed to create " << (path_granule / d) << ": " << ec.message() << std::endl;
+			return false;
+		}
+	}
+
+	// Spectral bands, with their pixel sizes relative to 10 m.
+	static const std::pair<const char *, unsigned int> bands[] = {
+		{"B02", 1}, {"B03", 1}, {"B04", 1}, {"B08", 1},
+		{"B05", 2}, {"B06", 2}, {"B07", 2}, {"B8A", 2}, {"B11", 2}, {"B12", 2},
+		{"B01", 6}, {"B09", 6}
+	};
+	for (unsigned int i=0; i<sizeof(bands) / sizeof(bands[0]); i++) {
+		std::string res = std::to_string(10 * bands[i].second) + "m";
+		std::filesystem::path path = path_img / ("R" + res) / (band_prefix + "_" + bands[i].first + "_" + res + ".jp2");
+		if (!write_jp2(path, bands[i].second, 16, [this, i](float x, float y) { return get_reflectance(i, x, y); }))
+			return false;
+	}
+
+	if (!write_jp2(path_img / "R20m" / (band_prefix + "_SCL_20m.jp2"), 2, 8, [this](float x, float y) { return get_scl(x, y); }))
+		return false;
+	if (!write_jp2(path_granule / "QI_DATA" / "MSK_CLDPRB_20m.jp2", 2, 8, [this](float x, float y) { return get_cloud_probability(x, y, 100); }))
+		return false;
+
+	pixel_fn_t clm = [this](float x, float y) { return get_clm(x, y); };
+	if (!write_tif(path_granule / "MAJA_DATA" / (band_prefix + "_CLM_R1.tif"), 1, clm) ||
+		!write_tif(path_granule / "MAJA_DATA" / (band_prefix + "_CLM_R2.tif"), 2, clm))
+		return false;
+
+	std::filesystem::path path_s2cloudless = path_granule / "S2CLOUDLESS_DATA" / "R20m";
+	if (!write_png(path_s2cloudless / (band_prefix + "_prediction.png"), 2, [this](float x, float y) { return get_cloud(x, y) >= 0.7f ? 1 : 0; }) ||
+		!write_png(path_s2cloudless / (band_prefix + "_probability.png"), 2, [this](float x, float y) { return get_cloud_probability(x, y, 255); }))
+		return false;
+
+	return true;
+}
@@ -15,18 +15,22 @@
 // limitations under the License.
 
 #include "raster/tif_image.hpp"
+#include "util/worker_arena.hpp"
+#include <algorithm>
 #include <cstring>
+#include <iostream>
 #include "tiffio.h"
 
-TIF_Image::TIF_Image(): num_tiff_channels(0) {}
+TIF_Image::TIF_Image(): num_tiff_channels(0), reader_failed(false) {}
 TIF_Image::~TIF_Image() {}
 
 bool TIF_Image::load_header(const std::filesystem::path &path) {
 	if (subset != nullptr)
 		clear();
 
-	TIFFSetWarningHandler(NULL);
-	TIFF *ptif = TIFFOpen(path.c_str(), "r");
+	TIFF *ptif = TIFWindowReader::open_tiff(path);
+	if (ptif == nullptr)
+		return false;
 
 	unsigned short n_chan = 0;
 	TIFFGetField(ptif, TIFFTAG_SAMPLESPERPIXEL, &n_chan);
@@ -52,12 +56,70 @@ bool TIF_Image::load_header(const std::filesystem::path &path) {
 	return true;
 }
 
+bool TIF_Image::open_reader(const std::filesystem::path &path) {
+	if (reader.is_open() && reader.get_path() == path)
+		return true;
+	if (reader_failed && reader_path == path)
+		return false;
+
+	reader_path = path;
+	reader_failed = !reader.open(path);
+	return !reader_failed;
+}
+
 bool TIF_Image::load_subset(const std::filesystem::path &path, unsigned int da_x0, unsigned int da_y0, unsigned int da_x1, unsigned int da_y1) {
+	// Fall back to Magick for layouts which the window reader doesn't support (palette, bilevel, etc.).
+	if (!open_reader(path) || (reader.num_channels != 1 && reader.num_channels != 3))
+		return load_subset_magick(path, da_x0, da_y0, da_x1, da_y1);
+
+	if (da_x1 <= da_x0 || da_y1 <= da_y0)
+		return false;
+
+	unsigned int w = da_x1 - da_x0;
+	unsigned int h = da_y1 - da_y0;
+	unsigned int size = w * h;
+	unsigned int channels[3] = {0, 1, 2};
+
+	main_geometry.width(reader.width);
+	main_geometry.height(reader.height);
+	main_depth = reader.bits_per_sample;
+	main_num_components = reader.num_channels;
+
+	float *buf = WorkerArena::get_current().get<float>(WorkerArena::SLOT_PLANES, (size_t) size * main_num_components);
+	float *planes[3] = {buf, buf + size, buf + 2 * size};
+	if (!reader.read_window(da_x0, da_y0, da_x1, da_y1, channels, main_num_components, planes))
+		return false;
+
+	unsigned int depth = std::min<unsigned int>(main_depth, 16);
+	reset_subset(w, h);
+	if (main_num_components == 3)
+		subset->type(Magick::TrueColorType);
+	else
+		subset->type(Magick::GrayscaleType);
+	subset->quiet(false);
+	subset->depth(depth);
+
+	Magick::PixelPacket *px = subset->getPixels(0, 0, w, h);
+	if (main_num_components == 3) {
+		for (unsigned int i = 0; i < size; i++)
+			px[i] = Magick::ColorRGB(planes[0][i], planes[1][i], planes[2][i]);
+	} else {
+		for (unsigned int i = 0; i < size; i++)
+			px[i] = Magick::ColorGray(planes[0][i]);
+	}
+	subset->syncPixels();
+
+	return true;
+}
+
+bool TIF_Image::load_subset_magick(const std::filesystem::path &path, unsigned int da_x0, unsigned int da_y0, unsigned int da_x1, unsigned int da_y1) {
 	if (subset != nullptr)
 		clear();
 
-	Magick::Image img(path);
+	Magick::Image img;
 	img.quiet(false);
+	if (!read_magick(img, path))
+		return false;
 
 	Magick::ImageType imgtype = img.type();
 	if (imgtype == Magick::BilevelType)
@@ -87,109 +149,85 @@ bool TIF_Image::load_subset(const std::filesystem::path &path, unsigned int da_x
 }
 
 bool TIF_Image::load_subset_channel(const std::filesystem::path &path, unsigned int da_x0, unsigned int da_y0, unsigned int da_x1, unsigned int da_y1, unsigned int channel) {
-	tsize_t retval = -1;
-	unsigned int blocksize = 0;
-	unsigned int tile_w = 0, tile_h = 0;
-	unsigned int da_x1c = da_x1;
-	unsigned int da_y1c = da_y1;
-	unsigned int x, y, yi;
-	unsigned int rows_per_strip = 0;
-	unsigned short planar_cfg = 0;
-	float dst_val;
-
-	// Make sure that we won't ask for out of range pixels from libtiff.
-	if (channel > num_tiff_channels)
+	std::vector<unsigned int> channels(1, channel);
+	if (!load_subset_channels(path, da_x0, da_y0, da_x1, da_y1, channels, std::vector<float>()))
 		return false;
-	if (da_x0 > main_geometry.width() || da_y0 > main_geometry.height())
+	return select_subset_channel(0);
+}
+
+bool TIF_Image::load_subset_channels(const std::filesystem::path &path, unsigned int da_x0, unsigned int da_y0, unsigned int da_x1, unsigned int da_y1,
+	const std::vector<unsigned int> &channels, const std::vector<float> &scales)
+{
+	channel_planes.clear();
+	channel_planes_path.clear();
+
+	if (!open_reader(path)) {
+		std::cerr << "ERROR: Unsupported TIFF layout in " << path << std::endl;
 		return false;
-	if (da_x1 > main_geometry.width())
-		da_x1c = main_geometry.width();
-	if (da_y1 > main_geometry.height())
-		da_y1c = main_geometry.height();
-
-	Magick::Geometry geom(main_geometry);
-	create_grayscale(Magick::Geometry(da_x1 - da_x0, da_y1 - da_y0), main_depth, 0);
-	main_geometry = geom;
-
-	Magick::PixelPacket *px = subset->getPixels(0, 0, da_x1 - da_x0, da_y1 - da_y0);
-
-	tdata_t pbuf = nullptr;
-	TIFF *ptif = TIFFOpen(path.c_str(), "r");
-	if (ptif) {
-		TIFFGetField(ptif, TIFFTAG_PLANARCONFIG, &planar_cfg);
-
-		if (TIFFIsTiled(ptif)) {
-			TIFFGetField(ptif, TIFFTAG_TILEWIDTH, &tile_w);
-			TIFFGetField(ptif, TIFFTAG_TILELENGTH, &tile_h);
-			unsigned int da_x0t = da_x0 / tile_w;
-			unsigned int da_y0t = da_y0 / tile_h;
-			unsigned int da_x1t = da_x1 / tile_w;
-			unsigned int da_y1t = da_y1 / tile_h;
-
-			if (da_x1 % tile_w > 0)
-				da_x1t++;
-			if (da_y1 % tile_h > 0)
-				da_y1t++;
-			da_x0t *= tile_w;
-			da_y0t *= tile_h;
-			da_x1t *= tile_w;
-			da_y1t *= tile_h;
-
-
-			blocksize = TIFFTileSize(ptif);
-			pbuf = _TIFFmalloc(blocksize);
-			for (y = da_y0t; y < da_y1t; y += tile_h) {
-				for (x = da_x0t; x < da_x1t; x += tile_w) {
-					retval = TIFFReadTile(ptif, pbuf, x, y, 0, channel);
-
-					//! \todo Implement blitting to Magick::Image
-				}
-			}
-		} else {
-			TIFFGetField(ptif, TIFFTAG_ROWSPERSTRIP, &rows_per_strip);
-
-			tile_w = main_geometry.width();
-			tile_h = rows_per_strip;
-
-			blocksize = TIFFStripSize(ptif);
-			pbuf = _TIFFmalloc(blocksize);
-			for (y = da_y0; y < da_y1c; y += rows_per_strip) {
-				if (planar_cfg == PLANARCONFIG_CONTIG) {
-					retval = TIFFReadEncodedStrip(ptif, y / rows_per_strip, pbuf, (tsize_t) -1);
-				} else if (planar_cfg == PLANARCONFIG_SEPARATE) {
-					retval = TIFFReadEncodedStrip(ptif, channel * tile_h + y / rows_per_strip, pbuf, (tsize_t) -1);
-				}
-
-				if (main_depth == 32) {
-					if (planar_cfg == PLANARCONFIG_CONTIG) {
-						for (yi = 0; yi < rows_per_strip; yi++) {
-							for (x = da_x0; x < da_x1c; x++) {
-								dst_val = ((float *) pbuf)[(x + yi * tile_w) * num_tiff_channels + channel];
-								if (dst_val < 0)
-									dst_val = 0.0f;
-								px[x - da_x0 + (y + yi - da_y0) * (da_x1 - da_x0)] = Magick::ColorGray(dst_val);
-							}
-						}
-					} else if (planar_cfg == PLANARCONFIG_SEPARATE) {
-						for (yi = 0; yi < rows_per_strip; yi++) {
-							for (x = da_x0; x < da_x1c; x++) {
-								dst_val = ((float *) pbuf)[x + yi * tile_w];
-								if (dst_val < 0)
-									dst_val = 0.0f;
-								px[x - da_x0 + (y + yi - da_y0) * (da_x1 - da_x0)] = Magick::ColorGray(dst_val);
-							}
-						}
-					}
-				}
-			}
-		}
-
-		subset->syncPixels();
-
-		_TIFFfree(pbuf);
-		TIFFClose(ptif);
 	}
 
-	return retval;
+	// Make sure that we won't ask for out of range pixels.
+	for (unsigned int c: channels) {
+		if (c >= reader.num_channels)
+			return false;
+	}
+	if (channels.empty() || (!scales.empty() && scales.size() != channels.size()))
+		return false;
+	if (da_x0 >= reader.width || da_y0 >= reader.height || da_x1 <= da_x0 || da_y1 <= da_y0)
+		return false;
+
+	size_t size = (size_t) (da_x1 - da_x0) * (da_y1 - da_y0);
+	num_tiff_channels = reader.num_channels;
+
+	// Strips or tiles covering the window are decoded by the reader, whichever the file has,
+	// and each one is deinterleaved into all the channel planes at once.
+	channel_planes.resize(channels.size());
+	std::vector<float *> dst(channels.size());
+	for (size_t i = 0; i < channels.size(); i++) {
+		channel_planes[i].resize(size);
+		dst[i] = channel_planes[i].data();
+	}
+	if (!reader.read_window(da_x0, da_y0, da_x1, da_y1, channels.data(), channels.size(), dst.data(), scales.empty() ? nullptr : scales.data())) {
+		channel_planes.clear();
+		return false;
+	}
+
+	channel_planes_path = path;
+	channel_planes_window[0] = da_x0;
+	channel_planes_window[1] = da_y0;
+	channel_planes_window[2] = da_x1;
+	channel_planes_window[3] = da_y1;
+	return true;
+}
+
+bool TIF_Image::has_subset_channels(const std::filesystem::path &path, unsigned int da_x0, unsigned int da_y0, unsigned int da_x1, unsigned int da_y1) const {
+	return !channel_planes.empty() && channel_planes_path == path &&
+		channel_planes_window[0] == da_x0 && channel_planes_window[1] == da_y0 &&
+		channel_planes_window[2] == da_x1 && channel_planes_window[3] == da_y1;
 }
 
+bool TIF_Image::select_subset_channel(size_t i) {
+	if (i >= channel_planes.size())
+		return false;
+
+	unsigned int w = channel_planes_window[2] - channel_planes_window[0];
+	unsigned int h = channel_planes_window[3] - channel_planes_window[1];
+	size_t size = (size_t) w * h;
+
+	// The subset of the thread is reused from one channel and window to the next, as in load_subset().
+	main_geometry = Magick::Geometry(reader.width, reader.height);
+	main_depth = reader.bits_per_sample;
+	main_num_components = 1;
+	reset_subset(w, h);
+	subset->type(Magick::GrayscaleType);
+	subset->quiet(false);
+	subset->depth(std::min<unsigned int>(main_depth, 16));
+
+	const std::vector<float> &plane = channel_planes[i];
+	Magick::PixelPacket *px = subset->getPixels(0, 0, w, h);
+	for (size_t j = 0; j < size; j++)
+		px[j] = Magick::ColorGray(plane[j]);
+	subset->syncPixels();
+
+	return true;
+}
@@ -0,0 +1,349 @@
+// Windowed reading of TIFF files
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "raster/tif_window_reader.hpp"
+#include "util/zip_archive.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include "tiffio.h"
+
+
+static tmsize_t zip_read_proc(thandle_t fd, void *buf, tmsize_t size) {
+	return (tmsize_t) ((ZipMemberReader *) fd)->read(buf, (size_t) size);
+}
+
+static tmsize_t zip_write_proc(thandle_t fd, void *buf, tmsize_t size) {
+	(void) fd;
+	(void) buf;
+	(void) size;
+	return -1;
+}
+
+static toff_t zip_seek_proc(thandle_t fd, toff_t off, int whence) {
+	ZipMemberReader *reader = (ZipMemberReader *) fd;
+	uint64_t pos = off;
+	if (whence == SEEK_CUR)
+		pos = reader->tell() + off;
+	else if (whence == SEEK_END)
+		pos = reader->size() + off;
+	if (!reader->seek(pos))
+		return (toff_t) -1;
+	return pos;
+}
+
+static int zip_close_proc(thandle_t fd) {
+	delete (ZipMemberReader *) fd;
+	return 0;
+}
+
+static toff_t zip_size_proc(thandle_t fd) {
+	return ((ZipMemberReader *) fd)->size();
+}
+
+static int zip_map_proc(thandle_t fd, void **base, toff_t *size) {
+	(void) fd;
+	(void) base;
+	(void) size;
+	return 0;
+}
+
+static void zip_unmap_proc(thandle_t fd, void *base, toff_t size) {
+	(void) fd;
+	(void) base;
+	(void) size;
+}
+
+
+/**
+ * Deinterleave samples of type T from a block into float buffers, in a single pass over the block.
+ * Integers are normalized into [0, 1], and each channel is multiplied by its scale factor.
+ */
+template<class T>
+static void copy_samples(const unsigned char *block, size_t offset, unsigned int spp, unsigned int row_stride,
+	unsigned int w, unsigned int h, const unsigned int *channels, const float *scales, unsigned int num_channels,
+	float *const *dst, size_t dst_offset, unsigned int dst_stride)
+{
+	float f_type = 1.0f;
+	if (std::numeric_limits<T>::is_integer)
+		f_type = 1.0f / std::numeric_limits<T>::max();
+
+	std::vector<float> f(num_channels);
+	for (unsigned int k = 0; k < num_channels; k++)
+		f[k] = f_type * scales[k];
+
+	const T *src = (const T *) block + offset;
+	for (unsigned int y = 0; y < h; y++) {
+		const T *s = src + (size_t) y * row_stride;
+		size_t d = dst_offset + (size_t) y * dst_stride;
+		if (num_channels == 1) {
+			const T *sc = s + channels[0];
+			float *dc = dst[0] + d;
+			for (unsigned int x = 0; x < w; x++) {
+				float v = sc[(size_t) x * spp] * f[0];
+				dc[x] = v < 0 ? 0.0f : v;
+			}
+		} else {
+			for (unsigned int x = 0; x < w; x++) {
+				const T *px = s + (size_t) x * spp;
+				for (unsigned int k = 0; k < num_channels; k++) {
+					float v = px[channels[k]] * f[k];
+					dst[k][d + x] = v < 0 ? 0.0f : v;
+				}
+			}
+		}
+	}
+}
+
+
+TIFWindowReader::TIFWindowReader(unsigned int cache_size):
+	width(0), height(0), num_channels(0), bits_per_sample(0), sample_format(SAMPLEFORMAT_UINT), photometric(0),
+	planar_separate(false), tiled(false), block_w(0), block_h(0),
+	ptif(nullptr), block_size(0), cache_size(cache_size > 0 ? cache_size : 1), use_counter(0) {}
+
+TIFWindowReader::~TIFWindowReader() {
+	close();
+}
+
+TIFF *TIFWindowReader::open_tiff(const std::filesystem::path &path) {
+	TIFFSetWarningHandler(NULL);
+
+	TIFF *ptif = nullptr;
+	if (ZipArchive::is_member_path(path)) {
+		ZipMemberReader *reader = new ZipMemberReader();
+		// TIFFClose() deletes the reader in zip_close_proc, but a failed TIFFClientOpen() doesn't.
+		if (reader->open(path))
+			ptif = TIFFClientOpen(path.c_str(), "rm", (thandle_t) reader,
+				zip_read_proc, zip_write_proc, zip_seek_proc, zip_close_proc, zip_size_proc, zip_map_proc, zip_unmap_proc);
+		if (ptif == nullptr)
+			delete reader;
+	} else {
+		ptif = TIFFOpen(path.c_str(), "r");
+	}
+
+	if (ptif == nullptr)
+		std::cerr << "ERROR: libtiff: Failed to open " << path << std::endl;
+	return ptif;
+}
+
+bool TIFWindowReader::open(const std::filesystem::path &path) {
+	close();
+
+	ptif = open_tiff(path);
+	if (ptif == nullptr)
+		return false;
+	this->path = path;
+
+	uint32_t w = 0, h = 0;
+	uint16_t spp = 1, bps = 1, fmt = SAMPLEFORMAT_UINT, planar = PLANARCONFIG_CONTIG, photo = 0;
+	TIFFGetField(ptif, TIFFTAG_IMAGEWIDTH, &w);
+	TIFFGetField(ptif, TIFFTAG_IMAGELENGTH, &h);
+	TIFFGetFieldDefaulted(ptif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+	TIFFGetFieldDefaulted(ptif, TIFFTAG_BITSPERSAMPLE, &bps);
+	TIFFGetFieldDefaulted(ptif, TIFFTAG_SAMPLEFORMAT, &fmt);
+	TIFFGetFieldDefaulted(ptif, TIFFTAG_PLANARCONFIG, &planar);
+	TIFFGetField(ptif, TIFFTAG_PHOTOMETRIC, &photo);
+
+	width = w;
+	height = h;
+	num_channels = spp;
+	bits_per_sample = bps;
+	sample_format = fmt;
+	photometric = photo;
+	planar_separate = planar == PLANARCONFIG_SEPARATE;
+	tiled = TIFFIsTiled(ptif);
+
+	if (tiled) {
+		uint32_t tw = 0, th = 0;
+		TIFFGetField(ptif, TIFFTAG_TILEWIDTH, &tw);
+		TIFFGetField(ptif, TIFFTAG_TILELENGTH, &th);
+		block_w = tw;
+		block_h = th;
+		block_size = TIFFTileSize(ptif);
+	} else {
+		uint32_t rps = 0;
+		TIFFGetFieldDefaulted(ptif, TIFFTAG_ROWSPERSTRIP, &rps);
+		block_w = width;
+		block_h = std::min<uint32_t>(rps, height);
+		block_size = TIFFStripSize(ptif);
+	}
+
+	bool supported = true;
+	if (bits_per_sample != 8 && bits_per_sample != 16 && bits_per_sample != 32 && bits_per_sample != 64)
+		supported = false;
+	if (sample_format == SAMPLEFORMAT_IEEEFP && bits_per_sample < 32)
+		supported = false;
+	if (sample_format != SAMPLEFORMAT_UINT && sample_format != SAMPLEFORMAT_INT && sample_format != SAMPLEFORMAT_IEEEFP)
+		supported = false;
+	if (photometric == PHOTOMETRIC_PALETTE)
+		supported = false;
+	if (width == 0 || height == 0 || block_w == 0 || block_h == 0 || block_size == 0)
+		supported = false;
+
+	if (!supported) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void TIFWindowReader::close() {
+	if (ptif != nullptr)
+		TIFFClose(ptif);
+	ptif = nullptr;
+	path.clear();
+	cache.clear();
+}
+
+const unsigned char *TIFWindowReader::get_block(uint32_t index) {
+	use_counter++;
+
+	Block *slot = nullptr;
+	for (Block &b: cache) {
+		if (b.index == index) {
+			b.last_used = use_counter;
+			return b.data.data();
+		}
+		if (slot == nullptr || b.last_used < slot->last_used)
+			slot = &b;
+	}
+
+	// Add a new block, or replace the least recently used one.
+	if (cache.size() < cache_size) {
+		cache.emplace_back();
+		slot = &cache.back();
+		slot->data.resize(block_size);
+	}
+	slot->index = index;
+	slot->last_used = use_counter;
+
+	tmsize_t n;
+	if (tiled)
+		n = TIFFReadEncodedTile(ptif, index, slot->data.data(), block_size);
+	else
+		n = TIFFReadEncodedStrip(ptif, index, slot->data.data(), block_size);
+	if (n < 0) {
+		std::cerr << "ERROR: libtiff: Failed to decode block " << index << " of " << path << std::endl;
+		// Make sure that the broken block won't be found in the cache.
+		slot->last_used = 0;
+		slot->index = UINT32_MAX;
+		return nullptr;
+	}
+	return slot->data.data();
+}
+
+void TIFWindowReader::copy_block(const unsigned char *block, unsigned int bx0, unsigned int by0, unsigned int ix0, unsigned int iy0, unsigned int ix1, unsigned int iy1,
+	const unsigned int *channels, const float *scales, unsigned int num_channels, unsigned int wx0, unsigned int wy0, unsigned int ww, float *const *dst) const
+{
+	unsigned int spp = planar_separate ? 1 : this->num_channels;
+	size_t offset = ((size_t) (iy0 - by0) * block_w + (ix0 - bx0)) * spp;
+	unsigned int row_stride = block_w * spp;
+	unsigned int w = ix1 - ix0;
+	unsigned int h = iy1 - iy0;
+	size_t d = (size_t) (iy0 - wy0) * ww + (ix0 - wx0);
+
+#define CM_VSM_COPY_SAMPLES(T) copy_samples<T>(block, offset, spp, row_stride, w, h, channels, scales, num_channels, dst, d, ww)
+	switch (sample_format) {
+		case SAMPLEFORMAT_IEEEFP:
+			if (bits_per_sample == 32)
+				CM_VSM_COPY_SAMPLES(float);
+			else
+				CM_VSM_COPY_SAMPLES(double);
+			break;
+		case SAMPLEFORMAT_INT:
+			if (bits_per_sample == 8)
+				CM_VSM_COPY_SAMPLES(int8_t);
+			else if (bits_per_sample == 16)
+				CM_VSM_COPY_SAMPLES(int16_t);
+			else if (bits_per_sample == 32)
+				CM_VSM_COPY_SAMPLES(int32_t);
+			else
+				CM_VSM_COPY_SAMPLES(int64_t);
+			break;
+		default:
+			if (bits_per_sample == 8)
+				CM_VSM_COPY_SAMPLES(uint8_t);
+			else if (bits_per_sample == 16)
+				CM_VSM_COPY_SAMPLES(uint16_t);
+			else if (bits_per_sample == 32)
+				CM_VSM_COPY_SAMPLES(uint32_t);
+			else
+				CM_VSM_COPY_SAMPLES(uint64_t);
+	}
+#undef CM_VSM_COPY_SAMPLES
+}
+
+bool TIFWindowReader::read_window(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, const unsigned int *channels, unsigned int num_channels, float *const *dst, const float *scales) {
+	if (ptif == nullptr || x1 <= x0 || y1 <= y0)
+		return false;
+	for (unsigned int i = 0; i < num_channels; i++) {
+		if (channels[i] >= this->num_channels)
+			return false;
+	}
+
+	unsigned int ww = x1 - x0;
+	unsigned int wh = y1 - y0;
+	for (unsigned int i = 0; i < num_channels; i++)
+		std::fill(dst[i], dst[i] + (size_t) ww * wh, 0.0f);
+
+	// Part of the window within the raster.
+	unsigned int cx1 = std::min(x1, width);
+	unsigned int cy1 = std::min(y1, height);
+	if (x0 >= cx1 || y0 >= cy1)
+		return true;
+
+	std::vector<float> unit_scales;
+	if (scales == nullptr) {
+		unit_scales.assign(num_channels, 1.0f);
+		scales = unit_scales.data();
+	}
+	const unsigned int zero = 0;
+
+	bool retval = true;
+	for (unsigned int by0 = (y0 / block_h) * block_h; by0 < cy1; by0 += block_h) {
+		for (unsigned int bx0 = (x0 / block_w) * block_w; bx0 < cx1; bx0 += block_w) {
+			unsigned int ix0 = std::max(x0, bx0);
+			unsigned int iy0 = std::max(y0, by0);
+			unsigned int ix1 = std::min(cx1, bx0 + block_w);
+			unsigned int iy1 = std::min(cy1, by0 + block_h);
+
+			if (planar_separate) {
+				// Each channel comes from a block of its own plane.
+				for (unsigned int i = 0; i < num_channels; i++) {
+					uint32_t index = tiled ? TIFFComputeTile(ptif, bx0, by0, 0, channels[i]) : TIFFComputeStrip(ptif, by0, channels[i]);
+					const unsigned char *block = get_block(index);
+					if (block == nullptr) {
+						retval = false;
+						continue;
+					}
+					copy_block(block, bx0, by0, ix0, iy0, ix1, iy1, &zero, scales + i, 1, x0, y0, ww, dst + i);
+				}
+			} else {
+				// With contiguous samples, all the channels are deinterleaved from a single block in one pass.
+				uint32_t index = tiled ? TIFFComputeTile(ptif, bx0, by0, 0, 0) : TIFFComputeStrip(ptif, by0, 0);
+				const unsigned char *block = get_block(index);
+				if (block == nullptr) {
+					retval = false;
+					continue;
+				}
+				copy_block(block, bx0, by0, ix0, iy0, ix1, iy1, channels, scales, num_channels, x0, y0, ww, dst);
+			}
+		}
+	}
+
+	return retval;
+}
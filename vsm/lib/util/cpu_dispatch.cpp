@@ -0,0 +1,67 @@
+// Selection of the instruction set for the vectorized kernels
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/cpu_dispatch.hpp"
+
+
+const char *CPUDispatch::isa_name[CPUDispatch::ISA_COUNT] = {"generic", "avx2", "avx512"};
+
+std::atomic<CPUDispatch::isa_t> CPUDispatch::selected(CPUDispatch::get_best());
+
+bool CPUDispatch::is_supported(isa_t isa) {
+#if defined(__x86_64__) || defined(__i386__)
+	// The CPU features may be queried before the constructors of libgcc have run.
+	__builtin_cpu_init();
+	// Besides cpuid, libgcc checks that the OS saves the state of the vector registers.
+	switch (isa) {
+		case ISA_GENERIC:
+			return true;
+		case ISA_AVX2:
+			return __builtin_cpu_supports("avx2");
+		case ISA_AVX512:
+			return __builtin_cpu_supports("avx512f");
+		default:
+			return false;
+	}
+#else
+	return isa == ISA_GENERIC;
+#endif
+}
+
+CPUDispatch::isa_t CPUDispatch::get_best() {
+	for (int i=ISA_COUNT - 1; i>ISA_GENERIC; i--) {
+		if (is_supported((isa_t) i))
+			return (isa_t) i;
+	}
+	return ISA_GENERIC;
+}
+
+bool CPUDispatch::set_isa(isa_t isa) {
+	if (!is_supported(isa))
+		return false;
+	selected.store(isa, std::memory_order_relaxed);
+	return true;
+}
+
+bool CPUDispatch::parse_isa(const std::string &name, isa_t &isa) {
+	for (int i=0; i<ISA_COUNT; i++) {
+		if (name == isa_name[i]) {
+			isa = (isa_t) i;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,54 @@
+// Memory budget for admitting concurrent work
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/memory_budget.hpp"
+
+
+MemoryBudget::MemoryBudget(uintmax_t limit): limit(limit), in_use(0), next_ticket(0), serving(0) {}
+
+uintmax_t MemoryBudget::acquire(uintmax_t bytes) {
+	if (limit == 0 || bytes == 0)
+		return 0;
+
+	// Reservations are admitted in the order of arrival, so that a large one isn't starved by a stream of smaller ones.
+	// One which is larger than the whole budget waits until it's alone.
+	std::unique_lock<std::mutex> lock(mutex);
+	uint64_t ticket = next_ticket++;
+	cv.wait(lock, [this, ticket, bytes] { return ticket == serving && (in_use == 0 || in_use + bytes <= limit); });
+	serving++;
+	in_use += bytes;
+	lock.unlock();
+
+	// The next one in line may fit as well.
+	cv.notify_all();
+	return bytes;
+}
+
+void MemoryBudget::release(uintmax_t bytes) {
+	if (bytes == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		in_use -= bytes;
+	}
+	cv.notify_all();
+}
+
+uintmax_t MemoryBudget::get_in_use() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return in_use;
+}
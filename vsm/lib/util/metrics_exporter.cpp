@@ -0,0 +1,125 @@
+// Periodic export of metrics in the Prometheus text format
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/metrics_exporter.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/resource.h>
+
+
+MetricsExporter::MetricsExporter(): interval(15), stopping(false) {}
+
+MetricsExporter::~MetricsExporter() {
+	stop();
+}
+
+bool MetricsExporter::start(const std::filesystem::path &path, unsigned int interval, formatter_t formatter) {
+	if (thread.joinable())
+		return false;
+
+	this->path = path;
+	this->interval = interval > 0 ? interval : 1;
+	this->formatter = formatter;
+	stopping = false;
+	thread = std::thread(&MetricsExporter::run, this);
+	return true;
+}
+
+void MetricsExporter::stop() {
+	if (!thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	cv.notify_all();
+	thread.join();
+	write();
+}
+
+bool MetricsExporter::write() {
+	if (path.empty() || !formatter)
+		return false;
+
+	// The collector may read the file at any time, so replace it as a whole.
+	std::filesystem::path path_tmp = path;
+	path_tmp += ".tmp";
+	{
+		std::ofstream f(path_tmp);
+		formatter(f);
+		if (!f) {
+			std::cerr << "ERROR: Failed to write the metrics into " << path_tmp << std::endl;
+			return false;
+		}
+	}
+	if (std::rename(path_tmp.c_str(), path.c_str()) != 0) {
+		std::cerr << "ERROR: Failed to rename " << path_tmp << " to " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void MetricsExporter::write_header(std::ostream &os, const std::string &name, const std::string &type, const std::string &help) {
+	os << "# HELP " << name << " " << help << "\n";
+	os << "# TYPE " << name << " " << type << "\n";
+}
+
+void MetricsExporter::write_sample(std::ostream &os, const std::string &name, double value, const std::string &labels) {
+	os << name;
+	if (!labels.empty())
+		os << "{" << labels << "}";
+	if (std::isnan(value))
+		os << " NaN\n";
+	else if (std::isinf(value))
+		os << (value > 0 ? " +Inf\n" : " -Inf\n");
+	else if (value == std::floor(value) && std::fabs(value) < 9007199254740992.0)
+		os << " " << (long long) value << "\n";
+	else {
+		std::ostringstream ss;
+		ss.precision(10);
+		ss << value;
+		os << " " << ss.str() << "\n";
+	}
+}
+
+void MetricsExporter::write_metric(std::ostream &os, const std::string &name, const std::string &type, const std::string &help, double value) {
+	write_header(os, name, type, help);
+	write_sample(os, name, value);
+}
+
+uintmax_t MetricsExporter::get_max_rss() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	// Linux reports the peak in KiB.
+	return (uintmax_t) usage.ru_maxrss * 1024;
+}
+
+void MetricsExporter::run() {
+	// The first update is written even if the exporter is stopped right away.
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		lock.unlock();
+		write();
+		lock.lock();
+		if (cv.wait_for(lock, std::chrono::seconds(interval), [this] { return stopping; }))
+			return;
+	}
+}
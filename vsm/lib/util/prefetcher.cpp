@@ -0,0 +1,161 @@
+// Read-ahead of the files which are about to be read
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/prefetcher.hpp"
+#include "util/zip_archive.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+
+
+Prefetcher::Prefetcher(uintmax_t window): window(window), in_window_bytes(0), num_prefetched(0), num_hits(0), num_misses(0), stopping(false) {}
+
+Prefetcher::~Prefetcher() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	cv.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+void Prefetcher::set_window(uintmax_t bytes) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		window = bytes;
+	}
+	cv.notify_all();
+}
+
+void Prefetcher::enqueue(const std::filesystem::path &path, uintmax_t size) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (window == 0)
+			return;
+		consumed.erase(path);
+		queue.emplace_back(path, size);
+		if (!thread.joinable())
+			thread = std::thread(&Prefetcher::run, this);
+	}
+	cv.notify_all();
+}
+
+void Prefetcher::consume(const std::filesystem::path &path) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// A file which is split by several tasks is consumed by each of them, but only the first read counts.
+		if (!consumed.insert(path).second)
+			return;
+		auto it = in_window.find(path);
+		if (it != in_window.end()) {
+			in_window_bytes -= it->second;
+			in_window.erase(it);
+			num_hits++;
+		} else {
+			num_misses++;
+			for (auto qit = queue.begin(); qit != queue.end(); qit++) {
+				if (qit->first == path) {
+					queue.erase(qit);
+					break;
+				}
+			}
+		}
+	}
+	cv.notify_all();
+}
+
+void Prefetcher::forget(const std::vector<std::filesystem::path> &paths) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const std::filesystem::path &path: paths) {
+			consumed.erase(path);
+			auto it = in_window.find(path);
+			if (it != in_window.end()) {
+				in_window_bytes -= it->second;
+				in_window.erase(it);
+			}
+			for (auto qit = queue.begin(); qit != queue.end();) {
+				if (qit->first == path)
+					qit = queue.erase(qit);
+				else
+					qit++;
+			}
+		}
+	}
+	cv.notify_all();
+}
+
+unsigned long Prefetcher::get_num_prefetched() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return num_prefetched;
+}
+
+unsigned long Prefetcher::get_num_hits() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return num_hits;
+}
+
+unsigned long Prefetcher::get_num_misses() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return num_misses;
+}
+
+void Prefetcher::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		// The first file is prefetched even if it's larger than the whole window.
+		cv.wait(lock, [this] {
+			return stopping || (window > 0 && !queue.empty() && (in_window_bytes == 0 || in_window_bytes + queue.front().second <= window));
+		});
+		if (stopping)
+			return;
+
+		std::pair<std::filesystem::path, uintmax_t> file = queue.front();
+		queue.pop_front();
+		in_window[file.first] += file.second;
+		in_window_bytes += file.second;
+
+		lock.unlock();
+		advise(file.first);
+		lock.lock();
+		num_prefetched++;
+	}
+}
+
+bool Prefetcher::advise(const std::filesystem::path &path) {
+	std::filesystem::path path_file = path;
+	off_t offset = 0, length = 0;
+
+	if (ZipArchive::is_member_path(path)) {
+		std::string name;
+		if (!ZipArchive::split_member_path(path, path_file, name))
+			return false;
+		std::shared_ptr<const ZipArchive> archive = ZipArchive::get(path_file);
+		const ZipArchive::Entry *e = archive != nullptr ? archive->find(name) : nullptr;
+		if (e == nullptr)
+			return false;
+		// The local header is followed by the name and an extra field of up to 64 KiB.
+		offset = e->header_offset;
+		length = 30 + e->name.size() + 0xffff + e->compressed_size;
+	}
+
+	int fd = open(path_file.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	bool retval = posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED) == 0;
+	close(fd);
+	return retval;
+}
@@ -0,0 +1,187 @@
+// Record of the sub-tile layers which have already been stored
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/resume_manifest.hpp"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+const char *ResumeManifest::file_name = "cm_vsm_manifest.txt";
+
+ResumeManifest::ResumeManifest(): fd(-1), file_existed(false) {}
+
+ResumeManifest::~ResumeManifest() {
+	close();
+}
+
+bool ResumeManifest::open(const std::filesystem::path &path_dir_out) {
+	close();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	path = path_dir_out / file_name;
+
+	std::error_code ec;
+	file_existed = std::filesystem::exists(path, ec);
+	if (file_existed) {
+		std::ifstream f(path, std::ios::binary);
+		std::string content((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+		// Only complete lines count, as the last one may have been cut short.
+		size_t start = 0, end;
+		while ((end = content.find('\n', start)) != std::string::npos) {
+			std::istringstream line(content.substr(start, end - start));
+			start = end + 1;
+
+			int x, y;
+			std::string layer, hash_hex, extra;
+			stamp_t stamp;
+			if (!(line >> x >> y >> layer >> hash_hex) || hash_hex.size() != 16)
+				continue;
+			// Entries of the earlier versions have no stamp, so their files are always probed.
+			bool has_stamp = (bool) (line >> stamp.first >> stamp.second);
+			if (has_stamp && (line >> extra))
+				continue;
+			try {
+				entries[std::make_tuple(x, y, layer)] = std::stoull(hash_hex, nullptr, 16);
+			} catch (std::exception &e) {
+				continue;
+			}
+			if (has_stamp)
+				stamps[std::make_pair(x, y)] = stamp;
+			else
+				stamps.erase(std::make_pair(x, y));
+		}
+	}
+
+	// Compact the manifest, dropping the replaced entries and any partial line.
+	std::filesystem::create_directories(path_dir_out, ec);
+	std::filesystem::path path_tmp = path;
+	path_tmp += ".tmp";
+	{
+		std::ofstream f(path_tmp, std::ios::binary | std::ios::trunc);
+		for (const auto &e: entries) {
+			// An entry without a stamp gets one which no file matches.
+			auto it = stamps.find(std::make_pair(std::get<0>(e.first), std::get<1>(e.first)));
+			f << format_entry(std::get<0>(e.first), std::get<1>(e.first), std::get<2>(e.first), e.second, it != stamps.end() ? it->second : stamp_t(0, 0));
+		}
+		if (!f.good()) {
+			std::cerr << "ERROR: Failed to write " << path_tmp << std::endl;
+			entries.clear();
+			stamps.clear();
+			return false;
+		}
+	}
+	std::filesystem::rename(path_tmp, path, ec);
+	if (ec) {
+		std::cerr << "ERROR: Failed to replace " << path << std::endl;
+		entries.clear();
+		stamps.clear();
+		return false;
+	}
+
+	fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (fd < 0) {
+		std::cerr << "ERROR: Failed to open " << path << std::endl;
+		entries.clear();
+		stamps.clear();
+		return false;
+	}
+	return true;
+}
+
+void ResumeManifest::close() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+	entries.clear();
+	stamps.clear();
+}
+
+size_t ResumeManifest::size() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
+
+bool ResumeManifest::has(int x, int y, const std::string &layer, uint64_t params_hash) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = entries.find(std::make_tuple(x, y, layer));
+	return it != entries.end() && it->second == params_hash;
+}
+
+bool ResumeManifest::is_intact(int x, int y, const std::filesystem::path &path_file) const {
+	stamp_t stamp;
+	if (!get_stamp(path_file, stamp))
+		return false;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = stamps.find(std::make_pair(x, y));
+	return it != stamps.end() && it->second == stamp;
+}
+
+bool ResumeManifest::add(int x, int y, const std::string &layer, uint64_t params_hash, const std::filesystem::path &path_file) {
+	stamp_t stamp;
+	if (!get_stamp(path_file, stamp)) {
+		std::cerr << "ERROR: Failed to record " << path_file << ", which doesn't exist" << std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (fd < 0)
+		return false;
+
+	std::string line = format_entry(x, y, layer, params_hash, stamp);
+	if (write(fd, line.data(), line.size()) != (ssize_t) line.size()) {
+		std::cerr << "ERROR: Failed to append to " << path << std::endl;
+		return false;
+	}
+	entries[std::make_tuple(x, y, layer)] = params_hash;
+	stamps[std::make_pair(x, y)] = stamp;
+	return true;
+}
+
+uint64_t ResumeManifest::hash(const std::string &s) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (unsigned char c: s) {
+		h ^= c;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+bool ResumeManifest::get_stamp(const std::filesystem::path &path_file, stamp_t &stamp) {
+	std::error_code ec;
+	stamp.first = std::filesystem::file_size(path_file, ec);
+	if (ec)
+		return false;
+	std::filesystem::file_time_type t = std::filesystem::last_write_time(path_file, ec);
+	if (ec)
+		return false;
+	stamp.second = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+	return true;
+}
+
+std::string ResumeManifest::format_entry(int x, int y, const std::string &layer, uint64_t params_hash, const stamp_t &stamp) {
+	char hash_hex[17];
+	snprintf(hash_hex, sizeof(hash_hex), "%016" PRIx64, params_hash);
+	return std::to_string(x) + " " + std::to_string(y) + " " + layer + " " + hash_hex + " " +
+		std::to_string(stamp.first) + " " + std::to_string(stamp.second) + "\n";
+}
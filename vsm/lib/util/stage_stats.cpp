@@ -0,0 +1,140 @@
+// Timing and byte counters of the stages of splitting a raster into sub-tiles
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/stage_stats.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+const char *StageStats::stage_name[StageStats::ST_COUNT] = {
+	"decode", "remap", "resample", "png", "nc_open", "nc_define", "nc_write", "nc_close", "directories"
+};
+
+const char *StageStats::alloc_name[StageStats::AL_COUNT] = {"buffers", "images"};
+
+thread_local StageStats *StageStats::current = nullptr;
+std::atomic<uint64_t> StageStats::live_ns[StageStats::ST_COUNT];
+std::atomic<uint64_t> StageStats::live_bytes[StageStats::ST_COUNT];
+std::atomic<uint64_t> StageStats::live_subtiles(0);
+
+StageStats::StageStats() {
+	for (int i=0; i<ST_COUNT; i++)
+		ns[i] = bytes[i] = count[i] = subtile_ns[i] = 0;
+	for (int i=0; i<AL_COUNT; i++)
+		allocs[i] = alloc_bytes[i] = reuses[i] = 0;
+}
+
+void StageStats::add(stage_t stage, uint64_t elapsed_ns, uint64_t num_bytes) {
+	ns[stage] += elapsed_ns;
+	bytes[stage] += num_bytes;
+	count[stage]++;
+	subtile_ns[stage] += elapsed_ns;
+	live_ns[stage].fetch_add(elapsed_ns, std::memory_order_relaxed);
+	live_bytes[stage].fetch_add(num_bytes, std::memory_order_relaxed);
+}
+
+void StageStats::add_allocation(alloc_t kind, bool reused, uint64_t num_bytes) {
+	if (reused) {
+		reuses[kind]++;
+	} else {
+		allocs[kind]++;
+		alloc_bytes[kind] += num_bytes;
+	}
+}
+
+void StageStats::begin_subtile() {
+	for (int i=0; i<ST_COUNT; i++)
+		subtile_ns[i] = 0;
+}
+
+void StageStats::end_subtile() {
+	uint64_t total = 0;
+	for (int i=0; i<ST_COUNT; i++) {
+		if (subtile_ns[i] == 0)
+			continue;
+		subtile_us[i].push_back((uint32_t) std::min<uint64_t>(subtile_ns[i] / 1000, UINT32_MAX));
+		total += subtile_ns[i];
+		subtile_ns[i] = 0;
+	}
+	subtile_totals.push_back((uint32_t) std::min<uint64_t>(total / 1000, UINT32_MAX));
+	live_subtiles.fetch_add(1, std::memory_order_relaxed);
+}
+
+void StageStats::merge(const StageStats &other) {
+	for (int i=0; i<ST_COUNT; i++) {
+		ns[i] += other.ns[i];
+		bytes[i] += other.bytes[i];
+		count[i] += other.count[i];
+		subtile_us[i].insert(subtile_us[i].end(), other.subtile_us[i].begin(), other.subtile_us[i].end());
+	}
+	subtile_totals.insert(subtile_totals.end(), other.subtile_totals.begin(), other.subtile_totals.end());
+	for (int i=0; i<AL_COUNT; i++) {
+		allocs[i] += other.allocs[i];
+		alloc_bytes[i] += other.alloc_bytes[i];
+		reuses[i] += other.reuses[i];
+	}
+}
+
+nlohmann::json StageStats::to_json() const {
+	nlohmann::json j;
+	j["subtiles"] = subtile_totals.size();
+	j["subtile_p50_ms"] = percentile(subtile_totals, 50) / 1000.0;
+	j["subtile_p95_ms"] = percentile(subtile_totals, 95) / 1000.0;
+
+	nlohmann::json stages = nlohmann::json::object();
+	for (int i=0; i<ST_COUNT; i++) {
+		if (count[i] == 0)
+			continue;
+		nlohmann::json s;
+		double seconds = ns[i] / 1e9;
+		s["count"] = count[i];
+		s["seconds"] = seconds;
+		s["bytes"] = bytes[i];
+		if (bytes[i] > 0 && seconds > 0.0)
+			s["mib_per_second"] = bytes[i] / seconds / (1 << 20);
+		if (!subtile_us[i].empty()) {
+			s["p50_ms"] = percentile(subtile_us[i], 50) / 1000.0;
+			s["p95_ms"] = percentile(subtile_us[i], 95) / 1000.0;
+		}
+		stages[stage_name[i]] = s;
+	}
+	j["stages"] = stages;
+
+	// Memory which is reused from sub-tile to sub-tile shows up as reuses, rather than allocations.
+	nlohmann::json allocations = nlohmann::json::object();
+	for (int i=0; i<AL_COUNT; i++) {
+		if (allocs[i] == 0 && reuses[i] == 0)
+			continue;
+		allocations[alloc_name[i]] = {
+			{"allocations", allocs[i]},
+			{"allocated_bytes", alloc_bytes[i]},
+			{"reuses", reuses[i]}
+		};
+	}
+	j["allocations"] = allocations;
+	return j;
+}
+
+uint32_t StageStats::percentile(std::vector<uint32_t> samples, double p) {
+	if (samples.empty())
+		return 0;
+	size_t rank = (size_t) std::ceil(p / 100.0 * samples.size());
+	if (rank > 0)
+		rank--;
+	rank = std::min(rank, samples.size() - 1);
+	std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+	return samples[rank];
+}
@@ -0,0 +1,124 @@
+// Output file written to a staging copy and published with an atomic rename
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/staged_file.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+
+const char *StagedFile::suffix = ".staged";
+
+StagedFile::StagedFile(const std::filesystem::path &path, const std::filesystem::path &dir_staging):
+	path_target(path), existed(false), published(false)
+{
+	if (dir_staging.empty()) {
+		path_staged = path;
+		path_staged += suffix;
+	} else {
+		// Targets with the same name in different sub-tile directories share the staging directory.
+		std::ostringstream ss;
+		ss << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>()(std::filesystem::absolute(path).string());
+		path_staged = dir_staging / (ss.str() + "_" + path.filename().string() + suffix);
+	}
+}
+
+StagedFile::~StagedFile() {
+	if (!published)
+		discard();
+}
+
+bool StagedFile::begin() {
+	std::error_code ec;
+	published = false;
+	std::filesystem::remove(path_staged, ec);
+
+	existed = std::filesystem::exists(path_target, ec);
+	if (existed && !copy(path_target, path_staged)) {
+		std::cerr << "ERROR: Failed to copy " << path_target << " to the staging file " << path_staged << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool StagedFile::publish() {
+	if (::rename(path_staged.c_str(), path_target.c_str()) == 0) {
+		published = true;
+		return true;
+	}
+	if (errno != EXDEV) {
+		std::cerr << "ERROR: Failed to rename " << path_staged << " to " << path_target << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	// The staging file is on another file system, so rename a copy from the directory of the target instead.
+	std::filesystem::path path_publish = path_target;
+	path_publish += suffix;
+	if (!copy(path_staged, path_publish)) {
+		std::cerr << "ERROR: Failed to copy the staging file " << path_staged << " to " << path_publish << std::endl;
+		return false;
+	}
+	if (::rename(path_publish.c_str(), path_target.c_str()) != 0) {
+		std::cerr << "ERROR: Failed to rename " << path_publish << " to " << path_target << ": " << strerror(errno) << std::endl;
+		std::error_code ec;
+		std::filesystem::remove(path_publish, ec);
+		return false;
+	}
+	discard();
+	published = true;
+	return true;
+}
+
+void StagedFile::discard() {
+	std::error_code ec;
+	std::filesystem::remove(path_staged, ec);
+}
+
+bool StagedFile::copy(const std::filesystem::path &from, const std::filesystem::path &to) {
+#ifdef FICLONE
+	int fd_from = open(from.c_str(), O_RDONLY);
+	if (fd_from >= 0) {
+		int fd_to = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		bool cloned = fd_to >= 0 && ioctl(fd_to, FICLONE, fd_from) == 0;
+		if (fd_to >= 0)
+			close(fd_to);
+		close(fd_from);
+		if (cloned)
+			return true;
+	}
+#endif
+	std::error_code ec;
+	return std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, ec);
+}
+
+bool StagedFile::sync(const std::filesystem::path &path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	bool synced = fsync(fd) == 0;
+	close(fd);
+	return synced;
+}
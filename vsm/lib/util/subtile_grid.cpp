@@ -0,0 +1,195 @@
+// Compact grid of sub-tile flags, and the order of traversing it
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/subtile_grid.hpp"
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+
+SubtileGrid::SubtileGrid(): width(0), height(0) {}
+
+SubtileGrid::SubtileGrid(unsigned int width, unsigned int height, bool value): width(width), height(height) {
+	size_t n = (size_t) width * height;
+	bits.assign((n + 63) / 64, value ? ~(uint64_t) 0 : 0);
+	// Keep the bits past the last sub-tile clear, for count().
+	if (value && (n % 64) != 0)
+		bits.back() = ((uint64_t) 1 << (n % 64)) - 1;
+}
+
+SubtileGrid::SubtileGrid(const std::vector<std::vector<unsigned char>> &mask):
+	SubtileGrid(mask.size(), mask.empty() ? 0 : mask[0].size(), false)
+{
+	for (unsigned int x=0; x<width; x++) {
+		for (unsigned int y=0; y<height && y<mask[x].size(); y++) {
+			if (mask[x][y] == 1)
+				set(x, y, true);
+		}
+	}
+}
+
+bool SubtileGrid::get(int x, int y) const {
+	if (x < 0 || y < 0 || x >= (int) width || y >= (int) height)
+		return false;
+	size_t i = (size_t) y * width + x;
+	return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+void SubtileGrid::set(int x, int y, bool value) {
+	if (x < 0 || y < 0 || x >= (int) width || y >= (int) height)
+		return;
+	size_t i = (size_t) y * width + x;
+	if (value)
+		bits[i / 64] |= (uint64_t) 1 << (i % 64);
+	else
+		bits[i / 64] &= ~((uint64_t) 1 << (i % 64));
+}
+
+size_t SubtileGrid::count() const {
+	size_t n = 0;
+	for (uint64_t word: bits)
+		n += __builtin_popcountll(word);
+	return n;
+}
+
+void SubtileGrid::clear() {
+	width = height = 0;
+	bits.clear();
+}
+
+void SubtileGrid::intersect(const SubtileGrid &other) {
+	if (other.width == width && other.height == height) {
+		for (size_t i=0; i<bits.size(); i++)
+			bits[i] &= other.bits[i];
+		return;
+	}
+
+	for (unsigned int y=0; y<height; y++) {
+		for (unsigned int x=0; x<width; x++) {
+			if (!other.get(x, y))
+				set(x, y, false);
+		}
+	}
+}
+
+std::vector<Vector<int>> SubtileGrid::get_subtiles(order_t order, unsigned int block_size) const {
+	if (block_size == 0)
+		block_size = 1;
+
+	// The Hilbert curve covers a square with a side of a power of 2.
+	unsigned int blocks_x = (width + block_size - 1) / block_size;
+	unsigned int blocks_y = (height + block_size - 1) / block_size;
+	uint32_t n = 1;
+	while (n < std::max(blocks_x, blocks_y))
+		n <<= 1;
+
+	// Sort key: position of the block, then the column and the row within the block in column order,
+	// or the row and the column otherwise.
+	bool by_column = order == SO_COLUMN_MAJOR;
+	std::vector<std::tuple<uint64_t, int, int>> keys;
+	for (size_t w=0; w<bits.size(); w++) {
+		uint64_t word = bits[w];
+		while (word != 0) {
+			size_t i = w * 64 + __builtin_ctzll(word);
+			word &= word - 1;
+
+			int x = (int) (i % width);
+			int y = (int) (i / width);
+			uint32_t bx = x / block_size;
+			uint32_t by = y / block_size;
+
+			uint64_t key = 0;
+			switch (order) {
+				case SO_COLUMN_MAJOR:
+					key = (uint64_t) bx * blocks_y + by;
+					break;
+				case SO_ROW_MAJOR:
+					key = (uint64_t) by * blocks_x + bx;
+					break;
+				case SO_MORTON:
+					key = morton_index(bx, by);
+					break;
+				case SO_HILBERT:
+					key = hilbert_index(n, bx, by);
+					break;
+			}
+			if (by_column)
+				keys.emplace_back(key, x, y);
+			else
+				keys.emplace_back(key, y, x);
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<Vector<int>> subtiles;
+	subtiles.reserve(keys.size());
+	for (const auto &k: keys) {
+		if (by_column)
+			subtiles.emplace_back(std::get<1>(k), std::get<2>(k));
+		else
+			subtiles.emplace_back(std::get<2>(k), std::get<1>(k));
+	}
+	return subtiles;
+}
+
+bool SubtileGrid::parse_order(const std::string &name, order_t &order) {
+	if (name == "column")
+		order = SO_COLUMN_MAJOR;
+	else if (name == "row")
+		order = SO_ROW_MAJOR;
+	else if (name == "morton")
+		order = SO_MORTON;
+	else if (name == "hilbert")
+		order = SO_HILBERT;
+	else
+		return false;
+	return true;
+}
+
+/**
+ * Spread the bits of a 32-bit value to the even bits of a 64-bit value.
+ */
+static uint64_t spread_bits(uint32_t v) {
+	uint64_t x = v;
+	x = (x | (x << 16)) & 0x0000ffff0000ffffULL;
+	x = (x | (x << 8)) & 0x00ff00ff00ff00ffULL;
+	x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	x = (x | (x << 2)) & 0x3333333333333333ULL;
+	x = (x | (x << 1)) & 0x5555555555555555ULL;
+	return x;
+}
+
+uint64_t SubtileGrid::morton_index(uint32_t x, uint32_t y) {
+	return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+uint64_t SubtileGrid::hilbert_index(uint32_t n, uint32_t x, uint32_t y) {
+	uint64_t d = 0;
+	for (uint32_t s = n / 2; s > 0; s /= 2) {
+		uint32_t rx = (x & s) > 0;
+		uint32_t ry = (y & s) > 0;
+		d += (uint64_t) s * s * ((3 * rx) ^ ry);
+		// Rotate the quadrant, so that the curve within it starts and ends next to the neighbouring quadrants.
+		if (ry == 0) {
+			if (rx == 1) {
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			std::swap(x, y);
+		}
+	}
+	return d;
+}
@@ -0,0 +1,153 @@
+// Selection of sub-tiles by the content of their mask bands
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/subtile_selector.hpp"
+#include "util/text.hpp"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+
+bool SubtileSelector::Term::has_value(unsigned int value) const {
+	for (const auto &r: ranges) {
+		if (value >= r.first && value <= r.second)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Parse a non-negative integer which makes up a whole string.
+ */
+static unsigned int parse_value(const std::string &s) {
+	size_t n = 0;
+	if (s.empty() || s[0] == '-' || s[0] == '+')
+		throw std::invalid_argument(s);
+	unsigned long v = std::stoul(s, &n);
+	if (n != s.size() || v > 255)
+		throw std::invalid_argument(s);
+	return (unsigned int) v;
+}
+
+bool SubtileSelector::parse(const std::string &expr) {
+	std::vector<Term> parsed;
+
+	for (const std::string &s: split_str(expr, ',')) {
+		try {
+			Term t;
+			size_t i_open = s.find('[');
+			size_t i_close = s.find(']');
+			if (i_open == std::string::npos || i_open == 0 || i_close == std::string::npos || i_close < i_open)
+				throw std::invalid_argument(s);
+			t.band = s.substr(0, i_open);
+
+			for (const std::string &v: split_str(s.substr(i_open + 1, i_close - i_open - 1), '+')) {
+				size_t i_dash = v.find('-');
+				if (i_dash == std::string::npos) {
+					unsigned int value = parse_value(v);
+					t.ranges.emplace_back(value, value);
+				} else {
+					unsigned int value_min = parse_value(v.substr(0, i_dash));
+					unsigned int value_max = parse_value(v.substr(i_dash + 1));
+					// A reversed range would match nothing.
+					if (value_min > value_max)
+						throw std::invalid_argument(s);
+					t.ranges.emplace_back(value_min, value_max);
+				}
+			}
+			if (t.ranges.empty())
+				throw std::invalid_argument(s);
+
+			std::string rest = s.substr(i_close + 1);
+			size_t n_op = 1;
+			if (startswith(rest, "<=")) {
+				t.op = OP_LE;
+				n_op = 2;
+			} else if (startswith(rest, ">=")) {
+				t.op = OP_GE;
+				n_op = 2;
+			} else if (startswith(rest, "<")) {
+				t.op = OP_LT;
+			} else if (startswith(rest, ">")) {
+				t.op = OP_GT;
+			} else {
+				throw std::invalid_argument(s);
+			}
+
+			size_t n = 0;
+			std::string threshold = rest.substr(n_op);
+			t.threshold = std::stof(threshold, &n);
+			if (n != threshold.size() || t.threshold < 0.0f || t.threshold > 1.0f)
+				throw std::invalid_argument(s);
+
+			parsed.push_back(t);
+		} catch (std::exception &e) {
+			std::cerr << "ERROR: Invalid sub-tile selection term \"" << s << "\"" << std::endl;
+			return false;
+		}
+	}
+
+	terms = parsed;
+	return true;
+}
+
+std::set<std::string> SubtileSelector::get_bands() const {
+	std::set<std::string> bands;
+	for (const Term &t: terms)
+		bands.insert(t.band);
+	return bands;
+}
+
+float SubtileSelector::get_fraction(const Term &term, const histogram_t &histogram) {
+	unsigned long total = 0, matched = 0;
+	for (unsigned int v=0; v<histogram.size(); v++) {
+		total += histogram[v];
+		if (term.has_value(v))
+			matched += histogram[v];
+	}
+	return total > 0 ? (float) matched / total : 0.0f;
+}
+
+bool SubtileSelector::evaluate(const std::map<std::string, histogram_t> &histograms) const {
+	for (const Term &t: terms) {
+		auto it = histograms.find(t.band);
+		if (it == histograms.end())
+			return false;
+		// A fraction of nothing would satisfy every upper bound.
+		if (std::all_of(it->second.begin(), it->second.end(), [](unsigned long n) { return n == 0; }))
+			return false;
+
+		float f = get_fraction(t, it->second);
+		bool satisfied = false;
+		switch (t.op) {
+			case OP_LT:
+				satisfied = f < t.threshold;
+				break;
+			case OP_LE:
+				satisfied = f <= t.threshold;
+				break;
+			case OP_GT:
+				satisfied = f > t.threshold;
+				break;
+			case OP_GE:
+				satisfied = f >= t.threshold;
+				break;
+		}
+		if (!satisfied)
+			return false;
+	}
+	return true;
+}
@@ -18,6 +18,8 @@
 #include <filesystem>
 #include <sstream>
 #include <algorithm>
+#include <cctype>
+#include <limits>
 #include <regex>
 
 
@@ -69,6 +71,47 @@ std::vector<std::string> split_str(std::string const &text, char delim) {
 	return result;
 }
 
+uintmax_t parse_size(std::string const &text) {
+	size_t pos = 0;
+	unsigned long long value;
+
+	if (text.empty() || !std::isdigit((unsigned char) text[0]))
+		return 0;
+
+	try {
+		value = std::stoull(text, &pos);
+	} catch (std::exception &e) {
+		return 0;
+	}
+
+	if (pos == text.length())
+		return value;
+	if (pos + 1 != text.length())
+		return 0;
+
+	unsigned int shift;
+	switch (std::toupper(text[pos])) {
+		case 'T':
+			shift = 40;
+			break;
+		case 'G':
+			shift = 30;
+			break;
+		case 'M':
+			shift = 20;
+			break;
+		case 'K':
+			shift = 10;
+			break;
+		default:
+			return 0;
+	}
+	// A size which doesn't fit is invalid, rather than wrapped around.
+	if (value > (std::numeric_limits<uintmax_t>::max() >> shift))
+		return 0;
+	return (uintmax_t) value << shift;
+}
+
 std::string extract_index_date(const std::filesystem::path &path) {
 	// Path example: "/home/user/Documents/work/S2A_MSIL1C_20170815T102021_N0205_R065_T32TMR_20200905T100047.SAFE/GRANULE/L1C_T32TMR_A011216_20170815T102513/IMG_DATA/T32TMR_20170815T102021_B03.jp2"
 	// Path example: "/home/user/Documents/work/S2A_MSIL2A_20200509T094041_N0214_R036_T35VME_20200509T111504.SAFE/GRANULE/L2A_T35VME_A025487_20200509T094035/IMG_DATA/R20m/T35VME_20200509T094041_AOT_20m.jp2"
@@ -76,7 +119,9 @@ std::string extract_index_date(const std::filesystem::path &path) {
 	// Path example: "/home/toshaklg/Documents/work/S2B_MSIL1C_20200401T093029_N0209_R136_T34UFA_20200401T113334.SAFE/GRANULE/L1C_T34UFA_A016035_20200401T093114/FMASK_DATA/L1C_T34UFA_A016035_20200401T093114_Fmask4.tif"
 	std::string index_firstdate_result;
 	std::string path_string = path.string(); 
-	std::regex regexp("(\\d+T\\d+)_.*?(T[\\dA-Z]+)_"); // Expression extracts ...index_firstdate... from a full path file name
+	// Expression extracts ...index_firstdate... from a full path file name.
+	// Static, because the function is called for every band and compiling the expression costs more than matching it.
+	static const std::regex regexp("(\\d+T\\d+)_.*?(T[\\dA-Z]+)_");
 	std::smatch matches;
 	
 	std::regex_search(path_string, matches, regexp);
@@ -93,7 +138,7 @@ std::string extract_tile_id(const std::filesystem::path &path) {
 	// Path example: "/home/user/Documents/work/S2A_MSIL2A_20200529T094041_N0214_R036_T35VLF_20200529T120441.CVAT/tile_256_3584"
 	std::string tile_id_result;
 	std::string path_string = path.string();
-	std::regex regexp("tile_(\\d+)_(\\d+)"); // Expression extracts tile_xi_yi from the path
+	static const std::regex regexp("tile_(\\d+)_(\\d+)"); // Expression extracts tile_xi_yi from the path
 	std::smatch matches;
 	
 	std::regex_search(path_string, matches, regexp); 
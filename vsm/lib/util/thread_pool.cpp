@@ -0,0 +1,164 @@
+// Work-stealing thread pool
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/thread_pool.hpp"
+#include <iostream>
+
+//! Pool which owns the current thread, if any.
+static thread_local const WorkStealingPool *tl_pool = nullptr;
+//! Index of the worker which runs the current thread.
+static thread_local int tl_worker_id = -1;
+
+
+WorkStealingPool::WorkStealingPool(unsigned int num_workers):
+	num_queued(0), num_pending(0), stopping(false), next_queue(0), failed(0)
+{
+	if (num_workers == 0)
+		num_workers = resolve_num_workers(0);
+
+	for (unsigned int i=0; i<num_workers; i++)
+		queues.emplace_back(new WorkerQueue());
+	for (unsigned int i=0; i<num_workers; i++)
+		threads.emplace_back(&WorkStealingPool::run, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	wait();
+	{
+		std::lock_guard<std::mutex> lock(state_mutex);
+		stopping = true;
+	}
+	cv_work.notify_all();
+	for (std::thread &t: threads)
+		t.join();
+}
+
+unsigned int WorkStealingPool::resolve_num_workers(int num_workers) {
+	if (num_workers > 0)
+		return num_workers;
+	unsigned int n = std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+int WorkStealingPool::current_worker() {
+	return tl_worker_id;
+}
+
+unsigned int WorkStealingPool::size() const {
+	return threads.size();
+}
+
+unsigned int WorkStealingPool::num_failed() const {
+	return failed;
+}
+
+void WorkStealingPool::submit(task_t task) {
+	unsigned int qi;
+
+	// Sub-tasks stay with the worker which produced them.
+	if (tl_pool == this && tl_worker_id >= 0)
+		qi = tl_worker_id;
+	else
+		qi = next_queue++ % queues.size();
+
+	{
+		std::lock_guard<std::mutex> lock(queues[qi]->mutex);
+		queues[qi]->tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> lock(state_mutex);
+		num_queued++;
+		num_pending++;
+	}
+	cv_work.notify_one();
+}
+
+unsigned int WorkStealingPool::get_num_queued() {
+	std::lock_guard<std::mutex> lock(state_mutex);
+	return num_queued;
+}
+
+unsigned int WorkStealingPool::get_num_pending() {
+	std::lock_guard<std::mutex> lock(state_mutex);
+	return num_pending;
+}
+
+void WorkStealingPool::wait() {
+	std::unique_lock<std::mutex> lock(state_mutex);
+	cv_done.wait(lock, [this] { return num_pending == 0; });
+}
+
+bool WorkStealingPool::take(unsigned int id, task_t &task) {
+	// Newest task from own queue.
+	{
+		WorkerQueue &q = *queues[id];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (!q.tasks.empty()) {
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+			return true;
+		}
+	}
+	// Oldest task from any other queue.
+	for (unsigned int i=1; i<queues.size(); i++) {
+		WorkerQueue &q = *queues[(id + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (!q.tasks.empty()) {
+			task = std::move(q.tasks.front());
+			q.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkStealingPool::run(unsigned int id) {
+	tl_pool = this;
+	tl_worker_id = id;
+
+	while (true) {
+		task_t task;
+
+		// Claim one of the queued tasks, or exit if there's nothing left to do.
+		{
+			std::unique_lock<std::mutex> lock(state_mutex);
+			cv_work.wait(lock, [this] { return num_queued > 0 || stopping; });
+			if (num_queued == 0)
+				return;
+			num_queued--;
+		}
+
+		// The claimed task is guaranteed to be in one of the queues, although possibly not in ours.
+		while (!take(id, task))
+			std::this_thread::yield();
+
+		try {
+			task();
+		} catch (std::exception &e) {
+			failed++;
+			std::cerr << "ERROR: " << e.what() << std::endl;
+		} catch (...) {
+			failed++;
+			std::cerr << "ERROR: Unknown exception in worker " << id << std::endl;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			if (--num_pending == 0)
+				cv_done.notify_all();
+		}
+	}
+}
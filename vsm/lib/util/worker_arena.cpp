@@ -0,0 +1,64 @@
+// Buffers which each worker thread reuses from sub-tile to sub-tile
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/worker_arena.hpp"
+#include "util/stage_stats.hpp"
+
+
+const size_t WorkerArena::max_kept_bytes = 64 << 20;
+
+WorkerArena &WorkerArena::get_current() {
+	static thread_local WorkerArena arena;
+	return arena;
+}
+
+void *WorkerArena::get_bytes(slot_t slot, size_t num_bytes) {
+	bool grown = grow(slot, num_bytes);
+	StageStats::count_allocation(StageStats::AL_BUFFER, !grown, grown ? buffers[slot].capacity : 0);
+	return buffers[slot].data.get();
+}
+
+void WorkerArena::reserve(slot_t slot, size_t num_bytes) {
+	if (grow(slot, num_bytes))
+		StageStats::count_allocation(StageStats::AL_BUFFER, false, buffers[slot].capacity);
+}
+
+void WorkerArena::release() {
+	for (int i=0; i<SLOT_COUNT; i++) {
+		buffers[i].data.reset();
+		buffers[i].capacity = 0;
+	}
+}
+
+void WorkerArena::trim(size_t max_bytes) {
+	for (int i=0; i<SLOT_COUNT; i++) {
+		if (buffers[i].capacity > max_bytes) {
+			buffers[i].data.reset();
+			buffers[i].capacity = 0;
+		}
+	}
+}
+
+bool WorkerArena::grow(slot_t slot, size_t num_bytes) {
+	Buffer &b = buffers[slot];
+	if (b.data != nullptr && b.capacity >= num_bytes)
+		return false;
+	size_t n = (num_bytes + sizeof(max_align_t) - 1) / sizeof(max_align_t);
+	b.data.reset();
+	b.data.reset(new max_align_t[n > 0 ? n : 1]);
+	b.capacity = n * sizeof(max_align_t);
+	return true;
+}
@@ -0,0 +1,352 @@
+// Reading of files within ZIP archives
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/zip_archive.hpp"
+#include "util/text.hpp"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <zlib.h>
+
+#define ZIP_SIG_LOCAL	0x04034b50
+#define ZIP_SIG_CENTRAL	0x02014b50
+#define ZIP_SIG_EOCD	0x06054b50
+#define ZIP_SIG_EOCD64	0x06064b50
+#define ZIP_SIG_LOCATOR64	0x07064b50
+
+static const std::string vsizip_prefix = "/vsizip/";
+
+
+static uint16_t get_u16(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+	return (uint32_t) get_u16(p) | ((uint32_t) get_u16(p + 2) << 16);
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+	return (uint64_t) get_u32(p) | ((uint64_t) get_u32(p + 4) << 32);
+}
+
+/**
+ * Read a block of a file at an offset.
+ */
+static bool read_at(FILE *fp, uint64_t offset, unsigned char *dst, size_t n) {
+	if (fseeko(fp, (off_t) offset, SEEK_SET) != 0)
+		return false;
+	return fread(dst, 1, n, fp) == n;
+}
+
+
+bool ZipArchive::open(const std::filesystem::path &path) {
+	this->path = path;
+	entries.clear();
+
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (fp == nullptr) {
+		std::cerr << "ERROR: Failed to open " << path << std::endl;
+		return false;
+	}
+
+	bool retval = false;
+	try {
+		if (fseeko(fp, 0, SEEK_END) != 0)
+			throw std::exception();
+		uint64_t file_size = ftello(fp);
+
+		// The end of central directory record is followed by a comment of up to 64 KiB.
+		size_t tail_size = (size_t) std::min<uint64_t>(file_size, 22 + 0xffff);
+		std::vector<unsigned char> tail(tail_size);
+		if (tail_size < 22 || !read_at(fp, file_size - tail_size, tail.data(), tail_size))
+			throw std::exception();
+
+		size_t eocd = std::string::npos;
+		for (size_t i = tail_size - 22 + 1; i-- > 0; ) {
+			if (get_u32(&tail[i]) == ZIP_SIG_EOCD) {
+				eocd = i;
+				break;
+			}
+		}
+		if (eocd == std::string::npos)
+			throw std::exception();
+
+		uint64_t num_entries = get_u16(&tail[eocd + 10]);
+		uint64_t cd_size = get_u32(&tail[eocd + 12]);
+		uint64_t cd_offset = get_u32(&tail[eocd + 16]);
+
+		// ZIP64 end of central directory, for large archives or many entries.
+		if (eocd >= 20 && get_u32(&tail[eocd - 20]) == ZIP_SIG_LOCATOR64) {
+			unsigned char eocd64[56];
+			if (!read_at(fp, get_u64(&tail[eocd - 20 + 8]), eocd64, sizeof(eocd64)) || get_u32(eocd64) != ZIP_SIG_EOCD64)
+				throw std::exception();
+			num_entries = get_u64(eocd64 + 32);
+			cd_size = get_u64(eocd64 + 40);
+			cd_offset = get_u64(eocd64 + 48);
+		}
+
+		std::vector<unsigned char> cd(cd_size);
+		if (cd_offset + cd_size > file_size || !read_at(fp, cd_offset, cd.data(), cd_size))
+			throw std::exception();
+
+		size_t i = 0;
+		for (uint64_t n = 0; n < num_entries; n++) {
+			if (i + 46 > cd.size() || get_u32(&cd[i]) != ZIP_SIG_CENTRAL)
+				throw std::exception();
+
+			Entry e;
+			e.flags = get_u16(&cd[i + 8]);
+			e.method = get_u16(&cd[i + 10]);
+			e.compressed_size = get_u32(&cd[i + 20]);
+			e.size = get_u32(&cd[i + 24]);
+			uint16_t name_len = get_u16(&cd[i + 28]);
+			uint16_t extra_len = get_u16(&cd[i + 30]);
+			uint16_t comment_len = get_u16(&cd[i + 32]);
+			e.header_offset = get_u32(&cd[i + 42]);
+			if (i + 46 + name_len + extra_len > cd.size())
+				throw std::exception();
+			e.name.assign((const char *) &cd[i + 46], name_len);
+
+			// ZIP64 extended information, for the fields which didn't fit into 32 bits.
+			const unsigned char *extra = &cd[i + 46 + name_len];
+			for (size_t j = 0; j + 4 <= extra_len; ) {
+				uint16_t id = get_u16(extra + j);
+				uint16_t len = get_u16(extra + j + 2);
+				if (id == 0x0001) {
+					const unsigned char *f = extra + j + 4;
+					const unsigned char *f_end = f + std::min<size_t>(len, extra_len - j - 4);
+					if (e.size == 0xffffffff && f + 8 <= f_end) {
+						e.size = get_u64(f);
+						f += 8;
+					}
+					if (e.compressed_size == 0xffffffff && f + 8 <= f_end) {
+						e.compressed_size = get_u64(f);
+						f += 8;
+					}
+					if (e.header_offset == 0xffffffff && f + 8 <= f_end)
+						e.header_offset = get_u64(f);
+				}
+				j += 4 + len;
+			}
+
+			entries.push_back(e);
+			i += 46 + name_len + extra_len + comment_len;
+		}
+		retval = true;
+	} catch (std::exception &e) {
+		std::cerr << "ERROR: Failed to read the central directory of " << path << std::endl;
+		entries.clear();
+	}
+
+	fclose(fp);
+	return retval;
+}
+
+const ZipArchive::Entry *ZipArchive::find(const std::string &name) const {
+	for (const Entry &e: entries) {
+		if (e.name == name)
+			return &e;
+	}
+	return nullptr;
+}
+
+std::shared_ptr<const ZipArchive> ZipArchive::get(const std::filesystem::path &path) {
+	static std::mutex mutex;
+	static std::map<std::filesystem::path, std::shared_ptr<const ZipArchive>> archives;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = archives.find(path);
+	if (it != archives.end())
+		return it->second;
+
+	std::shared_ptr<ZipArchive> archive = std::make_shared<ZipArchive>();
+	if (!archive->open(path))
+		return nullptr;
+	archives[path] = archive;
+	return archive;
+}
+
+bool ZipArchive::is_zip_file(const std::filesystem::path &path) {
+	std::error_code ec;
+	return path.extension() == ".zip" && std::filesystem::is_regular_file(path, ec);
+}
+
+bool ZipArchive::is_member_path(const std::filesystem::path &path) {
+	return startswith(path.string(), vsizip_prefix);
+}
+
+std::filesystem::path ZipArchive::make_member_path(const std::filesystem::path &path_zip, const std::string &name) {
+	return std::filesystem::path(vsizip_prefix + path_zip.string() + "/" + name);
+}
+
+bool ZipArchive::split_member_path(const std::filesystem::path &path, std::filesystem::path &path_zip, std::string &name) {
+	std::string s = path.string();
+	if (!startswith(s, vsizip_prefix))
+		return false;
+
+	size_t i = s.find(".zip/", vsizip_prefix.size());
+	if (i == std::string::npos)
+		return false;
+	path_zip = s.substr(vsizip_prefix.size(), i + 4 - vsizip_prefix.size());
+	name = s.substr(i + 5);
+	return true;
+}
+
+bool ZipArchive::read_member(const std::filesystem::path &path, std::vector<unsigned char> &data) {
+	ZipMemberReader reader;
+	if (!reader.open(path))
+		return false;
+	data.resize(reader.size());
+	return reader.read(data.data(), data.size()) == data.size();
+}
+
+
+ZipMemberReader::ZipMemberReader(): fp(nullptr), data_offset(0), position(0), zs(nullptr), compressed_read(0) {}
+
+ZipMemberReader::~ZipMemberReader() {
+	close();
+}
+
+bool ZipMemberReader::open(const std::filesystem::path &path) {
+	close();
+
+	std::filesystem::path path_zip;
+	std::string name;
+	if (!ZipArchive::split_member_path(path, path_zip, name))
+		return false;
+
+	std::shared_ptr<const ZipArchive> archive = ZipArchive::get(path_zip);
+	if (archive == nullptr)
+		return false;
+	const ZipArchive::Entry *e = archive->find(name);
+	if (e == nullptr) {
+		std::cerr << "ERROR: No " << name << " in " << path_zip << std::endl;
+		return false;
+	}
+	if ((e->flags & 1) || (e->method != 0 && e->method != 8)) {
+		std::cerr << "ERROR: Unsupported encryption or compression method of " << path << std::endl;
+		return false;
+	}
+	entry = *e;
+
+	fp = fopen(path_zip.c_str(), "rb");
+	if (fp == nullptr)
+		return false;
+
+	// The stored data follows the local header, the extra field of which may differ from the central directory.
+	unsigned char local[30];
+	if (!read_at(fp, entry.header_offset, local, sizeof(local)) || get_u32(local) != ZIP_SIG_LOCAL) {
+		close();
+		return false;
+	}
+	data_offset = entry.header_offset + 30 + get_u16(local + 26) + get_u16(local + 28);
+
+	if (entry.method == 8) {
+		zs = new z_stream();
+		if (inflateInit2(zs, -MAX_WBITS) != Z_OK) {
+			delete zs;
+			zs = nullptr;
+			close();
+			return false;
+		}
+		in_buf.resize(1 << 16);
+	}
+	position = 0;
+	compressed_read = 0;
+	return true;
+}
+
+void ZipMemberReader::close() {
+	if (zs != nullptr) {
+		inflateEnd(zs);
+		delete zs;
+	}
+	zs = nullptr;
+	if (fp != nullptr)
+		fclose(fp);
+	fp = nullptr;
+	in_buf.clear();
+}
+
+bool ZipMemberReader::restart() {
+	if (inflateReset(zs) != Z_OK)
+		return false;
+	zs->next_in = nullptr;
+	zs->avail_in = 0;
+	position = 0;
+	compressed_read = 0;
+	return true;
+}
+
+size_t ZipMemberReader::read(void *dst, size_t n) {
+	if (fp == nullptr)
+		return 0;
+	n = (size_t) std::min<uint64_t>(n, entry.size - std::min(position, entry.size));
+	if (n == 0)
+		return 0;
+
+	if (zs == nullptr) {
+		if (fseeko(fp, (off_t) (data_offset + position), SEEK_SET) != 0)
+			return 0;
+		size_t r = fread(dst, 1, n, fp);
+		position += r;
+		return r;
+	}
+
+	zs->next_out = (Bytef *) dst;
+	zs->avail_out = (uInt) n;
+	while (zs->avail_out > 0) {
+		if (zs->avail_in == 0) {
+			size_t m = (size_t) std::min<uint64_t>(in_buf.size(), entry.compressed_size - compressed_read);
+			if (m == 0 || !read_at(fp, data_offset + compressed_read, in_buf.data(), m))
+				break;
+			compressed_read += m;
+			zs->next_in = in_buf.data();
+			zs->avail_in = (uInt) m;
+		}
+		int ret = inflate(zs, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END)
+			break;
+		if (ret != Z_OK) {
+			std::cerr << "ERROR: Failed to inflate " << entry.name << std::endl;
+			break;
+		}
+	}
+	size_t r = n - zs->avail_out;
+	position += r;
+	return r;
+}
+
+bool ZipMemberReader::seek(uint64_t offset) {
+	if (fp == nullptr || offset > entry.size)
+		return false;
+	if (zs == nullptr || offset == position) {
+		position = offset;
+		return true;
+	}
+
+	// Deflated data can only be skipped forward, by inflating it.
+	if (offset < position && !restart())
+		return false;
+	unsigned char skip_buf[1 << 14];
+	while (position < offset) {
+		size_t n = (size_t) std::min<uint64_t>(sizeof(skip_buf), offset - position);
+		if (read(skip_buf, n) != n)
+			return false;
+	}
+	return true;
+}
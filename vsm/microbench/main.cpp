@@ -0,0 +1,487 @@
+// Microbenchmarks of the pixel kernels
+//
+// Copyright 2026 KappaZeta Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "version.hpp"
+#include "raster/raster_image.hpp"
+#include "raster/jp2_image.hpp"
+#include "raster/cnes_maja_clm_tif.hpp"
+#include "raster/esa_s2_scl_jp2.hpp"
+#include "raster/pixel_kernels.hpp"
+#include "raster/subtile_splitter.hpp"
+#include "raster/synthetic_s2.hpp"
+#include "util/cpu_dispatch.hpp"
+#include "util/text.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <Magick++.h>
+#include <nlohmann/json.hpp>
+
+
+/**
+ * @brief Measurement of a kernel at a single size.
+ */
+struct KernelResult {
+	std::string kernel;	///< Name of the kernel, with the variant and the instruction set, such as `scale_to/cubic` or `remap_values[avx2]`.
+	unsigned int size;	///< Width and height of the output, in pixels.
+	unsigned int repeats;	///< Number of timed runs.
+	double ns_per_pixel;	///< Best time per output pixel, in nanoseconds.
+	double gb_per_s;	///< Bytes read and written per second in the best run, in GB/s.
+	bool exact;	///< Whether the output is bit-exact with the reference implementation.
+};
+
+/**
+ * Time a kernel, repeating it until it has run for long enough, and keep the best time.
+ * @param[in] reset Reference to the function to restore the input before each run, which is not timed.
+ * @param[in] run Reference to the kernel.
+ * @param[out] repeats Reference to the number of runs to set.
+ * @return Best time of a run, in nanoseconds.
+ */
+double time_best(const std::function<void()> &reset, const std::function<void()> &run, unsigned int &repeats) {
+	double best = 0, total = 0;
+	for (repeats = 0; repeats < 3 || (total < 0.5e9 && repeats < 50); repeats++) {
+		reset();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		run();
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		best = repeats == 0 ? ns : std::min(best, ns);
+		total += ns;
+	}
+	return best;
+}
+
+/**
+ * Create a 16-bit grayscale raster, as the loaders do.
+ */
+Magick::Image *create_image(unsigned int w, unsigned int h) {
+	Magick::Image *img = new Magick::Image(Magick::Geometry(w, h), Magick::ColorGray(0));
+	img->type(Magick::GrayscaleType);
+	img->depth(16);
+	return img;
+}
+
+/**
+ * Copy pixels into a raster.
+ */
+void set_pixels(Magick::Image &img, const std::vector<Magick::PixelPacket> &px) {
+	memcpy(img.getPixels(0, 0, img.columns(), img.rows()), px.data(), px.size() * sizeof(Magick::PixelPacket));
+	img.syncPixels();
+}
+
+/**
+ * @return True if the pixels of a raster are the same as the reference ones, bit by bit.
+ */
+bool same_pixels(Magick::Image &img, const std::vector<Magick::PixelPacket> &px) {
+	if ((size_t) img.columns() * img.rows() != px.size())
+		return false;
+	return memcmp(img.getConstPixels(0, 0, img.columns(), img.rows()), px.data(), px.size() * sizeof(Magick::PixelPacket)) == 0;
+}
+
+/**
+ * Fill pixels with the values of a function of the synthetic product, sampled over the whole granule.
+ */
+std::vector<Magick::PixelPacket> synthetic_pixels(unsigned int size, const std::function<double(float x, float y)> &fn) {
+	std::vector<Magick::PixelPacket> px((size_t) size * size);
+	float f = 10980.0f / size;
+	for (unsigned int y=0; y<size; y++)
+		for (unsigned int x=0; x<size; x++)
+			px[(size_t) y * size + x] = Magick::ColorGray(fn((x + 0.5f) * f, (y + 0.5f) * f));
+	return px;
+}
+
+// Reference implementations, kept as they were before any optimizations of the kernels.
+
+void reference_remap_values(Magick::PixelPacket *px, size_t size, const unsigned char *values, unsigned char max_value) {
+	for (size_t i=0; i<size; i++) {
+		float src_val = Magick::ColorGray(px[i]).shade();
+		unsigned char idx = (unsigned char) (255 * src_val);
+		if (idx > max_value)
+			idx = max_value;
+		px[i] = Magick::ColorGray(values[idx] / 255.0f);
+	}
+}
+
+void reference_multiply(Magick::PixelPacket *px, size_t size, float f) {
+	for (size_t i=0; i<size; i++)
+		px[i] = Magick::ColorGray(Magick::ColorGray(px[i]).shade() * f);
+}
+
+void reference_remap_majac_values(Magick::PixelPacket *px, size_t size) {
+	const float v_cloud = ESA_S2_SCL_JP2_Image::SCL_CLOUD_HIGH_PROBABILITY / 255.0f;
+	const float v_shadow = ESA_S2_SCL_JP2_Image::SCL_CLOUD_SHADOWS / 255.0f;
+	const float v_cirrus = ESA_S2_SCL_JP2_Image::SCL_THIN_CIRRUS / 255.0f;
+	const float v_clear = ESA_S2_SCL_JP2_Image::SCL_VEGETATION / 255.0f;
+	const float v_unsure = ESA_S2_SCL_JP2_Image::SCL_UNCLASSIFIED / 255.0f;
+	const char f_cloud = CNES_MAJA_CLM_TIF::CLM_THEIA_CLOUDS;
+	const char f_shadow = CNES_MAJA_CLM_TIF::CLM_THEIA_CLOUD_SHADOWS | CNES_MAJA_CLM_TIF::CLM_THEIA_CLOUD_SHADOWS_OUTSIDE;
+	const char f_cirrus = CNES_MAJA_CLM_TIF::CLM_THEIA_THIN_CLOUDS;
+
+	for (size_t i=0; i<size; i++) {
+		unsigned char value = (unsigned char) (255 * Magick::ColorGray(px[i]).shade());
+		float dst_val;
+		if (value == 0)
+			dst_val = v_clear;
+		else if ((value & f_cloud) != 0)
+			dst_val = v_cloud;
+		else if ((value & f_shadow) != 0)
+			dst_val = v_shadow;
+		else if ((value & f_cirrus) != 0)
+			dst_val = v_cirrus;
+		else
+			dst_val = v_unsure;
+		px[i] = Magick::ColorGray(dst_val);
+	}
+}
+
+void reference_pixels_to_float(const Magick::PixelPacket *px, unsigned int w, unsigned int h, float *dst) {
+	for (unsigned int y=0; y<h; y++)
+		for (unsigned int x=0; x<w; x++)
+			dst[y * w + x] = ((float) px[y * w + x].green) / MaxRGB;
+}
+
+void reference_pixels_to_ubyte(const Magick::PixelPacket *px, unsigned int w, unsigned int h, unsigned char *dst) {
+	for (unsigned int y=0; y<h; y++)
+		for (unsigned int x=0; x<w; x++)
+			dst[y * w + x] = (int) (px[y * w + x].green * 255 / MaxRGB);
+}
+
+void reference_component_to_pixels(const int32_t *data, size_t n, float f, Magick::PixelPacket *px) {
+	Magick::ColorGray col;
+	for (size_t i=0; i<n; i++) {
+		col.shade(data[i] * f);
+		px[i] = col;
+	}
+}
+
+void reference_blit(const Magick::PixelPacket *src, unsigned long w_src, unsigned long h_src, Magick::PixelPacket *dst, unsigned long w_dst, unsigned long dx, unsigned long dy) {
+	for (unsigned long y=0; y<h_src; y++)
+		for (unsigned long x=0; x<w_src; x++)
+			dst[dx + x + (dy + y) * w_dst] = src[x + y * w_src];
+}
+
+/**
+ * @brief Kernels at a single size, with the inputs shared between them.
+ */
+class KernelBench {
+	public:
+		/**
+		 * @param size Width and height of the rasters, in pixels.
+		 */
+		KernelBench(unsigned int size): size(size), n((size_t) size * size), product(10980, 1) {}
+
+		unsigned int size;	///< Width and height of the rasters, in pixels.
+		size_t n;	///< Number of pixels.
+		SyntheticS2Product product;	///< Source of the content of the rasters.
+		std::string isa;	///< Name of the instruction set of the vectorized kernels, appended to their names (empty for the others).
+		std::vector<KernelResult> results;	///< Results so far.
+
+		/**
+		 * Record a result.
+		 * @param kernel Name of the kernel.
+		 * @param ns Best time of a run, in nanoseconds.
+		 * @param repeats Number of runs.
+		 * @param bytes Number of bytes which a run reads and writes.
+		 * @param exact Whether the output matched the reference.
+		 */
+		void add(const std::string &kernel, double ns, unsigned int repeats, double bytes, bool exact) {
+			results.push_back({isa.empty() ? kernel : kernel + "[" + isa + "]", size, repeats, ns / n, bytes / ns, exact});
+			const KernelResult &r = results.back();
+			std::cout << std::left << std::setw(32) << r.kernel << std::right << std::setw(7) << size
+				<< std::fixed << std::setprecision(3) << std::setw(12) << r.ns_per_pixel << " ns/px"
+				<< std::setprecision(2) << std::setw(10) << r.gb_per_s << " GB/s"
+				<< (exact ? "" : "  MISMATCH") << std::endl;
+		}
+
+		void bench_remap_values() {
+			// SCL classes, remapped into the classes of the labels.
+			static const unsigned char values[13] = {5, 5, 1, 2, 1, 1, 1, 0, 4, 4, 3, 1, 5};
+			std::vector<Magick::PixelPacket> input = synthetic_pixels(size, [this](float x, float y) { return product.get_scl(x, y) / 255.0; });
+			RasterImage img;
+			img.subset = create_image(size, size);
+
+			unsigned int repeats;
+			double ns = time_best([&] { set_pixels(*img.subset, input); }, [&] { img.remap_values(values, 12); }, repeats);
+
+			std::vector<Magick::PixelPacket> expected = input;
+			reference_remap_values(expected.data(), n, values, 12);
+			add("remap_values", ns, repeats, 2.0 * n * sizeof(Magick::PixelPacket), same_pixels(*img.subset, expected));
+		}
+
+		void bench_multiply() {
+			std::vector<Magick::PixelPacket> input = synthetic_pixels(size, [this](float x, float y) { return product.get_reflectance(3, x, y) / 65535.0; });
+			RasterImage img;
+			img.subset = create_image(size, size);
+
+			unsigned int repeats;
+			double ns = time_best([&] { set_pixels(*img.subset, input); }, [&] { img.multiply(0.5f); }, repeats);
+
+			std::vector<Magick::PixelPacket> expected = input;
+			reference_multiply(expected.data(), n, 0.5f);
+			add("multiply", ns, repeats, 2.0 * n * sizeof(Magick::PixelPacket), same_pixels(*img.subset, expected));
+		}
+
+		void bench_scale_to() {
+			// Sub-tiles of the 20 m bands are upscaled by a factor of 2.
+			unsigned int size_in = size / 2;
+			Magick::Image *input = create_image(size_in, size_in);
+			std::vector<Magick::PixelPacket> px_in = synthetic_pixels(size_in, [this](float x, float y) { return product.get_reflectance(5, x, y) / 65535.0; });
+			set_pixels(*input, px_in);
+
+			static const char *filters[] = {
+				"point", "box", "linear", "cubic", "sinc", "hermite", "hanning", "hamming", "blackman",
+				"gaussian", "quadratic", "catrom", "mitchell", "lanczos", "bessel"
+			};
+			for (const char *filter: filters) {
+				RasterImage img;
+				unsigned int repeats;
+				double ns = time_best([&] {
+					if (img.subset == nullptr)
+						img.subset = new Magick::Image();
+					*img.subset = *input;
+					img.set_resampling_filter(filter);
+				}, [&] { img.scale_to(size); }, repeats);
+
+				// The reference is the resize of GraphicsMagick itself.
+				Magick::Image expected(*input);
+				expected.filterType(img.set_resampling_filter(filter));
+				expected.resize(Magick::Geometry(size, size));
+				std::vector<Magick::PixelPacket> px_expected((size_t) expected.columns() * expected.rows());
+				memcpy(px_expected.data(), expected.getConstPixels(0, 0, expected.columns(), expected.rows()), px_expected.size() * sizeof(Magick::PixelPacket));
+
+				add(std::string("scale_to/") + filter, ns, repeats, ((double) size_in * size_in + n) * sizeof(Magick::PixelPacket), same_pixels(*img.subset, px_expected));
+			}
+			delete input;
+		}
+
+		void bench_netcdf_conversion() {
+			std::vector<Magick::PixelPacket> input = synthetic_pixels(size, [this](float x, float y) { return product.get_reflectance(3, x, y) / 65535.0; });
+			unsigned int repeats;
+
+			std::vector<float> f(n), f_expected(n);
+			double ns = time_best([] {}, [&] { PixelKernels::pixels_to_float(input.data(), n, f.data()); }, repeats);
+			reference_pixels_to_float(input.data(), size, size, f_expected.data());
+			add("pixels_to_float", ns, repeats, (double) n * (sizeof(Magick::PixelPacket) + sizeof(float)),
+				memcmp(f.data(), f_expected.data(), n * sizeof(float)) == 0);
+
+			std::vector<unsigned char> b(n), b_expected(n);
+			ns = time_best([] {}, [&] { PixelKernels::pixels_to_ubyte(input.data(), n, b.data()); }, repeats);
+			reference_pixels_to_ubyte(input.data(), size, size, b_expected.data());
+			add("pixels_to_ubyte", ns, repeats, (double) n * (sizeof(Magick::PixelPacket) + 1), b == b_expected);
+		}
+
+		/**
+		 * Time a mask transform step by step, followed by the conversion for NetCDF, and in a single pass.
+		 * @param name Name of the transform.
+		 * @param transform Reference to the transform.
+		 * @param fn Reference to the function of the synthetic product to fill the mask with.
+		 */
+		template<class Transform>
+		void bench_fused(const std::string &name, const Transform &transform, const std::function<double(float x, float y)> &fn) {
+			// Masks at 20 m are upsampled into the sub-tiles of the 10 m bands.
+			unsigned int size_in = size / 2;
+			std::vector<Magick::PixelPacket> input = synthetic_pixels(size_in, fn);
+			RasterImage img;
+			img.main_depth = 8;
+			auto reset = [&] {
+				delete img.subset;
+				img.subset = create_image(size_in, size_in);
+				set_pixels(*img.subset, input);
+			};
+			double bytes = (double) size_in * size_in * sizeof(Magick::PixelPacket) + n;
+
+			unsigned int repeats;
+			std::vector<unsigned char> expected(n);
+			const void *px = nullptr;
+			double ns = time_best(reset, [&] {
+				transform(img, size);
+				PixelKernels::pixels_to_ubyte(img.subset->getConstPixels(0, 0, size, size), n, expected.data());
+			}, repeats);
+			add(name + "/steps", ns, repeats, bytes, true);
+
+			reset();
+			ns = time_best([] {}, [&] { transform.apply_fused(img, size, px); }, repeats);
+			add(name + "/fused", ns, repeats, bytes, px != nullptr && memcmp(px, expected.data(), n) == 0);
+		}
+
+		void bench_class_maps() {
+			static const unsigned char values[13] = {5, 5, 1, 2, 1, 1, 1, 0, 4, 4, 3, 1, 5};
+			bench_fused("class_map", ClassMapTransform(nullptr, 0, values, 12),
+				[this](float x, float y) { return product.get_scl(x, y) / 255.0; });
+			bench_fused("maja_class_map", MajaClassMapTransform(CNES_MAJA_CLM_TIF::CLM_FMT_THEIA, values, 12),
+				[this](float x, float y) { return product.get_clm(x, y) / 255.0; });
+		}
+
+		void bench_remap_majac_values() {
+			std::vector<Magick::PixelPacket> input = synthetic_pixels(size, [this](float x, float y) { return product.get_clm(x, y) / 255.0; });
+			RasterImage img;
+			img.subset = create_image(size, size);
+
+			unsigned int repeats;
+			double ns = time_best([&] { set_pixels(*img.subset, input); }, [&] { CNES_MAJA_CLM_TIF::remap_majac_values(&img, CNES_MAJA_CLM_TIF::CLM_FMT_THEIA); }, repeats);
+
+			std::vector<Magick::PixelPacket> expected = input;
+			reference_remap_majac_values(expected.data(), n);
+			add("remap_majac_values", ns, repeats, 2.0 * n * sizeof(Magick::PixelPacket), same_pixels(*img.subset, expected));
+		}
+
+		void bench_jp2_blit() {
+			// Samples of a decoded 16-bit band.
+			std::vector<int32_t> data(n);
+			for (unsigned int y=0; y<size; y++)
+				for (unsigned int x=0; x<size; x++)
+					data[(size_t) y * size + x] = product.get_reflectance(3, (x + 0.5f) * 10980.0f / size, (y + 0.5f) * 10980.0f / size);
+			float f = 1.0f / 65535.0f;
+
+			unsigned int repeats;
+			std::vector<Magick::PixelPacket> px(n), px_expected(n);
+			double ns = time_best([] {}, [&] { JP2_Image::component_to_pixels(data.data(), n, f, 65536, px.data()); }, repeats);
+			reference_component_to_pixels(data.data(), n, f, px_expected.data());
+			add("component_to_pixels", ns, repeats, (double) n * (sizeof(int32_t) + sizeof(Magick::PixelPacket)),
+				memcmp(px.data(), px_expected.data(), n * sizeof(Magick::PixelPacket)) == 0);
+
+			// The decoded window into a sub-tile with a border, as at the edges of the decoded window.
+			unsigned long w_dst = size + 16;
+			std::vector<Magick::PixelPacket> dst(w_dst * w_dst), dst_expected(w_dst * w_dst);
+			ns = time_best([] {}, [&] { JP2_Image::blit(px.data(), size, size, dst.data(), w_dst, 8, 8); }, repeats);
+			reference_blit(px.data(), size, size, dst_expected.data(), w_dst, 8, 8);
+			add("blit", ns, repeats, 2.0 * n * sizeof(Magick::PixelPacket),
+				memcmp(dst.data(), dst_expected.data(), dst.size() * sizeof(Magick::PixelPacket)) == 0);
+		}
+};
+
+int main(int argc, char *argv[]) {
+	std::cout << "cm_vsm_microbench " << CM_CONVERTER_VERSION_STR << std::endl;
+
+	std::string arg_sizes = "512,1024,10980", arg_kernels, arg_isas, arg_path_json;
+
+	for (int i=1; i<argc; i++) {
+		if (!strncmp(argv[i], "-h", 2) || i + 1 >= argc) {
+			std::cout << "Usage: " << argv[0] << " [-s SIZES] [-k KERNELS] [-i ISAS] [-o JSON]" << std::endl
+				<< "Time the pixel kernels in isolation, and check their output against the reference implementations." << std::endl
+				<< "\tSIZES Comma-separated list of raster sizes in pixels (default: 512,1024,10980)." << std::endl
+				<< "\tKERNELS Comma-separated list of kernel groups to run: remap_values, multiply, scale_to, fused, netcdf, majac, jp2 (default: all)." << std::endl
+				<< "\tISAS Comma-separated list of instruction sets to run the vectorized kernels in: generic, avx2, avx512 (default: all supported)." << std::endl
+				<< "\tJSON File to write the results into." << std::endl;
+			return 1;
+		}
+		if (!strncmp(argv[i], "-s", 2))
+			arg_sizes.assign(argv[i + 1]);
+		else if (!strncmp(argv[i], "-k", 2))
+			arg_kernels.assign(argv[i + 1]);
+		else if (!strncmp(argv[i], "-i", 2))
+			arg_isas.assign(argv[i + 1]);
+		else if (!strncmp(argv[i], "-o", 2))
+			arg_path_json.assign(argv[i + 1]);
+		i++;
+	}
+
+	std::vector<CPUDispatch::isa_t> isas;
+	if (arg_isas.empty()) {
+		for (int i=0; i<CPUDispatch::ISA_COUNT; i++) {
+			if (CPUDispatch::is_supported((CPUDispatch::isa_t) i))
+				isas.push_back((CPUDispatch::isa_t) i);
+		}
+	} else {
+		for (const std::string &name: split_str(arg_isas, ',')) {
+			CPUDispatch::isa_t isa;
+			if (!CPUDispatch::parse_isa(name, isa)) {
+				std::cerr << "ERROR: Unknown instruction set " << name << std::endl;
+				return 1;
+			}
+			if (!CPUDispatch::is_supported(isa)) {
+				std::cerr << "ERROR: This CPU doesn't support " << name << std::endl;
+				return 1;
+			}
+			isas.push_back(isa);
+		}
+	}
+
+	Magick::InitializeMagick(*argv);
+
+	std::vector<std::string> kernels = split_str(arg_kernels, ',');
+	auto enabled = [&kernels, &arg_kernels](const std::string &name) {
+		return arg_kernels.empty() || std::find(kernels.begin(), kernels.end(), name) != kernels.end();
+	};
+
+	nlohmann::json results = {
+		{"version", CM_CONVERTER_VERSION_STR},
+		{"results", nlohmann::json::array()}
+	};
+	bool exact = true;
+
+	for (const std::string &s: split_str(arg_sizes, ',')) {
+		unsigned int size = atoi(s.c_str());
+		if (size < 2) {
+			std::cerr << "ERROR: Invalid size " << s << std::endl;
+			return 1;
+		}
+
+		KernelBench bench(size);
+		if (enabled("multiply"))
+			bench.bench_multiply();
+		// Only sub-tiles are resampled, never whole bands.
+		if (enabled("scale_to") && size <= 2048)
+			bench.bench_scale_to();
+		if (enabled("fused") && size <= 2048)
+			bench.bench_class_maps();
+
+		for (CPUDispatch::isa_t isa: isas) {
+			CPUDispatch::set_isa(isa);
+			bench.isa = CPUDispatch::isa_name[isa];
+			if (enabled("remap_values"))
+				bench.bench_remap_values();
+			if (enabled("netcdf"))
+				bench.bench_netcdf_conversion();
+			if (enabled("majac"))
+				bench.bench_remap_majac_values();
+			if (enabled("jp2"))
+				bench.bench_jp2_blit();
+		}
+		bench.isa.clear();
+
+		for (const KernelResult &r: bench.results) {
+			results["results"].push_back({
+				{"kernel", r.kernel},
+				{"size", r.size},
+				{"repeats", r.repeats},
+				{"ns_per_pixel", r.ns_per_pixel},
+				{"gb_per_s", r.gb_per_s},
+				{"exact", r.exact}
+			});
+			exact &= r.exact;
+		}
+	}
+
+	if (!arg_path_json.empty()) {
+		std::ofstream f(arg_path_json);
+		f << results.dump(2) << std::endl;
+		if (!f.good()) {
+			std::cerr << "ERROR: Failed to write " << arg_path_json << std::endl;
+			return 3;
+		}
+	}
+
+	if (!exact) {
+		std::cerr << "ERROR: Some of the kernels don't match the reference implementations." << std::endl;
+		return 5;
+	}
+	return 0;
+}
@@ -19,7 +19,34 @@
 #include <cppunit/TestFixture.h>
 
 #include "util/text.hpp"
+#include "util/cpu_dispatch.hpp"
 #include "util/geometry.hpp"
+#include "util/thread_pool.hpp"
+#include "util/worker_arena.hpp"
+#include "util/memory_budget.hpp"
+#include "util/metrics_exporter.hpp"
+#include "util/prefetcher.hpp"
+#include "util/resume_manifest.hpp"
+#include "util/staged_file.hpp"
+#include "util/stage_stats.hpp"
+#include "util/subtile_grid.hpp"
+#include "util/subtile_selector.hpp"
+#include "raster/esa_s2.hpp"
+#include "raster/gdal_image.hpp"
+#include "raster/pixel_kernels.hpp"
+#include "raster/subtile_plan.hpp"
+#include "raster/synthetic_s2.hpp"
+#include "raster/esa_s2_scl_jp2.hpp"
+#include "raster/tif_window_reader.hpp"
+#include "raster/png_row_reader.hpp"
+#include "util/zip_archive.hpp"
+
+#include <fstream>
+#include <math.h>
+#include <tiffio.h>
+#include <png.h>
+#include <zlib.h>
+#include <gdal_priv.h>
 
 std::vector<std::vector<unsigned char>> fill_poly_overlap(const AABB<int> &image_aabb, Polygon<int> &poly, float pixel_size_div, bool buffer_out);
 
@@ -489,6 +516,1628 @@ CPPUNIT_TEST_SUITE_END();
 		}
 };
 
+class SubtileGridTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(SubtileGridTest);
+CPPUNIT_TEST(testMask01);
+CPPUNIT_TEST(testIntersect01);
+CPPUNIT_TEST(testOrder01);
+CPPUNIT_TEST(testBlocks01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void testMask01() {
+			// 9 x 10 sub-tiles, so that the bits span more than a single word.
+			std::vector<std::vector<unsigned char>> mask(9, std::vector<unsigned char>(10, 0));
+			mask[0][0] = 1;
+			mask[8][9] = 1;
+			mask[3][7] = 1;
+			SubtileGrid grid(mask);
+			CPPUNIT_ASSERT(grid.get_width() == 9 && grid.get_height() == 10);
+			CPPUNIT_ASSERT(grid.count() == 3);
+			CPPUNIT_ASSERT(grid.get(3, 7) && !grid.get(7, 3));
+			CPPUNIT_ASSERT(!grid.get(-1, 0) && !grid.get(9, 0));
+
+			grid.set(3, 7, false);
+			grid.set(100, 100, true);
+			CPPUNIT_ASSERT(grid.count() == 2);
+
+			// The legacy order is column by column.
+			std::vector<Vector<int>> subtiles = grid.get_subtiles();
+			CPPUNIT_ASSERT(subtiles.size() == 2);
+			CPPUNIT_ASSERT(subtiles[0] == Vector<int>(0, 0) && subtiles[1] == Vector<int>(8, 9));
+
+			CPPUNIT_ASSERT(SubtileGrid(7, 11, true).count() == 77);
+			CPPUNIT_ASSERT(SubtileGrid(7, 11, false).count() == 0);
+			grid.clear();
+			CPPUNIT_ASSERT(grid.empty() && grid.count() == 0);
+		}
+
+		void testIntersect01() {
+			SubtileGrid a(4, 4, true), b(4, 4, false), c(2, 8, true);
+			b.set(1, 1, true);
+			b.set(3, 2, true);
+			a.intersect(b);
+			CPPUNIT_ASSERT(a.count() == 2 && a.get(1, 1) && a.get(3, 2));
+
+			// Sub-tiles outside of the other grid are dropped.
+			a.intersect(c);
+			CPPUNIT_ASSERT(a.count() == 1 && a.get(1, 1));
+		}
+
+		void testOrder01() {
+			SubtileGrid grid(5, 3, true);
+			std::vector<Vector<int>> rows = grid.get_subtiles(SubtileGrid::SO_ROW_MAJOR);
+			for (size_t i = 0; i < rows.size(); i++)
+				CPPUNIT_ASSERT(rows[i] == Vector<int>(i % 5, i / 5));
+
+			CPPUNIT_ASSERT(SubtileGrid::morton_index(0, 0) == 0);
+			CPPUNIT_ASSERT(SubtileGrid::morton_index(1, 0) == 1);
+			CPPUNIT_ASSERT(SubtileGrid::morton_index(0, 1) == 2);
+			CPPUNIT_ASSERT(SubtileGrid::morton_index(2, 3) == 14);
+
+			// Each step along the Hilbert curve moves to a neighbouring sub-tile, and every sub-tile is visited once.
+			SubtileGrid square(8, 8, true);
+			std::vector<Vector<int>> curve = square.get_subtiles(SubtileGrid::SO_HILBERT);
+			CPPUNIT_ASSERT(curve.size() == 64);
+			CPPUNIT_ASSERT(curve[0] == Vector<int>(0, 0));
+			std::set<std::pair<int, int>> visited;
+			for (size_t i = 0; i < curve.size(); i++) {
+				visited.insert(std::make_pair(curve[i].x, curve[i].y));
+				if (i > 0)
+					CPPUNIT_ASSERT(abs(curve[i].x - curve[i - 1].x) + abs(curve[i].y - curve[i - 1].y) == 1);
+			}
+			CPPUNIT_ASSERT(visited.size() == 64);
+
+			SubtileGrid::order_t order;
+			CPPUNIT_ASSERT(SubtileGrid::parse_order("morton", order) && order == SubtileGrid::SO_MORTON);
+			CPPUNIT_ASSERT(!SubtileGrid::parse_order("diagonal", order));
+		}
+
+		void testBlocks01() {
+			// Blocks of 2 x 2 sub-tiles, with partial blocks at the right and bottom edges.
+			SubtileGrid grid(5, 3, true);
+			grid.set(0, 0, false);
+			std::vector<Vector<int>> subtiles = grid.get_subtiles(SubtileGrid::SO_MORTON, 2);
+			CPPUNIT_ASSERT(subtiles.size() == 14);
+			CPPUNIT_ASSERT(subtiles[0] == Vector<int>(1, 0));
+			CPPUNIT_ASSERT(subtiles[1] == Vector<int>(0, 1));
+			CPPUNIT_ASSERT(subtiles[2] == Vector<int>(1, 1));
+			CPPUNIT_ASSERT(subtiles[3] == Vector<int>(2, 0));
+			CPPUNIT_ASSERT(subtiles[6] == Vector<int>(3, 1));
+			CPPUNIT_ASSERT(subtiles[7] == Vector<int>(0, 2));
+
+			// In column order, the sub-tiles within a block are listed column by column too.
+			subtiles = grid.get_subtiles(SubtileGrid::SO_COLUMN_MAJOR, 2);
+			CPPUNIT_ASSERT(subtiles[0] == Vector<int>(0, 1));
+			CPPUNIT_ASSERT(subtiles[1] == Vector<int>(1, 0));
+			CPPUNIT_ASSERT(subtiles[2] == Vector<int>(1, 1));
+			CPPUNIT_ASSERT(subtiles[3] == Vector<int>(0, 2));
+			CPPUNIT_ASSERT(subtiles[4] == Vector<int>(1, 2));
+			CPPUNIT_ASSERT(subtiles[5] == Vector<int>(2, 0));
+
+			// All the sub-tiles of a block come one after another.
+			for (SubtileGrid::order_t order: {SubtileGrid::SO_COLUMN_MAJOR, SubtileGrid::SO_ROW_MAJOR, SubtileGrid::SO_HILBERT}) {
+				subtiles = grid.get_subtiles(order, 2);
+				std::set<std::pair<int, int>> done;
+				for (size_t i = 1; i < subtiles.size(); i++) {
+					std::pair<int, int> b(subtiles[i - 1].x / 2, subtiles[i - 1].y / 2);
+					if (b != std::make_pair(subtiles[i].x / 2, subtiles[i].y / 2))
+						done.insert(b);
+					CPPUNIT_ASSERT(done.count(std::make_pair(subtiles[i].x / 2, subtiles[i].y / 2)) == 0);
+				}
+			}
+		}
+};
+
+class SubtileSelectorTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(SubtileSelectorTest);
+CPPUNIT_TEST(testParse01);
+CPPUNIT_TEST(testEvaluate01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void testParse01() {
+			SubtileSelector selector;
+			CPPUNIT_ASSERT(selector.parse("") && selector.empty());
+			CPPUNIT_ASSERT(selector.parse("SCL[8+9+10]>=0.05,S2CC[50-100]<0.5"));
+
+			const std::vector<SubtileSelector::Term> &terms = selector.get_terms();
+			CPPUNIT_ASSERT(terms.size() == 2);
+			CPPUNIT_ASSERT(terms[0].band == "SCL" && terms[0].op == SubtileSelector::OP_GE && terms[0].threshold == 0.05f);
+			CPPUNIT_ASSERT(terms[0].ranges.size() == 3 && terms[0].has_value(9) && !terms[0].has_value(11));
+			CPPUNIT_ASSERT(terms[1].band == "S2CC" && terms[1].op == SubtileSelector::OP_LT);
+			CPPUNIT_ASSERT(terms[1].has_value(50) && terms[1].has_value(100) && !terms[1].has_value(49));
+			CPPUNIT_ASSERT(selector.get_bands() == std::set<std::string>({"SCL", "S2CC"}));
+
+			// An invalid expression leaves the previous one in place.
+			CPPUNIT_ASSERT(!selector.parse("SCL[8]=0.5"));
+			CPPUNIT_ASSERT(!selector.parse("SCL[]>0.5"));
+			CPPUNIT_ASSERT(!selector.parse("SCL[256]>0.5"));
+			CPPUNIT_ASSERT(!selector.parse("SCL[8]>1.5"));
+			CPPUNIT_ASSERT(!selector.parse("[8]>0.5"));
+			CPPUNIT_ASSERT(!selector.parse("SCL[8-3]>0.5"));
+			CPPUNIT_ASSERT(selector.get_terms().size() == 2);
+		}
+
+		void testEvaluate01() {
+			SubtileSelector selector;
+			CPPUNIT_ASSERT(selector.parse("SCL[8+9]>=0.25,SCL[8+9]<=0.75"));
+
+			SubtileSelector::histogram_t h;
+			h.fill(0);
+			h[4] = 60;
+			h[8] = 30;
+			h[9] = 10;
+			std::map<std::string, SubtileSelector::histogram_t> histograms;
+			histograms["SCL"] = h;
+			CPPUNIT_ASSERT(SubtileSelector::get_fraction(selector.get_terms()[0], h) == 0.4f);
+			CPPUNIT_ASSERT(selector.evaluate(histograms));
+
+			histograms["SCL"][4] = 0;
+			CPPUNIT_ASSERT(!selector.evaluate(histograms));
+
+			// Sub-tiles without any valid pixels satisfy neither bound.
+			CPPUNIT_ASSERT(selector.parse("SCL[8+9]<0.5"));
+			histograms["SCL"].fill(0);
+			CPPUNIT_ASSERT(!selector.evaluate(histograms));
+
+			// Without the band, none of the sub-tiles is selected.
+			CPPUNIT_ASSERT(!selector.evaluate(std::map<std::string, SubtileSelector::histogram_t>()));
+			CPPUNIT_ASSERT(SubtileSelector().evaluate(std::map<std::string, SubtileSelector::histogram_t>()));
+		}
+};
+
+class ThreadPoolTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(ThreadPoolTest);
+CPPUNIT_TEST(testAllTasks01);
+CPPUNIT_TEST(testNestedTasks01);
+CPPUNIT_TEST(testException01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void setUp() {
+		}
+
+		void tearDown() {
+		}
+
+		void testAllTasks01() {
+			WorkStealingPool pool(4);
+			std::atomic<unsigned int> sum(0);
+
+			for (unsigned int i=1; i<=100; i++)
+				pool.submit([&sum, i]() { sum += i; });
+			pool.wait();
+
+			CPPUNIT_ASSERT(pool.size() == 4);
+			CPPUNIT_ASSERT(sum == 5050);
+		}
+
+		void testNestedTasks01() {
+			WorkStealingPool pool(3);
+			std::atomic<unsigned int> num(0);
+
+			// Each task queues further tasks, as products queue their bands and bands their sub-tile ranges.
+			for (unsigned int i=0; i<4; i++) {
+				pool.submit([&pool, &num]() {
+					for (unsigned int j=0; j<10; j++) {
+						pool.submit([&num]() {
+							CPPUNIT_ASSERT(WorkStealingPool::current_worker() >= 0);
+							num++;
+						});
+					}
+				});
+			}
+			pool.wait();
+
+			CPPUNIT_ASSERT(num == 40);
+			CPPUNIT_ASSERT(WorkStealingPool::current_worker() == -1);
+		}
+
+		void testException01() {
+			WorkStealingPool pool(2);
+			std::atomic<unsigned int> num(0);
+
+			pool.submit([]() { throw std::runtime_error("Intentional failure"); });
+			pool.submit([&num]() { num++; });
+			pool.wait();
+
+			CPPUNIT_ASSERT(pool.num_failed() == 1);
+			CPPUNIT_ASSERT(num == 1);
+		}
+};
+
+class MemoryBudgetTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(MemoryBudgetTest);
+CPPUNIT_TEST(testParseSize01);
+CPPUNIT_TEST(testUnlimited01);
+CPPUNIT_TEST(testOversized01);
+CPPUNIT_TEST(testFIFO01);
+CPPUNIT_TEST(testConcurrent01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void testParseSize01() {
+			CPPUNIT_ASSERT(parse_size("1024") == 1024);
+			CPPUNIT_ASSERT(parse_size("4k") == 4096);
+			CPPUNIT_ASSERT(parse_size("512M") == 512ull << 20);
+			CPPUNIT_ASSERT(parse_size("8G") == 8ull << 30);
+			CPPUNIT_ASSERT(parse_size("") == 0);
+			CPPUNIT_ASSERT(parse_size("-1G") == 0);
+			CPPUNIT_ASSERT(parse_size("8GB") == 0);
+			CPPUNIT_ASSERT(parse_size("16777215T") == 16777215ull << 40);
+			CPPUNIT_ASSERT(parse_size("99999999T") == 0);
+			CPPUNIT_ASSERT(parse_size("99999999999999999999") == 0);
+		}
+
+		void testUnlimited01() {
+			MemoryBudget budget(0);
+			CPPUNIT_ASSERT(budget.acquire(1ull << 40) == 0);
+			CPPUNIT_ASSERT(budget.get_in_use() == 0);
+		}
+
+		void testOversized01() {
+			MemoryBudget budget(100);
+			{
+				MemoryBudget::Reservation r(budget, 1000);
+				CPPUNIT_ASSERT(budget.get_in_use() == 1000);
+			}
+			CPPUNIT_ASSERT(budget.get_in_use() == 0);
+		}
+
+		void testFIFO01() {
+			MemoryBudget budget(100);
+			std::atomic<bool> large_admitted(false), small_admitted(false);
+			std::unique_ptr<MemoryBudget::Reservation> r(new MemoryBudget::Reservation(budget, 50));
+
+			// A large reservation which doesn't fit yet holds back the smaller one behind it, which would fit.
+			std::thread t_large([&] {
+				MemoryBudget::Reservation r_large(budget, 80);
+				large_admitted = true;
+			});
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			std::thread t_small([&] {
+				MemoryBudget::Reservation r_small(budget, 10);
+				small_admitted = true;
+			});
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			CPPUNIT_ASSERT(!large_admitted && !small_admitted);
+
+			r.reset();
+			t_large.join();
+			t_small.join();
+			CPPUNIT_ASSERT(large_admitted && small_admitted);
+			CPPUNIT_ASSERT(budget.get_in_use() == 0);
+		}
+
+		void testConcurrent01() {
+			MemoryBudget budget(100);
+			std::atomic<uintmax_t> peak(0);
+			std::atomic<uintmax_t> in_use(0);
+			WorkStealingPool pool(4);
+
+			for (int i=0; i<32; i++) {
+				pool.submit([&budget, &peak, &in_use]() {
+					MemoryBudget::Reservation r(budget, 40);
+					uintmax_t n = in_use += 40;
+					uintmax_t p = peak;
+					while (n > p && !peak.compare_exchange_weak(p, n));
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					in_use -= 40;
+				});
+			}
+			pool.wait();
+
+			CPPUNIT_ASSERT(peak <= 80);
+			CPPUNIT_ASSERT(budget.get_in_use() == 0);
+		}
+};
+
+class PrefetcherTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(PrefetcherTest);
+CPPUNIT_TEST(testWindow01);
+CPPUNIT_TEST(testForget01);
+CPPUNIT_TEST(testDisabled01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::vector<std::filesystem::path> paths;
+
+		void setUp() {
+			for (int i = 0; i < 4; i++) {
+				paths.push_back(std::filesystem::temp_directory_path() / ("cm_vsm_test_prefetch_" + std::to_string(i) + ".bin"));
+				std::ofstream f(paths.back(), std::ios::binary);
+				f << std::string(1000, 'x');
+			}
+		}
+
+		void tearDown() {
+			for (auto &p: paths)
+				std::filesystem::remove(p);
+			paths.clear();
+		}
+
+		/**
+		 * Wait for the background thread to prefetch a number of files.
+		 */
+		bool wait_for(Prefetcher &prefetcher, unsigned long n) {
+			for (int i = 0; i < 5000 && prefetcher.get_num_prefetched() < n; i++)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			return prefetcher.get_num_prefetched() == n;
+		}
+
+		void testWindow01() {
+			// Room for 2 of the files at a time.
+			Prefetcher prefetcher(2500);
+			for (auto &p: paths)
+				prefetcher.enqueue(p, 1000);
+			CPPUNIT_ASSERT(wait_for(prefetcher, 2));
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			CPPUNIT_ASSERT(prefetcher.get_num_prefetched() == 2);
+
+			// Reading the first file makes room for the third one. Reading it again doesn't count.
+			prefetcher.consume(paths[0]);
+			prefetcher.consume(paths[0]);
+			CPPUNIT_ASSERT(wait_for(prefetcher, 3));
+			CPPUNIT_ASSERT(prefetcher.get_num_hits() == 1 && prefetcher.get_num_misses() == 0);
+
+			// A file which is read before its turn is not prefetched at all.
+			prefetcher.consume(paths[3]);
+			prefetcher.consume(paths[1]);
+			prefetcher.consume(paths[3]);
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			CPPUNIT_ASSERT(prefetcher.get_num_prefetched() == 3);
+			CPPUNIT_ASSERT(prefetcher.get_num_hits() == 2 && prefetcher.get_num_misses() == 1);
+
+			CPPUNIT_ASSERT(Prefetcher::advise(paths[0]));
+			CPPUNIT_ASSERT(!Prefetcher::advise(paths[0].string() + ".missing"));
+		}
+
+		void testForget01() {
+			// Room for 2 of the files at a time, neither of which is ever read.
+			Prefetcher prefetcher(2500);
+			for (auto &p: paths)
+				prefetcher.enqueue(p, 1000);
+			CPPUNIT_ASSERT(wait_for(prefetcher, 2));
+
+			// Forgetting them makes room for the rest, without counting as reads.
+			prefetcher.forget({paths[0], paths[1], paths[2]});
+			CPPUNIT_ASSERT(wait_for(prefetcher, 3));
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			CPPUNIT_ASSERT(prefetcher.get_num_prefetched() == 3);
+			CPPUNIT_ASSERT(prefetcher.get_num_hits() == 0 && prefetcher.get_num_misses() == 0);
+		}
+
+		void testDisabled01() {
+			Prefetcher prefetcher(0);
+			prefetcher.enqueue(paths[0], 1000);
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			CPPUNIT_ASSERT(prefetcher.get_num_prefetched() == 0);
+		}
+};
+
+/**
+ * Write a ZIP archive with the given files, either stored or deflated.
+ */
+static void write_zip(const std::filesystem::path &path, const std::vector<std::pair<std::string, std::string>> &files, bool deflated) {
+	std::string zip, cd;
+	auto put16 = [](std::string &s, unsigned int v) { s += (char) (v & 0xff); s += (char) ((v >> 8) & 0xff); };
+	auto put32 = [&put16](std::string &s, unsigned long v) { put16(s, v & 0xffff); put16(s, (v >> 16) & 0xffff); };
+
+	for (auto it = files.begin(); it != files.end(); it++) {
+		std::string data = it->second;
+		if (deflated) {
+			std::vector<unsigned char> buf(compressBound(data.size()) + 64);
+			z_stream zs = {};
+			deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+			zs.next_in = (Bytef *) it->second.data();
+			zs.avail_in = it->second.size();
+			zs.next_out = buf.data();
+			zs.avail_out = buf.size();
+			deflate(&zs, Z_FINISH);
+			data.assign((const char *) buf.data(), zs.total_out);
+			deflateEnd(&zs);
+		}
+		unsigned long crc = crc32(0, (const Bytef *) it->second.data(), it->second.size());
+		unsigned long offset = zip.size();
+
+		std::string common;
+		put16(common, 20);
+		put16(common, 0);
+		put16(common, deflated ? 8 : 0);
+		put32(common, 0);
+		put32(common, crc);
+		put32(common, data.size());
+		put32(common, it->second.size());
+		put16(common, it->first.size());
+		put16(common, 0);
+
+		put32(zip, 0x04034b50);
+		zip += common + it->first + data;
+
+		put32(cd, 0x02014b50);
+		put16(cd, 20);
+		cd += common;
+		put16(cd, 0);
+		put16(cd, 0);
+		put16(cd, 0);
+		put32(cd, 0);
+		put32(cd, offset);
+		cd += it->first;
+	}
+
+	unsigned long cd_offset = zip.size();
+	zip += cd;
+	put32(zip, 0x06054b50);
+	put32(zip, 0);
+	put16(zip, files.size());
+	put16(zip, files.size());
+	put32(zip, cd.size());
+	put32(zip, cd_offset);
+	put16(zip, 0);
+
+	std::ofstream f(path, std::ios::binary);
+	f << zip;
+}
+
+class ResumeManifestTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(ResumeManifestTest);
+CPPUNIT_TEST(testResume01);
+CPPUNIT_TEST(testIntact01);
+CPPUNIT_TEST(testHash01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::filesystem::path path_dir;
+
+		void setUp() {
+			path_dir = std::filesystem::temp_directory_path() / "cm_vsm_test_manifest";
+			std::filesystem::remove_all(path_dir);
+		}
+
+		void tearDown() {
+			std::filesystem::remove_all(path_dir);
+		}
+
+		void testResume01() {
+			std::filesystem::path path_nc = path_dir / "tile_1_2.nc";
+			{
+				ResumeManifest manifest;
+				CPPUNIT_ASSERT(manifest.open(path_dir));
+				CPPUNIT_ASSERT(!manifest.existed());
+				std::ofstream(path_nc, std::ios::binary) << "layers";
+				CPPUNIT_ASSERT(manifest.add(1, 2, "B02", 10, path_nc));
+				CPPUNIT_ASSERT(manifest.add(1, 2, "SCL", 20, path_nc));
+				CPPUNIT_ASSERT(manifest.add(1, 2, "B02", 11, path_nc));
+				CPPUNIT_ASSERT(!manifest.add(3, 4, "B03", 0, path_dir / "tile_3_4.nc"));
+				CPPUNIT_ASSERT(manifest.has(1, 2, "B02", 11) && !manifest.has(1, 2, "B02", 10));
+			}
+
+			// An interrupted run may leave a partial line behind.
+			{
+				std::ofstream f(path_dir / ResumeManifest::file_name, std::ios::binary | std::ios::app);
+				f << "3 4 B03 00000000";
+			}
+
+			ResumeManifest manifest;
+			CPPUNIT_ASSERT(manifest.open(path_dir));
+			CPPUNIT_ASSERT(manifest.existed());
+			CPPUNIT_ASSERT(manifest.size() == 2);
+			CPPUNIT_ASSERT(manifest.has(1, 2, "B02", 11));
+			CPPUNIT_ASSERT(manifest.has(1, 2, "SCL", 20));
+			CPPUNIT_ASSERT(!manifest.has(3, 4, "B03", 0));
+			CPPUNIT_ASSERT(!manifest.has(2, 1, "B02", 11));
+			CPPUNIT_ASSERT(manifest.is_intact(1, 2, path_nc));
+
+			// The manifest has been compacted.
+			std::ifstream f(path_dir / ResumeManifest::file_name);
+			std::string content((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+			CPPUNIT_ASSERT(std::count(content.begin(), content.end(), '\n') == 2);
+		}
+
+		void testIntact01() {
+			std::filesystem::path path_nc = path_dir / "tile_1_2.nc";
+			{
+				ResumeManifest manifest;
+				CPPUNIT_ASSERT(manifest.open(path_dir));
+				std::ofstream(path_nc, std::ios::binary) << "layers";
+				CPPUNIT_ASSERT(manifest.add(1, 2, "B02", 10, path_nc));
+			}
+
+			// A file which has changed since, or has been removed, isn't trusted.
+			std::ofstream(path_nc, std::ios::binary | std::ios::app) << ", half";
+			ResumeManifest manifest;
+			CPPUNIT_ASSERT(manifest.open(path_dir));
+			CPPUNIT_ASSERT(manifest.has(1, 2, "B02", 10));
+			CPPUNIT_ASSERT(!manifest.is_intact(1, 2, path_nc));
+			std::filesystem::remove(path_nc);
+			CPPUNIT_ASSERT(!manifest.is_intact(1, 2, path_nc));
+			CPPUNIT_ASSERT(!manifest.is_intact(2, 1, path_nc));
+
+			// Entries of the earlier versions are kept, but their files are always probed.
+			std::ofstream(path_nc, std::ios::binary) << "layers";
+			{
+				std::ofstream f(path_dir / ResumeManifest::file_name, std::ios::binary | std::ios::app);
+				f << "1 2 SCL 0000000000000014\n";
+			}
+			ResumeManifest manifest_old;
+			CPPUNIT_ASSERT(manifest_old.open(path_dir));
+			CPPUNIT_ASSERT(manifest_old.has(1, 2, "SCL", 20));
+			CPPUNIT_ASSERT(!manifest_old.is_intact(1, 2, path_nc));
+		}
+
+		void testHash01() {
+			CPPUNIT_ASSERT(ResumeManifest::hash("") == 0xcbf29ce484222325ULL);
+			CPPUNIT_ASSERT(ResumeManifest::hash("a") == 0xaf63dc4c8601ec8cULL);
+		}
+};
+
+class StagedFileTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(StagedFileTest);
+CPPUNIT_TEST(testPublish01);
+CPPUNIT_TEST(testDiscard01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::filesystem::path path_dir;
+
+		void setUp() {
+			path_dir = std::filesystem::temp_directory_path() / "cm_vsm_test_staged";
+			std::filesystem::remove_all(path_dir);
+			std::filesystem::create_directories(path_dir / "staging");
+		}
+
+		void tearDown() {
+			std::filesystem::remove_all(path_dir);
+		}
+
+		std::string read(const std::filesystem::path &path) {
+			std::ifstream f(path, std::ios::binary);
+			return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+		}
+
+		void testPublish01() {
+			std::filesystem::path path = path_dir / "bands.nc";
+			{
+				StagedFile staged(path, path_dir / "staging");
+				CPPUNIT_ASSERT(staged.begin());
+				CPPUNIT_ASSERT(!staged.target_existed());
+				std::ofstream(staged.get_path(), std::ios::binary) << "first";
+				CPPUNIT_ASSERT(!std::filesystem::exists(path));
+				CPPUNIT_ASSERT(staged.publish());
+			}
+			CPPUNIT_ASSERT(read(path) == "first");
+
+			// The staging copy starts with the content of the target.
+			StagedFile staged(path);
+			CPPUNIT_ASSERT(staged.begin());
+			CPPUNIT_ASSERT(staged.target_existed());
+			CPPUNIT_ASSERT(read(staged.get_path()) == "first");
+			std::ofstream(staged.get_path(), std::ios::binary | std::ios::app) << ", second";
+			CPPUNIT_ASSERT(read(path) == "first");
+			CPPUNIT_ASSERT(staged.publish());
+			CPPUNIT_ASSERT(read(path) == "first, second");
+			CPPUNIT_ASSERT(!std::filesystem::exists(staged.get_path()));
+			CPPUNIT_ASSERT(std::filesystem::is_empty(path_dir / "staging"));
+		}
+
+		void testDiscard01() {
+			std::filesystem::path path = path_dir / "bands.nc";
+			std::ofstream(path, std::ios::binary) << "old";
+			std::filesystem::path path_staged;
+			{
+				// Interrupted before publishing.
+				StagedFile staged(path, path_dir / "staging");
+				CPPUNIT_ASSERT(staged.begin());
+				path_staged = staged.get_path();
+				std::ofstream(path_staged, std::ios::binary) << "half";
+			}
+			CPPUNIT_ASSERT(read(path) == "old");
+			CPPUNIT_ASSERT(!std::filesystem::exists(path_staged));
+		}
+};
+
+class StageStatsTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(StageStatsTest);
+CPPUNIT_TEST(testPercentile01);
+CPPUNIT_TEST(testSubtiles01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void testPercentile01() {
+			CPPUNIT_ASSERT(StageStats::percentile({}, 50) == 0);
+			CPPUNIT_ASSERT(StageStats::percentile({7}, 95) == 7);
+			std::vector<uint32_t> samples;
+			for (uint32_t i=100; i>0; i--)
+				samples.push_back(i);
+			CPPUNIT_ASSERT(StageStats::percentile(samples, 50) == 50);
+			CPPUNIT_ASSERT(StageStats::percentile(samples, 95) == 95);
+			CPPUNIT_ASSERT(StageStats::percentile(samples, 100) == 100);
+		}
+
+		void testSubtiles01() {
+			// Without current statistics, the timers have no effect.
+			CPPUNIT_ASSERT(StageStats::get_current() == nullptr);
+			{
+				StageTimer timer(StageStats::ST_DECODE, 10);
+			}
+
+			StageStats stats;
+			{
+				StageStats::Scope scope(stats);
+				CPPUNIT_ASSERT(StageStats::get_current() == &stats);
+				// Time outside of the sub-tiles counts towards the totals only.
+				stats.add(StageStats::ST_DIRECTORIES, 5000000, 0);
+				for (int i=1; i<=4; i++) {
+					stats.begin_subtile();
+					{
+						StageTimer timer(StageStats::ST_DECODE, 100);
+					}
+					stats.add(StageStats::ST_NC_WRITE, i * 1000000, 1000);
+					stats.end_subtile();
+				}
+			}
+			CPPUNIT_ASSERT(StageStats::get_current() == nullptr);
+
+			CPPUNIT_ASSERT(stats.get_num_subtiles() == 4);
+			CPPUNIT_ASSERT(stats.get_count(StageStats::ST_DECODE) == 4);
+			CPPUNIT_ASSERT(stats.get_bytes(StageStats::ST_DECODE) == 400);
+			CPPUNIT_ASSERT(stats.get_ns(StageStats::ST_NC_WRITE) == 10000000);
+
+			StageStats total;
+			total.merge(stats);
+			total.merge(stats);
+			CPPUNIT_ASSERT(total.get_num_subtiles() == 8);
+			CPPUNIT_ASSERT(total.get_bytes(StageStats::ST_NC_WRITE) == 8000);
+
+			nlohmann::json j = stats.to_json();
+			CPPUNIT_ASSERT(j["subtiles"] == 4);
+			CPPUNIT_ASSERT(j["stages"]["nc_write"]["p50_ms"] == 2.0);
+			CPPUNIT_ASSERT(j["stages"]["nc_write"]["p95_ms"] == 4.0);
+			CPPUNIT_ASSERT(!j["stages"]["directories"].contains("p50_ms"));
+			CPPUNIT_ASSERT(!j["stages"].contains("png"));
+		}
+};
+
+class WorkerArenaTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(WorkerArenaTest);
+CPPUNIT_TEST(testReuse01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void testReuse01() {
+			StageStats stats;
+			WorkerArena *arena_thread = nullptr;
+			size_t capacity_new = 1, capacity_reserved = 0, capacity_trimmed = 1, capacity_kept = 0, capacity_released = 1;
+			float *a = nullptr, *b = nullptr, *c = nullptr, *d = nullptr;
+			// A new thread starts with an empty arena. Assertions which fail within it would terminate the runner.
+			std::thread t([&] {
+				StageStats::Scope scope(stats);
+				WorkerArena &arena = WorkerArena::get_current();
+				arena_thread = &arena;
+				capacity_new = arena.get_capacity(WorkerArena::SLOT_PLANES);
+
+				a = arena.get<float>(WorkerArena::SLOT_PLANES, 1000);
+				b = arena.get<float>(WorkerArena::SLOT_PLANES, 500);
+				c = arena.get<float>(WorkerArena::SLOT_PLANES, 1000);
+				d = arena.get<float>(WorkerArena::SLOT_PLANES, 2000);
+				d[1999] = 1.0f;
+
+				// Reserving room which is already there isn't counted.
+				arena.reserve(WorkerArena::SLOT_FUSED, 64);
+				arena.reserve(WorkerArena::SLOT_FUSED, 32);
+				capacity_reserved = arena.get_capacity(WorkerArena::SLOT_FUSED);
+
+				// Only the buffers beyond the limit are trimmed.
+				arena.trim(1000 * sizeof(float));
+				capacity_trimmed = arena.get_capacity(WorkerArena::SLOT_PLANES);
+				capacity_kept = arena.get_capacity(WorkerArena::SLOT_FUSED);
+
+				arena.release();
+				capacity_released = arena.get_capacity(WorkerArena::SLOT_PLANES);
+			});
+			t.join();
+			CPPUNIT_ASSERT(arena_thread != nullptr && arena_thread != &WorkerArena::get_current());
+			CPPUNIT_ASSERT(capacity_new == 0);
+			CPPUNIT_ASSERT(a != nullptr && b == a && c == a && d != nullptr);
+			CPPUNIT_ASSERT(capacity_reserved >= 64);
+			CPPUNIT_ASSERT(capacity_trimmed == 0 && capacity_kept == capacity_reserved);
+			CPPUNIT_ASSERT(capacity_released == 0);
+
+			CPPUNIT_ASSERT(stats.get_allocations(StageStats::AL_BUFFER) == 3);
+			CPPUNIT_ASSERT(stats.get_reuses(StageStats::AL_BUFFER) == 2);
+			CPPUNIT_ASSERT(stats.get_allocations(StageStats::AL_IMAGE) == 0);
+
+			nlohmann::json j = stats.to_json();
+			CPPUNIT_ASSERT(j["allocations"]["buffers"]["allocations"] == 3);
+			CPPUNIT_ASSERT(j["allocations"]["buffers"]["reuses"] == 2);
+			CPPUNIT_ASSERT(j["allocations"]["buffers"]["allocated_bytes"] >= 3000 * sizeof(float) + 64);
+			CPPUNIT_ASSERT(!j["allocations"].contains("images"));
+		}
+};
+
+class MetricsExporterTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(MetricsExporterTest);
+CPPUNIT_TEST(testFormat01);
+CPPUNIT_TEST(testExport01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::filesystem::path path;
+
+		void setUp() {
+			path = std::filesystem::temp_directory_path() / "cm_vsm_test_metrics.prom";
+			std::filesystem::remove(path);
+		}
+
+		void tearDown() {
+			std::filesystem::remove(path);
+		}
+
+		void testFormat01() {
+			std::ostringstream ss;
+			MetricsExporter::write_metric(ss, "cm_vsm_subtiles_stored_total", "counter", "Stored sub-tiles.", 12345678901.0);
+			MetricsExporter::write_header(ss, "cm_vsm_stage_seconds_total", "counter", "Time per stage.");
+			MetricsExporter::write_sample(ss, "cm_vsm_stage_seconds_total", 0.25, "stage=\"decode\"");
+			MetricsExporter::write_sample(ss, "cm_vsm_eta_seconds", std::nan(""));
+			CPPUNIT_ASSERT(ss.str() ==
+				"# HELP cm_vsm_subtiles_stored_total Stored sub-tiles.\n"
+				"# TYPE cm_vsm_subtiles_stored_total counter\n"
+				"cm_vsm_subtiles_stored_total 12345678901\n"
+				"# HELP cm_vsm_stage_seconds_total Time per stage.\n"
+				"# TYPE cm_vsm_stage_seconds_total counter\n"
+				"cm_vsm_stage_seconds_total{stage=\"decode\"} 0.25\n"
+				"cm_vsm_eta_seconds NaN\n");
+		}
+
+		void testExport01() {
+			std::atomic<int> n(0);
+			{
+				MetricsExporter exporter;
+				CPPUNIT_ASSERT(exporter.start(path, 60, [&n](std::ostream &os) {
+					MetricsExporter::write_metric(os, "cm_vsm_test", "gauge", "Number of updates.", ++n);
+				}));
+				CPPUNIT_ASSERT(!exporter.start(path, 60, [](std::ostream &) {}));
+			}
+			// Written when started, and once more when stopped.
+			CPPUNIT_ASSERT(n == 2);
+			std::ifstream f(path);
+			std::string content((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+			CPPUNIT_ASSERT(content.find("cm_vsm_test 2\n") != std::string::npos);
+			CPPUNIT_ASSERT(!std::filesystem::exists(path.string() + ".tmp"));
+			CPPUNIT_ASSERT(MetricsExporter::get_max_rss() > 0);
+		}
+};
+
+class ProductScanTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(ProductScanTest);
+CPPUNIT_TEST(testScanL2A01);
+CPPUNIT_TEST(testScanZip01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::filesystem::path path_product;
+		std::filesystem::path path_zip;
+
+		void touch(const std::string &rel) {
+			std::filesystem::path p = path_product / rel;
+			std::filesystem::create_directories(p.parent_path());
+			std::ofstream f(p);
+			f << "0";
+		}
+
+		void setUp() {
+			path_product = std::filesystem::temp_directory_path() / "cm_vsm_test_S2A_MSIL2A_20200529T094041_N0214_R036_T35VLF_20200529T120441.SAFE";
+			std::filesystem::remove_all(path_product);
+
+			touch("GRANULE/L2A_T35VLF_A025695_20200529T094041/IMG_DATA/R10m/T35VLF_20200529T094041_TCI_10m.jp2");
+			touch("GRANULE/L2A_T35VLF_A025695_20200529T094041/IMG_DATA/R10m/T35VLF_20200529T094041_B02_10m.jp2");
+			touch("GRANULE/L2A_T35VLF_A025695_20200529T094041/IMG_DATA/R20m/T35VLF_20200529T094041_B02_20m.jp2");
+			touch("GRANULE/L2A_T35VLF_A025695_20200529T094041/IMG_DATA/R20m/T35VLF_20200529T094041_SCL_20m.jp2");
+			touch("GRANULE/L2A_T35VLF_A025695_20200529T094041/QI_DATA/MSK_CLDPRB_20m.jp2");
+			touch("GRANULE/L2A_T35VLF_A025695_20200529T094041/MAJA_DATA/T35VLF_CLM_R1.tif");
+			touch("GRANULE/L2A_T35VLF_A025695_20200529T094041/MAJA_DATA/T35VLF_CLM_R2.tif");
+			touch("ref_dataset/Classification/classification_map.tif");
+			touch("AUX_DATA/T35VLF_B02.jp2");
+		}
+
+		void tearDown() {
+			std::filesystem::remove_all(path_product);
+			if (!path_zip.empty())
+				std::filesystem::remove(path_zip);
+		}
+
+		void testScanL2A01() {
+			std::vector<ESA_S2_Band> bands = ESA_S2_Image::scan_product(path_product);
+
+			CPPUNIT_ASSERT(bands.size() == 6);
+			CPPUNIT_ASSERT(bands[0].data_type == ESA_S2_Image_Operator::DT_TCI);
+			CPPUNIT_ASSERT(bands[1].data_type == ESA_S2_Image_Operator::DT_B02);
+			CPPUNIT_ASSERT(bands[1].data_resolution == ESA_S2_Image_Operator::DR_10M);
+			// MAJA cloud mask at 10 m is preferred over the one at 20 m.
+			CPPUNIT_ASSERT(bands[2].data_type == ESA_S2_Image_Operator::DT_MAJAC);
+			CPPUNIT_ASSERT(bands[2].data_resolution == ESA_S2_Image_Operator::DR_10M);
+			CPPUNIT_ASSERT(bands[2].format == ESA_S2_Band::RF_TIF);
+			CPPUNIT_ASSERT(bands[3].data_type == ESA_S2_Image_Operator::DT_SCL);
+			CPPUNIT_ASSERT(bands[4].data_type == ESA_S2_Image_Operator::DT_S2CC);
+			CPPUNIT_ASSERT(bands[5].data_type == ESA_S2_Image_Operator::DT_BHC);
+			CPPUNIT_ASSERT(bands[5].data_resolution == ESA_S2_Image_Operator::DR_60M);
+		}
+
+		void testScanZip01() {
+			// The same product, zipped with the .SAFE directory at the top.
+			std::vector<std::pair<std::string, std::string>> files;
+			std::filesystem::recursive_directory_iterator it(path_product);
+			for (; it != std::filesystem::recursive_directory_iterator(); it++) {
+				if (it->is_regular_file())
+					files.emplace_back((path_product.filename() / it->path().lexically_relative(path_product)).string(), "0");
+			}
+			path_zip = path_product.string() + ".zip";
+			write_zip(path_zip, files, true);
+
+			std::vector<ESA_S2_Band> bands = ESA_S2_Image::scan_product(path_zip);
+
+			CPPUNIT_ASSERT(bands.size() == 6);
+			CPPUNIT_ASSERT(bands[0].data_type == ESA_S2_Image_Operator::DT_TCI);
+			CPPUNIT_ASSERT(bands[2].data_type == ESA_S2_Image_Operator::DT_MAJAC);
+			CPPUNIT_ASSERT(bands[2].data_resolution == ESA_S2_Image_Operator::DR_10M);
+			CPPUNIT_ASSERT(bands[5].data_type == ESA_S2_Image_Operator::DT_BHC);
+			CPPUNIT_ASSERT(ZipArchive::is_member_path(bands[1].path));
+			CPPUNIT_ASSERT(bands[1].file_size == 1);
+
+			std::vector<unsigned char> data;
+			CPPUNIT_ASSERT(ZipArchive::read_member(bands[1].path, data));
+			CPPUNIT_ASSERT(data.size() == 1 && data[0] == '0');
+		}
+};
+
+class ZipArchiveTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(ZipArchiveTest);
+CPPUNIT_TEST(testMemberPath01);
+CPPUNIT_TEST(testStored01);
+CPPUNIT_TEST(testDeflatedSeek01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::filesystem::path path_stored;
+		std::filesystem::path path_deflated;
+		std::string data;
+
+		void setUp() {
+			// Data which doesn't compress to nothing, but spans several inflate buffers.
+			data.resize(300000);
+			unsigned int v = 1;
+			for (size_t i = 0; i < data.size(); i++) {
+				v = v * 1103515245 + 12345;
+				data[i] = (char) ((v >> 16) & 0x0f);
+			}
+
+			std::vector<std::pair<std::string, std::string>> files = {{"P.SAFE/", ""}, {"P.SAFE/small.txt", "hello"}, {"P.SAFE/big.bin", data}};
+			path_stored = std::filesystem::temp_directory_path() / "cm_vsm_test_stored.zip";
+			path_deflated = std::filesystem::temp_directory_path() / "cm_vsm_test_deflated.zip";
+			write_zip(path_stored, files, false);
+			write_zip(path_deflated, files, true);
+		}
+
+		void tearDown() {
+			std::filesystem::remove(path_stored);
+			std::filesystem::remove(path_deflated);
+		}
+
+		void testMemberPath01() {
+			std::filesystem::path p = ZipArchive::make_member_path("/data/P.SAFE.zip", "P.SAFE/GRANULE/B02.jp2");
+			CPPUNIT_ASSERT(p == "/vsizip//data/P.SAFE.zip/P.SAFE/GRANULE/B02.jp2");
+			CPPUNIT_ASSERT(ZipArchive::is_member_path(p));
+			CPPUNIT_ASSERT(!ZipArchive::is_member_path("/data/P.SAFE/GRANULE/B02.jp2"));
+
+			std::filesystem::path path_zip;
+			std::string name;
+			CPPUNIT_ASSERT(ZipArchive::split_member_path(p, path_zip, name));
+			CPPUNIT_ASSERT(path_zip == "/data/P.SAFE.zip");
+			CPPUNIT_ASSERT(name == "P.SAFE/GRANULE/B02.jp2");
+		}
+
+		void testStored01() {
+			ZipArchive archive;
+			CPPUNIT_ASSERT(archive.open(path_stored));
+			CPPUNIT_ASSERT(archive.get_entries().size() == 3);
+			CPPUNIT_ASSERT(archive.get_entries()[0].is_directory());
+			const ZipArchive::Entry *e = archive.find("P.SAFE/big.bin");
+			CPPUNIT_ASSERT(e != nullptr && e->method == 0 && e->size == data.size());
+			CPPUNIT_ASSERT(archive.find("P.SAFE/missing.bin") == nullptr);
+
+			ZipMemberReader reader;
+			CPPUNIT_ASSERT(reader.open(ZipArchive::make_member_path(path_stored, "P.SAFE/small.txt")));
+			char buf[16];
+			CPPUNIT_ASSERT(reader.read(buf, sizeof(buf)) == 5);
+			CPPUNIT_ASSERT(std::string(buf, 5) == "hello");
+			CPPUNIT_ASSERT(reader.seek(1) && reader.read(buf, 2) == 2 && std::string(buf, 2) == "el");
+		}
+
+		void testDeflatedSeek01() {
+			std::shared_ptr<const ZipArchive> archive = ZipArchive::get(path_deflated);
+			CPPUNIT_ASSERT(archive != nullptr);
+			CPPUNIT_ASSERT(archive->find("P.SAFE/big.bin")->method == 8);
+
+			ZipMemberReader reader;
+			CPPUNIT_ASSERT(reader.open(ZipArchive::make_member_path(path_deflated, "P.SAFE/big.bin")));
+			CPPUNIT_ASSERT(reader.size() == data.size());
+
+			// Forward, backward and past the end.
+			std::vector<char> buf(1000);
+			size_t offsets[] = {250000, 10, 150000, 299500};
+			for (size_t offset: offsets) {
+				CPPUNIT_ASSERT(reader.seek(offset));
+				size_t n = reader.read(buf.data(), buf.size());
+				CPPUNIT_ASSERT(n == std::min<size_t>(buf.size(), data.size() - offset));
+				CPPUNIT_ASSERT(std::string(buf.data(), n) == data.substr(offset, n));
+			}
+			CPPUNIT_ASSERT(reader.tell() == data.size());
+			CPPUNIT_ASSERT(reader.read(buf.data(), buf.size()) == 0);
+
+			std::vector<unsigned char> whole;
+			CPPUNIT_ASSERT(ZipArchive::read_member(ZipArchive::make_member_path(path_deflated, "P.SAFE/big.bin"), whole));
+			CPPUNIT_ASSERT(std::string(whole.begin(), whole.end()) == data);
+		}
+};
+
+class GDALImageTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(GDALImageTest);
+CPPUNIT_TEST(testWindow01);
+CPPUNIT_TEST(testEdge01);
+CPPUNIT_TEST(testOutOfRange01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::filesystem::path path_tif;
+
+		void setUp() {
+			GDALAllRegister();
+			path_tif = std::filesystem::temp_directory_path() / "cm_vsm_test_gdal.tif";
+
+			// 20x15 pixels of 16 bits, with the value 100 * y + x, on a 10 m grid.
+			GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+			CPPUNIT_ASSERT(driver != nullptr);
+			GDALDataset *dataset = driver->Create(path_tif.c_str(), 20, 15, 1, GDT_UInt16, nullptr);
+			CPPUNIT_ASSERT(dataset != nullptr);
+			double transform[6] = {600000.0, 10.0, 0.0, 6500000.0, 0.0, -10.0};
+			dataset->SetGeoTransform(transform);
+			std::vector<uint16_t> px(20 * 15);
+			for (unsigned int y = 0; y < 15; y++)
+				for (unsigned int x = 0; x < 20; x++)
+					px[y * 20 + x] = 100 * y + x;
+			CPPUNIT_ASSERT(dataset->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, 20, 15, px.data(), 20, 15, GDT_UInt16, 0, 0) == CE_None);
+			GDALClose(dataset);
+		}
+
+		void tearDown() {
+			std::filesystem::remove(path_tif);
+		}
+
+		/**
+		 * @return Sample of a pixel, scaled back into the 16-bit range of the raster.
+		 */
+		static unsigned int get_sample(const GDAL_Image &img, unsigned int x, unsigned int y) {
+			const Magick::PixelPacket *px = img.subset->getConstPixels(x, y, 1, 1);
+			return (unsigned int) lround(65535.0 * px->green / MaxRGB);
+		}
+
+		void testWindow01() {
+			GDAL_Image img;
+			CPPUNIT_ASSERT(img.load_header(path_tif));
+			CPPUNIT_ASSERT(img.main_geometry.width() == 20 && img.main_geometry.height() == 15);
+			CPPUNIT_ASSERT(img.main_num_components == 1 && img.main_depth == 16);
+
+			CPPUNIT_ASSERT(img.load_subset(path_tif, 4, 3, 10, 8));
+			CPPUNIT_ASSERT(img.subset->columns() == 6 && img.subset->rows() == 5);
+			for (unsigned int y = 0; y < 5; y++)
+				for (unsigned int x = 0; x < 6; x++)
+					CPPUNIT_ASSERT(get_sample(img, x, y) == 100 * (y + 3) + x + 4);
+
+			// Resampled by GDAL into a smaller square, and back to the original size on the next load.
+			CPPUNIT_ASSERT(img.load_subset(path_tif, 0, 0, 8, 8, 4, "point"));
+			CPPUNIT_ASSERT(img.subset->columns() == 4 && img.scaling_factor == 0.5f);
+			CPPUNIT_ASSERT(img.load_subset(path_tif, 0, 0, 8, 8));
+			CPPUNIT_ASSERT(img.subset->columns() == 8 && img.scaling_factor == 1.0f);
+		}
+
+		void testEdge01() {
+			// The part of the window outside of the raster is left at 0.
+			GDAL_Image img;
+			CPPUNIT_ASSERT(img.load_subset(path_tif, 16, 12, 24, 20));
+			CPPUNIT_ASSERT(img.subset->columns() == 8 && img.subset->rows() == 8);
+			for (unsigned int y = 0; y < 8; y++) {
+				for (unsigned int x = 0; x < 8; x++) {
+					unsigned int expected = (x + 16 < 20 && y + 12 < 15) ? 100 * (y + 12) + x + 16 : 0;
+					CPPUNIT_ASSERT(get_sample(img, x, y) == expected);
+				}
+			}
+		}
+
+		void testOutOfRange01() {
+			GDAL_Image img;
+			CPPUNIT_ASSERT(!img.load_subset(path_tif, 20, 0, 28, 8));
+			CPPUNIT_ASSERT(!img.load_subset(path_tif, 0, 15, 8, 23));
+			CPPUNIT_ASSERT(!img.load_subset(path_tif, 8, 8, 8, 12));
+			CPPUNIT_ASSERT(!img.load_subset(std::filesystem::temp_directory_path() / "cm_vsm_test_gdal_missing.tif", 0, 0, 8, 8));
+		}
+};
+
+class TIFWindowReaderTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(TIFWindowReaderTest);
+CPPUNIT_TEST(testStripsContig01);
+CPPUNIT_TEST(testTilesSeparate01);
+CPPUNIT_TEST(testTilesContigInt01);
+CPPUNIT_TEST(testScales01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::filesystem::path path_tif;
+
+		void setUp() {
+			path_tif = std::filesystem::temp_directory_path() / "cm_vsm_test_window.tif";
+		}
+
+		void tearDown() {
+			std::filesystem::remove(path_tif);
+		}
+
+		TIFF *create_tif(unsigned int w, unsigned int h, unsigned int spp, unsigned int bps, unsigned int fmt, unsigned int planar) {
+			TIFF *ptif = TIFFOpen(path_tif.c_str(), "w");
+			TIFFSetField(ptif, TIFFTAG_IMAGEWIDTH, w);
+			TIFFSetField(ptif, TIFFTAG_IMAGELENGTH, h);
+			TIFFSetField(ptif, TIFFTAG_SAMPLESPERPIXEL, spp);
+			TIFFSetField(ptif, TIFFTAG_BITSPERSAMPLE, bps);
+			TIFFSetField(ptif, TIFFTAG_SAMPLEFORMAT, fmt);
+			TIFFSetField(ptif, TIFFTAG_PLANARCONFIG, planar);
+			TIFFSetField(ptif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+			TIFFSetField(ptif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+			return ptif;
+		}
+
+		void testStripsContig01() {
+			// 10x7 pixels, 3 channels of 16 bits, 3 rows per strip.
+			TIFF *ptif = create_tif(10, 7, 3, 16, SAMPLEFORMAT_UINT, PLANARCONFIG_CONTIG);
+			TIFFSetField(ptif, TIFFTAG_ROWSPERSTRIP, 3);
+			for (unsigned int s = 0; s < 3; s++) {
+				std::vector<uint16_t> strip(10 * 3 * 3, 0);
+				for (unsigned int y = 0; y < 3; y++)
+					for (unsigned int x = 0; x < 10; x++)
+						for (unsigned int c = 0; c < 3; c++)
+							strip[(y * 10 + x) * 3 + c] = 1000 * c + 10 * (s * 3 + y) + x;
+				unsigned int rows = s < 2 ? 3 : 1;
+				TIFFWriteEncodedStrip(ptif, s, strip.data(), rows * 10 * 3 * sizeof(uint16_t));
+			}
+			TIFFClose(ptif);
+
+			TIFWindowReader reader;
+			CPPUNIT_ASSERT(reader.open(path_tif));
+			CPPUNIT_ASSERT(reader.width == 10 && reader.height == 7 && reader.num_channels == 3);
+
+			// Window 2..9 x 1..6, channels 2 and 1.
+			std::vector<float> a(7 * 5), b(7 * 5);
+			float *dst[2] = {a.data(), b.data()};
+			unsigned int channels[2] = {2, 1};
+			CPPUNIT_ASSERT(reader.read_window(2, 1, 9, 6, channels, 2, dst));
+
+			for (unsigned int y = 0; y < 5; y++) {
+				for (unsigned int x = 0; x < 7; x++) {
+					unsigned int v = 10 * (y + 1) + x + 2;
+					CPPUNIT_ASSERT(fabs(a[y * 7 + x] - (2000 + v) / 65535.0f) < 1e-7);
+					CPPUNIT_ASSERT(fabs(b[y * 7 + x] - (1000 + v) / 65535.0f) < 1e-7);
+				}
+			}
+		}
+
+		void testTilesSeparate01() {
+			// 40x40 pixels, 2 planes of 32-bit floats, 16x16 tiles.
+			TIFF *ptif = create_tif(40, 40, 2, 32, SAMPLEFORMAT_IEEEFP, PLANARCONFIG_SEPARATE);
+			TIFFSetField(ptif, TIFFTAG_TILEWIDTH, 16);
+			TIFFSetField(ptif, TIFFTAG_TILELENGTH, 16);
+			unsigned int index = 0;
+			for (unsigned int c = 0; c < 2; c++) {
+				for (unsigned int ty = 0; ty < 48; ty += 16) {
+					for (unsigned int tx = 0; tx < 48; tx += 16) {
+						std::vector<float> tile(16 * 16, 0.0f);
+						for (unsigned int y = 0; y < 16; y++)
+							for (unsigned int x = 0; x < 16; x++)
+								tile[y * 16 + x] = c + (ty + y) * 0.01f + (tx + x) * 0.0001f;
+						TIFFWriteEncodedTile(ptif, index++, tile.data(), tile.size() * sizeof(float));
+					}
+				}
+			}
+			TIFFClose(ptif);
+
+			TIFWindowReader reader(2);
+			CPPUNIT_ASSERT(reader.open(path_tif));
+			CPPUNIT_ASSERT(reader.tiled && reader.planar_separate);
+
+			// Window reaching 10 pixels past the right edge.
+			std::vector<float> a(40 * 20);
+			float *dst[1] = {a.data()};
+			unsigned int channels[1] = {1};
+			CPPUNIT_ASSERT(reader.read_window(10, 10, 50, 30, channels, 1, dst));
+
+			for (unsigned int y = 0; y < 20; y++) {
+				for (unsigned int x = 0; x < 40; x++) {
+					float expected = 0.0f;
+					if (x + 10 < 40)
+						expected = 1 + (y + 10) * 0.01f + (x + 10) * 0.0001f;
+					CPPUNIT_ASSERT(fabs(a[y * 40 + x] - expected) < 1e-6);
+				}
+			}
+		}
+
+		void testTilesContigInt01() {
+			// 32x32 pixels, 4 channels of signed 16-bit integers, 16x16 tiles.
+			TIFF *ptif = create_tif(32, 32, 4, 16, SAMPLEFORMAT_INT, PLANARCONFIG_CONTIG);
+			TIFFSetField(ptif, TIFFTAG_TILEWIDTH, 16);
+			TIFFSetField(ptif, TIFFTAG_TILELENGTH, 16);
+			unsigned int index = 0;
+			for (unsigned int ty = 0; ty < 32; ty += 16) {
+				for (unsigned int tx = 0; tx < 32; tx += 16) {
+					std::vector<int16_t> tile(16 * 16 * 4);
+					for (unsigned int y = 0; y < 16; y++)
+						for (unsigned int x = 0; x < 16; x++)
+							for (unsigned int c = 0; c < 4; c++)
+								tile[(y * 16 + x) * 4 + c] = (c == 0 ? -1 : 1) * (int) ((ty + y) * 100 + tx + x);
+					TIFFWriteEncodedTile(ptif, index++, tile.data(), tile.size() * sizeof(int16_t));
+				}
+			}
+			TIFFClose(ptif);
+
+			TIFWindowReader reader;
+			CPPUNIT_ASSERT(reader.open(path_tif));
+
+			// Window across all 4 tiles, negative values of channel 0 are clamped to 0.
+			std::vector<float> a(12 * 12), b(12 * 12);
+			float *dst[2] = {a.data(), b.data()};
+			unsigned int channels[2] = {0, 3};
+			CPPUNIT_ASSERT(reader.read_window(10, 10, 22, 22, channels, 2, dst));
+
+			for (unsigned int y = 0; y < 12; y++) {
+				for (unsigned int x = 0; x < 12; x++) {
+					CPPUNIT_ASSERT(a[y * 12 + x] == 0.0f);
+					CPPUNIT_ASSERT(fabs(b[y * 12 + x] - ((y + 10) * 100 + x + 10) / 32767.0f) < 1e-7);
+				}
+			}
+		}
+
+		void testScales01() {
+			// 8x4 pixels, 5 channels of 32-bit floats in a single strip.
+			TIFF *ptif = create_tif(8, 4, 5, 32, SAMPLEFORMAT_IEEEFP, PLANARCONFIG_CONTIG);
+			TIFFSetField(ptif, TIFFTAG_ROWSPERSTRIP, 4);
+			std::vector<float> strip(8 * 4 * 5);
+			for (unsigned int i = 0; i < 8 * 4; i++)
+				for (unsigned int c = 0; c < 5; c++)
+					strip[i * 5 + c] = c + i * 0.5f;
+			TIFFWriteEncodedStrip(ptif, 0, strip.data(), strip.size() * sizeof(float));
+			TIFFClose(ptif);
+
+			TIFWindowReader reader;
+			CPPUNIT_ASSERT(reader.open(path_tif));
+
+			// Three channels, deinterleaved and scaled in one pass.
+			std::vector<float> a(6 * 2), b(6 * 2), c(6 * 2);
+			float *dst[3] = {a.data(), b.data(), c.data()};
+			unsigned int channels[3] = {4, 0, 2};
+			float scales[3] = {0.25f, 2.0f, 1.0f};
+			CPPUNIT_ASSERT(reader.read_window(1, 1, 7, 3, channels, 3, dst, scales));
+
+			for (unsigned int y = 0; y < 2; y++) {
+				for (unsigned int x = 0; x < 6; x++) {
+					float v = ((y + 1) * 8 + x + 1) * 0.5f;
+					CPPUNIT_ASSERT(fabs(a[y * 6 + x] - (4 + v) * 0.25f) < 1e-6);
+					CPPUNIT_ASSERT(fabs(b[y * 6 + x] - v * 2.0f) < 1e-6);
+					CPPUNIT_ASSERT(fabs(c[y * 6 + x] - (2 + v)) < 1e-6);
+				}
+			}
+		}
+};
+
+class PNGRowReaderTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(PNGRowReaderTest);
+CPPUNIT_TEST(testRowMajor01);
+CPPUNIT_TEST(testRestart01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::filesystem::path path_png;
+
+		void setUp() {
+			// 20x30 pixels, 16-bit grayscale.
+			path_png = std::filesystem::temp_directory_path() / "cm_vsm_test_rows.png";
+			FILE *fp = fopen(path_png.c_str(), "wb");
+			png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+			png_infop info = png_create_info_struct(png);
+			png_init_io(png, fp);
+			png_set_IHDR(png, info, 20, 30, 16, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+			png_write_info(png, info);
+			std::vector<unsigned char> row(20 * 2);
+			for (unsigned int y = 0; y < 30; y++) {
+				for (unsigned int x = 0; x < 20; x++) {
+					unsigned int v = y * 1000 + x;
+					row[x * 2] = v >> 8;
+					row[x * 2 + 1] = v & 0xff;
+				}
+				png_write_row(png, row.data());
+			}
+			png_write_end(png, nullptr);
+			png_destroy_write_struct(&png, &info);
+			fclose(fp);
+		}
+
+		void tearDown() {
+			std::filesystem::remove(path_png);
+		}
+
+		bool check_window(PNGRowReader &reader, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1) {
+			std::vector<float> a((x1 - x0) * (y1 - y0));
+			float *dst[1] = {a.data()};
+			if (!reader.read_window(x0, y0, x1, y1, dst))
+				return false;
+			for (unsigned int y = y0; y < y1; y++) {
+				for (unsigned int x = x0; x < x1; x++) {
+					float expected = (x < 20 && y < 30) ? (y * 1000 + x) / 65535.0f : 0.0f;
+					if (fabs(a[(y - y0) * (x1 - x0) + x - x0] - expected) > 1e-7)
+						return false;
+				}
+			}
+			return true;
+		}
+
+		void testRowMajor01() {
+			PNGRowReader reader;
+			CPPUNIT_ASSERT(reader.open(path_png));
+			CPPUNIT_ASSERT(reader.width == 20 && reader.height == 30 && reader.num_channels == 1 && reader.bit_depth == 16);
+
+			// Overlapping 12x12 windows, row by row, with the last ones past the edges.
+			for (unsigned int y = 0; y < 30; y += 10) {
+				for (unsigned int x = 0; x < 20; x += 10)
+					CPPUNIT_ASSERT(check_window(reader, x, y, x + 12, y + 12));
+				// Only the rows of the current row of windows are kept.
+				CPPUNIT_ASSERT(reader.get_num_cached_rows() <= 12);
+			}
+
+			// Each row has been decoded once.
+			CPPUNIT_ASSERT(reader.get_num_decoded_rows() == 30);
+		}
+
+		void testRestart01() {
+			PNGRowReader reader;
+			CPPUNIT_ASSERT(reader.open(path_png));
+
+			CPPUNIT_ASSERT(check_window(reader, 5, 15, 15, 25));
+			CPPUNIT_ASSERT(reader.get_num_decoded_rows() == 25);
+			CPPUNIT_ASSERT(reader.get_num_cached_rows() == 10);
+
+			// Going back up starts over from the top.
+			CPPUNIT_ASSERT(check_window(reader, 0, 2, 4, 6));
+			CPPUNIT_ASSERT(reader.get_num_decoded_rows() == 31);
+		}
+};
+
+class SubtilePlanTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(SubtilePlanTest);
+CPPUNIT_TEST(testWindows10m01);
+CPPUNIT_TEST(testWindows20m01);
+CPPUNIT_TEST(testPaths01);
+CPPUNIT_TEST(testOutside01);
+CPPUNIT_TEST(testRowMajorOrder01);
+CPPUNIT_TEST(testBounds01);
+CPPUNIT_TEST(testValidFraction01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::vector<Vector<int>> subtiles;
+
+		void setUp() {
+			subtiles.clear();
+			subtiles.push_back(Vector<int>(0, 0));
+			subtiles.push_back(Vector<int>(1, 2));
+		}
+
+		void testWindows10m01() {
+			SubtilePlan plan(subtiles, "out", "T35VLF_20200529T094041", AABB<float>(0, 0, 1, 1), 10980, 10980, 512, 0.0f, 1.0f);
+
+			CPPUNIT_ASSERT(plan.size() == 2);
+			CPPUNIT_ASSERT(plan[0].x0 == 0 && plan[0].y0 == 0 && plan[0].x1 == 512 && plan[0].y1 == 512);
+			CPPUNIT_ASSERT(plan[1].x0 == 512 && plan[1].y0 == 1024 && plan[1].x1 == 1024 && plan[1].y1 == 1536);
+			CPPUNIT_ASSERT(!plan[0].skip && !plan[1].skip);
+		}
+
+		void testWindows20m01() {
+			SubtilePlan plan(subtiles, "out", "", AABB<float>(0, 0, 1, 1), 5490, 5490, 512, 0.0f, 2.0f);
+
+			CPPUNIT_ASSERT(plan[1].x0 == 256 && plan[1].y0 == 512 && plan[1].x1 == 512 && plan[1].y1 == 768);
+		}
+
+		void testPaths01() {
+			SubtilePlan plan(subtiles, "out", "T35VLF_20200529T094041", AABB<float>(0, 0, 1, 1), 10980, 10980, 512, 0.0f, 1.0f);
+
+			CPPUNIT_ASSERT(plan[1].path_dir == "out/tile_1_2/");
+			CPPUNIT_ASSERT(plan[1].path_nc == "out/tile_1_2/T35VLF_20200529T094041_tile_1_2.nc");
+			CPPUNIT_ASSERT(plan[1].name_suffix == "_tile_1_2");
+		}
+
+		void testValidFraction01() {
+			std::map<std::pair<int, int>, float> fractions;
+			fractions[std::make_pair(1, 2)] = 0.75f;
+			SubtilePlan plan(subtiles, "out", "", AABB<float>(0, 0, 1, 1), 10980, 10980, 512, 0.0f, 1.0f, fractions);
+			CPPUNIT_ASSERT(plan[0].valid_fraction < 0.0f);
+			CPPUNIT_ASSERT(plan[1].valid_fraction == 0.75f);
+
+			// Pixels with any non-zero value are valid.
+			std::vector<Magick::PixelPacket> px(8);
+			for (size_t i = 0; i < px.size(); i++)
+				px[i].red = px[i].green = px[i].blue = i % 4 == 0 ? 0 : 100;
+			CPPUNIT_ASSERT(ESA_S2_Image::get_valid_fraction(px.data(), px.size()) == 0.75f);
+			CPPUNIT_ASSERT(ESA_S2_Image::get_valid_fraction(px.data(), 0) == 0.0f);
+		}
+
+		void testOutside01() {
+			subtiles.push_back(Vector<int>(30, 0));
+			SubtilePlan plan(subtiles, "out", "", AABB<float>(0, 0, 1, 1), 10980, 10980, 512, 0.0f, 1.0f);
+
+			CPPUNIT_ASSERT(plan[2].skip);
+		}
+
+		void testRowMajorOrder01() {
+			subtiles.clear();
+			for (int x = 0; x < 3; x++)
+				for (int y = 0; y < 2; y++)
+					subtiles.push_back(Vector<int>(x, y));
+			SubtilePlan plan(subtiles, "out", "", AABB<float>(0, 0, 1, 1), 10980, 10980, 512, 0.0f, 1.0f);
+
+			// Sub-tiles are listed column by column, and ordered row by row.
+			std::vector<size_t> order = plan.get_row_major_order(1, 6);
+			CPPUNIT_ASSERT(order.size() == 5);
+			CPPUNIT_ASSERT(order[0] == 2 && order[1] == 4);
+			CPPUNIT_ASSERT(order[2] == 1 && order[3] == 3 && order[4] == 5);
+		}
+
+		void testBounds01() {
+			subtiles.push_back(Vector<int>(30, 0));
+			SubtilePlan plan(subtiles, "out", "", AABB<float>(0, 0, 1, 1), 10980, 10980, 512, 0.25f, 1.0f);
+
+			// Windows of 384 pixels plus the overlap, and the sub-tile outside of the raster is left out.
+			int x0 = -1, y0 = -1, x1 = -1, y1 = -1;
+			CPPUNIT_ASSERT(plan.get_bounds(0, 3, x0, y0, x1, y1));
+			CPPUNIT_ASSERT(x0 == 0 && y0 == 0);
+			CPPUNIT_ASSERT(x1 == plan[1].x1 && y1 == plan[1].y1);
+			CPPUNIT_ASSERT(x1 > 2 * 384 && y1 > 3 * 384);
+
+			CPPUNIT_ASSERT(plan.get_bounds(1, 2, x0, y0, x1, y1));
+			CPPUNIT_ASSERT(x0 == 384 && y0 == 768);
+			CPPUNIT_ASSERT(!plan.get_bounds(2, 3, x0, y0, x1, y1));
+		}
+};
+
+class SyntheticS2ProductTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(SyntheticS2ProductTest);
+CPPUNIT_TEST(testContent01);
+CPPUNIT_TEST(testTif01);
+CPPUNIT_TEST(testPng01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::filesystem::path path_out;
+
+		void setUp() {
+			path_out = std::filesystem::temp_directory_path() / "cm_vsm_test_synthetic";
+			std::filesystem::create_directories(path_out);
+		}
+
+		void tearDown() {
+			std::filesystem::remove_all(path_out);
+		}
+
+		void testContent01() {
+			SyntheticS2Product a(1000, 7), b(1000, 7), c(1000, 8);
+
+			// The same seed gives the same content, and another seed gives different clouds.
+			bool differs = false;
+			for (float y = 5; y < 1000; y += 50) {
+				for (float x = 5; x < 1000; x += 50) {
+					CPPUNIT_ASSERT(a.get_reflectance(3, x, y) == b.get_reflectance(3, x, y));
+					differs |= a.get_cloud(x, y) != c.get_cloud(x, y);
+				}
+			}
+			CPPUNIT_ASSERT(differs);
+
+			// The no-data wedge at the left edge is empty in all the bands.
+			CPPUNIT_ASSERT(!a.is_valid(100, 0) && a.is_valid(100, 999));
+			CPPUNIT_ASSERT(a.get_reflectance(0, 100, 0) == 0);
+			CPPUNIT_ASSERT(a.get_scl(100, 0) == ESA_S2_SCL_JP2_Image::SCL_NO_DATA);
+			CPPUNIT_ASSERT(a.get_clm(100, 0) == 0);
+
+			// The masks agree about the clouds.
+			for (float y = 5; y < 1000; y += 10) {
+				for (float x = 500; x < 1000; x += 10) {
+					bool cloud = a.get_cloud(x, y) >= 0.7f;
+					unsigned char scl = a.get_scl(x, y);
+					CPPUNIT_ASSERT(cloud == (scl == ESA_S2_SCL_JP2_Image::SCL_CLOUD_MEDIUM_PROBABILITY || scl == ESA_S2_SCL_JP2_Image::SCL_CLOUD_HIGH_PROBABILITY));
+					CPPUNIT_ASSERT(cloud == ((a.get_clm(x, y) & CNES_MAJA_CLM_TIF::CLM_THEIA_CLOUDS) != 0));
+					CPPUNIT_ASSERT(!cloud || a.get_cloud_probability(x, y, 100) >= 60);
+				}
+			}
+		}
+
+		void testTif01() {
+			// 50x50 pixels at 20 m.
+			SyntheticS2Product product(100, 1);
+			std::filesystem::path path = path_out / "clm.tif";
+			CPPUNIT_ASSERT(product.write_tif(path, 2, [&product](float x, float y) { return product.get_clm(x, y); }));
+
+			TIFWindowReader reader;
+			CPPUNIT_ASSERT(reader.open(path));
+			CPPUNIT_ASSERT(reader.width == 50 && reader.height == 50 && reader.num_channels == 1);
+
+			std::vector<float> a(50 * 50);
+			float *dst[1] = {a.data()};
+			unsigned int channels[1] = {0};
+			CPPUNIT_ASSERT(reader.read_window(0, 0, 50, 50, channels, 1, dst));
+			for (unsigned int y = 0; y < 50; y++)
+				for (unsigned int x = 0; x < 50; x++)
+					CPPUNIT_ASSERT(fabs(a[y * 50 + x] - product.get_clm(x * 2 + 1, y * 2 + 1) / 255.0f) < 1e-7);
+		}
+
+		void testPng01() {
+			// 17x17 pixels at 60 m, with a partial pixel at the edges.
+			SyntheticS2Product product(100, 1);
+			std::filesystem::path path = path_out / "probability.png";
+			CPPUNIT_ASSERT(product.write_png(path, 6, [&product](float x, float y) { return product.get_cloud_probability(x, y, 255); }));
+
+			PNGRowReader reader;
+			CPPUNIT_ASSERT(reader.open(path));
+			CPPUNIT_ASSERT(reader.width == 17 && reader.height == 17 && reader.bit_depth == 8);
+
+			std::vector<float> a(17 * 17);
+			float *dst[1] = {a.data()};
+			CPPUNIT_ASSERT(reader.read_window(0, 0, 17, 17, dst));
+			for (unsigned int y = 0; y < 17; y++)
+				for (unsigned int x = 0; x < 17; x++)
+					CPPUNIT_ASSERT(fabs(a[y * 17 + x] - product.get_cloud_probability(x * 6 + 3, y * 6 + 3, 255) / 255.0f) < 1e-7);
+		}
+};
+
+class CPUDispatchTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(CPUDispatchTest);
+CPPUNIT_TEST(testParse01);
+CPPUNIT_TEST(testKernels01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void testParse01() {
+			CPUDispatch::isa_t isa;
+			CPPUNIT_ASSERT(CPUDispatch::parse_isa("avx2", isa) && isa == CPUDispatch::ISA_AVX2);
+			CPPUNIT_ASSERT(CPUDispatch::parse_isa("generic", isa) && isa == CPUDispatch::ISA_GENERIC);
+			CPPUNIT_ASSERT(!CPUDispatch::parse_isa("sse9", isa));
+
+			CPPUNIT_ASSERT(CPUDispatch::is_supported(CPUDispatch::ISA_GENERIC));
+			CPPUNIT_ASSERT(CPUDispatch::is_supported(CPUDispatch::get_best()));
+			CPPUNIT_ASSERT(CPUDispatch::get_isa() == CPUDispatch::get_best());
+		}
+
+		void testKernels01() {
+			// An odd number of pixels, for the scalar tails of the vectorized loops.
+			const size_t n = 1003;
+			std::vector<Magick::PixelPacket> px(n);
+			std::vector<int32_t> samples(n);
+			for (size_t i=0; i<n; i++) {
+				Magick::Quantum q = (i * 7919) & 0xffff;
+				px[i].red = px[i].green = px[i].blue = q;
+				px[i].opacity = 0;
+				samples[i] = (i * 31) % 300;
+			}
+
+			std::vector<uint8_t> lut(65536 + 3, 0);
+			for (unsigned int q=0; q<65536; q++)
+				lut[q] = q / 257;
+			PixelKernels::class_table_t classes;
+			std::vector<Magick::PixelPacket> table(300);
+			for (unsigned int i=0; i<table.size(); i++) {
+				table[i].red = table[i].green = table[i].blue = i * 200;
+				table[i].opacity = 0;
+				if (i < classes.size())
+					classes[i] = table[(i * 13) % 256];
+			}
+
+			std::vector<Magick::PixelPacket> px_generic, px_remap, px_samples(n);
+			std::vector<float> f_generic(n), f(n);
+			std::vector<unsigned char> b_generic(n), b(n);
+			CPUDispatch::isa_t isa_orig = CPUDispatch::get_isa();
+
+			for (int i=0; i<CPUDispatch::ISA_COUNT; i++) {
+				if (!CPUDispatch::set_isa((CPUDispatch::isa_t) i))
+					continue;
+
+				px_remap = px;
+				PixelKernels::remap_classes(px_remap.data(), n, lut.data(), classes);
+				PixelKernels::pixels_to_float(px.data(), n, f.data());
+				PixelKernels::pixels_to_ubyte(px.data(), n, b.data());
+				CPPUNIT_ASSERT(PixelKernels::samples_to_pixels(samples.data(), n, table.data(), 300, px_samples.data()));
+				for (size_t j=0; j<n; j++)
+					CPPUNIT_ASSERT(memcmp(&px_samples[j], &table[samples[j]], sizeof(Magick::PixelPacket)) == 0);
+				// A sample outside of the table is reported.
+				CPPUNIT_ASSERT(!PixelKernels::samples_to_pixels(samples.data(), n, table.data(), 256, px_samples.data()));
+
+				if (i == CPUDispatch::ISA_GENERIC) {
+					px_generic = px_remap;
+					f_generic = f;
+					b_generic = b;
+					CPPUNIT_ASSERT(b[500] == px[500].green / 257);
+				} else {
+					CPPUNIT_ASSERT(memcmp(px_remap.data(), px_generic.data(), n * sizeof(Magick::PixelPacket)) == 0);
+					CPPUNIT_ASSERT(memcmp(f.data(), f_generic.data(), n * sizeof(float)) == 0);
+					CPPUNIT_ASSERT(b == b_generic);
+				}
+			}
+
+			CPUDispatch::set_isa(isa_orig);
+		}
+};
+
+class PixelKernelsTest: public CppUnit::TestFixture {
+CPPUNIT_TEST_SUITE(PixelKernelsTest);
+CPPUNIT_TEST(testPointSample01);
+CPPUNIT_TEST(testRemapResample01);
+CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void testPointSample01() {
+			std::vector<uint32_t> index;
+
+			// Upsampling repeats each pixel.
+			CPPUNIT_ASSERT(PixelKernels::point_sample_index(4, 8, index));
+			CPPUNIT_ASSERT(index == std::vector<uint32_t>({0, 0, 1, 1, 2, 2, 3, 3}));
+			CPPUNIT_ASSERT(PixelKernels::point_sample_index(2, 6, index));
+			CPPUNIT_ASSERT(index == std::vector<uint32_t>({0, 0, 0, 1, 1, 1}));
+
+			// Downsampling takes the pixel before the center of each output pixel, where the center falls on a pixel edge.
+			CPPUNIT_ASSERT(PixelKernels::point_sample_index(8, 4, index));
+			CPPUNIT_ASSERT(index == std::vector<uint32_t>({0, 2, 4, 6}));
+			CPPUNIT_ASSERT(PixelKernels::point_sample_index(9, 3, index));
+			CPPUNIT_ASSERT(index == std::vector<uint32_t>({1, 4, 7}));
+
+			CPPUNIT_ASSERT(PixelKernels::point_sample_index(5, 5, index));
+			CPPUNIT_ASSERT(index == std::vector<uint32_t>({0, 1, 2, 3, 4}));
+			CPPUNIT_ASSERT(!PixelKernels::point_sample_index(0, 5, index));
+		}
+
+		void testRemapResample01() {
+			// A 3x3 raster of values 0 to 8, upsampled by 2.
+			std::vector<Magick::PixelPacket> px(9);
+			for (unsigned int i=0; i<9; i++) {
+				px[i].red = px[i].green = px[i].blue = i * 257;
+				px[i].opacity = 0;
+			}
+			std::vector<uint8_t> lut(65536 + 3, 0);
+			for (unsigned int q=0; q<65536; q++)
+				lut[q] = q / 257;
+			std::vector<unsigned char> values(256);
+			std::vector<float> values_f(256);
+			for (unsigned int i=0; i<256; i++) {
+				values[i] = 10 * i;
+				values_f[i] = i / 10.0f;
+			}
+
+			std::vector<uint32_t> index;
+			CPPUNIT_ASSERT(PixelKernels::point_sample_index(3, 6, index));
+			std::vector<unsigned char> dst(36);
+			std::vector<float> dst_f(36);
+			PixelKernels::remap_resample(px.data(), 3, lut.data(), values.data(), index, index, dst.data());
+			PixelKernels::remap_resample(px.data(), 3, lut.data(), values_f.data(), index, index, dst_f.data());
+			for (unsigned int y=0; y<6; y++) {
+				for (unsigned int x=0; x<6; x++) {
+					unsigned int v = (y / 2) * 3 + x / 2;
+					CPPUNIT_ASSERT(dst[y * 6 + x] == 10 * v);
+					CPPUNIT_ASSERT(dst_f[y * 6 + x] == v / 10.0f);
+				}
+			}
+		}
+};
+
 int main(int argc, char* argv[]) {
 	CppUnit::TextUi::TestRunner runner;
 
@@ -496,6 +2145,25 @@ int main(int argc, char* argv[]) {
 	runner.addTest(ClipAABBTest::suite());
 	runner.addTest(PolyAreaTest::suite());
 	runner.addTest(TestSubtileCoords::suite());
+	runner.addTest(SubtileGridTest::suite());
+	runner.addTest(SubtileSelectorTest::suite());
+	runner.addTest(ThreadPoolTest::suite());
+	runner.addTest(MemoryBudgetTest::suite());
+	runner.addTest(PrefetcherTest::suite());
+	runner.addTest(ResumeManifestTest::suite());
+	runner.addTest(StagedFileTest::suite());
+	runner.addTest(StageStatsTest::suite());
+	runner.addTest(WorkerArenaTest::suite());
+	runner.addTest(MetricsExporterTest::suite());
+	runner.addTest(ProductScanTest::suite());
+	runner.addTest(ZipArchiveTest::suite());
+	runner.addTest(SubtilePlanTest::suite());
+	runner.addTest(GDALImageTest::suite());
+	runner.addTest(TIFWindowReaderTest::suite());
+	runner.addTest(PNGRowReaderTest::suite());
+	runner.addTest(SyntheticS2ProductTest::suite());
+	runner.addTest(CPUDispatchTest::suite());
+	runner.addTest(PixelKernelsTest::suite());
 	runner.run();
 
 	return 0;
@@ -20,9 +20,11 @@
 #include "raster/supervisely_raster.hpp"
 #include "raster/segmentsai_raster.hpp"
 #include "raster/kz_s2_tif.hpp"
+#include "raster/netcdf_interface.hpp"
 #include "vector/gml.hpp"
 #include "vector/cvat_rasterizer.hpp"
 #include "vector/supervisely_rasterizer.hpp"
+#include "util/cpu_dispatch.hpp"
 #include "util/text.hpp"
 #include "util/geometry.hpp"
 #include <openjpeg.h>
@@ -53,6 +55,30 @@ unsigned char new_class_map[] = {
 	5  // 12 - 255                    -> UNCLASSIFIED
 };
 
+/**
+ * @brief Read a list of paths from a text file, one path per line.
+ * Empty lines and lines starting with `#` are skipped.
+ * @param[in] path Reference to the path of the list file.
+ * @param[out] paths Reference to the list to append the paths to.
+ * @return True on success, false if the file could not be opened.
+ */
+bool read_path_list(const std::string &path, std::vector<std::string> &paths) {
+	std::ifstream f(path);
+	if (!f.is_open())
+		return false;
+
+	std::string line;
+	while (std::getline(f, line)) {
+		// Strip surrounding whitespace, including a possible carriage return.
+		size_t b = line.find_first_not_of(" \t\r");
+		size_t e = line.find_last_not_of(" \t\r");
+		if (b == std::string::npos || line[b] == '#')
+			continue;
+		paths.push_back(line.substr(b, e - b + 1));
+	}
+	return true;
+}
+
 int main(int argc, char* argv[]) {
 	std::cout << "Vectorization and splitting tool for the KappaZeta Cloudmask project." << std::endl;
 	std::cout << " Version: " << CM_CONVERTER_VERSION_STR << std::endl;
@@ -68,7 +94,8 @@ int main(int argc, char* argv[]) {
 
 	if (argc < 2) {
 		std::cerr << "Usage: " << CM_CONVERTER_NAME_STR
-			<< " [-d S2_PATH]"
+			<< " [-d S2_PATH [-d S2_PATH ...]]"
+			<< " [--list S2_LIST]"
 			<< " [--kz-s2 KZ_S2_PATH]"
 			<< " [-D CVAT_PATH]"
 			<< " [-O OUT_PATH]"
@@ -80,14 +107,18 @@ int main(int argc, char* argv[]) {
 			<< " [-f DEFLATE_LEVEL]"
 			<< " [-m RESAMPLING_METHOD]"
 			<< " [-o OVERLAP]"
-			<< " [--png] [--tiled] [-j JOBS]"
+			<< " [--png] [--tiled] [--overwrite] [-j JOBS] [-w WORKERS] [--max-memory MAX_MEMORY]"
+			<< " [--gdal GDAL_BANDS] [--prefetch PREFETCH] [--order ORDER] [--min-valid MIN_VALID] [--select SELECT]"
+			<< " [--staging STAGING] [--report REPORT] [--metrics METRICS [--metrics-interval INTERVAL]] [--force-isa ISA]"
 			<< " [-g EWKT]"
 			<< " [-M MAJA_FMT]"
 			<< " [-T SUBTILES]"<< std::endl
-			<< "\twhere S2_PATH points to the .SAFE directory of an ESA S2 L2A or L1C product." << std::endl
+			<< "\twhere S2_PATH points to the .SAFE directory of an ESA S2 L2A or L1C product, or to a .zip archive of it." << std::endl
+			<< "\tS2_LIST points to a text file with one S2_PATH per line (empty lines and lines starting with # are skipped)." << std::endl
 			<< "\tKZ_S2_PATH points to the KappaZeta .TIF file of an ESA S2 L2A product." << std::endl
 			<< "\tCVAT_PATH points to the .CVAT directory (pre-processed ESA S2 product)." << std::endl
 			<< "\tOUT_PATH points to the directory to store the output files (.CVAT directory, right next to the input .SAFE, by default)." << std::endl
+			<< "\t\tWith more than one S2_PATH, the .CVAT directories are stored in OUT_PATH." << std::endl
 			<< "\tCVAT_XML points to a CVAT annotations.xml file." << std::endl
 			<< "\tCVAT_SAI_PATH points to the .CVAT directory with Segments.AI segmentation masks stored in subtiles." << std::endl
 			<< "\tSUPERVISELY_DIR points to a directory with the Supervise.ly annotations files." << std::endl
@@ -100,6 +131,27 @@ int main(int argc, char* argv[]) {
 			<< "\tRESAMPLING_METHOD defines a preferred way for resampling (point, box, cubic, sinc, linear, hermite, hanning, hamming, blackman, gaussian, quadratic, catrom, mitchell, lanczos, bessel)." << std::endl
 			<< "\tOVERLAP Overlap between sub-tiles (between 0 and 0.5)." << std::endl
 			<< "\tJOBS Number of threads to parallelize to (0 for default, negative to use all available threads)." << std::endl
+			<< "\tWORKERS Number of workers to split products, bands and sub-tiles in parallel (default: 1, 0 to use all available threads)." << std::endl
+			<< "\tMAX_MEMORY Memory budget for decoded rasters, in bytes or with a K, M or G suffix (for example, 8G)." << std::endl
+			<< "\t\tChooses between whole and tiled reading per band (instead of --tiled), and delays bands which don't fit into the budget." << std::endl
+			<< "\tGDAL_BANDS is a comma-separated list of bands to read through GDAL instead of OpenJPEG or libtiff, or \"all\"." << std::endl
+			<< "\t\tThe size of the GDAL block cache can be set with the GDAL_CACHEMAX environment variable, or with MAX_MEMORY." << std::endl
+			<< "\tPREFETCH Read-ahead window for the band files which are about to be split, in bytes or with a K, M or G suffix (default: 512M, 0 to disable)." << std::endl
+			<< "\tORDER is the order of splitting the sub-tiles: column, row, morton or hilbert (default: hilbert)." << std::endl
+			<< "\t\tSub-tiles are grouped into blocks which match the tiles of the JP2 files, and the blocks are split in this order." << std::endl
+			<< "\tMIN_VALID Minimum fraction of valid (non-zero) pixels in a sub-tile, between 0 and 1 (default: 0, to keep all the sub-tiles)." << std::endl
+			<< "\t\tThe fraction is found from the B01 or SCL band of each product, and sub-tiles below it are skipped in all the bands." << std::endl
+			<< "\tSELECT is a comma-separated list of conditions on the mask bands, all of which a sub-tile has to satisfy to be split." << std::endl
+			<< "\t\tEach condition compares the fraction of pixels with a set of values with a threshold." << std::endl
+			<< "\t\tThe values of SCL are the classes after the SCL class map, while the other mask bands are compared on their raw values." << std::endl
+			<< "\t\tFor example, \"SCL[8+9+10]>=0.05,SCL[8+9+10]<=0.95\" or \"S2CC[50-100]>0.1\"." << std::endl
+			<< "\tSTAGING Directory to write the NetCDF files in before they replace the output files (default: next to each file, \"none\" to write in place)." << std::endl
+			<< "\t\tThe layers of a sub-tile are written to a staging copy of its file, which then replaces the file with an atomic rename." << std::endl
+			<< "\tREPORT JSON file to write the timing of the processing stages of all the products into, at exit." << std::endl
+			<< "\t\tThe report of each product is written into its output directory, as cm_vsm_report.json, regardless." << std::endl
+			<< "\tMETRICS File to periodically write the progress and throughput into, in the Prometheus text format (for example, for the textfile collector of node_exporter)." << std::endl
+			<< "\tINTERVAL Number of seconds between the updates of the METRICS file (default: 15)." << std::endl
+			<< "\tISA Instruction set of the vectorized pixel kernels: generic, avx2 or avx512 (default: the best one which the CPU supports, " << CPUDispatch::isa_name[CPUDispatch::get_best()] << ")." << std::endl
 			<< "\tEWKT Geometry for area of interest (whole product, by default)." << std::endl
 			<< "\t\tFor example: \"SRID=4326;Polygon ((22.64992375534184887 50.27513740160615185, 23.60228115218003708 50.35482161490517683, 23.54514084707420452 49.94024031630130622, 23.3153953947536472 50.21771699530808775, 22.64992375534184887 50.27513740160615185))\"" << std::endl
 			<< "\tMAJA_FMT is either \"THEIA\" for the THEIA S2 L2A, or \"MAJA\" for MAJA S2 format." << std::endl
@@ -112,8 +164,9 @@ int main(int argc, char* argv[]) {
 	//! \note Magick relies on jasper for JP2 files, and jasper is not able to open the ESA S2 JP2 images.
 	Magick::InitializeMagick(*argv);
 
-	std::string arg_path_s2_dir, arg_path_cvat_dir, arg_path_rasterize, arg_path_nc, arg_path_cvat_sai_dir, arg_path_supervisely, arg_tilename;
-	std::string arg_bands, arg_resampling_method, arg_path_out, arg_wkt_geom, arg_path_kz_s2, arg_maja_fmt = "THEIA", arg_subtiles;
+	std::vector<std::string> arg_paths_s2_dir;
+	std::string arg_path_cvat_dir, arg_path_rasterize, arg_path_nc, arg_path_cvat_sai_dir, arg_path_supervisely, arg_tilename;
+	std::string arg_bands, arg_gdal_bands, arg_select, arg_report, arg_metrics, arg_resampling_method, arg_path_out, arg_wkt_geom, arg_path_kz_s2, arg_maja_fmt = "THEIA", arg_subtiles;
 	unsigned int tilesize = 512;
 	int downscale = -1;
 	int deflatelevel = 9;
@@ -122,9 +175,21 @@ int main(int argc, char* argv[]) {
 	bool tiled_input = false;
 	bool overwrite_subtiles = false;
 	int num_jobs = 0;
+	int num_workers = 1;
+	uintmax_t max_memory = 0;
+	uintmax_t prefetch_window = 512 << 20;
+	SubtileGrid::order_t subtile_order = SubtileGrid::SO_HILBERT;
+	float min_valid = 0.0f;
+	int metrics_interval = 15;
 	for (int i=0; i<argc; i++) {
 		if (!strncmp(argv[i], "-d", 2))
-			arg_path_s2_dir.assign(argv[i + 1]);
+			arg_paths_s2_dir.push_back(argv[i + 1]);
+		else if (!strncmp(argv[i], "--list", 6)) {
+			if (!read_path_list(argv[i + 1], arg_paths_s2_dir)) {
+				std::cerr << "ERROR: Failed to read the list of products from " << argv[i + 1] << std::endl;
+				return 1;
+			}
+		}
 		else if (!strncmp(argv[i], "--kz-s2", 7))
 			arg_path_kz_s2.assign(argv[i + 1]);
 		else if (!strncmp(argv[i], "-O", 2))
@@ -161,6 +226,74 @@ int main(int argc, char* argv[]) {
 			overwrite_subtiles = true;
 		else if (!strncmp(argv[i], "-j", 2))
 			num_jobs = std::atoi(argv[i + 1]);
+		else if (!strncmp(argv[i], "-w", 2))
+			num_workers = std::atoi(argv[i + 1]);
+		else if (!strncmp(argv[i], "--max-memory", 12)) {
+			max_memory = parse_size(argv[i + 1]);
+			if (max_memory == 0) {
+				std::cerr << "ERROR: Invalid memory budget " << argv[i + 1] << std::endl;
+				return 1;
+			}
+		}
+		else if (!strncmp(argv[i], "--prefetch", 10)) {
+			prefetch_window = parse_size(argv[i + 1]);
+			if (prefetch_window == 0 && strcmp(argv[i + 1], "0")) {
+				std::cerr << "ERROR: Invalid read-ahead window " << argv[i + 1] << std::endl;
+				return 1;
+			}
+		}
+		else if (!strncmp(argv[i], "--order", 7)) {
+			if (!SubtileGrid::parse_order(argv[i + 1], subtile_order)) {
+				std::cerr << "ERROR: Invalid sub-tile order " << argv[i + 1] << std::endl;
+				return 1;
+			}
+		}
+		else if (!strncmp(argv[i], "--min-valid", 11)) {
+			min_valid = std::atof(argv[i + 1]);
+			if (min_valid < 0.0f || min_valid > 1.0f) {
+				std::cerr << "ERROR: Invalid fraction of valid pixels " << argv[i + 1] << std::endl;
+				return 1;
+			}
+		}
+		else if (!strncmp(argv[i], "--select", 8))
+			arg_select.assign(argv[i + 1]);
+		else if (!strncmp(argv[i], "--staging", 9)) {
+			std::error_code ec;
+			if (!strcmp(argv[i + 1], "none")) {
+				NetCDFInterface::set_staging(false);
+			} else {
+				std::filesystem::create_directories(argv[i + 1], ec);
+				if (ec) {
+					std::cerr << "ERROR: Failed to create the staging directory " << argv[i + 1] << ": " << ec.message() << std::endl;
+					return 1;
+				}
+				NetCDFInterface::set_staging(true, argv[i + 1]);
+			}
+		}
+		else if (!strncmp(argv[i], "--metrics-interval", 18)) {
+			metrics_interval = std::atoi(argv[i + 1]);
+			if (metrics_interval <= 0) {
+				std::cerr << "ERROR: Invalid metrics interval " << argv[i + 1] << std::endl;
+				return 1;
+			}
+		}
+		else if (!strncmp(argv[i], "--metrics", 9))
+			arg_metrics.assign(argv[i + 1]);
+		else if (!strncmp(argv[i], "--report", 8))
+			arg_report.assign(argv[i + 1]);
+		else if (!strncmp(argv[i], "--gdal", 6))
+			arg_gdal_bands.assign(argv[i + 1]);
+		else if (!strncmp(argv[i], "--force-isa", 11)) {
+			CPUDispatch::isa_t isa;
+			if (!CPUDispatch::parse_isa(argv[i + 1], isa)) {
+				std::cerr << "ERROR: Unknown instruction set " << argv[i + 1] << std::endl;
+				return 1;
+			}
+			if (!CPUDispatch::set_isa(isa)) {
+				std::cerr << "ERROR: This CPU doesn't support " << argv[i + 1] << std::endl;
+				return 1;
+			}
+		}
 		else if (!strncmp(argv[i], "-g", 2))
 			arg_wkt_geom.assign(argv[i + 1]);
 		else if (!strncmp(argv[i], "-M", 2))
@@ -169,20 +302,31 @@ int main(int argc, char* argv[]) {
 			arg_subtiles.assign(argv[i + 1]);
 	}
 
-	if (arg_path_s2_dir.length() > 0) {
+	if (!arg_paths_s2_dir.empty()) {
 		ESA_S2_Image img;
 		EmptyImageOperator img_op;
 
-		std::filesystem::path path_dir_in(arg_path_s2_dir);
-		if (!path_dir_in.is_absolute())
-			path_dir_in = std::filesystem::absolute(arg_path_s2_dir);
-
-		std::string str_path_dir_out;
-		if (arg_path_out.empty())
-			str_path_dir_out = path_dir_in.parent_path().string() + "/" + path_dir_in.stem().string() + ".CVAT";
-		else
-			str_path_dir_out = arg_path_out;
-		std::filesystem::path path_dir_out(str_path_dir_out);
+		std::vector<std::pair<std::filesystem::path, std::filesystem::path>> products;
+		for (auto it = arg_paths_s2_dir.begin(); it != arg_paths_s2_dir.end(); it++) {
+			std::filesystem::path path_dir_in(*it);
+			if (!path_dir_in.is_absolute())
+				path_dir_in = std::filesystem::absolute(*it);
+
+			// Zipped products (.SAFE.zip) are named after the .SAFE directory within.
+			std::filesystem::path path_name = path_dir_in.filename();
+			if (path_name.extension() == ".zip")
+				path_name = path_name.stem();
+
+			std::string str_path_dir_out;
+			if (arg_path_out.empty())
+				str_path_dir_out = path_dir_in.parent_path().string() + "/" + path_name.stem().string() + ".CVAT";
+			else if (arg_paths_s2_dir.size() > 1)
+				str_path_dir_out = arg_path_out + "/" + path_name.stem().string() + ".CVAT";
+			else
+				str_path_dir_out = arg_path_out;
+
+			products.emplace_back(path_dir_in, std::filesystem::path(str_path_dir_out));
+		}
 
 		std::vector<std::string> bands;
 
@@ -205,14 +349,26 @@ int main(int argc, char* argv[]) {
 		img.set_png_output(output_png);
 		img.set_tiled_input(tiled_input);
 		img.set_num_threads(num_jobs);
+		img.set_num_workers(num_workers);
+		img.set_max_memory(max_memory);
+		img.set_prefetch_window(prefetch_window);
+		img.set_subtile_order(subtile_order);
+		img.set_min_valid(min_valid);
+		if (!img.set_selection(arg_select))
+			return 1;
+		if (!arg_gdal_bands.empty())
+			img.set_gdal_bands(split_str(arg_gdal_bands, ','));
 		img.set_aoi_geometry(arg_wkt_geom);
 		img.set_overwrite(overwrite_subtiles);
 		img.set_maja_format(arg_maja_fmt);
+		img.set_report_path(arg_report);
+		img.set_metrics(arg_metrics, metrics_interval);
 
 		std::vector<Vector<int>> subtiles = extract_coords(arg_subtiles, ',', '_');
 		img.set_subtiles(subtiles);
 
-		img.process(path_dir_in, path_dir_out, img_op, bands);
+		if (!img.process_batch(products, img_op, bands))
+			return 4;
 
 	} else if (arg_path_kz_s2.length() > 0) {
 		KZ_S2_TIF_Image img;